@@ -1,7 +1,10 @@
 #include <algorithm>
 #include <functional>
+#include <memory>
 #include <sstream>
 #include "EventStackFilter.h"
+#include "MediaTimeline.h"
+#include "ExportUtils.h"
 
 using namespace std;
 using namespace MediaCore;
@@ -413,7 +416,13 @@ public:
     {
         imgui_json::value filterJson = SaveAsJson();
         BluePrint::BluePrintCallbackFunctions bpCallbacks;
-        return LoadFromJson(filterJson, bpCallbacks);
+        auto hNewFilter = LoadFromJson(filterJson, bpCallbacks);
+        if (hNewFilter)
+        {
+            VideoEventStackFilter* pEsf = dynamic_cast<VideoEventStackFilter*>(hNewFilter.get());
+            pEsf->SetTimelineHandle(m_tlHandle);
+        }
+        return hNewFilter;
     }
 
     void ApplyTo(VideoClip* clip) override
@@ -443,6 +452,16 @@ public:
                 effectiveEvents.push_back(e);
         }
         ImGui::ImMat outM = vmat;
+        if (effectiveEvents.empty())
+            return outM;
+        // account the filter time into the export stage statistics
+        MediaTimeline::TimeLine* timeline = (MediaTimeline::TimeLine*)m_tlHandle;
+        std::unique_ptr<ScopedStageTimer> stageTimer;
+        if (timeline && timeline->mIsEncoding)
+        {
+            stageTimer.reset(new ScopedStageTimer(timeline->mEncodeStageStatus[MediaTimeline::TimeLine::ENC_STAGE_VIDEO_FILTER].busyUs));
+            timeline->mEncodeStageStatus[MediaTimeline::TimeLine::ENC_STAGE_VIDEO_FILTER].processed++;
+        }
         for (auto& e : effectiveEvents)
         {
             VideoEvent_Impl* pEvtImpl = dynamic_cast<VideoEvent_Impl*>(e.get());
@@ -0,0 +1,606 @@
+/*
+    Copyright (c) 2023 CodeWin
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <cstdio>
+#include <algorithm>
+#include <imgui_helper.h>
+#include "ExportJobQueue.h"
+#include "SysUtils.h"
+#include "Logger.h"
+
+using namespace std;
+using namespace Logger;
+using namespace MediaTimeline;
+
+namespace MEC
+{
+bool LoadProject(TimeLine* timeline, const string& path, string& errMsg)
+{
+    auto loadResult = imgui_json::value::load(path);
+    if (!loadResult.second)
+    {
+        errMsg = "FAILED to load project file '" + path + "'!";
+        return false;
+    }
+    if (!LoadProject(timeline, loadResult.first, errMsg))
+    {
+        errMsg = "Project file '" + path + "': " + errMsg;
+        return false;
+    }
+    return true;
+}
+
+bool LoadProject(TimeLine* timeline, const imgui_json::value& project, string& errMsg)
+{
+    const imgui_json::array* mediaBankArray = nullptr;
+    if (imgui_json::GetPtrTo(project, "MediaBank", mediaBankArray))
+    {
+        for (auto& media : *mediaBankArray)
+        {
+            int64_t id = -1;
+            string name;
+            string mpath;
+            uint32_t type = MEDIA_UNKNOWN;
+            if (media.contains("id"))
+            {
+                auto& val = media["id"];
+                if (val.is_number()) id = val.get<imgui_json::number>();
+            }
+            if (media.contains("name"))
+            {
+                auto& val = media["name"];
+                if (val.is_string()) name = val.get<imgui_json::string>();
+            }
+            if (media.contains("path"))
+            {
+                auto& val = media["path"];
+                if (val.is_string()) mpath = val.get<imgui_json::string>();
+            }
+            if (media.contains("type"))
+            {
+                auto& val = media["type"];
+                if (val.is_number()) type = val.get<imgui_json::number>();
+            }
+            MediaItem * item = new MediaItem(name, mpath, type, timeline);
+            if (id != -1) item->mID = id;
+            if (!item->mValid)
+                Log(WARN) << "Media '" << mpath << "' is not valid!" << endl;
+            timeline->media_items.push_back(item);
+        }
+    }
+    if (!project.contains("TimeLine"))
+    {
+        errMsg = "Project has no timeline!";
+        return false;
+    }
+    timeline->Load(project["TimeLine"]);
+    return true;
+}
+
+imgui_json::value SaveProject(TimeLine* timeline)
+{
+    imgui_json::value project;
+    imgui_json::value mediaBank;
+    for (auto media : timeline->media_items)
+    {
+        imgui_json::value item;
+        item["id"] = imgui_json::number(media->mID);
+        item["name"] = media->mName;
+        item["path"] = media->mPath;
+        item["type"] = imgui_json::number(media->mMediaType);
+        mediaBank.push_back(item);
+    }
+    project["MediaBank"] = mediaBank;
+    imgui_json::value timelineValue;
+    timeline->Save(timelineValue);
+    project["TimeLine"] = timelineValue;
+    return project;
+}
+
+static imgui_json::value EncoderOptionsToJson(const vector<MediaCore::MediaEncoder::Option>& options)
+{
+    imgui_json::value value;
+    for (auto& opt : options)
+    {
+        imgui_json::value item;
+        item["name"] = opt.name;
+        item["value"] = imgui_json::number(opt.value.numval.i64);
+        value.push_back(item);
+    }
+    return value;
+}
+
+static void EncoderOptionsFromJson(const imgui_json::value& value, vector<MediaCore::MediaEncoder::Option>& options)
+{
+    options.clear();
+    if (!value.is_array())
+        return;
+    for (auto& item : value.get<imgui_json::array>())
+    {
+        if (!item.contains("name") || !item["name"].is_string() || !item.contains("value") || !item["value"].is_number())
+            continue;
+        options.push_back({item["name"].get<imgui_json::string>(), MediaCore::Value((int)item["value"].get<imgui_json::number>())});
+    }
+}
+
+imgui_json::value VideoEncoderParamsToJson(const TimeLine::VideoEncoderParams& params)
+{
+    imgui_json::value video;
+    video["Codec"] = params.codecName;
+    video["ImageFormat"] = params.imageFormat;
+    video["Width"] = imgui_json::number(params.width);
+    video["Height"] = imgui_json::number(params.height);
+    video["FrameRateNum"] = imgui_json::number(params.frameRate.num);
+    video["FrameRateDen"] = imgui_json::number(params.frameRate.den);
+    video["BitRate"] = imgui_json::number(params.bitRate);
+    video["Options"] = EncoderOptionsToJson(params.extraOpts);
+    return video;
+}
+
+void VideoEncoderParamsFromJson(const imgui_json::value& value, TimeLine::VideoEncoderParams& params)
+{
+    auto getNumber = [&value] (const char* key, double defVal) -> double {
+        if (value.contains(key) && value[key].is_number()) return value[key].get<imgui_json::number>();
+        return defVal;
+    };
+    auto getString = [&value] (const char* key) -> string {
+        if (value.contains(key) && value[key].is_string()) return value[key].get<imgui_json::string>();
+        return string();
+    };
+    params.codecName = getString("Codec");
+    params.imageFormat = getString("ImageFormat");
+    params.width = getNumber("Width", 0);
+    params.height = getNumber("Height", 0);
+    params.frameRate.num = getNumber("FrameRateNum", 25);
+    params.frameRate.den = getNumber("FrameRateDen", 1);
+    params.bitRate = getNumber("BitRate", 0);
+    if (value.contains("Options"))
+        EncoderOptionsFromJson(value["Options"], params.extraOpts);
+}
+
+imgui_json::value ExportJob::ToJson() const
+{
+    imgui_json::value value;
+    value["ID"] = imgui_json::number(id);
+    value["Name"] = name;
+    value["ProjectPath"] = projectPath;
+    value["OwnsProject"] = imgui_json::boolean(ownsProject);
+    value["OutputPath"] = outputPath;
+    value["RangeStart"] = imgui_json::number(rangeStart);
+    value["RangeEnd"] = imgui_json::number(rangeEnd);
+    value["Video"] = VideoEncoderParamsToJson(vidParams);
+    imgui_json::value audio;
+    audio["Codec"] = audParams.codecName;
+    audio["SampleFormat"] = audParams.sampleFormat;
+    audio["Channels"] = imgui_json::number(audParams.channels);
+    audio["SampleRate"] = imgui_json::number(audParams.sampleRate);
+    audio["BitRate"] = imgui_json::number(audParams.bitRate);
+    audio["SamplesPerFrame"] = imgui_json::number(audParams.samplesPerFrame);
+    audio["Options"] = EncoderOptionsToJson(audParams.extraOpts);
+    value["Audio"] = audio;
+    value["Threads"] = imgui_json::number(threads);
+    value["GopSize"] = imgui_json::number(gopSize);
+    value["SmartRender"] = imgui_json::boolean(smartRender);
+    value["CacheDir"] = cacheDir;
+    value["Resumable"] = imgui_json::boolean(resumable);
+    value["StatsPath"] = statsPath;
+    value["State"] = imgui_json::number(state);
+    value["Progress"] = imgui_json::number(progress);
+    value["Elapsed"] = imgui_json::number(elapsed);
+    value["Error"] = errMsg;
+    return value;
+}
+
+bool ExportJob::FromJson(const imgui_json::value& value, ExportJob& job)
+{
+    auto getNumber = [] (const imgui_json::value& v, const char* key, double defVal) -> double {
+        if (v.contains(key) && v[key].is_number()) return v[key].get<imgui_json::number>();
+        return defVal;
+    };
+    auto getString = [] (const imgui_json::value& v, const char* key) -> string {
+        if (v.contains(key) && v[key].is_string()) return v[key].get<imgui_json::string>();
+        return string();
+    };
+    auto getBoolean = [] (const imgui_json::value& v, const char* key) -> bool {
+        if (v.contains(key) && v[key].is_boolean()) return v[key].get<imgui_json::boolean>();
+        return false;
+    };
+    if (!value.is_object() || !value.contains("Video") || !value.contains("Audio"))
+        return false;
+    job.id = getNumber(value, "ID", -1);
+    job.name = getString(value, "Name");
+    job.projectPath = getString(value, "ProjectPath");
+    job.ownsProject = getBoolean(value, "OwnsProject");
+    job.outputPath = getString(value, "OutputPath");
+    job.rangeStart = getNumber(value, "RangeStart", -1);
+    job.rangeEnd = getNumber(value, "RangeEnd", -1);
+    VideoEncoderParamsFromJson(value["Video"], job.vidParams);
+    auto& audio = value["Audio"];
+    job.audParams.codecName = getString(audio, "Codec");
+    job.audParams.sampleFormat = getString(audio, "SampleFormat");
+    job.audParams.channels = getNumber(audio, "Channels", 2);
+    job.audParams.sampleRate = getNumber(audio, "SampleRate", 44100);
+    job.audParams.bitRate = getNumber(audio, "BitRate", 128000);
+    job.audParams.samplesPerFrame = getNumber(audio, "SamplesPerFrame", 1024);
+    if (audio.contains("Options"))
+        EncoderOptionsFromJson(audio["Options"], job.audParams.extraOpts);
+    job.threads = getNumber(value, "Threads", 1);
+    job.gopSize = getNumber(value, "GopSize", 12);
+    job.smartRender = getBoolean(value, "SmartRender");
+    job.cacheDir = getString(value, "CacheDir");
+    job.resumable = getBoolean(value, "Resumable");
+    job.statsPath = getString(value, "StatsPath");
+    job.state = getNumber(value, "State", QUEUED);
+    job.progress = getNumber(value, "Progress", 0);
+    job.elapsed = getNumber(value, "Elapsed", 0);
+    job.errMsg = getString(value, "Error");
+    return job.id >= 0 && !job.projectPath.empty() && !job.outputPath.empty();
+}
+
+ExportJobQueue::ExportJobQueue(const string& pluginPath, const string& queuePath)
+    : mPluginPath(pluginPath), mQueuePath(queuePath)
+{
+    Load();
+    mScheduleThread = thread(&ExportJobQueue::_ScheduleProc, this);
+    SysUtils::SetThreadName(mScheduleThread, "ExportQueue");
+}
+
+ExportJobQueue::~ExportJobQueue()
+{
+    mQuit = true;
+    if (mScheduleThread.joinable())
+        mScheduleThread.join();
+    map<int64_t, shared_ptr<RunningJob>> runningJobs;
+    {
+        lock_guard<mutex> lk(mJobsLock);
+        runningJobs.swap(mRunningJobs);
+    }
+    for (auto& item : runningJobs)
+    {
+        item.second->cancel = true;
+        if (item.second->thread.joinable())
+            item.second->thread.join();
+    }
+    Save();
+}
+
+int64_t ExportJobQueue::AddJob(const ExportJob& job)
+{
+    int64_t id;
+    {
+        lock_guard<mutex> lk(mJobsLock);
+        ExportJob newJob = job;
+        newJob.id = id = mNextJobId++;
+        newJob.state = ExportJob::QUEUED;
+        newJob.progress = 0;
+        newJob.elapsed = 0;
+        newJob.errMsg.clear();
+        mJobs.push_back(newJob);
+    }
+    Save();
+    return id;
+}
+
+bool ExportJobQueue::RemoveJob(int64_t id)
+{
+    {
+        lock_guard<mutex> lk(mJobsLock);
+        auto iter = find_if(mJobs.begin(), mJobs.end(), [id] (const ExportJob& job) { return job.id == id; });
+        if (iter == mJobs.end() || iter->state == ExportJob::RUNNING)
+            return false;
+        if (iter->ownsProject)
+            remove(iter->projectPath.c_str());
+        mJobs.erase(iter);
+    }
+    Save();
+    return true;
+}
+
+void ExportJobQueue::CancelJob(int64_t id)
+{
+    {
+        lock_guard<mutex> lk(mJobsLock);
+        auto iter = find_if(mJobs.begin(), mJobs.end(), [id] (const ExportJob& job) { return job.id == id; });
+        if (iter == mJobs.end())
+            return;
+        if (iter->state == ExportJob::QUEUED)
+            iter->state = ExportJob::CANCELED;
+        auto runningIter = mRunningJobs.find(id);
+        if (runningIter != mRunningJobs.end())
+            runningIter->second->cancel = true;
+    }
+    Save();
+}
+
+void ExportJobQueue::RetryJob(int64_t id)
+{
+    {
+        lock_guard<mutex> lk(mJobsLock);
+        auto iter = find_if(mJobs.begin(), mJobs.end(), [id] (const ExportJob& job) { return job.id == id; });
+        if (iter == mJobs.end() || iter->state == ExportJob::RUNNING || iter->state == ExportJob::QUEUED)
+            return;
+        iter->state = ExportJob::QUEUED;
+        iter->progress = 0;
+        iter->elapsed = 0;
+        iter->errMsg.clear();
+    }
+    Save();
+}
+
+void ExportJobQueue::ClearFinishedJobs()
+{
+    {
+        lock_guard<mutex> lk(mJobsLock);
+        auto iter = mJobs.begin();
+        while (iter != mJobs.end())
+        {
+            if (iter->state == ExportJob::DONE)
+            {
+                if (iter->ownsProject)
+                    remove(iter->projectPath.c_str());
+                iter = mJobs.erase(iter);
+            }
+            else
+                iter++;
+        }
+    }
+    Save();
+}
+
+vector<ExportJob> ExportJobQueue::GetJobs()
+{
+    lock_guard<mutex> lk(mJobsLock);
+    return mJobs;
+}
+
+void ExportJobQueue::SetMaxConcurrency(int maxConcurrency)
+{
+    maxConcurrency = max(maxConcurrency, 1);
+    if (maxConcurrency == mMaxConcurrency)
+        return;
+    mMaxConcurrency = maxConcurrency;
+    Save();
+}
+
+int ExportJobQueue::GetRunningCount()
+{
+    lock_guard<mutex> lk(mJobsLock);
+    return mRunningJobs.size();
+}
+
+const char* ExportJobQueue::GetStateName(int state)
+{
+    switch (state)
+    {
+    case ExportJob::QUEUED:     return "Queued";
+    case ExportJob::RUNNING:    return "Running";
+    case ExportJob::DONE:       return "Done";
+    case ExportJob::FAILED:     return "Failed";
+    case ExportJob::CANCELED:   return "Canceled";
+    default:                    return "Unknown";
+    }
+}
+
+bool ExportJobQueue::Load()
+{
+    if (mQueuePath.empty() || !ImGuiHelper::file_exists(mQueuePath))
+        return false;
+    auto loadResult = imgui_json::value::load(mQueuePath);
+    if (!loadResult.second)
+    {
+        Log(WARN) << "FAILED to load export queue from '" << mQueuePath << "'!" << endl;
+        return false;
+    }
+    auto& queue = loadResult.first;
+    if (queue.contains("MaxConcurrency") && queue["MaxConcurrency"].is_number())
+        mMaxConcurrency = max((int)queue["MaxConcurrency"].get<imgui_json::number>(), 1);
+    const imgui_json::array* jobArray = nullptr;
+    if (imgui_json::GetPtrTo(queue, "Jobs", jobArray))
+    {
+        for (auto& item : *jobArray)
+        {
+            ExportJob job;
+            if (!ExportJob::FromJson(item, job))
+                continue;
+            // interrupted by quitting, run it again
+            if (job.state == ExportJob::RUNNING)
+            {
+                job.state = ExportJob::QUEUED;
+                job.progress = 0;
+            }
+            mNextJobId = max(mNextJobId, job.id+1);
+            mJobs.push_back(job);
+        }
+    }
+    return true;
+}
+
+imgui_json::value ExportJobQueue::_ToJson()
+{
+    imgui_json::value queue;
+    queue["MaxConcurrency"] = imgui_json::number(mMaxConcurrency);
+    imgui_json::value jobs = imgui_json::array();
+    for (auto& job : mJobs)
+        jobs.push_back(job.ToJson());
+    queue["Jobs"] = jobs;
+    return queue;
+}
+
+bool ExportJobQueue::Save()
+{
+    if (mQueuePath.empty())
+        return false;
+    // the saving is serialized, and the queue file is replaced at once, so a crash never leaves it half written
+    lock_guard<mutex> saveLk(mSaveLock);
+    imgui_json::value queue;
+    {
+        lock_guard<mutex> lk(mJobsLock);
+        queue = _ToJson();
+    }
+    const string tmpPath = mQueuePath+".tmp";
+    if (!queue.save(tmpPath))
+    {
+        Log(Error) << "FAILED to save export queue into '" << tmpPath << "'!" << endl;
+        return false;
+    }
+    if (rename(tmpPath.c_str(), mQueuePath.c_str()) != 0)
+    {
+        // rename() doesn't replace an existing file on windows
+        remove(mQueuePath.c_str());
+        if (rename(tmpPath.c_str(), mQueuePath.c_str()) != 0)
+        {
+            Log(Error) << "FAILED to rename '" << tmpPath << "' to '" << mQueuePath << "'!" << endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+void ExportJobQueue::_UpdateJob(const ExportJob& job)
+{
+    lock_guard<mutex> lk(mJobsLock);
+    auto iter = find_if(mJobs.begin(), mJobs.end(), [&job] (const ExportJob& item) { return item.id == job.id; });
+    if (iter == mJobs.end())
+        return;
+    iter->state = job.state;
+    iter->progress = job.progress;
+    iter->elapsed = job.elapsed;
+    iter->errMsg = job.errMsg;
+}
+
+void ExportJobQueue::_ScheduleProc()
+{
+    Log(DEBUG) << ">>>>>>>>>>> Enter export queue schedule proc >>>>>>>>>>>>" << endl;
+    while (!mQuit)
+    {
+        bool stateChanged = false;
+        vector<shared_ptr<RunningJob>> finishedJobs;
+        {
+            lock_guard<mutex> lk(mJobsLock);
+            auto runningIter = mRunningJobs.begin();
+            while (runningIter != mRunningJobs.end())
+            {
+                if (runningIter->second->finished)
+                {
+                    finishedJobs.push_back(runningIter->second);
+                    runningIter = mRunningJobs.erase(runningIter);
+                }
+                else
+                    runningIter++;
+            }
+            for (auto& job : mJobs)
+            {
+                if ((int)mRunningJobs.size() >= mMaxConcurrency)
+                    break;
+                if (job.state != ExportJob::QUEUED)
+                    continue;
+                job.state = ExportJob::RUNNING;
+                job.progress = 0;
+                job.elapsed = 0;
+                job.errMsg.clear();
+                auto running = make_shared<RunningJob>();
+                running->thread = thread(&ExportJobQueue::_RunJob, this, job, running);
+                SysUtils::SetThreadName(running->thread, "ExportJob"+to_string(job.id));
+                mRunningJobs[job.id] = running;
+                stateChanged = true;
+            }
+        }
+        for (auto& running : finishedJobs)
+            running->thread.join();
+        if (stateChanged || !finishedJobs.empty())
+            Save();
+        ImGui::sleep(100);
+    }
+    Log(DEBUG) << "<<<<<<<<<<<<< Quit export queue schedule proc <<<<<<<<<<<<<<<<" << endl;
+}
+
+void ExportJobQueue::_RunJob(ExportJob job, shared_ptr<RunningJob> running)
+{
+    Log(DEBUG) << "Export job #" << job.id << " '" << job.name << "' starts." << endl;
+    const double startTime = ImGui::get_current_time();
+    TimeLine* timeline = new TimeLine(mPluginPath, true);
+    bool started = false;
+    do {
+        if (!LoadProject(timeline, job.projectPath, job.errMsg))
+            break;
+        if (job.rangeStart >= 0 && job.rangeEnd > job.rangeStart)
+        {
+            timeline->mark_in = job.rangeStart;
+            timeline->mark_out = job.rangeEnd;
+            timeline->mEncodingInRange = true;
+        }
+        if (timeline->ValidDuration() <= 0)
+        {
+            job.errMsg = "Nothing to export!";
+            break;
+        }
+        // the thread budget is spent on concurrent segment encoders, each of them runs single threaded
+        auto vidParams = job.vidParams;
+        auto optIter = find_if(vidParams.extraOpts.begin(), vidParams.extraOpts.end(), [] (const MediaCore::MediaEncoder::Option& opt) { return opt.name == "threads"; });
+        if (optIter != vidParams.extraOpts.end())
+            vidParams.extraOpts.erase(optIter);
+        vidParams.extraOpts.push_back({"threads", MediaCore::Value((int)1)});
+        timeline->mEncodingSegmentThreads = job.threads > 1 ? job.threads : 0;
+        timeline->mEncodingGopSize = job.gopSize > 0 ? job.gopSize : 12;
+        timeline->mEncodingSmartRender = job.smartRender;
+        timeline->mEncodingCacheDir = job.cacheDir;
+        timeline->mEncodingResumable = job.resumable;
+        timeline->mEncodingStatsPath = job.statsPath;
+        timeline->mEncodingPreviewRate = 0;
+        if (!timeline->ConfigEncoder(job.outputPath, vidParams, job.audParams, job.errMsg))
+            break;
+        timeline->StartEncoding();
+        started = true;
+        while (timeline->mIsEncoding)
+        {
+            ImGui::sleep(200);
+            if (running->cancel)
+            {
+                timeline->StopEncoding();
+                break;
+            }
+            job.progress = timeline->mEncodingProgress;
+            job.elapsed = ImGui::get_current_time() - startTime;
+            _UpdateJob(job);
+        }
+        timeline->StopEncoding();
+        job.errMsg = timeline->mEncodeProcErrMsg;
+    } while (false);
+    delete timeline;
+
+    job.elapsed = ImGui::get_current_time() - startTime;
+    if (running->cancel)
+    {
+        // quitting puts the job back to the queue, a canceled one stays canceled
+        job.state = mQuit ? ExportJob::QUEUED : ExportJob::CANCELED;
+        job.errMsg.clear();
+    }
+    else if (!started || !job.errMsg.empty())
+    {
+        job.state = ExportJob::FAILED;
+    }
+    else
+    {
+        job.state = ExportJob::DONE;
+        job.progress = 1;
+    }
+    _UpdateJob(job);
+    Log(DEBUG) << "Export job #" << job.id << " '" << job.name << "' ends as '" << GetStateName(job.state) << "'. "
+            << job.errMsg << endl;
+    running->finished = true;
+}
+}
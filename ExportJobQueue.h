@@ -0,0 +1,128 @@
+/*
+    Copyright (c) 2023 CodeWin
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <imgui_json.h>
+#include "MediaTimeline.h"
+
+namespace MEC
+{
+    // Load a project without UI, first media bank then timeline
+    bool LoadProject(MediaTimeline::TimeLine* timeline, const std::string& path, std::string& errMsg);
+    bool LoadProject(MediaTimeline::TimeLine* timeline, const imgui_json::value& project, std::string& errMsg);
+    // Media bank and timeline of a headless timeline, in the layout of a project file
+    imgui_json::value SaveProject(MediaTimeline::TimeLine* timeline);
+
+    imgui_json::value VideoEncoderParamsToJson(const MediaTimeline::TimeLine::VideoEncoderParams& params);
+    void VideoEncoderParamsFromJson(const imgui_json::value& value, MediaTimeline::TimeLine::VideoEncoderParams& params);
+
+    // One export of a project file with fixed encoder settings
+    struct ExportJob
+    {
+        enum State
+        {
+            QUEUED = 0,
+            RUNNING,
+            DONE,
+            FAILED,
+            CANCELED,
+        };
+
+        int64_t id {-1};
+        std::string name;
+        std::string projectPath;
+        bool ownsProject {false};           // the project is a snapshot made for this job, removed together with the job
+        std::string outputPath;
+        int64_t rangeStart {-1};            // millisecond, whole timeline if <0
+        int64_t rangeEnd {-1};              // millisecond
+        MediaTimeline::TimeLine::VideoEncoderParams vidParams {};
+        MediaTimeline::TimeLine::AudioEncoderParams audParams {};
+        int threads {1};                    // thread budget, the count of single threaded segment encoders
+        int gopSize {12};
+        bool smartRender {false};
+        std::string cacheDir;
+        bool resumable {false};             // keep the finished segments of a failed or canceled run, a retry resumes from them
+        std::string statsPath;
+
+        int state {QUEUED};
+        float progress {0};
+        double elapsed {0};                 // second
+        std::string errMsg;
+
+        imgui_json::value ToJson() const;
+        static bool FromJson(const imgui_json::value& value, ExportJob& job);
+    };
+
+    // Persisted export queue. Jobs are run in the queued order by headless timelines, at most 'MaxConcurrency'
+    // of them at once, the editor timeline is not touched. Jobs interrupted by quitting are queued again on next load.
+    class ExportJobQueue
+    {
+    public:
+        ExportJobQueue(const std::string& pluginPath, const std::string& queuePath);
+        ExportJobQueue(const ExportJobQueue&) = delete;
+        ExportJobQueue& operator=(const ExportJobQueue&) = delete;
+        ~ExportJobQueue();
+
+        int64_t AddJob(const ExportJob& job);
+        bool RemoveJob(int64_t id);         // running jobs can't be removed, cancel them first
+        void CancelJob(int64_t id);
+        void RetryJob(int64_t id);
+        void ClearFinishedJobs();
+        std::vector<ExportJob> GetJobs();   // copy of current jobs for display
+
+        void SetMaxConcurrency(int maxConcurrency);
+        int GetMaxConcurrency() const { return mMaxConcurrency; }
+        int GetRunningCount();
+
+        static const char* GetStateName(int state);
+
+    private:
+        struct RunningJob
+        {
+            std::thread thread;
+            std::atomic<bool> cancel {false};
+            std::atomic<bool> finished {false};
+        };
+
+        bool Load();
+        bool Save();
+        imgui_json::value _ToJson();
+        void _ScheduleProc();
+        void _RunJob(ExportJob job, std::shared_ptr<RunningJob> running);
+        void _UpdateJob(const ExportJob& job);
+
+    private:
+        std::string mPluginPath;
+        std::string mQueuePath;
+        std::mutex mJobsLock;
+        std::mutex mSaveLock;
+        std::vector<ExportJob> mJobs;
+        std::map<int64_t, std::shared_ptr<RunningJob>> mRunningJobs;
+        int64_t mNextJobId {0};
+        std::atomic<int> mMaxConcurrency {1};
+        std::atomic<bool> mQuit {false};
+        std::thread mScheduleThread;
+    };
+}
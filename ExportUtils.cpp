@@ -0,0 +1,1835 @@
+/*
+    Copyright (c) 2023 CodeWin
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <sstream>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <cstdio>
+#include <iomanip>
+#include <sys/stat.h>
+#if defined(_WIN32)
+#include <direct.h>
+#include <io.h>
+#include <fcntl.h>
+#include <sys/utime.h>
+#else
+#include <unistd.h>
+#include <dirent.h>
+#include <utime.h>
+#endif
+#include "ExportUtils.h"
+#include "Logger.h"
+#if IMGUI_VULKAN_SHADER
+#include <ImVulkanShader.h>
+#include <Resize_vulkan.h>
+#endif
+extern "C"
+{
+    #include "libavformat/avformat.h"
+    #include "libavcodec/avcodec.h"
+    #include "libavutil/avutil.h"
+    #include "libavutil/pixdesc.h"
+    #include "libavutil/frame.h"
+    #include "libavutil/opt.h"
+}
+
+using namespace std;
+using namespace Logger;
+
+namespace MEC
+{
+static string AvErrorString(int errnum)
+{
+    char buf[AV_ERROR_MAX_STRING_SIZE] = {0};
+    av_strerror(errnum, buf, sizeof(buf));
+    return string(buf);
+}
+
+static const AVRational MILLISEC_TIMEBASE = { 1, 1000 };
+
+FrameScaler::~FrameScaler()
+{
+#if IMGUI_VULKAN_SHADER
+    if (mResize) { delete mResize; mResize = nullptr; }
+#endif
+}
+
+bool FrameScaler::Scale(const ImGui::ImMat& src, ImGui::ImMat& dst, uint32_t width, uint32_t height)
+{
+    if (src.empty() || width == 0 || height == 0)
+        return false;
+    if (src.w == width && src.h == height)
+    {
+        dst = src;
+        return true;
+    }
+#if IMGUI_VULKAN_SHADER
+    if (!mResize)
+    {
+        int gpu = src.device == IM_DD_VULKAN ? src.device_number : ImGui::get_default_gpu_index();
+        mResize = new ImGui::Resize_vulkan(gpu);
+    }
+    ImGui::VkMat scaledMat; scaledMat.type = src.type;
+    mResize->Resize(src, scaledMat, (float)width / src.w, (float)height / src.h, IM_INTERPOLATE_BILINEAR);
+    if (scaledMat.w != width || scaledMat.h != height)
+        return false;
+    dst = scaledMat;
+#else
+    if (src.device != IM_DD_CPU || src.type != IM_DT_INT8)
+        return false;
+    ImGui::ImMat srcMat(src);
+    ImGui::ImMat scaledMat;
+    scaledMat.create_type(width, height, src.c, IM_DT_INT8);
+    const float fx = (float)src.w / width, fy = (float)src.h / height;
+    for (int y = 0; y < height; y++)
+    {
+        const float sy = std::max((y+0.5f)*fy-0.5f, 0.f);
+        const int y0 = std::min((int)sy, src.h-1), y1 = std::min(y0+1, src.h-1);
+        const float wy = sy-y0;
+        for (int x = 0; x < width; x++)
+        {
+            const float sx = std::max((x+0.5f)*fx-0.5f, 0.f);
+            const int x0 = std::min((int)sx, src.w-1), x1 = std::min(x0+1, src.w-1);
+            const float wx = sx-x0;
+            for (int c = 0; c < src.c; c++)
+            {
+                const float top = srcMat.at<uint8_t>(x0, y0, c)*(1-wx)+srcMat.at<uint8_t>(x1, y0, c)*wx;
+                const float bottom = srcMat.at<uint8_t>(x0, y1, c)*(1-wx)+srcMat.at<uint8_t>(x1, y1, c)*wx;
+                scaledMat.at<uint8_t>(x, y, c) = (uint8_t)(top*(1-wy)+bottom*wy+0.5f);
+            }
+        }
+    }
+    dst = scaledMat;
+#endif
+    dst.time_stamp = src.time_stamp;
+    return true;
+}
+
+void ContentHasher::Add(const void* data, size_t size)
+{
+    mBuffer.append((const char*)data, size);
+}
+
+void ContentHasher::Add(const string& str)
+{
+    // the length is hashed too, so the concatenation of several strings is unambiguous
+    Add((int64_t)str.size());
+    Add(str.data(), str.size());
+}
+
+void ContentHasher::Add(int64_t value)
+{
+    Add(&value, sizeof(value));
+}
+
+string ContentHasher::HexDigest() const
+{
+    // the inputs are a few kilobytes of json at most, hashing them twice is cheap
+    const uint64_t hashLo = HashBytes64(mBuffer.data(), mBuffer.size(), 0);
+    const uint64_t hashHi = HashBytes64(mBuffer.data(), mBuffer.size(), 0x9e3779b97f4a7c15ULL);
+    ostringstream oss;
+    oss << hex << setfill('0') << setw(16) << hashHi << setw(16) << hashLo;
+    return oss.str();
+}
+
+string GetFileIdentity(const string& path)
+{
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0)
+        return string();
+    ostringstream oss;
+    oss << (int64_t)st.st_size << "-" << (int64_t)st.st_mtime;
+    return oss.str();
+}
+
+bool MakeDirectory(const string& path)
+{
+    struct stat st;
+    if (stat(path.c_str(), &st) == 0)
+        return (st.st_mode & S_IFDIR) != 0;
+#if defined(_WIN32)
+    return _mkdir(path.c_str()) == 0;
+#else
+    return mkdir(path.c_str(), 0755) == 0;
+#endif
+}
+
+bool TouchFile(const string& path)
+{
+    return utime(path.c_str(), nullptr) == 0;
+}
+
+int PruneDirectory(const string& dir, uint64_t maxBytes, const vector<string>& keepPaths)
+{
+    struct FileEntry
+    {
+        string path;
+        uint64_t size;
+        int64_t mtime;
+    };
+    vector<FileEntry> files;
+    vector<string> names;
+#if defined(_WIN32)
+    struct _finddata_t findData;
+    intptr_t hFind = _findfirst((dir+"/*").c_str(), &findData);
+    if (hFind != -1)
+    {
+        do {
+            if (!(findData.attrib & _A_SUBDIR))
+                names.push_back(findData.name);
+        } while (_findnext(hFind, &findData) == 0);
+        _findclose(hFind);
+    }
+#else
+    DIR* pDir = opendir(dir.c_str());
+    if (pDir)
+    {
+        struct dirent* entry;
+        while ((entry = readdir(pDir)) != nullptr)
+        {
+            if (entry->d_name[0] != '.')
+                names.push_back(entry->d_name);
+        }
+        closedir(pDir);
+    }
+#endif
+    uint64_t totalBytes = 0;
+    for (auto& name : names)
+    {
+        const string path = dir+"/"+name;
+        struct stat st;
+        if (stat(path.c_str(), &st) != 0 || !(st.st_mode & S_IFREG))
+            continue;
+        totalBytes += (uint64_t)st.st_size;
+        if (find(keepPaths.begin(), keepPaths.end(), path) == keepPaths.end())
+            files.push_back({path, (uint64_t)st.st_size, (int64_t)st.st_mtime});
+    }
+    sort(files.begin(), files.end(), [] (const FileEntry& a, const FileEntry& b) { return a.mtime < b.mtime; });
+    int deleted = 0;
+    for (auto& file : files)
+    {
+        if (totalBytes <= maxBytes)
+            break;
+        if (remove(file.path.c_str()) == 0)
+        {
+            totalBytes -= file.size;
+            deleted++;
+        }
+    }
+    return deleted;
+}
+
+static bool OpenVideoInput(const string& path, AVFormatContext*& fmtCtx, int& streamIdx, string& errMsg)
+{
+    int fferr = avformat_open_input(&fmtCtx, path.c_str(), nullptr, nullptr);
+    if (fferr < 0)
+    {
+        ostringstream oss; oss << "FAILED to open '" << path << "'! fferr=" << fferr << "(" << AvErrorString(fferr) << ").";
+        errMsg = oss.str();
+        return false;
+    }
+    fferr = avformat_find_stream_info(fmtCtx, nullptr);
+    if (fferr < 0)
+    {
+        ostringstream oss; oss << "FAILED to find stream info of '" << path << "'! fferr=" << fferr << "(" << AvErrorString(fferr) << ").";
+        errMsg = oss.str();
+        avformat_close_input(&fmtCtx);
+        return false;
+    }
+    streamIdx = av_find_best_stream(fmtCtx, AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0);
+    if (streamIdx < 0)
+    {
+        ostringstream oss; oss << "'" << path << "' has no video stream!";
+        errMsg = oss.str();
+        avformat_close_input(&fmtCtx);
+        return false;
+    }
+    return true;
+}
+
+static AVRational GetStreamFrameRate(const AVStream* stream)
+{
+    if (stream->avg_frame_rate.num > 0 && stream->avg_frame_rate.den > 0)
+        return stream->avg_frame_rate;
+    return stream->r_frame_rate;
+}
+
+// profile_idc and level_idc from avcC/hvcC or annex-b extradata
+static void GetProfileLevel(int codecId, const uint8_t* data, int size, int& profile, int& level)
+{
+    profile = level = -1;
+    if (!data || size < 4)
+        return;
+    const bool isAnnexB = (data[0] == 0 && data[1] == 0 && data[2] == 1) || (data[0] == 0 && data[1] == 0 && data[2] == 0 && data[3] == 1);
+    if (!isAnnexB)
+    {
+        if (data[0] != 1)
+            return;
+        if (codecId == AV_CODEC_ID_H264)
+        {
+            profile = data[1];
+            level = data[3];
+        }
+        else if (codecId == AV_CODEC_ID_HEVC && size > 12)
+        {
+            profile = data[1] & 0x1f;
+            level = data[12];
+        }
+        return;
+    }
+    for (int pos = 0; pos+3 < size; pos++)
+    {
+        if (data[pos] != 0 || data[pos+1] != 0 || data[pos+2] != 1)
+            continue;
+        const int nalStart = pos+3;
+        // the leading bytes of the sps payload, without the emulation prevention bytes
+        vector<uint8_t> payload;
+        int zeros = 0;
+        for (int i = nalStart; i < size && payload.size() < 16; i++)
+        {
+            if (zeros >= 2 && data[i] == 3)
+            {
+                zeros = 0;
+                continue;
+            }
+            if (zeros >= 2 && data[i] <= 1)
+                break;
+            zeros = data[i] == 0 ? zeros+1 : 0;
+            payload.push_back(data[i]);
+        }
+        if (codecId == AV_CODEC_ID_H264 && payload.size() >= 4 && (payload[0] & 0x1f) == 7)
+        {
+            profile = payload[1];
+            level = payload[3];
+            return;
+        }
+        if (codecId == AV_CODEC_ID_HEVC && payload.size() >= 15 && ((payload[0] >> 1) & 0x3f) == 33)
+        {
+            // nal header(2), sps ids(1), profile_space/tier/profile_idc(1), compatibility(4), constraints(6), level_idc(1)
+            profile = payload[3] & 0x1f;
+            level = payload[14];
+            return;
+        }
+    }
+}
+
+bool ProbeVideoStream(const string& path, VideoStreamInfo& info, string& errMsg)
+{
+    AVFormatContext* fmtCtx = nullptr;
+    int streamIdx = -1;
+    if (!OpenVideoInput(path, fmtCtx, streamIdx, errMsg))
+        return false;
+    auto stream = fmtCtx->streams[streamIdx];
+    info.codecId = stream->codecpar->codec_id;
+    info.pixelFormat = stream->codecpar->format;
+    info.width = stream->codecpar->width;
+    info.height = stream->codecpar->height;
+    auto frameRate = GetStreamFrameRate(stream);
+    info.frameRateNum = frameRate.num;
+    info.frameRateDen = frameRate.den;
+    GetProfileLevel(stream->codecpar->codec_id, stream->codecpar->extradata, stream->codecpar->extradata_size, info.profile, info.level);
+    info.timeBaseNum = stream->time_base.num;
+    info.timeBaseDen = stream->time_base.den;
+    avformat_close_input(&fmtCtx);
+    return true;
+}
+
+bool GetVideoEncoderInfo(const string& codecName, const string& pixelFormat, uint32_t width, uint32_t height,
+        int frameRateNum, int frameRateDen, const vector<pair<string, int64_t>>& options, VideoStreamInfo& info)
+{
+    auto codec = avcodec_find_encoder_by_name(codecName.c_str());
+    if (!codec)
+        return false;
+    info.codecId = codec->id;
+    if (!pixelFormat.empty())
+        info.pixelFormat = av_get_pix_fmt(pixelFormat.c_str());
+    else
+        info.pixelFormat = codec->pix_fmts ? codec->pix_fmts[0] : AV_PIX_FMT_NONE;
+    info.width = width;
+    info.height = height;
+    info.frameRateNum = frameRateNum;
+    info.frameRateDen = frameRateDen;
+    if (info.pixelFormat == AV_PIX_FMT_NONE || frameRateNum <= 0 || frameRateDen <= 0)
+        return true;
+    // the parameter sets are only known once the encoder is opened with the export options
+    AVCodecContext* codecCtx = avcodec_alloc_context3(codec);
+    if (!codecCtx)
+        return true;
+    codecCtx->width = width;
+    codecCtx->height = height;
+    codecCtx->pix_fmt = (AVPixelFormat)info.pixelFormat;
+    codecCtx->time_base = { frameRateDen, frameRateNum };
+    codecCtx->framerate = { frameRateNum, frameRateDen };
+    codecCtx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+    for (auto& opt : options)
+        av_opt_set_int(codecCtx, opt.first.c_str(), opt.second, AV_OPT_SEARCH_CHILDREN);
+    if (avcodec_open2(codecCtx, codec, nullptr) >= 0)
+    {
+        GetProfileLevel(codec->id, codecCtx->extradata, codecCtx->extradata_size, info.profile, info.level);
+        info.timeBaseNum = codecCtx->time_base.num;
+        info.timeBaseDen = codecCtx->time_base.den;
+    }
+    avcodec_free_context(&codecCtx);
+    return true;
+}
+
+bool CanPassthrough(const VideoStreamInfo& srcInfo, const VideoStreamInfo& encInfo)
+{
+    if (srcInfo.codecId != AV_CODEC_ID_H264 && srcInfo.codecId != AV_CODEC_ID_HEVC)
+        return false;
+    if (srcInfo.frameRateNum <= 0 || srcInfo.frameRateDen <= 0 || encInfo.frameRateNum <= 0 || encInfo.frameRateDen <= 0)
+        return false;
+    if (srcInfo.profile < 0 || srcInfo.level < 0 || srcInfo.timeBaseNum <= 0 || srcInfo.timeBaseDen <= 0 || encInfo.timeBaseNum <= 0 || encInfo.timeBaseDen <= 0)
+        return false;
+    // the copied timestamps are rescaled without rounding
+    const bool timeBaseFits = ((int64_t)encInfo.timeBaseNum * srcInfo.timeBaseDen) % ((int64_t)encInfo.timeBaseDen * srcInfo.timeBaseNum) == 0;
+    return srcInfo.codecId == encInfo.codecId && srcInfo.pixelFormat == encInfo.pixelFormat &&
+        srcInfo.width == encInfo.width && srcInfo.height == encInfo.height &&
+        srcInfo.profile == encInfo.profile && srcInfo.level == encInfo.level && timeBaseFits &&
+        (int64_t)srcInfo.frameRateNum * encInfo.frameRateDen == (int64_t)encInfo.frameRateNum * srcInfo.frameRateDen;
+}
+
+bool ScanVideoKeyFrames(const string& path, int64_t startMs, int64_t endMs, vector<int64_t>& keyFrames, string& errMsg)
+{
+    keyFrames.clear();
+    AVFormatContext* fmtCtx = nullptr;
+    int streamIdx = -1;
+    if (!OpenVideoInput(path, fmtCtx, streamIdx, errMsg))
+        return false;
+    auto stream = fmtCtx->streams[streamIdx];
+    const int64_t startTs = stream->start_time != AV_NOPTS_VALUE ? stream->start_time : 0;
+    av_seek_frame(fmtCtx, streamIdx, av_rescale_q(startMs, MILLISEC_TIMEBASE, stream->time_base)+startTs, AVSEEK_FLAG_BACKWARD);
+    AVPacket* pkt = av_packet_alloc();
+    bool success = true;
+    while (true)
+    {
+        int fferr = av_read_frame(fmtCtx, pkt);
+        if (fferr == AVERROR_EOF)
+            break;
+        else if (fferr < 0)
+        {
+            ostringstream oss; oss << "FAILED to read packet from '" << path << "'! fferr=" << fferr << "(" << AvErrorString(fferr) << ").";
+            errMsg = oss.str();
+            success = false;
+            break;
+        }
+        if (pkt->stream_index == streamIdx && pkt->pts != AV_NOPTS_VALUE)
+        {
+            const int64_t posMs = av_rescale_q(pkt->pts-startTs, stream->time_base, MILLISEC_TIMEBASE);
+            const bool isKeyFrame = (pkt->flags & AV_PKT_FLAG_KEY) != 0;
+            if (isKeyFrame && posMs > endMs)
+            {
+                av_packet_unref(pkt);
+                break;
+            }
+            if (isKeyFrame && posMs >= startMs)
+                keyFrames.push_back(posMs);
+        }
+        av_packet_unref(pkt);
+    }
+    av_packet_free(&pkt);
+    avformat_close_input(&fmtCtx);
+    sort(keyFrames.begin(), keyFrames.end());
+    keyFrames.erase(unique(keyFrames.begin(), keyFrames.end()), keyFrames.end());
+    return success;
+}
+
+bool RemuxVideoRange(const string& path, int64_t startMs, int64_t endMs, const string& outputPath, int64_t& frameCount, string& errMsg)
+{
+    frameCount = 0;
+    AVFormatContext* inCtx = nullptr;
+    int streamIdx = -1;
+    if (!OpenVideoInput(path, inCtx, streamIdx, errMsg))
+        return false;
+    auto inStream = inCtx->streams[streamIdx];
+    const int64_t startTs = inStream->start_time != AV_NOPTS_VALUE ? inStream->start_time : 0;
+    const int64_t startPts = av_rescale_q(startMs, MILLISEC_TIMEBASE, inStream->time_base)+startTs;
+    const int64_t endPts = av_rescale_q(endMs, MILLISEC_TIMEBASE, inStream->time_base)+startTs;
+    const auto frameRate = GetStreamFrameRate(inStream);
+    const int64_t halfFrame = frameRate.num > 0 && frameRate.den > 0 ? av_rescale_q(1, av_inv_q(frameRate), inStream->time_base)/2 : 0;
+
+    AVFormatContext* outCtx = nullptr;
+    AVStream* outStream = nullptr;
+    AVPacket* pkt = av_packet_alloc();
+    bool headerWritten = false;
+    bool success = false;
+    int fferr;
+    do {
+        fferr = avformat_alloc_output_context2(&outCtx, nullptr, nullptr, outputPath.c_str());
+        if (fferr < 0 || !outCtx)
+        {
+            ostringstream oss; oss << "FAILED to allocate output context for '" << outputPath << "'! fferr=" << fferr << "(" << AvErrorString(fferr) << ").";
+            errMsg = oss.str();
+            break;
+        }
+        outStream = avformat_new_stream(outCtx, nullptr);
+        if (!outStream)
+        {
+            errMsg = "FAILED to create output stream!";
+            break;
+        }
+        avcodec_parameters_copy(outStream->codecpar, inStream->codecpar);
+        outStream->codecpar->codec_tag = 0;
+        outStream->time_base = inStream->time_base;
+        outStream->avg_frame_rate = inStream->avg_frame_rate;
+        outStream->r_frame_rate = inStream->r_frame_rate;
+        outStream->sample_aspect_ratio = inStream->sample_aspect_ratio;
+        if (!(outCtx->oformat->flags & AVFMT_NOFILE))
+        {
+            fferr = avio_open(&outCtx->pb, outputPath.c_str(), AVIO_FLAG_WRITE);
+            if (fferr < 0)
+            {
+                ostringstream oss; oss << "FAILED to open '" << outputPath << "' for writing! fferr=" << fferr << "(" << AvErrorString(fferr) << ").";
+                errMsg = oss.str();
+                break;
+            }
+        }
+        fferr = avformat_write_header(outCtx, nullptr);
+        if (fferr < 0)
+        {
+            ostringstream oss; oss << "FAILED to write header of '" << outputPath << "'! fferr=" << fferr << "(" << AvErrorString(fferr) << ").";
+            errMsg = oss.str();
+            break;
+        }
+        headerWritten = true;
+
+        av_seek_frame(inCtx, streamIdx, startPts, AVSEEK_FLAG_BACKWARD);
+        bool started = false;
+        bool failed = false;
+        while (true)
+        {
+            fferr = av_read_frame(inCtx, pkt);
+            if (fferr == AVERROR_EOF)
+                break;
+            else if (fferr < 0)
+            {
+                ostringstream oss; oss << "FAILED to read packet from '" << path << "'! fferr=" << fferr << "(" << AvErrorString(fferr) << ").";
+                errMsg = oss.str();
+                failed = true;
+                break;
+            }
+            if (pkt->stream_index != streamIdx || pkt->pts == AV_NOPTS_VALUE)
+            {
+                av_packet_unref(pkt);
+                continue;
+            }
+            const bool isKeyFrame = (pkt->flags & AV_PKT_FLAG_KEY) != 0;
+            if (!started)
+            {
+                if (!isKeyFrame || pkt->pts < startPts-halfFrame)
+                {
+                    av_packet_unref(pkt);
+                    continue;
+                }
+                started = true;
+            }
+            else if (isKeyFrame && pkt->pts >= endPts-halfFrame)
+            {
+                av_packet_unref(pkt);
+                break;
+            }
+            // drop the leading pictures of an open GOP, they refer to the previous GOP
+            if (pkt->pts < startPts-halfFrame)
+            {
+                av_packet_unref(pkt);
+                continue;
+            }
+            pkt->pts -= startPts;
+            if (pkt->dts != AV_NOPTS_VALUE)
+                pkt->dts -= startPts;
+            pkt->stream_index = 0;
+            pkt->pos = -1;
+            av_packet_rescale_ts(pkt, inStream->time_base, outStream->time_base);
+            fferr = av_interleaved_write_frame(outCtx, pkt);
+            if (fferr < 0)
+            {
+                ostringstream oss; oss << "FAILED to write packet into '" << outputPath << "'! fferr=" << fferr << "(" << AvErrorString(fferr) << ").";
+                errMsg = oss.str();
+                failed = true;
+                break;
+            }
+            frameCount++;
+        }
+        if (failed)
+            break;
+        if (!started)
+        {
+            ostringstream oss; oss << "No key frame at " << startMs << "ms in '" << path << "'!";
+            errMsg = oss.str();
+            break;
+        }
+        success = true;
+    } while (false);
+
+    if (headerWritten)
+        av_write_trailer(outCtx);
+    if (outCtx)
+    {
+        if (!(outCtx->oformat->flags & AVFMT_NOFILE))
+            avio_closep(&outCtx->pb);
+        avformat_free_context(outCtx);
+    }
+    av_packet_free(&pkt);
+    avformat_close_input(&inCtx);
+    if (!success)
+        Log(Error) << "RemuxVideoRange() FAILED! " << errMsg << endl;
+    return success;
+}
+
+// sequential decoding of the best video stream of a file
+struct VideoFileDecoder
+{
+    AVFormatContext* fmtCtx {nullptr};
+    AVCodecContext* codecCtx {nullptr};
+    AVPacket* packet {nullptr};
+    int streamIdx {-1};
+    bool flushed {false};
+
+    ~VideoFileDecoder()
+    {
+        if (packet) av_packet_free(&packet);
+        if (codecCtx) avcodec_free_context(&codecCtx);
+        if (fmtCtx) avformat_close_input(&fmtCtx);
+    }
+
+    bool Open(const string& path, string& errMsg)
+    {
+        if (!OpenVideoInput(path, fmtCtx, streamIdx, errMsg))
+            return false;
+        auto codecpar = fmtCtx->streams[streamIdx]->codecpar;
+        auto codec = avcodec_find_decoder(codecpar->codec_id);
+        codecCtx = codec ? avcodec_alloc_context3(codec) : nullptr;
+        packet = av_packet_alloc();
+        if (!codecCtx || !packet || avcodec_parameters_to_context(codecCtx, codecpar) < 0 || avcodec_open2(codecCtx, codec, nullptr) < 0)
+        {
+            errMsg = "FAILED to open the video decoder of '" + path + "'!";
+            return false;
+        }
+        return true;
+    }
+
+    // false at the end of the stream or on error, 'errMsg' is set only on error
+    bool ReadFrame(AVFrame* frame, string& errMsg)
+    {
+        while (true)
+        {
+            int fferr = avcodec_receive_frame(codecCtx, frame);
+            if (fferr == 0)
+                return true;
+            if (fferr == AVERROR_EOF)
+                return false;
+            if (fferr != AVERROR(EAGAIN))
+            {
+                errMsg = "FAILED to decode video! fferr=" + to_string(fferr) + "(" + AvErrorString(fferr) + ").";
+                return false;
+            }
+            if (flushed)
+                return false;
+            fferr = av_read_frame(fmtCtx, packet);
+            if (fferr < 0)
+            {
+                flushed = true;
+                avcodec_send_packet(codecCtx, nullptr);
+                continue;
+            }
+            if (packet->stream_index == streamIdx)
+                avcodec_send_packet(codecCtx, packet);
+            av_packet_unref(packet);
+        }
+    }
+};
+
+bool CompareVideoPsnr(const string& path, const string& refPath, double& psnr, string& errMsg)
+{
+    psnr = 0;
+    VideoFileDecoder decoder, refDecoder;
+    if (!decoder.Open(path, errMsg) || !refDecoder.Open(refPath, errMsg))
+        return false;
+    AVFrame* frame = av_frame_alloc();
+    AVFrame* refFrame = av_frame_alloc();
+    double psnrSum = 0;
+    int64_t frameCount = 0;
+    bool success = false;
+    while (true)
+    {
+        const bool hasFrame = decoder.ReadFrame(frame, errMsg);
+        const bool hasRefFrame = errMsg.empty() && refDecoder.ReadFrame(refFrame, errMsg);
+        if (!errMsg.empty())
+            break;
+        if (!hasFrame || !hasRefFrame)
+        {
+            if (hasFrame != hasRefFrame)
+                errMsg = "'" + path + "' and '" + refPath + "' have different frame counts!";
+            else if (frameCount == 0)
+                errMsg = "No video frame in '" + path + "'!";
+            else
+                success = true;
+            break;
+        }
+        // the luma of YUV or gray formats is compared, the chroma mostly follows it
+        const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get((AVPixelFormat)frame->format);
+        if (frame->format != refFrame->format || frame->width != refFrame->width || frame->height != refFrame->height ||
+            !desc || (desc->flags & AV_PIX_FMT_FLAG_RGB) || (desc->flags & AV_PIX_FMT_FLAG_BE) || desc->comp[0].depth > 16)
+        {
+            errMsg = "Only the YUV video of the same size and format can be compared!";
+            break;
+        }
+        const int depth = desc->comp[0].depth;
+        uint64_t sqSum = 0;
+        for (int y = 0; y < frame->height; y++)
+        {
+            const uint8_t* row = frame->data[0]+y*frame->linesize[0];
+            const uint8_t* refRow = refFrame->data[0]+y*refFrame->linesize[0];
+            for (int x = 0; x < frame->width; x++)
+            {
+                const int64_t diff = depth > 8 ? (int64_t)((const uint16_t*)row)[x]-((const uint16_t*)refRow)[x] : (int64_t)row[x]-refRow[x];
+                sqSum += diff*diff;
+            }
+        }
+        const double maxValue = (double)((1 << depth)-1);
+        const double mse = (double)sqSum / ((double)frame->width*frame->height);
+        psnrSum += mse > 0 ? std::min(10*log10(maxValue*maxValue/mse), 100.) : 100.;
+        frameCount++;
+        av_frame_unref(frame);
+        av_frame_unref(refFrame);
+    }
+    av_frame_free(&frame);
+    av_frame_free(&refFrame);
+    if (success)
+        psnr = psnrSum / frameCount;
+    return success;
+}
+
+// parameter set NAL units from avcC/hvcC extradata, or the raw bytes if the extradata is in annex-b format
+static bool ExtractParameterSets(const AVCodecParameters* codecpar, bool& isAnnexB, int& nalLengthSize, vector<vector<uint8_t>>& nalUnits)
+{
+    const uint8_t* data = codecpar->extradata;
+    const int size = codecpar->extradata_size;
+    nalUnits.clear();
+    if (!data || size < 4)
+        return false;
+    if ((data[0] == 0 && data[1] == 0 && data[2] == 1) || (data[0] == 0 && data[1] == 0 && data[2] == 0 && data[3] == 1))
+    {
+        isAnnexB = true;
+        nalLengthSize = 0;
+        nalUnits.push_back(vector<uint8_t>(data, data+size));
+        return true;
+    }
+    isAnnexB = false;
+    auto readNalUnit = [&] (int& pos) {
+        if (pos+2 > size)
+            return false;
+        const int len = (data[pos] << 8) | data[pos+1];
+        pos += 2;
+        if (pos+len > size)
+            return false;
+        nalUnits.push_back(vector<uint8_t>(data+pos, data+pos+len));
+        pos += len;
+        return true;
+    };
+    if (codecpar->codec_id == AV_CODEC_ID_H264)
+    {
+        if (size < 7 || data[0] != 1)
+            return false;
+        nalLengthSize = (data[4] & 3)+1;
+        int pos = 5;
+        const int spsCount = data[pos++] & 0x1f;
+        for (int i = 0; i < spsCount; i++)
+            if (!readNalUnit(pos)) return false;
+        if (pos >= size)
+            return false;
+        const int ppsCount = data[pos++];
+        for (int i = 0; i < ppsCount; i++)
+            if (!readNalUnit(pos)) return false;
+        return true;
+    }
+    else if (codecpar->codec_id == AV_CODEC_ID_HEVC)
+    {
+        if (size < 23 || data[0] != 1)
+            return false;
+        nalLengthSize = (data[21] & 3)+1;
+        const int arrayCount = data[22];
+        int pos = 23;
+        for (int i = 0; i < arrayCount; i++)
+        {
+            if (pos+3 > size)
+                return false;
+            const int nalCount = (data[pos+1] << 8) | data[pos+2];
+            pos += 3;
+            for (int j = 0; j < nalCount; j++)
+                if (!readNalUnit(pos)) return false;
+        }
+        return true;
+    }
+    return false;
+}
+
+string GetImageSequenceCodec(const string& outputPath)
+{
+    auto dotPos = outputPath.rfind('.');
+    auto slashPos = outputPath.find_last_of("/\\");
+    if (dotPos == string::npos || (slashPos != string::npos && dotPos < slashPos))
+        return string();
+    string suffix = outputPath.substr(dotPos+1);
+    transform(suffix.begin(), suffix.end(), suffix.begin(), ::tolower);
+    if (suffix == "png")
+        return "png";
+    if (suffix == "tif" || suffix == "tiff")
+        return "tiff";
+    if (suffix == "exr")
+        return "exr";
+    return string();
+}
+
+struct ImageSequenceWriter::WriterContext
+{
+    AVCodecContext* codecCtx {nullptr};
+    AVFrame* frame {nullptr};
+    AVPacket* packet {nullptr};
+
+    ~WriterContext()
+    {
+        if (packet) av_packet_free(&packet);
+        if (frame) av_frame_free(&frame);
+        if (codecCtx) avcodec_free_context(&codecCtx);
+    }
+};
+
+// composed frame in CPU memory with 8/16-bit or float pixels
+static bool DownloadVideoFrame(const ImGui::ImMat& src, ImGui::ImMat& dst)
+{
+    dst = src;
+#if IMGUI_VULKAN_SHADER
+    if (dst.device == IM_DD_VULKAN)
+    {
+        ImGui::VkMat vkmat = src;
+        ImGui::ImVulkanVkMatToImMat(vkmat, dst);
+    }
+#endif
+    if (dst.empty() || dst.device != IM_DD_CPU)
+        return false;
+    return dst.type == IM_DT_INT8 || dst.type == IM_DT_INT16 || dst.type == IM_DT_FLOAT32;
+}
+
+// normalized value of channel 'c', gray is replicated to RGB and a missing alpha is opaque
+static inline float GetPixelValue(const ImGui::ImMat& mat, int x, int y, int c)
+{
+    ImGui::ImMat& m = const_cast<ImGui::ImMat&>(mat);
+    if (c >= m.c)
+    {
+        if (c == 3) return 1.f;
+        c = 0;
+    }
+    switch (m.type)
+    {
+    case IM_DT_INT8:    return m.at<uint8_t>(x, y, c)/255.f;
+    case IM_DT_INT16:   return m.at<uint16_t>(x, y, c)/65535.f;
+    default:            return m.at<float>(x, y, c);
+    }
+}
+
+// fill an image encoder frame from a composed frame, PNG/TIFF take 8-bit RGBA and EXR takes planar float GBRA
+static bool FillImageFrame(const ImGui::ImMat& src, AVFrame* frame)
+{
+    ImGui::ImMat mat;
+    if (!DownloadVideoFrame(src, mat) || mat.w != frame->width || mat.h != frame->height)
+        return false;
+    if (av_frame_make_writable(frame) < 0)
+        return false;
+    auto getValue = [&mat] (int x, int y, int c) { return GetPixelValue(mat, x, y, c); };
+    if (frame->format == AV_PIX_FMT_RGBA)
+    {
+        for (int y = 0; y < frame->height; y++)
+        {
+            uint8_t* row = frame->data[0]+y*frame->linesize[0];
+            if (mat.type == IM_DT_INT8 && mat.c == 4)
+            {
+                for (int x = 0; x < frame->width; x++)
+                    for (int c = 0; c < 4; c++)
+                        row[x*4+c] = mat.at<uint8_t>(x, y, c);
+                continue;
+            }
+            for (int x = 0; x < frame->width; x++)
+                for (int c = 0; c < 4; c++)
+                    row[x*4+c] = (uint8_t)(std::min(std::max(getValue(x, y, c), 0.f), 1.f)*255.f+0.5f);
+        }
+        return true;
+    }
+    // GBRA planes
+    const int planeChannels[4] = { 1, 2, 0, 3 };
+    for (int p = 0; p < 4; p++)
+    {
+        for (int y = 0; y < frame->height; y++)
+        {
+            float* row = (float*)(frame->data[p]+y*frame->linesize[p]);
+            for (int x = 0; x < frame->width; x++)
+                row[x] = getValue(x, y, planeChannels[p]);
+        }
+    }
+    return true;
+}
+
+bool ImageSequenceWriter::Open(const string& outputPath, const string& codecName, uint32_t width, uint32_t height, int threads, string& errMsg)
+{
+    Close(true);
+    const AVCodec* codec = avcodec_find_encoder_by_name(codecName.c_str());
+    if (!codec)
+    {
+        errMsg = "CANNOT find image encoder '"+codecName+"'!";
+        return false;
+    }
+    AVPixelFormat pixfmt = AV_PIX_FMT_RGBA;
+    if (codecName == "exr")
+    {
+#ifdef AV_PIX_FMT_GBRAPF32
+        pixfmt = AV_PIX_FMT_GBRAPF32;
+#else
+        errMsg = "OpenEXR output needs a newer libavcodec!";
+        return false;
+#endif
+    }
+    if (threads <= 0)
+        threads = max((int)thread::hardware_concurrency(), 1);
+    mOutputPath = outputPath;
+    mClosing = mDiscard = false;
+    mFailed = false;
+    mErrMsg.clear();
+    for (int i = 0; i < threads; i++)
+    {
+        auto writer = new WriterContext();
+        mWriters.push_back(writer);
+        writer->codecCtx = avcodec_alloc_context3(codec);
+        writer->frame = av_frame_alloc();
+        writer->packet = av_packet_alloc();
+        if (!writer->codecCtx || !writer->frame || !writer->packet)
+        {
+            errMsg = "FAILED to allocate image encoder context!";
+            Close(true);
+            return false;
+        }
+        // every writer compresses one frame at a time, the encoder itself stays single threaded
+        writer->codecCtx->width = width;
+        writer->codecCtx->height = height;
+        writer->codecCtx->pix_fmt = pixfmt;
+        writer->codecCtx->time_base = { 1, 25 };
+        writer->codecCtx->thread_count = 1;
+        int fferr = avcodec_open2(writer->codecCtx, codec, nullptr);
+        if (fferr < 0)
+        {
+            errMsg = "FAILED to open image encoder '"+codecName+"'! fferr="+to_string(fferr)+", "+AvErrorString(fferr)+".";
+            Close(true);
+            return false;
+        }
+        writer->frame->format = pixfmt;
+        writer->frame->width = width;
+        writer->frame->height = height;
+        fferr = av_frame_get_buffer(writer->frame, 0);
+        if (fferr < 0)
+        {
+            errMsg = "FAILED to allocate image frame! fferr="+to_string(fferr)+", "+AvErrorString(fferr)+".";
+            Close(true);
+            return false;
+        }
+    }
+    mQueueCapacity = threads*2;
+    for (auto writer : mWriters)
+        mWriterThreads.push_back(thread(&ImageSequenceWriter::_WriterProc, this, writer));
+    return true;
+}
+
+bool ImageSequenceWriter::WriteFrame(const ImGui::ImMat& vmat, int64_t index)
+{
+    unique_lock<mutex> lk(mQueueLock);
+    mQueueCv.wait(lk, [this] { return mQueue.size() < mQueueCapacity || mFailed || mClosing; });
+    if (mFailed || mClosing || mWriterThreads.empty())
+        return false;
+    mQueue.push_back({vmat, index});
+    lk.unlock();
+    mQueueCv.notify_all();
+    return true;
+}
+
+bool ImageSequenceWriter::Close(bool discardPending)
+{
+    {
+        lock_guard<mutex> lk(mQueueLock);
+        mClosing = true;
+        mDiscard = discardPending;
+        if (discardPending)
+            mQueue.clear();
+    }
+    mQueueCv.notify_all();
+    for (auto& t : mWriterThreads)
+        t.join();
+    mWriterThreads.clear();
+    for (auto writer : mWriters)
+        delete writer;
+    mWriters.clear();
+    mQueue.clear();
+    return !mFailed;
+}
+
+size_t ImageSequenceWriter::GetQueuedCount()
+{
+    lock_guard<mutex> lk(mQueueLock);
+    return mQueue.size();
+}
+
+string ImageSequenceWriter::GetError()
+{
+    lock_guard<mutex> lk(mQueueLock);
+    return mErrMsg;
+}
+
+void ImageSequenceWriter::_SetError(const string& errMsg)
+{
+    {
+        lock_guard<mutex> lk(mQueueLock);
+        if (mErrMsg.empty())
+            mErrMsg = errMsg;
+        mFailed = true;
+    }
+    mQueueCv.notify_all();
+}
+
+void ImageSequenceWriter::_WriterProc(WriterContext* writer)
+{
+    while (true)
+    {
+        pair<ImGui::ImMat, int64_t> item;
+        {
+            unique_lock<mutex> lk(mQueueLock);
+            mQueueCv.wait(lk, [this] { return !mQueue.empty() || mClosing; });
+            if (mQueue.empty() || mDiscard)
+                break;
+            item = mQueue.front();
+            mQueue.pop_front();
+        }
+        mQueueCv.notify_all();
+        if (mFailed)
+            continue;
+
+        const string path = MakeSegmentPath(mOutputPath, [&item] {
+            ostringstream oss; oss << setw(6) << setfill('0') << item.second; return oss.str(); }());
+        string errMsg;
+        ScopedStageTimer stageTimer(mBusyUs ? *mBusyUs : mUnusedBusyUs);
+        if (!FillImageFrame(item.first, writer->frame))
+        {
+            errMsg = "FAILED to convert frame #"+to_string(item.second)+" for the image encoder!";
+        }
+        else
+        {
+            writer->frame->pts = item.second;
+            int fferr = avcodec_send_frame(writer->codecCtx, writer->frame);
+            if (fferr >= 0)
+                fferr = avcodec_receive_packet(writer->codecCtx, writer->packet);
+            if (fferr < 0)
+            {
+                errMsg = "FAILED to encode image '"+path+"'! fferr="+to_string(fferr)+", "+AvErrorString(fferr)+".";
+            }
+            else
+            {
+                FILE* fp = fopen(path.c_str(), "wb");
+                if (!fp || fwrite(writer->packet->data, 1, writer->packet->size, fp) != (size_t)writer->packet->size)
+                    errMsg = "FAILED to write image file '"+path+"'!";
+                if (fp)
+                    fclose(fp);
+                av_packet_unref(writer->packet);
+            }
+        }
+        if (!errMsg.empty())
+        {
+            Log(Error) << errMsg << endl;
+            _SetError(errMsg);
+        }
+        else if (mProcessed)
+        {
+            (*mProcessed)++;
+        }
+    }
+}
+
+// pixel layout of the raw stream formats
+struct RawPixelFormat
+{
+    const char* name;
+    int bytesPerChannel;
+    int channels;
+    int order[4];           // source channel(RGBA) of each output channel
+    ImDataType type;        // channel type, a frame of this type is copied without conversion
+};
+
+static const RawPixelFormat RAW_PIXEL_FORMATS[] = {
+    { "rgba",       1, 4, { 0, 1, 2, 3 }, IM_DT_INT8 },
+    { "bgra",       1, 4, { 2, 1, 0, 3 }, IM_DT_INT8 },
+    { "rgb24",      1, 3, { 0, 1, 2, 0 }, IM_DT_INT8 },
+    { "rgba64le",   2, 4, { 0, 1, 2, 3 }, IM_DT_INT16 },
+    { "rgbaf32le",  4, 4, { 0, 1, 2, 3 }, IM_DT_FLOAT32 },
+};
+
+static const RawPixelFormat* FindRawPixelFormat(const string& name)
+{
+    for (auto& fmt : RAW_PIXEL_FORMATS)
+        if (name == fmt.name)
+            return &fmt;
+    return nullptr;
+}
+
+bool RawStreamWriter::IsSupportedPixelFormat(const string& pixelFormat)
+{
+    return FindRawPixelFormat(pixelFormat) != nullptr;
+}
+
+bool RawStreamWriter::Open(const string& outputPath, const RawStreamFormat& format, string& errMsg)
+{
+    Close();
+    if (format.width > 0 && !FindRawPixelFormat(format.pixelFormat))
+    {
+        errMsg = "Unsupported raw pixel format '"+format.pixelFormat+"'!";
+        return false;
+    }
+    if (format.channels > 0 && format.sampleFormat != "f32le" && format.sampleFormat != "s16le")
+    {
+        errMsg = "Unsupported raw sample format '"+format.sampleFormat+"'!";
+        return false;
+    }
+    if (outputPath == "-")
+    {
+        // take over stdout, anything else printed to stdout goes to stderr so it can't break the stream
+        fflush(stdout);
+#if defined(_WIN32)
+        int fd = _dup(_fileno(stdout));
+        _dup2(_fileno(stderr), _fileno(stdout));
+        _setmode(fd, _O_BINARY);
+#else
+        int fd = dup(fileno(stdout));
+        dup2(fileno(stderr), fileno(stdout));
+#endif
+        mFp = fd >= 0 ? fdopen(fd, "wb") : nullptr;
+    }
+    else
+    {
+        // a named pipe blocks here until the reader opens it
+        mFp = fopen(outputPath.c_str(), "wb");
+    }
+    if (!mFp)
+    {
+        errMsg = "FAILED to open raw stream output '"+outputPath+"'!";
+        return false;
+    }
+    mFormat = format;
+    ostringstream oss;
+    oss << "{\"format\":\"mec-raw\",\"version\":1";
+    if (format.width > 0)
+        oss << ",\"video\":{\"width\":" << format.width << ",\"height\":" << format.height << ",\"pix_fmt\":\"" << format.pixelFormat
+            << "\",\"frame_rate\":\"" << format.frameRateNum << "/" << format.frameRateDen << "\"}";
+    if (format.channels > 0)
+        oss << ",\"audio\":{\"sample_rate\":" << format.sampleRate << ",\"channels\":" << format.channels
+            << ",\"sample_fmt\":\"" << format.sampleFormat << "\",\"layout\":\"interleaved\"}";
+    oss << ",\"packet\":\"tag[4] size:u32le pts_us:i64le payload\"}\n";
+    const string header = oss.str();
+    if (fwrite(header.data(), 1, header.size(), mFp) != header.size())
+    {
+        errMsg = "FAILED to write raw stream header!";
+        Close();
+        return false;
+    }
+    return true;
+}
+
+bool RawStreamWriter::_WritePacket(const char* tag, const void* data, size_t size, int64_t ptsUs)
+{
+    uint8_t header[16];
+    memcpy(header, tag, 4);
+    for (int i = 0; i < 4; i++)
+        header[4+i] = (uint8_t)(((uint32_t)size >> (i*8)) & 0xff);
+    for (int i = 0; i < 8; i++)
+        header[8+i] = (uint8_t)(((uint64_t)ptsUs >> (i*8)) & 0xff);
+    if (fwrite(header, 1, sizeof(header), mFp) != sizeof(header) || fwrite(data, 1, size, mFp) != size)
+    {
+        mErrMsg = "FAILED to write raw stream, the reader may be closed!";
+        return false;
+    }
+    return true;
+}
+
+bool RawStreamWriter::WriteVideoFrame(const ImGui::ImMat& vmat, int64_t ptsUs)
+{
+    if (!mFp || mFormat.width == 0)
+        return false;
+    auto fmt = FindRawPixelFormat(mFormat.pixelFormat);
+    ImGui::ImMat mat;
+    if (!DownloadVideoFrame(vmat, mat) || mat.w != mFormat.width || mat.h != mFormat.height)
+    {
+        mErrMsg = "Unsupported video frame for the raw stream!";
+        return false;
+    }
+    const int bpc = fmt->bytesPerChannel;
+    const size_t dstPixelBytes = (size_t)fmt->channels*bpc;
+    const size_t dstRowBytes = (size_t)mat.w*dstPixelBytes;
+    const size_t size = dstRowBytes*mat.h;
+    // an interleaved frame is converted row by row from 'srcRowBytes' apart rows, a planar one pixel by pixel
+    const bool interleaved = mat.elempack == mat.c;
+    const int srcBytes = mat.type == IM_DT_INT8 ? 1 : mat.type == IM_DT_INT16 ? 2 : 4;
+    const size_t srcRowBytes = (size_t)mat.w*mat.c*srcBytes;
+    const uint8_t* src = (const uint8_t*)mat.data;
+    const bool sameLayout = interleaved && mat.type == fmt->type && mat.c == fmt->channels &&
+            std::equal(fmt->order, fmt->order+fmt->channels, RAW_PIXEL_FORMATS[0].order);
+    // the frame of the same layout is written as it is if its rows are packed, otherwise row by row
+    if (sameLayout && srcRowBytes == dstRowBytes)
+        return _WritePacket("VIDF", src, size, ptsUs);
+    mBuffer.resize(size);
+    if (sameLayout)
+    {
+        for (int y = 0; y < mat.h; y++)
+            memcpy(mBuffer.data()+y*dstRowBytes, src+y*srcRowBytes, dstRowBytes);
+        return _WritePacket("VIDF", mBuffer.data(), size, ptsUs);
+    }
+    if (interleaved && mat.type == fmt->type)
+    {
+        // same channel type in another order, the channels are copied. gray is replicated and a missing alpha is opaque
+        const uint8_t opaque8 = 0xff;
+        const uint16_t opaque16 = 0xffff;
+        const float opaque32 = 1.f;
+        const void* opaque = bpc == 1 ? (const void*)&opaque8 : bpc == 2 ? (const void*)&opaque16 : (const void*)&opaque32;
+        int srcOffsets[4];
+        for (int i = 0; i < fmt->channels; i++)
+            srcOffsets[i] = fmt->order[i] < mat.c ? fmt->order[i]*bpc : fmt->order[i] == 3 ? -1 : 0;
+        for (int y = 0; y < mat.h; y++)
+        {
+            const uint8_t* srcPixel = src+y*srcRowBytes;
+            uint8_t* dst = mBuffer.data()+y*dstRowBytes;
+            for (int x = 0; x < mat.w; x++, srcPixel += mat.c*bpc)
+            {
+                for (int i = 0; i < fmt->channels; i++, dst += bpc)
+                    memcpy(dst, srcOffsets[i] < 0 ? opaque : srcPixel+srcOffsets[i], bpc);
+            }
+        }
+        return _WritePacket("VIDF", mBuffer.data(), size, ptsUs);
+    }
+    auto toOutput = [fmt] (float value, uint8_t* dst) {
+        if (fmt->bytesPerChannel == 1)
+        {
+            *dst = (uint8_t)(std::min(std::max(value, 0.f), 1.f)*255.f+0.5f);
+        }
+        else if (fmt->bytesPerChannel == 2)
+        {
+            const uint16_t v = (uint16_t)(std::min(std::max(value, 0.f), 1.f)*65535.f+0.5f);
+            dst[0] = v & 0xff; dst[1] = v >> 8;
+        }
+        else
+        {
+            memcpy(dst, &value, 4);
+        }
+    };
+    uint8_t* dst = mBuffer.data();
+    if (interleaved)
+    {
+        // another channel type, the values are normalized from the row
+        auto fromSource = [&mat] (const uint8_t* p) -> float {
+            switch (mat.type)
+            {
+            case IM_DT_INT8:    return *p/255.f;
+            case IM_DT_INT16:   { uint16_t v; memcpy(&v, p, 2); return v/65535.f; }
+            default:            { float v; memcpy(&v, p, 4); return v; }
+            }
+        };
+        for (int y = 0; y < mat.h; y++)
+        {
+            const uint8_t* srcPixel = src+y*srcRowBytes;
+            for (int x = 0; x < mat.w; x++, srcPixel += mat.c*srcBytes)
+            {
+                for (int i = 0; i < fmt->channels; i++, dst += bpc)
+                {
+                    const int c = fmt->order[i];
+                    toOutput(c < mat.c ? fromSource(srcPixel+c*srcBytes) : c == 3 ? 1.f : fromSource(srcPixel), dst);
+                }
+            }
+        }
+        return _WritePacket("VIDF", mBuffer.data(), size, ptsUs);
+    }
+    for (int y = 0; y < mat.h; y++)
+    {
+        for (int x = 0; x < mat.w; x++)
+        {
+            for (int i = 0; i < fmt->channels; i++, dst += bpc)
+                toOutput(GetPixelValue(mat, x, y, fmt->order[i]), dst);
+        }
+    }
+    return _WritePacket("VIDF", mBuffer.data(), size, ptsUs);
+}
+
+bool RawStreamWriter::WriteAudioSamples(const ImGui::ImMat& amat, int64_t ptsUs)
+{
+    if (!mFp || mFormat.channels == 0)
+        return false;
+    ImGui::ImMat& mat = const_cast<ImGui::ImMat&>(amat);
+    if (mat.empty() || mat.device != IM_DD_CPU || (mat.type != IM_DT_FLOAT32 && mat.type != IM_DT_INT16) || mat.c != (int)mFormat.channels)
+    {
+        mErrMsg = "Unsupported audio samples for the raw stream!";
+        return false;
+    }
+    const bool s16 = mFormat.sampleFormat == "s16le";
+    const size_t size = (size_t)mat.w*mat.c*(s16 ? 2 : 4);
+    // interleaved samples of the same format are written as they are
+    if (mat.elempack > 1 && mat.type == (s16 ? IM_DT_INT16 : IM_DT_FLOAT32))
+        return _WritePacket("AUDF", mat.data, size, ptsUs);
+    mBuffer.resize(size);
+    uint8_t* dst = mBuffer.data();
+    for (int x = 0; x < mat.w; x++)
+    {
+        for (int c = 0; c < mat.c; c++)
+        {
+            float value;
+            if (mat.elempack > 1)
+                value = mat.type == IM_DT_FLOAT32 ? ((float*)mat.data)[x*mat.c+c] : ((int16_t*)mat.data)[x*mat.c+c]/32768.f;
+            else
+                value = mat.type == IM_DT_FLOAT32 ? mat.at<float>(x, 0, c) : mat.at<int16_t>(x, 0, c)/32768.f;
+            if (s16)
+            {
+                const int16_t v = (int16_t)std::min(std::max(value*32768.f, -32768.f), 32767.f);
+                dst[0] = v & 0xff; dst[1] = (v >> 8) & 0xff;
+                dst += 2;
+            }
+            else
+            {
+                memcpy(dst, &value, 4);
+                dst += 4;
+            }
+        }
+    }
+    return _WritePacket("AUDF", mBuffer.data(), size, ptsUs);
+}
+
+void RawStreamWriter::Close()
+{
+    if (mFp)
+    {
+        fclose(mFp);
+        mFp = nullptr;
+    }
+}
+
+static const uint64_t XXH_PRIME64_1 = 0x9E3779B185EBCA87ULL;
+static const uint64_t XXH_PRIME64_2 = 0xC2B2AE3D27D4EB4FULL;
+static const uint64_t XXH_PRIME64_3 = 0x165667B19E3779F9ULL;
+static const uint64_t XXH_PRIME64_4 = 0x85EBCA77C2B2AE63ULL;
+static const uint64_t XXH_PRIME64_5 = 0x27D4EB2F165667C5ULL;
+
+static inline uint64_t XxhRotl(uint64_t x, int r) { return (x << r) | (x >> (64-r)); }
+static inline uint64_t XxhRead64(const uint8_t* p) { uint64_t v; memcpy(&v, p, 8); return v; }
+static inline uint32_t XxhRead32(const uint8_t* p) { uint32_t v; memcpy(&v, p, 4); return v; }
+static inline uint64_t XxhRound(uint64_t acc, uint64_t input)
+{
+    acc += input*XXH_PRIME64_2;
+    return XxhRotl(acc, 31)*XXH_PRIME64_1;
+}
+static inline uint64_t XxhMergeRound(uint64_t acc, uint64_t val)
+{
+    acc ^= XxhRound(0, val);
+    return acc*XXH_PRIME64_1+XXH_PRIME64_4;
+}
+
+uint64_t HashBytes64(const void* data, size_t size, uint64_t seed)
+{
+    // XXH64, the reads are little-endian on every platform we build for
+    const uint8_t* p = (const uint8_t*)data;
+    const uint8_t* const end = p+size;
+    uint64_t h;
+    if (size >= 32)
+    {
+        uint64_t v1 = seed+XXH_PRIME64_1+XXH_PRIME64_2;
+        uint64_t v2 = seed+XXH_PRIME64_2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed-XXH_PRIME64_1;
+        for (; p+32 <= end; p += 32)
+        {
+            v1 = XxhRound(v1, XxhRead64(p));
+            v2 = XxhRound(v2, XxhRead64(p+8));
+            v3 = XxhRound(v3, XxhRead64(p+16));
+            v4 = XxhRound(v4, XxhRead64(p+24));
+        }
+        h = XxhRotl(v1, 1)+XxhRotl(v2, 7)+XxhRotl(v3, 12)+XxhRotl(v4, 18);
+        h = XxhMergeRound(h, v1);
+        h = XxhMergeRound(h, v2);
+        h = XxhMergeRound(h, v3);
+        h = XxhMergeRound(h, v4);
+    }
+    else
+    {
+        h = seed+XXH_PRIME64_5;
+    }
+    h += (uint64_t)size;
+    for (; p+8 <= end; p += 8)
+    {
+        h ^= XxhRound(0, XxhRead64(p));
+        h = XxhRotl(h, 27)*XXH_PRIME64_1+XXH_PRIME64_4;
+    }
+    if (p+4 <= end)
+    {
+        h ^= (uint64_t)XxhRead32(p)*XXH_PRIME64_1;
+        h = XxhRotl(h, 23)*XXH_PRIME64_2+XXH_PRIME64_3;
+        p += 4;
+    }
+    for (; p < end; p++)
+    {
+        h ^= (*p)*XXH_PRIME64_5;
+        h = XxhRotl(h, 11)*XXH_PRIME64_1;
+    }
+    h ^= h >> 33;
+    h *= XXH_PRIME64_2;
+    h ^= h >> 29;
+    h *= XXH_PRIME64_3;
+    h ^= h >> 32;
+    return h;
+}
+
+bool HashMediaFrame(const ImGui::ImMat& src, uint64_t& hash)
+{
+    ImGui::ImMat mat;
+    if (!DownloadVideoFrame(src, mat))
+        return false;
+    const size_t bytesPerValue = mat.type == IM_DT_INT8 ? 1 : mat.type == IM_DT_INT16 ? 2 : 4;
+    // the layout is part of the hash, the same bytes in another shape are another frame
+    const int64_t shape[4] = { mat.w, mat.h, mat.c, (int64_t)mat.type };
+    hash = HashBytes64(shape, sizeof(shape));
+    if (mat.elempack > 1)
+    {
+        // interleaved channels, rows are packed
+        hash = HashBytes64(mat.data, (size_t)mat.w*mat.h*mat.c*bytesPerValue, hash);
+    }
+    else
+    {
+        // planar, every plane may be padded to its channel step
+        for (int c = 0; c < mat.c; c++)
+            hash = HashBytes64(mat.channel(c).data, (size_t)mat.w*mat.h*bytesPerValue, hash);
+    }
+    return true;
+}
+
+bool FrameHashWriter::Open(const string& path, string& errMsg)
+{
+    Close();
+    mFp = fopen(path.c_str(), "w");
+    if (!mFp)
+    {
+        errMsg = "CANNOT create frame hash file '" + path + "'!";
+        return false;
+    }
+    fprintf(mFp, "# mec frame hashes v1: <V|A> <index> <pts ms> <xxh64>\n");
+    return true;
+}
+
+void FrameHashWriter::_AddLine(char stream, int64_t index, double pts, uint64_t hash)
+{
+    lock_guard<mutex> lk(mLock);
+    if (mFp)
+        fprintf(mFp, "%c %lld %lld %016llx\n", stream, (long long)index, (long long)llround(pts*1000), (unsigned long long)hash);
+}
+
+void FrameHashWriter::Close()
+{
+    lock_guard<mutex> lk(mLock);
+    if (mFp)
+    {
+        fclose(mFp);
+        mFp = nullptr;
+    }
+}
+
+struct FrameHashLine
+{
+    int64_t pts;
+    uint64_t hash;
+};
+
+static bool LoadFrameHashes(const string& path, vector<FrameHashLine> hashes[2], string& errMsg)
+{
+    FILE* fp = fopen(path.c_str(), "r");
+    if (!fp)
+    {
+        errMsg = "CANNOT open frame hash file '" + path + "'!";
+        return false;
+    }
+    char line[256];
+    while (fgets(line, sizeof(line), fp))
+    {
+        char stream;
+        long long index, pts;
+        unsigned long long hash;
+        if (line[0] == '#' || sscanf(line, "%c %lld %lld %llx", &stream, &index, &pts, &hash) != 4 || (stream != 'V' && stream != 'A'))
+            continue;
+        auto& list = hashes[stream == 'V' ? 0 : 1];
+        if (index < 0)
+            continue;
+        if (index >= (long long)list.size())
+            list.resize(index+1, {-1, 0});
+        list[index] = {pts, hash};
+    }
+    fclose(fp);
+    return true;
+}
+
+bool CompareFrameHashes(const string& path1, const string& path2, FrameHashDiff& diff, string& errMsg)
+{
+    vector<FrameHashLine> hashes1[2], hashes2[2];
+    if (!LoadFrameHashes(path1, hashes1, errMsg) || !LoadFrameHashes(path2, hashes2, errMsg))
+        return false;
+    diff = FrameHashDiff();
+    for (int i = 0; i < 2; i++)
+    {
+        auto& list1 = hashes1[i];
+        auto& list2 = hashes2[i];
+        int64_t* counts = i == 0 ? diff.videoFrames : diff.audioBlocks;
+        counts[0] = list1.size();
+        counts[1] = list2.size();
+        // a missing line or a shorter list is a divergence too
+        int64_t firstDiff = -1;
+        const size_t common = min(list1.size(), list2.size());
+        for (size_t j = 0; j < common && firstDiff < 0; j++)
+        {
+            if (list1[j].pts < 0 || list2[j].pts < 0 || list1[j].hash != list2[j].hash)
+                firstDiff = j;
+        }
+        if (firstDiff < 0 && list1.size() != list2.size())
+            firstDiff = common;
+        int64_t firstPts = -1;
+        if (firstDiff >= 0)
+            firstPts = firstDiff < (int64_t)list1.size() && list1[firstDiff].pts >= 0 ? list1[firstDiff].pts :
+                    firstDiff < (int64_t)list2.size() ? list2[firstDiff].pts : -1;
+        (i == 0 ? diff.firstVideoDiff : diff.firstAudioDiff) = firstDiff;
+        (i == 0 ? diff.firstVideoPts : diff.firstAudioPts) = firstPts;
+    }
+    return true;
+}
+
+string MakeSegmentPath(const string& outputPath, const string& tag)
+{
+    auto dotPos = outputPath.rfind('.');
+    auto slashPos = outputPath.find_last_of("/\\");
+    if (dotPos == string::npos || (slashPos != string::npos && dotPos < slashPos))
+        return outputPath+"."+tag;
+    return outputPath.substr(0, dotPos)+"."+tag+outputPath.substr(dotPos);
+}
+
+// one packet source of the concatenation, video segments are chained one after another
+struct ConcatInput
+{
+    vector<string> paths;
+    size_t pathIdx {0};
+    AVFormatContext* fmtCtx {nullptr};
+    int streamIdx {-1};
+    AVMediaType mediaType {AVMEDIA_TYPE_UNKNOWN};
+    int64_t offsetUs {0};           // accumulated duration of the finished segments
+    int64_t segEndUs {0};           // end time of the current segment
+    int64_t lastOutDts {AV_NOPTS_VALUE};   // dts of the last written packet, in the output stream time base
+    AVPacket* pkt {nullptr};
+    bool pktReady {false};
+    bool eof {false};
+    const AVCodecParameters* refPar {nullptr};  // codec parameters written into the output header
+    vector<uint8_t> inbandParamSets;            // parameter sets inserted before the first packet of current segment
+
+    ~ConcatInput()
+    {
+        if (fmtCtx) avformat_close_input(&fmtCtx);
+        if (pkt) av_packet_free(&pkt);
+    }
+
+    bool OpenCurrent(string& errMsg)
+    {
+        if (fmtCtx) avformat_close_input(&fmtCtx);
+        const string& path = paths[pathIdx];
+        int fferr = avformat_open_input(&fmtCtx, path.c_str(), nullptr, nullptr);
+        if (fferr < 0)
+        {
+            ostringstream oss; oss << "FAILED to open segment '" << path << "'! fferr=" << fferr << "(" << AvErrorString(fferr) << ").";
+            errMsg = oss.str();
+            return false;
+        }
+        fferr = avformat_find_stream_info(fmtCtx, nullptr);
+        if (fferr < 0)
+        {
+            ostringstream oss; oss << "FAILED to find stream info of segment '" << path << "'! fferr=" << fferr << "(" << AvErrorString(fferr) << ").";
+            errMsg = oss.str();
+            return false;
+        }
+        streamIdx = av_find_best_stream(fmtCtx, mediaType, -1, -1, nullptr, 0);
+        if (streamIdx < 0)
+        {
+            ostringstream oss; oss << "Segment '" << path << "' has no " << av_get_media_type_string(mediaType) << " stream!";
+            errMsg = oss.str();
+            return false;
+        }
+        return refPar ? PrepareInbandParamSets(errMsg) : true;
+    }
+
+    // segments from different encoders(passthrough source or our encoder) carry different parameter sets
+    bool PrepareInbandParamSets(string& errMsg)
+    {
+        inbandParamSets.clear();
+        auto codecpar = fmtCtx->streams[streamIdx]->codecpar;
+        if (codecpar->extradata_size == refPar->extradata_size &&
+            (codecpar->extradata_size == 0 || memcmp(codecpar->extradata, refPar->extradata, codecpar->extradata_size) == 0))
+            return true;
+        bool refAnnexB, curAnnexB;
+        int refNalLengthSize, curNalLengthSize;
+        vector<vector<uint8_t>> refNalUnits, curNalUnits;
+        if (codecpar->codec_id != refPar->codec_id ||
+            !ExtractParameterSets(refPar, refAnnexB, refNalLengthSize, refNalUnits) ||
+            !ExtractParameterSets(codecpar, curAnnexB, curNalLengthSize, curNalUnits) ||
+            refAnnexB != curAnnexB || refNalLengthSize != curNalLengthSize)
+        {
+            ostringstream oss; oss << "Segment '" << paths[pathIdx] << "' has incompatible codec parameters!";
+            errMsg = oss.str();
+            return false;
+        }
+        for (auto& nalUnit : curNalUnits)
+        {
+            if (!curAnnexB)
+            {
+                for (int i = curNalLengthSize-1; i >= 0; i--)
+                    inbandParamSets.push_back((uint8_t)((nalUnit.size() >> (i*8)) & 0xff));
+            }
+            inbandParamSets.insert(inbandParamSets.end(), nalUnit.begin(), nalUnit.end());
+        }
+        return true;
+    }
+
+    // read the next packet of the selected stream, switch to the next segment at eof
+    bool ReadNext(string& errMsg)
+    {
+        if (!pkt) pkt = av_packet_alloc();
+        while (!eof)
+        {
+            int fferr = av_read_frame(fmtCtx, pkt);
+            if (fferr == AVERROR_EOF)
+            {
+                pathIdx++;
+                if (pathIdx >= paths.size())
+                {
+                    eof = true;
+                    break;
+                }
+                offsetUs = segEndUs;
+                if (!OpenCurrent(errMsg))
+                    return false;
+                continue;
+            }
+            else if (fferr < 0)
+            {
+                ostringstream oss; oss << "FAILED to read packet from '" << paths[pathIdx] << "'! fferr=" << fferr << "(" << AvErrorString(fferr) << ").";
+                errMsg = oss.str();
+                return false;
+            }
+            if (pkt->stream_index != streamIdx)
+            {
+                av_packet_unref(pkt);
+                continue;
+            }
+            auto stream = fmtCtx->streams[streamIdx];
+            if (!inbandParamSets.empty())
+            {
+                AVPacket* newPkt = av_packet_alloc();
+                av_new_packet(newPkt, inbandParamSets.size()+pkt->size);
+                memcpy(newPkt->data, inbandParamSets.data(), inbandParamSets.size());
+                memcpy(newPkt->data+inbandParamSets.size(), pkt->data, pkt->size);
+                av_packet_copy_props(newPkt, pkt);
+                av_packet_unref(pkt);
+                av_packet_move_ref(pkt, newPkt);
+                av_packet_free(&newPkt);
+                inbandParamSets.clear();
+            }
+            if (pkt->duration <= 0 && mediaType == AVMEDIA_TYPE_VIDEO)
+            {
+                auto frameRate = GetStreamFrameRate(stream);
+                if (frameRate.num > 0 && frameRate.den > 0)
+                    pkt->duration = av_rescale_q(1, av_inv_q(frameRate), stream->time_base);
+            }
+            const int64_t offsetTs = av_rescale_q(offsetUs, AV_TIME_BASE_Q, stream->time_base);
+            if (pkt->pts != AV_NOPTS_VALUE)
+            {
+                pkt->pts += offsetTs;
+                const int64_t pktEndUs = av_rescale_q(pkt->pts+pkt->duration, stream->time_base, AV_TIME_BASE_Q);
+                if (pktEndUs > segEndUs) segEndUs = pktEndUs;
+            }
+            if (pkt->dts != AV_NOPTS_VALUE)
+                pkt->dts += offsetTs;
+            else
+                pkt->dts = pkt->pts;
+            pktReady = true;
+            break;
+        }
+        return true;
+    }
+
+    int64_t PacketTimeUs() const
+    {
+        return av_rescale_q(pkt->dts, fmtCtx->streams[streamIdx]->time_base, AV_TIME_BASE_Q);
+    }
+};
+
+bool ConcatMediaSegments(const vector<string>& videoSegments, const string& audioPath, const string& outputPath, string& errMsg)
+{
+    if (videoSegments.empty() && audioPath.empty())
+    {
+        errMsg = "No segment to concatenate!";
+        return false;
+    }
+
+    vector<ConcatInput*> inputs;
+    if (!videoSegments.empty())
+    {
+        auto input = new ConcatInput();
+        input->paths = videoSegments;
+        input->mediaType = AVMEDIA_TYPE_VIDEO;
+        inputs.push_back(input);
+    }
+    if (!audioPath.empty())
+    {
+        auto input = new ConcatInput();
+        input->paths.push_back(audioPath);
+        input->mediaType = AVMEDIA_TYPE_AUDIO;
+        inputs.push_back(input);
+    }
+
+    AVFormatContext* outCtx = nullptr;
+    vector<AVStream*> outStreams;
+    bool headerWritten = false;
+    bool success = false;
+    int fferr;
+    do {
+        fferr = avformat_alloc_output_context2(&outCtx, nullptr, nullptr, outputPath.c_str());
+        if (fferr < 0 || !outCtx)
+        {
+            ostringstream oss; oss << "FAILED to allocate output context for '" << outputPath << "'! fferr=" << fferr << "(" << AvErrorString(fferr) << ").";
+            errMsg = oss.str();
+            break;
+        }
+        bool inputsOpened = true;
+        for (auto input : inputs)
+        {
+            if (!input->OpenCurrent(errMsg))
+            {
+                inputsOpened = false;
+                break;
+            }
+            auto inStream = input->fmtCtx->streams[input->streamIdx];
+            auto outStream = avformat_new_stream(outCtx, nullptr);
+            if (!outStream)
+            {
+                errMsg = "FAILED to create output stream!";
+                inputsOpened = false;
+                break;
+            }
+            avcodec_parameters_copy(outStream->codecpar, inStream->codecpar);
+            outStream->codecpar->codec_tag = 0;
+            outStream->time_base = inStream->time_base;
+            outStream->avg_frame_rate = inStream->avg_frame_rate;
+            outStream->r_frame_rate = inStream->r_frame_rate;
+            outStream->sample_aspect_ratio = inStream->sample_aspect_ratio;
+            outStreams.push_back(outStream);
+            input->refPar = outStream->codecpar;
+        }
+        if (!inputsOpened)
+            break;
+
+        if (!(outCtx->oformat->flags & AVFMT_NOFILE))
+        {
+            fferr = avio_open(&outCtx->pb, outputPath.c_str(), AVIO_FLAG_WRITE);
+            if (fferr < 0)
+            {
+                ostringstream oss; oss << "FAILED to open '" << outputPath << "' for writing! fferr=" << fferr << "(" << AvErrorString(fferr) << ").";
+                errMsg = oss.str();
+                break;
+            }
+        }
+        fferr = avformat_write_header(outCtx, nullptr);
+        if (fferr < 0)
+        {
+            ostringstream oss; oss << "FAILED to write header of '" << outputPath << "'! fferr=" << fferr << "(" << AvErrorString(fferr) << ").";
+            errMsg = oss.str();
+            break;
+        }
+        headerWritten = true;
+
+        // merge the packet sources in dts order
+        bool readFailed = false;
+        while (true)
+        {
+            int selIdx = -1;
+            int64_t selTime = INT64_MAX;
+            for (int i = 0; i < inputs.size(); i++)
+            {
+                auto input = inputs[i];
+                if (!input->pktReady && !input->eof && !input->ReadNext(errMsg))
+                {
+                    readFailed = true;
+                    break;
+                }
+                if (input->pktReady && input->PacketTimeUs() < selTime)
+                {
+                    selTime = input->PacketTimeUs();
+                    selIdx = i;
+                }
+            }
+            if (readFailed || selIdx < 0)
+                break;
+            auto input = inputs[selIdx];
+            auto pkt = input->pkt;
+            pkt->stream_index = selIdx;
+            av_packet_rescale_ts(pkt, input->fmtCtx->streams[input->streamIdx]->time_base, outStreams[selIdx]->time_base);
+            // keep dts strictly increasing across the segment joints, the segments may have different time bases,
+            // so compare in the output time base
+            if (input->lastOutDts != AV_NOPTS_VALUE && pkt->dts <= input->lastOutDts)
+            {
+                pkt->dts = input->lastOutDts+1;
+                if (pkt->pts != AV_NOPTS_VALUE && pkt->pts < pkt->dts)
+                    pkt->pts = pkt->dts;
+            }
+            input->lastOutDts = pkt->dts;
+            pkt->pos = -1;
+            fferr = av_interleaved_write_frame(outCtx, pkt);
+            input->pktReady = false;
+            if (fferr < 0)
+            {
+                ostringstream oss; oss << "FAILED to write packet into '" << outputPath << "'! fferr=" << fferr << "(" << AvErrorString(fferr) << ").";
+                errMsg = oss.str();
+                readFailed = true;
+                break;
+            }
+        }
+        if (readFailed)
+            break;
+        success = true;
+    } while (false);
+
+    if (headerWritten)
+        av_write_trailer(outCtx);
+    if (outCtx)
+    {
+        if (!(outCtx->oformat->flags & AVFMT_NOFILE))
+            avio_closep(&outCtx->pb);
+        avformat_free_context(outCtx);
+    }
+    for (auto input : inputs)
+        delete input;
+    if (!success)
+        Log(Error) << "ConcatMediaSegments() FAILED! " << errMsg << endl;
+    return success;
+}
+}
@@ -0,0 +1,362 @@
+/*
+    Copyright (c) 2023 CodeWin
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <imgui.h>
+
+#if IMGUI_VULKAN_SHADER
+namespace ImGui { class Resize_vulkan; }
+#endif
+
+namespace MEC
+{
+    // Bounded lock-free queue for single producer and single consumer. Push fails when the queue is full,
+    // it's the back-pressure signal to the producer stage.
+    template <typename T>
+    class BoundedQueue
+    {
+    public:
+        explicit BoundedQueue(size_t capacity) : mSlots(capacity+1) {}
+        BoundedQueue(const BoundedQueue&) = delete;
+        BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+        bool TryPush(const T& item)
+        {
+            const size_t writeIdx = mWriteIdx.load(std::memory_order_relaxed);
+            const size_t nextIdx = (writeIdx+1) % mSlots.size();
+            if (nextIdx == mReadIdx.load(std::memory_order_acquire))
+                return false;
+            mSlots[writeIdx] = item;
+            mWriteIdx.store(nextIdx, std::memory_order_release);
+            return true;
+        }
+
+        bool TryPop(T& item)
+        {
+            const size_t readIdx = mReadIdx.load(std::memory_order_relaxed);
+            if (readIdx == mWriteIdx.load(std::memory_order_acquire))
+                return false;
+            item = mSlots[readIdx];
+            mSlots[readIdx] = T();
+            mReadIdx.store((readIdx+1) % mSlots.size(), std::memory_order_release);
+            return true;
+        }
+
+        size_t Size() const
+        {
+            const size_t writeIdx = mWriteIdx.load(std::memory_order_acquire);
+            const size_t readIdx = mReadIdx.load(std::memory_order_acquire);
+            return (writeIdx+mSlots.size()-readIdx) % mSlots.size();
+        }
+
+        size_t Capacity() const { return mSlots.size()-1; }
+
+    private:
+        std::vector<T> mSlots;
+        std::atomic<size_t> mWriteIdx {0};
+        std::atomic<size_t> mReadIdx {0};
+    };
+
+    // Lock-free single slot mailbox for single producer and single consumer. A new post replaces the pending
+    // item which is not taken yet, the consumer always gets the latest one. Three buffers are rotated by one
+    // atomic exchange, so neither side waits for the other or copies under a lock.
+    template <typename T>
+    class SingleSlotMailbox
+    {
+    public:
+        SingleSlotMailbox() = default;
+        SingleSlotMailbox(const SingleSlotMailbox&) = delete;
+        SingleSlotMailbox& operator=(const SingleSlotMailbox&) = delete;
+
+        void Post(const T& item)
+        {
+            mSlots[mBackIdx] = item;
+            const int prevIdx = mPendingIdx.exchange(mBackIdx|SLOT_NEW_FLAG, std::memory_order_acq_rel);
+            mBackIdx = prevIdx&SLOT_INDEX_MASK;
+        }
+
+        bool Take(T& item)
+        {
+            if ((mPendingIdx.load(std::memory_order_relaxed)&SLOT_NEW_FLAG) == 0)
+                return false;
+            const int prevIdx = mPendingIdx.exchange(mFrontIdx, std::memory_order_acq_rel);
+            mFrontIdx = prevIdx&SLOT_INDEX_MASK;
+            item = mSlots[mFrontIdx];
+            mSlots[mFrontIdx] = T();
+            return true;
+        }
+
+        // Drop the pending item, only call it when the producer is not running
+        void Clear()
+        {
+            T item;
+            Take(item);
+        }
+
+    private:
+        enum { SLOT_INDEX_MASK = 3, SLOT_NEW_FLAG = 4 };
+        T mSlots[3];
+        int mBackIdx {0};                   // owned by the producer
+        int mFrontIdx {1};                  // owned by the consumer
+        std::atomic<int> mPendingIdx {2};
+    };
+
+    // Accumulate the wall time spent inside a scope into a busy-time counter(microseconds), the counter
+    // can be shared by several threads running the same stage.
+    class ScopedStageTimer
+    {
+    public:
+        explicit ScopedStageTimer(std::atomic<int64_t>& busyUs) : mBusyUs(busyUs), mStartTp(std::chrono::steady_clock::now()) {}
+        ScopedStageTimer(const ScopedStageTimer&) = delete;
+        ScopedStageTimer& operator=(const ScopedStageTimer&) = delete;
+        ~ScopedStageTimer()
+        {
+            mBusyUs += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now()-mStartTp).count();
+        }
+
+    private:
+        std::atomic<int64_t>& mBusyUs;
+        std::chrono::steady_clock::time_point mStartTp;
+    };
+
+    // Scale video frames to an exact size. Vulkan resize is used if it's available, otherwise only 8-bit
+    // frames in CPU memory can be scaled(bilinear). One instance must not be used by several threads at once.
+    class FrameScaler
+    {
+    public:
+        FrameScaler() = default;
+        FrameScaler(const FrameScaler&) = delete;
+        FrameScaler& operator=(const FrameScaler&) = delete;
+        ~FrameScaler();
+
+        bool Scale(const ImGui::ImMat& src, ImGui::ImMat& dst, uint32_t width, uint32_t height);
+
+    private:
+#if IMGUI_VULKAN_SHADER
+        ImGui::Resize_vulkan* mResize {nullptr};
+#endif
+    };
+
+    // Video stream parameters which must match between a source media and the export settings for packet passthrough
+    struct VideoStreamInfo
+    {
+        int codecId {0};                // AVCodecID
+        int pixelFormat {-1};           // AVPixelFormat
+        int width {0};
+        int height {0};
+        int frameRateNum {0};
+        int frameRateDen {1};
+        int profile {-1};               // profile_idc and level_idc of the sequence parameter set, -1 if unknown
+        int level {-1};
+        int timeBaseNum {0};            // stream time base of a source, codec time base of an encoder
+        int timeBaseDen {1};
+    };
+
+    bool ProbeVideoStream(const std::string& path, VideoStreamInfo& info, std::string& errMsg);
+    // The encoder is opened with 'options' to learn the profile and level it produces
+    bool GetVideoEncoderInfo(const std::string& codecName, const std::string& pixelFormat, uint32_t width, uint32_t height,
+            int frameRateNum, int frameRateDen, const std::vector<std::pair<std::string, int64_t>>& options, VideoStreamInfo& info);
+    // Only H.264 and HEVC are passthrough-able, the parameter sets can be carried in-band at the segment joints.
+    // Profile and level must be the same, and every encoder tick must be a whole number of source ticks.
+    bool CanPassthrough(const VideoStreamInfo& srcInfo, const VideoStreamInfo& encInfo);
+    // Collect the key frame positions(millisecond) of the best video stream inside [startMs, endMs], only packets are read
+    bool ScanVideoKeyFrames(const std::string& path, int64_t startMs, int64_t endMs, std::vector<int64_t>& keyFrames, std::string& errMsg);
+    // Copy the video packets of the GOPs in [startMs, endMs) into a new file, 'startMs' must be a key frame position.
+    // 'frameCount' is the count of copied video packets.
+    bool RemuxVideoRange(const std::string& path, int64_t startMs, int64_t endMs, const std::string& outputPath, int64_t& frameCount, std::string& errMsg);
+    // Decode both videos and compare the luma of their frames in order, 'psnr' is the mean PSNR(dB), 100 for identical frames.
+    // They must have the same frame count, size and YUV format.
+    bool CompareVideoPsnr(const std::string& path, const std::string& refPath, double& psnr, std::string& errMsg);
+
+    // 128-bit content hash(two independently seeded XXH64 over the buffered input) of the inputs of a rendered segment,
+    // used as the key of the segment render cache
+    class ContentHasher
+    {
+    public:
+        void Add(const void* data, size_t size);
+        void Add(const std::string& str);
+        void Add(int64_t value);
+        std::string HexDigest() const;
+
+    private:
+        std::string mBuffer;
+    };
+
+    // Identity of a source media file(size and modification time), empty if the file doesn't exist
+    std::string GetFileIdentity(const std::string& path);
+    bool MakeDirectory(const std::string& path);
+    // Set the modification time of a file to now, the reused render cache files are kept longer by the pruning
+    bool TouchFile(const std::string& path);
+    // Delete the least recently modified files in 'dir' until their total size fits in 'maxBytes', the files in
+    // 'keepPaths' are never deleted. Returns the count of deleted files.
+    int PruneDirectory(const std::string& dir, uint64_t maxBytes, const std::vector<std::string>& keepPaths);
+
+    // Image encoder('png', 'tiff' or 'exr') of an image sequence output path, empty if the path is a media container
+    std::string GetImageSequenceCodec(const std::string& outputPath);
+
+    // Write video frames as numbered image files by a pool of writer threads, each with its own image encoder.
+    // Frames are compressed and written out of order, the file name comes from the frame index, e.g.
+    // '/out/name.png' => '/out/name.000012.png', so the sequence is always complete and in order.
+    class ImageSequenceWriter
+    {
+    public:
+        ImageSequenceWriter() = default;
+        ImageSequenceWriter(const ImageSequenceWriter&) = delete;
+        ImageSequenceWriter& operator=(const ImageSequenceWriter&) = delete;
+        ~ImageSequenceWriter() { Close(true); }
+
+        // 'threads' <= 0 means one writer per CPU core
+        bool Open(const std::string& outputPath, const std::string& codecName, uint32_t width, uint32_t height, int threads, std::string& errMsg);
+        // Optional counters of the writers, busy time(microseconds) and written frames
+        void SetStageCounters(std::atomic<int64_t>* busyUs, std::atomic<int64_t>* processed) { mBusyUs = busyUs; mProcessed = processed; }
+        // Queue a frame, it waits while the queue is full. Fails after any writer failed.
+        bool WriteFrame(const ImGui::ImMat& vmat, int64_t index);
+        // Wait for the queued frames to be written(or drop them) and stop the writers
+        bool Close(bool discardPending = false);
+
+        int GetThreadCount() const { return (int)mWriters.size(); }
+        size_t GetQueueCapacity() const { return mQueueCapacity; }
+        size_t GetQueuedCount();
+        std::string GetError();
+
+    private:
+        struct WriterContext;
+        void _WriterProc(WriterContext* writer);
+        void _SetError(const std::string& errMsg);
+
+    private:
+        std::string mOutputPath;
+        std::vector<WriterContext*> mWriters;
+        std::vector<std::thread> mWriterThreads;
+        std::mutex mQueueLock;
+        std::condition_variable mQueueCv;
+        std::deque<std::pair<ImGui::ImMat, int64_t>> mQueue;
+        size_t mQueueCapacity {0};
+        bool mClosing {false};
+        bool mDiscard {false};
+        std::string mErrMsg;
+        std::atomic<bool> mFailed {false};
+        std::atomic<int64_t>* mBusyUs {nullptr};
+        std::atomic<int64_t>* mProcessed {nullptr};
+        std::atomic<int64_t> mUnusedBusyUs {0};
+    };
+
+    struct RawStreamFormat
+    {
+        uint32_t width {0};                 // no video if 0
+        uint32_t height {0};
+        std::string pixelFormat {"rgba"};   // rgba, bgra, rgb24, rgba64le or rgbaf32le
+        int frameRateNum {25};
+        int frameRateDen {1};
+        uint32_t channels {0};              // no audio if 0
+        uint32_t sampleRate {0};
+        std::string sampleFormat {"f32le"}; // f32le or s16le, always interleaved
+    };
+
+    // Raw composed video frames and PCM written to a pipe, a named pipe or stdout('-') for downstream tools, without
+    // any encoding. The stream starts with one json line describing the format, followed by packets in timestamp
+    // order: a 16 bytes header {char tag[4] 'VIDF'/'AUDF', uint32 payload size, int64 pts in microseconds}, both
+    // little-endian, then the payload. Frames and samples already in the requested layout are written without copy.
+    class RawStreamWriter
+    {
+    public:
+        RawStreamWriter() = default;
+        RawStreamWriter(const RawStreamWriter&) = delete;
+        RawStreamWriter& operator=(const RawStreamWriter&) = delete;
+        ~RawStreamWriter() { Close(); }
+
+        static bool IsSupportedPixelFormat(const std::string& pixelFormat);
+        bool Open(const std::string& outputPath, const RawStreamFormat& format, std::string& errMsg);
+        bool WriteVideoFrame(const ImGui::ImMat& vmat, int64_t ptsUs);
+        bool WriteAudioSamples(const ImGui::ImMat& amat, int64_t ptsUs);
+        void Close();
+        const RawStreamFormat& GetFormat() const { return mFormat; }
+        std::string GetError() const { return mErrMsg; }
+
+    private:
+        bool _WritePacket(const char* tag, const void* data, size_t size, int64_t ptsUs);
+
+    private:
+        FILE* mFp {nullptr};
+        RawStreamFormat mFormat;
+        std::vector<uint8_t> mBuffer;
+        std::string mErrMsg;
+    };
+
+    // xxHash64 of a memory block
+    uint64_t HashBytes64(const void* data, size_t size, uint64_t seed = 0);
+    // Content hash of the pixels of a composed video frame or the samples of an audio block, the padding between rows
+    // and planes is skipped. A frame on GPU is downloaded first.
+    bool HashMediaFrame(const ImGui::ImMat& mat, uint64_t& hash);
+
+    // Per-frame content hash sidecar of an export, one text line per composed video frame or audio block:
+    // '<V|A> <index> <pts in millisecond> <hash in hex>'. Same project and same build give the same sidecar,
+    // so two sidecars compared by CompareFrameHashes locate a rendering regression without reference videos.
+    class FrameHashWriter
+    {
+    public:
+        FrameHashWriter() = default;
+        FrameHashWriter(const FrameHashWriter&) = delete;
+        FrameHashWriter& operator=(const FrameHashWriter&) = delete;
+        ~FrameHashWriter() { Close(); }
+
+        bool Open(const std::string& path, std::string& errMsg);
+        bool IsOpened() const { return mFp != nullptr; }
+        // thread-safe, video and audio can be added from their own threads
+        void AddVideoFrame(int64_t index, double pts, uint64_t hash) { _AddLine('V', index, pts, hash); }
+        void AddAudioBlock(int64_t index, double pts, uint64_t hash) { _AddLine('A', index, pts, hash); }
+        void Close();
+
+    private:
+        void _AddLine(char stream, int64_t index, double pts, uint64_t hash);
+
+    private:
+        std::mutex mLock;
+        FILE* mFp {nullptr};
+    };
+
+    struct FrameHashDiff
+    {
+        int64_t videoFrames[2] {0, 0};      // frame and block counts of both sidecars
+        int64_t audioBlocks[2] {0, 0};
+        int64_t firstVideoDiff {-1};        // index of the first diverging or missing video frame, -1 if none
+        int64_t firstVideoPts {-1};         // millisecond
+        int64_t firstAudioDiff {-1};
+        int64_t firstAudioPts {-1};
+        bool Identical() const { return firstVideoDiff < 0 && firstAudioDiff < 0; }
+    };
+    bool CompareFrameHashes(const std::string& path1, const std::string& path2, FrameHashDiff& diff, std::string& errMsg);
+
+    // Build a segment file path next to the final output, e.g. '/out/name.mp4' => '/out/name.seg0003.mp4'
+    std::string MakeSegmentPath(const std::string& outputPath, const std::string& tag);
+
+    // Concatenate independently encoded video segments (same codec) and an optional audio-only file
+    // into one container by packet copy, no decoding or encoding is involved. If the parameter sets of
+    // a H.264/HEVC segment differ from the first one, they are inserted in-band before its first packet.
+    bool ConcatMediaSegments(const std::vector<std::string>& videoSegments, const std::string& audioPath,
+            const std::string& outputPath, std::string& errMsg);
+}
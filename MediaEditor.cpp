@@ -32,6 +32,7 @@
 #endif
 #include "MediaTimeline.h"
 #include "EventStackFilter.h"
+#include "ExportJobQueue.h"
 #include "MediaEncoder.h"
 #include "TextureManager.h"
 #include "FFUtils.h"
@@ -78,8 +79,9 @@ static const output_format OutFormats[] =
     {"Material eXchange Format", "mxf"},
     {"MPEG-2 Transport Stream", "ts"},
     {"WebM", "webm"},
-    //{"PNG", "png"},
-    //{"TIFF", "tiff"}
+    {"PNG Sequence", "png"},
+    {"TIFF Sequence", "tiff"},
+    {"OpenEXR Sequence", "exr"},
 };
 
 typedef struct _output_codec
@@ -379,6 +381,11 @@ struct MediaEditorSettings
     int ColorSpaceIndex {1};                // timeline color space default is bt 709
     int ColorTransferIndex {0};             // timeline color transfer default is bt 709
     int VideoFrameCacheSize {10};           // timeline video cache size
+    int VideoPrefetchBudget {256};          // timeline playback read-ahead cache budget in MB, 0=disable
+    bool PreviewAdaptive {true};            // lower the read-ahead preview resolution while playback misses frames
+    bool ShowPlaybackStats {false};         // show the playback statistics over the preview
+    bool ProxyEnabled {false};              // preview video media by their generated low resolution proxies
+    int PreviewRenderBudget {2048};         // rendered preview cache budget in MB
     int AudioChannels {2};                  // timeline audio channels
     int AudioSampleRate {44100};            // timeline audio sample rate
     int AudioFormat {2};                    // timeline audio format 0=unknown 1=s16 2=f32
@@ -493,6 +500,17 @@ struct MediaEditorSettings
     int OutputVideoBitrate {-1};
     int OutputVideoGOPSize {-1};
     int OutputVideoBFrames {0};
+    int OutputSegmentThreads {0};                       // parallel GOP aligned segment encoders, 0=disable
+    bool OutputSmartRender {false};                     // copy packets of untouched clip ranges
+    bool OutputRenderCache {false};                     // keep rendered segments and reuse the unchanged ones in the next export
+    bool OutputResumable {false};                       // keep finished segments of a failed or stopped export to resume it
+    bool OutputAutoTune {false};                        // pick the fastest encoder thread setting by a cached calibration
+    int OutputQueueJobThreads {2};                      // thread budget of each job added to the export queue
+    bool OutputWriteStats {false};                      // write per-stage encoding statistics next to the output
+    bool OutputWriteHashes {false};                     // write per-frame content hashes next to the output
+    float OutputPreviewRate {2.f};                      // encoding preview frames per second, 0=disable
+    int OutputRenditionDivisor[3] {0, 0, 0};            // extra outputs scaled down from the output size by 2/4/8, 0=disable
+    int OutputRenditionBitrate[3] {0, 0, 0};            // video bitrate of extra outputs, 0=scaled from output bitrate
     // Output audio configure
     int OutputAudioCodecIndex {0};
     int OutputAudioCodecTypeIndex {0};
@@ -530,6 +548,8 @@ static std::vector<MediaCore::MediaEncoder::Description> g_currVidEncDescList;
 static bool g_audEncSelChanged = true;
 static std::vector<MediaCore::MediaEncoder::Description> g_currAudEncDescList;
 static std::string g_encoderConfigErrorMessage;
+static MEC::ExportJobQueue * g_export_queue = nullptr;
+static std::string g_export_queue_dir;          // export queue file and project snapshots of queued jobs
 static bool quit_save_confirm = true;
 static bool project_need_save = false;
 static bool mouse_hold = false;
@@ -1400,6 +1420,8 @@ static void ShowConfigure(MediaEditorSettings & config)
     static int format_index = GetAudioFormatIndex(config.AudioFormat);
 
     static char buf_cache_size[64] = {0}; snprintf(buf_cache_size, 64, "%d", config.VideoFrameCacheSize);
+    static char buf_prefetch_budget[64] = {0}; snprintf(buf_prefetch_budget, 64, "%d", config.VideoPrefetchBudget);
+    static char buf_render_budget[64] = {0}; snprintf(buf_render_budget, 64, "%d", config.PreviewRenderBudget);
     static char buf_res_x[64] = {0}; snprintf(buf_res_x, 64, "%d", config.VideoWidth);
     static char buf_res_y[64] = {0}; snprintf(buf_res_y, 64, "%d", config.VideoHeight);
     static char buf_par_x[64] = {0}; snprintf(buf_par_x, 64, "%d", config.PixelAspectRatio.num);
@@ -1456,6 +1478,28 @@ static void ShowConfigure(MediaEditorSettings & config)
                 ImGui::PushItemWidth(60);
                 ImGui::InputText("##Video_cache_size", buf_cache_size, 64, ImGuiInputTextFlags_CharsDecimal);
                 config.VideoFrameCacheSize = atoi(buf_cache_size);
+                ImGui::PopItemWidth();
+                ImGui::BulletText("Playback Read-ahead Budget (MB)");
+                ImGui::PushItemWidth(60);
+                ImGui::InputText("##Video_prefetch_budget", buf_prefetch_budget, 64, ImGuiInputTextFlags_CharsDecimal);
+                ImGui::ShowTooltipOnHover("Memory for the frames composed ahead of the play head during playback, 0 disables the read-ahead.");
+                config.VideoPrefetchBudget = ImMax(atoi(buf_prefetch_budget), 0);
+                ImGui::PopItemWidth();
+                ImGui::BulletText("Adaptive Preview Resolution");
+                ImGui::ToggleButton("##preview_adaptive", &config.PreviewAdaptive);
+                ImGui::ShowTooltipOnHover("Compose the read-ahead frames at 1/2, 1/4 or 1/8 of the preview size while playback misses frames, the paused frame is always shown at full preview size.");
+                ImGui::BulletText("Show Playback Statistics");
+                ImGui::ToggleButton("##show_playback_stats", &config.ShowPlaybackStats);
+                ImGui::ShowTooltipOnHover("Show the presented, late and dropped frames per second, the A/V offset and the composition time over the preview.");
+                ImGui::BulletText("Preview Render Budget (MB)");
+                ImGui::PushItemWidth(60);
+                ImGui::InputText("##preview_render_budget", buf_render_budget, 64, ImGuiInputTextFlags_CharsDecimal);
+                ImGui::ShowTooltipOnHover("Memory for the rendered preview of heavy timeline regions, the least recently played chunks are dropped first.");
+                config.PreviewRenderBudget = ImMax(atoi(buf_render_budget), 0);
+                ImGui::PopItemWidth();
+                ImGui::BulletText("Proxy Media");
+                ImGui::ToggleButton("##proxy_media", &config.ProxyEnabled);
+                ImGui::ShowTooltipOnHover("Generate a 1/4 size intra-only proxy of every video media in background, preview and snapshots use the proxy, export always uses the original.");
             }
             break;
             case 1:
@@ -1641,6 +1685,12 @@ static void NewTimeline()
         timeline->mPreviewScale = g_media_editor_settings.PreviewScale;
         timeline->mFrameRate = g_media_editor_settings.VideoFrameRate;
         timeline->mMaxCachedVideoFrame = g_media_editor_settings.VideoFrameCacheSize > 0 ? g_media_editor_settings.VideoFrameCacheSize : MAX_VIDEO_CACHE_FRAMES;
+        timeline->mPrefetchBudgetMB = g_media_editor_settings.VideoPrefetchBudget;
+        timeline->mPreviewAdaptive = g_media_editor_settings.PreviewAdaptive;
+        timeline->bShowPlaybackStats = g_media_editor_settings.ShowPlaybackStats;
+        timeline->mPreviewRenderBudgetMB = g_media_editor_settings.PreviewRenderBudget;
+        timeline->mProxyEnabled = g_media_editor_settings.ProxyEnabled;
+        timeline->mProxyDir = ImGui::GetIO().IniFilename ? ImGuiHelper::path_parent(ImGui::GetIO().IniFilename)+"Media_Editor_Proxy" : std::string();
         timeline->mAudioSampleRate = g_media_editor_settings.AudioSampleRate;
         timeline->mAudioChannels = g_media_editor_settings.AudioChannels;
         timeline->mAudioFormat = (MediaCore::AudioRender::PcmFormat)g_media_editor_settings.AudioFormat;
@@ -1749,6 +1799,7 @@ static void LoadProjectThread(std::string path, bool in_splash)
             item = new MediaItem(name, path, type, timeline);
             if (id != -1) item->mID = id;
             timeline->media_items.push_back(item);
+            timeline->RequestProxyMedia(item);
             g_project_loading_percentage += percentage;
         }
     }
@@ -1770,13 +1821,9 @@ static void LoadProjectThread(std::string path, bool in_splash)
     timeline->m_in_threads = false;
 }
 
-static void SaveProject(std::string path)
+// collect the project data into g_project
+static void UpdateProject()
 {
-    if (!timeline || path.empty())
-        return;
-
-    Logger::Log(Logger::DEBUG) << "[Project] Save project to file!!!" << std::endl;
-
     timeline->Play(false, true);
     // check current editing clip, if it has bp then save it to clip
     Clip * editing_clip = timeline->FindEditingClip();
@@ -1823,7 +1870,16 @@ static void SaveProject(std::string path)
     imgui_json::value timeline_val;
     timeline->Save(timeline_val);
     g_project["TimeLine"] = timeline_val;
+}
+
+static void SaveProject(std::string path)
+{
+    if (!timeline || path.empty())
+        return;
+
+    Logger::Log(Logger::DEBUG) << "[Project] Save project to file!!!" << std::endl;
 
+    UpdateProject();
     g_project.save(path);
     g_media_editor_settings.project_path = path;
     //quit_save_confirm = false;
@@ -1941,6 +1997,7 @@ static bool InsertMedia(const std::string path)
         {
             MediaItem * item = new MediaItem(name, path, type, timeline);
             timeline->media_items.push_back(item);
+            timeline->RequestProxyMedia(item);
             project_need_save = true;
             return project_need_save;
         }
@@ -1963,6 +2020,7 @@ static bool ReloadMedia(std::string path, MediaItem* item)
     auto old_name = item->mName;
     auto old_path = item->mPath;
     item->UpdateItem(name, path, timeline);
+    timeline->RequestProxyMedia(item);
     if (item->mValid)
     {
         // need update timeline clip which is using current Media
@@ -3025,6 +3083,251 @@ static void ShowFilterBankTreeWindow(ImDrawList *_draw_list)
  * Media Output window
  *
  ***************************************************************************************/
+static void ShowEncodeStageStats(TimeLine* timeline)
+{
+    const double elapsed = timeline->GetEncodingElapsedTime();
+    if (elapsed <= 0)
+        return;
+    const double encoded = timeline->mEncodingProgress * timeline->mEncodingDuration;
+    const int bottleneck = timeline->GetEncodeBottleneckStage();
+    const ImGuiTableFlags flags = ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg | ImGuiTableFlags_SizingFixedFit;
+    if (ImGui::BeginTable("##encode_stage_stats", 5, flags))
+    {
+        ImGui::TableSetupColumn("Stage");
+        ImGui::TableSetupColumn("Rate");
+        ImGui::TableSetupColumn("Realtime");
+        ImGui::TableSetupColumn("Busy");
+        ImGui::TableSetupColumn("Queue");
+        ImGui::TableHeadersRow();
+        for (int i = 0; i < TimeLine::ENC_STAGE_COUNT; i++)
+        {
+            auto& status = timeline->mEncodeStageStatus[i];
+            if (status.busyUs == 0)
+                continue;
+            // rate and realtime of the stage alone, as if it would be the only work of its threads
+            const int threads = status.threads > 0 ? status.threads.load() : 1;
+            const double busy = (double)status.busyUs / 1000000 / threads;
+            ImGui::TableNextRow();
+            ImGui::TableNextColumn();
+            if (i == bottleneck)
+                ImGui::TextColored({1., 0.5, 0.5, 1.}, "%s *", TimeLine::GetEncodeStageName(i));
+            else
+                ImGui::TextUnformatted(TimeLine::GetEncodeStageName(i));
+            ImGui::TableNextColumn(); ImGui::Text("%.1f/s", status.processed / busy);
+            ImGui::TableNextColumn(); ImGui::Text("%.2fx", encoded / busy);
+            ImGui::TableNextColumn(); ImGui::Text("%.0f%%", busy * 100 / elapsed);
+            ImGui::TableNextColumn();
+            if (status.capacity > 0)
+                ImGui::Text("%d/%d", status.queued.load(), status.capacity.load());
+            else
+                ImGui::TextUnformatted("-");
+        }
+        ImGui::EndTable();
+    }
+    if (bottleneck >= 0)
+        ImGui::Text("Bottleneck: %s", TimeLine::GetEncodeStageName(bottleneck));
+}
+
+// encoder params of current output settings
+static void GetEncoderParams(TimeLine::VideoEncoderParams& vidEncParams, TimeLine::AudioEncoderParams& audEncParams)
+{
+    vidEncParams.codecName = g_currVidEncDescList[g_media_editor_settings.OutputVideoCodecTypeIndex].codecName;
+    vidEncParams.width = g_media_editor_settings.OutputVideoResolutionWidth;
+    vidEncParams.height = g_media_editor_settings.OutputVideoResolutionHeight;
+    vidEncParams.frameRate = g_media_editor_settings.OutputVideoFrameRate;
+    vidEncParams.bitRate = g_media_editor_settings.OutputVideoBitrate;
+    auto outColorspaceValue = ColorSpace[g_media_editor_settings.OutputColorSpaceIndex].tag;
+    switch (outColorspaceValue)
+    {
+    case AVCOL_SPC_BT709:
+        vidEncParams.extraOpts.push_back({"color_primaries", MediaCore::Value((int)AVCOL_PRI_BT709)});
+        break;
+    case AVCOL_SPC_FCC:
+        vidEncParams.extraOpts.push_back({"color_primaries", MediaCore::Value((int)AVCOL_PRI_BT470M)});
+        break;
+    case AVCOL_SPC_BT470BG:
+        vidEncParams.extraOpts.push_back({"color_primaries", MediaCore::Value((int)AVCOL_PRI_BT470BG)});
+        break;
+    case AVCOL_SPC_SMPTE170M:
+        vidEncParams.extraOpts.push_back({"color_primaries", MediaCore::Value((int)AVCOL_PRI_SMPTE170M)});
+        break;
+    case AVCOL_SPC_SMPTE240M:
+        vidEncParams.extraOpts.push_back({"color_primaries", MediaCore::Value((int)AVCOL_PRI_SMPTE240M)});
+        break;
+    case AVCOL_SPC_BT2020_NCL:
+    case AVCOL_SPC_BT2020_CL:
+        vidEncParams.extraOpts.push_back({"color_primaries", MediaCore::Value((int)AVCOL_PRI_BT2020)});
+        break;
+    default:
+        vidEncParams.extraOpts.push_back({"color_primaries", MediaCore::Value((int)AVCOL_PRI_UNSPECIFIED)});
+    }
+    vidEncParams.extraOpts.push_back({"colorspace", MediaCore::Value((int)outColorspaceValue)});
+    vidEncParams.extraOpts.push_back({"color_trc", MediaCore::Value((int)(ColorTransfer[g_media_editor_settings.OutputColorTransferIndex].tag))});
+    audEncParams.codecName = g_currAudEncDescList[g_media_editor_settings.OutputAudioCodecTypeIndex].codecName;
+    audEncParams.channels = g_media_editor_settings.OutputAudioChannels;
+    audEncParams.sampleRate = g_media_editor_settings.OutputAudioSampleRate;
+    audEncParams.bitRate = 128000;
+}
+
+// fill the export settings which aren't encoder params
+static void GetExportJobSettings(MEC::ExportJob& job, const std::string& outputPath, const std::string& outputName)
+{
+    GetEncoderParams(job.vidParams, job.audParams);
+    job.name = outputName;
+    job.outputPath = outputPath+"/"+outputName+"."+OutFormats[g_media_editor_settings.OutputFormatIndex].suffix;
+    job.threads = g_media_editor_settings.OutputQueueJobThreads;
+    job.gopSize = g_media_editor_settings.OutputVideoGOPSize > 0 ? g_media_editor_settings.OutputVideoGOPSize : 12;
+    job.smartRender = g_media_editor_settings.OutputSmartRender;
+    job.cacheDir = g_media_editor_settings.OutputRenderCache ? outputPath+"/"+outputName+".cache" : std::string();
+    job.resumable = g_media_editor_settings.OutputResumable;
+    job.statsPath = g_media_editor_settings.OutputWriteStats ? outputPath+"/"+outputName+".stats.json" : std::string();
+}
+
+// queue the current project with current output settings, the project is saved as a snapshot for the job
+static bool AddCurrentProjectToExportQueue(std::string& errMsg)
+{
+    if (timeline->ValidDuration() <= 0)
+    {
+        errMsg = "Nothing to export!";
+        return false;
+    }
+    MEC::ExportJob job;
+    GetExportJobSettings(job, timeline->mOutputPath, timeline->mOutputName);
+    if (timeline->mEncodingInRange)
+    {
+        job.rangeStart = timeline->mark_in;
+        job.rangeEnd = timeline->mark_out;
+    }
+    const int64_t timestamp = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    job.projectPath = g_export_queue_dir+"ExportJob_"+std::to_string(timestamp)+".mep";
+    job.ownsProject = true;
+    UpdateProject();
+    if (!g_project.save(job.projectPath))
+    {
+        errMsg = "FAILED to save project snapshot '"+job.projectPath+"'!";
+        return false;
+    }
+    g_export_queue->AddJob(job);
+    return true;
+}
+
+// queue a saved project with current output settings, it's exported to the output path saved in the project
+static bool AddProjectFileToExportQueue(const std::string& path, std::string& errMsg)
+{
+    auto loadResult = imgui_json::value::load(path);
+    if (!loadResult.second || !loadResult.first.contains("TimeLine"))
+    {
+        errMsg = "FAILED to load project file '"+path+"'!";
+        return false;
+    }
+    auto& timelineValue = loadResult.first["TimeLine"];
+    std::string outputPath = ImGuiHelper::path_parent(path);
+    std::string outputName = ImGuiHelper::path_filename_prefix(path);
+    if (timelineValue.contains("OutputPath") && timelineValue["OutputPath"].is_string())
+        outputPath = timelineValue["OutputPath"].get<imgui_json::string>();
+    if (timelineValue.contains("OutputName") && timelineValue["OutputName"].is_string())
+        outputName = timelineValue["OutputName"].get<imgui_json::string>();
+    MEC::ExportJob job;
+    GetExportJobSettings(job, outputPath, outputName);
+    job.projectPath = path;
+    g_export_queue->AddJob(job);
+    return true;
+}
+
+static void ShowExportQueue()
+{
+    static std::string queue_error_message;
+    ImGui::TextUnformatted("Export Queue");
+    ImGui::Separator();
+    if (!g_export_queue)
+    {
+        ImGui::TextUnformatted("Waiting for plugins...");
+        return;
+    }
+    if (ImGui::Button("Add Current##export_queue"))
+    {
+        queue_error_message.clear();
+        AddCurrentProjectToExportQueue(queue_error_message);
+    }
+    ImGui::ShowTooltipOnHover("Export a snapshot of current project with current output settings in background.");
+    ImGui::SameLine();
+    if (ImGui::Button("Add Project...##export_queue"))
+    {
+        ImGuiFileDialog::Instance()->OpenDialog("##MediaEditQueueProjectDlgKey", ICON_IGFD_FOLDER_OPEN " Queue Project File",
+                                                pfilters.c_str(),
+                                                g_media_editor_settings.project_path.empty() ? "." : ImGuiHelper::path_url(g_media_editor_settings.project_path).c_str(),
+                                                1,
+                                                IGFDUserDatas("QueueProject"),
+                                                ImGuiFileDialogFlags_ShowBookmark |
+                                                ImGuiFileDialogFlags_CaseInsensitiveExtention |
+                                                ImGuiFileDialogFlags_Modal);
+    }
+    ImGui::ShowTooltipOnHover("Export a saved project with current output settings in background.");
+    ImGui::SameLine();
+    if (ImGui::Button("Clear Done##export_queue"))
+        g_export_queue->ClearFinishedJobs();
+    int max_jobs = g_export_queue->GetMaxConcurrency();
+    if (ImGui::InputInt("Max Jobs##export_queue", &max_jobs))
+        g_export_queue->SetMaxConcurrency(ImClamp(max_jobs, 1, 16));
+    ImGui::ShowTooltipOnHover("Count of the jobs encoding at the same time.");
+    if (ImGui::InputInt("Threads per Job##export_queue", &g_media_editor_settings.OutputQueueJobThreads))
+        g_media_editor_settings.OutputQueueJobThreads = ImClamp(g_media_editor_settings.OutputQueueJobThreads, 1, 64);
+    ImGui::ShowTooltipOnHover("Count of single threaded segment encoders of a job added from now on.");
+    if (!queue_error_message.empty())
+        ImGui::TextColored({1., 0.2, 0.2, 1.}, "%s", queue_error_message.c_str());
+
+    auto jobs = g_export_queue->GetJobs();
+    const ImGuiTableFlags flags = ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg | ImGuiTableFlags_SizingFixedFit;
+    if (!jobs.empty() && ImGui::BeginTable("##export_queue_jobs", 4, flags))
+    {
+        ImGui::TableSetupColumn("Job");
+        ImGui::TableSetupColumn("Range");
+        ImGui::TableSetupColumn("Progress", ImGuiTableColumnFlags_WidthStretch);
+        ImGui::TableSetupColumn("Action");
+        ImGui::TableHeadersRow();
+        for (auto& job : jobs)
+        {
+            ImGui::PushID((int)job.id);
+            ImGui::TableNextRow();
+            ImGui::TableNextColumn();
+            ImGui::TextUnformatted(job.name.c_str());
+            if (ImGui::IsItemHovered() && ImGui::BeginTooltip())
+            {
+                ImGui::TextUnformatted(job.outputPath.c_str());
+                if (!job.errMsg.empty())
+                    ImGui::TextColored({1., 0.5, 0.5, 1.}, "%s", job.errMsg.c_str());
+                ImGui::EndTooltip();
+            }
+            ImGui::TableNextColumn();
+            if (job.rangeStart >= 0)
+                ImGui::Text("%s-%s", ImGuiHelper::MillisecToString(job.rangeStart, 2).c_str(), ImGuiHelper::MillisecToString(job.rangeEnd, 2).c_str());
+            else
+                ImGui::TextUnformatted("All");
+            ImGui::TableNextColumn();
+            std::string overlay = std::string(MEC::ExportJobQueue::GetStateName(job.state));
+            if (job.state == MEC::ExportJob::RUNNING)
+                overlay += " " + std::to_string((int)(job.progress * 100)) + "% " + ImGuiHelper::MillisecToString(job.elapsed * 1000, 1);
+            ImGui::ProgressBar(job.progress, ImVec2(-FLT_MIN, 0), overlay.c_str());
+            ImGui::TableNextColumn();
+            if (job.state == MEC::ExportJob::QUEUED || job.state == MEC::ExportJob::RUNNING)
+            {
+                if (ImGui::Button("Cancel"))
+                    g_export_queue->CancelJob(job.id);
+            }
+            else
+            {
+                if (ImGui::Button("Retry"))
+                    g_export_queue->RetryJob(job.id);
+                ImGui::SameLine();
+                if (ImGui::Button("Remove"))
+                    g_export_queue->RemoveJob(job.id);
+            }
+            ImGui::PopID();
+        }
+        ImGui::EndTable();
+    }
+}
+
 static void ShowMediaOutputWindow(ImDrawList *_draw_list)
 {
     ImGuiIO& io = ImGui::GetIO(); (void)io;
@@ -3423,6 +3726,39 @@ static void ShowMediaOutputWindow(ImDrawList *_draw_list)
             }
             else
                 g_media_editor_settings.OutputVideoBFrames = 0;
+            if (ImGui::InputInt("Segment Threads##video", &g_media_editor_settings.OutputSegmentThreads, 1, 1, ImGuiInputTextFlags_EnterReturnsTrue))
+                g_media_editor_settings.OutputSegmentThreads = ImClamp(g_media_editor_settings.OutputSegmentThreads, 0, 64);
+            ImGui::ShowTooltipOnHover("Encode the video in GOP aligned segments concurrently, less than 2 means single encoder.");
+            ImGui::Checkbox("Auto Tune Encoder##video", &g_media_editor_settings.OutputAutoTune);
+            ImGui::ShowTooltipOnHover("Measure the encoder thread settings on a slice of the timeline before a single encoder export and use the fastest one, the choice is remembered per codec, size and core count.");
+            ImGui::Checkbox("Smart Render##video", &g_media_editor_settings.OutputSmartRender);
+            ImGui::ShowTooltipOnHover("Copy the compressed video of untouched clips without re-encoding, if the source codec and format match the output.");
+            ImGui::Checkbox("Render Cache##video", &g_media_editor_settings.OutputRenderCache);
+            ImGui::ShowTooltipOnHover("Keep the rendered segments in '<output name>.cache', the next export only renders the segments whose inputs are changed.");
+            ImGui::Checkbox("Resumable##video", &g_media_editor_settings.OutputResumable);
+            ImGui::ShowTooltipOnHover("Keep the finished segments of a failed or stopped export next to the output, starting it again resumes from them.");
+            for (int i = 0; i < IM_ARRAYSIZE(g_media_editor_settings.OutputRenditionDivisor); i++)
+            {
+                auto& divisor = g_media_editor_settings.OutputRenditionDivisor[i];
+                int divisor_index = divisor == 2 ? 1 : divisor == 4 ? 2 : divisor == 8 ? 3 : 0;
+                std::string label = "Rendition " + std::to_string(i + 1) + "##video";
+                if (ImGui::Combo(label.c_str(), &divisor_index, "Off\0" "1/2 Size\0" "1/4 Size\0" "1/8 Size\0"))
+                    divisor = divisor_index > 0 ? 1 << divisor_index : 0;
+                ImGui::ShowTooltipOnHover("Encode another output with a smaller size from the same composition, saved as '<output name>_<height>p'.");
+                if (divisor > 0)
+                {
+                    label = "Rendition " + std::to_string(i + 1) + " Bitrate##video";
+                    if (ImGui::InputInt(label.c_str(), &g_media_editor_settings.OutputRenditionBitrate[i], 1000, 1000000, ImGuiInputTextFlags_EnterReturnsTrue))
+                        g_media_editor_settings.OutputRenditionBitrate[i] = ImMax(g_media_editor_settings.OutputRenditionBitrate[i], 0);
+                    ImGui::ShowTooltipOnHover("0 means the output bitrate scaled by the rendition area.");
+                }
+            }
+            bool has_rendition = false;
+            for (int i = 0; i < IM_ARRAYSIZE(g_media_editor_settings.OutputRenditionDivisor); i++)
+                if (g_media_editor_settings.OutputRenditionDivisor[i] > 1) has_rendition = true;
+            if (has_rendition && (g_media_editor_settings.OutputSegmentThreads > 1 || g_media_editor_settings.OutputSmartRender ||
+                g_media_editor_settings.OutputRenderCache || g_media_editor_settings.OutputResumable))
+                ImGui::TextColored({1., 0.5, 0.5, 1.}, "Renditions can't be encoded with segment threads, smart render, render cache or resumable export.");
             ImGui::EndDisabled(); // disable if disable video
             ImGui::Separator();
 
@@ -3479,6 +3815,10 @@ static void ShowMediaOutputWindow(ImDrawList *_draw_list)
             ImGui::EndDisabled(); // disable if param as timline
             ImGui::EndDisabled(); // disable if no audio
             ImGui::Separator();
+
+            // Export Queue
+            ImGui::Dummy(ImVec2(0, 20));
+            ShowExportQueue();
         }
         ImGui::EndChild();
 
@@ -3497,11 +3837,7 @@ static void ShowMediaOutputWindow(ImDrawList *_draw_list)
             if (timeline->mIsEncoding)
             {
                 ImGui::ImMat encMatV;
-                {
-                    std::lock_guard<std::mutex> lk(timeline->mEncodingMutex);
-                    encMatV = timeline->mEncodingVFrame;
-                }
-                if (!encMatV.empty())
+                if (timeline->mEncodingPreviewMailbox.Take(encMatV) && !encMatV.empty())
                 {
                     ImGui::ImMatToTexture(encMatV, timeline->mEncodingPreviewTexture);
                 }
@@ -3544,6 +3880,7 @@ static void ShowMediaOutputWindow(ImDrawList *_draw_list)
                 ImGui::TextUnformatted("Speed:"); ImGui::SameLine();
                 float encoding_speed = timeline->mEncodingDuration / (encode_duration + FLT_EPSILON);
                 ImGui::Text("%.2fx", encoding_speed);
+                ShowEncodeStageStats(timeline);
             }
             else if (timeline->mIsEncoding)
             {
@@ -3554,6 +3891,7 @@ static void ShowMediaOutputWindow(ImDrawList *_draw_list)
                 float estimated_time = (1.f - timeline->mEncodingProgress) * timeline->mEncodingDuration / (encoding_speed + FLT_EPSILON);
                 ImGui::TextUnformatted("Speed:"); ImGui::SameLine(); ImGui::Text("%.2fx", encoding_speed); ImGui::SameLine();
                 ImGui::TextUnformatted("Estimated:"); ImGui::SameLine(); ImGui::Text("%s", ImGuiHelper::MillisecToString(estimated_time * 1000, 1).c_str());
+                ShowEncodeStageStats(timeline);
             }
             else
             {
@@ -3591,44 +3929,35 @@ static void ShowMediaOutputWindow(ImDrawList *_draw_list)
                 {
                     // config encoders
                     TimeLine::VideoEncoderParams vidEncParams;
-                    vidEncParams.codecName = g_currVidEncDescList[g_media_editor_settings.OutputVideoCodecTypeIndex].codecName;
-                    vidEncParams.width = g_media_editor_settings.OutputVideoResolutionWidth;
-                    vidEncParams.height = g_media_editor_settings.OutputVideoResolutionHeight;
-                    vidEncParams.frameRate = g_media_editor_settings.OutputVideoFrameRate;
-                    vidEncParams.bitRate = g_media_editor_settings.OutputVideoBitrate;
-                    auto outColorspaceValue = ColorSpace[g_media_editor_settings.OutputColorSpaceIndex].tag;
-                    switch (outColorspaceValue)
+                    TimeLine::AudioEncoderParams audEncParams;
+                    GetEncoderParams(vidEncParams, audEncParams);
+                    timeline->mEncodingSegmentThreads = g_media_editor_settings.OutputSegmentThreads;
+                    timeline->mEncodingSmartRender = g_media_editor_settings.OutputSmartRender;
+                    timeline->mEncodingCacheDir = g_media_editor_settings.OutputRenderCache ? timeline->mOutputPath+"/"+timeline->mOutputName+".cache" : std::string();
+                    timeline->mEncodingResumable = g_media_editor_settings.OutputResumable;
+                    timeline->mEncodingGopSize = g_media_editor_settings.OutputVideoGOPSize > 0 ? g_media_editor_settings.OutputVideoGOPSize : 12;
+                    timeline->mEncodingPreviewRate = g_media_editor_settings.OutputPreviewRate;
+                    timeline->mEncodingStatsPath = g_media_editor_settings.OutputWriteStats ? timeline->mOutputPath+"/"+timeline->mOutputName+".stats.json" : std::string();
+                    timeline->mEncodingHashPath = g_media_editor_settings.OutputWriteHashes ? timeline->mOutputPath+"/"+timeline->mOutputName+".hash" : std::string();
+                    // the encoding thread runs the calibration, it's ignored by the segmented and image sequence exports
+                    timeline->mEncodingTuneCachePath = g_media_editor_settings.OutputAutoTune ? g_export_queue_dir+"Media_Editor_EncoderTune.json" : std::string();
+                    bool encoderConfigured = timeline->ConfigEncoder(fullpath, vidEncParams, audEncParams, g_encoderConfigErrorMessage);
+                    const bool image_sequence = !MEC::GetImageSequenceCodec(fullpath).empty();
+                    for (int i = 0; encoderConfigured && timeline->bExportVideo && !image_sequence && i < IM_ARRAYSIZE(g_media_editor_settings.OutputRenditionDivisor); i++)
                     {
-                    case AVCOL_SPC_BT709:
-                        vidEncParams.extraOpts.push_back({"color_primaries", MediaCore::Value((int)AVCOL_PRI_BT709)});
-                        break;
-                    case AVCOL_SPC_FCC:
-                        vidEncParams.extraOpts.push_back({"color_primaries", MediaCore::Value((int)AVCOL_PRI_BT470M)});
-                        break;
-                    case AVCOL_SPC_BT470BG:
-                        vidEncParams.extraOpts.push_back({"color_primaries", MediaCore::Value((int)AVCOL_PRI_BT470BG)});
-                        break;
-                    case AVCOL_SPC_SMPTE170M:
-                        vidEncParams.extraOpts.push_back({"color_primaries", MediaCore::Value((int)AVCOL_PRI_SMPTE170M)});
-                        break;
-                    case AVCOL_SPC_SMPTE240M:
-                        vidEncParams.extraOpts.push_back({"color_primaries", MediaCore::Value((int)AVCOL_PRI_SMPTE240M)});
-                        break;
-                    case AVCOL_SPC_BT2020_NCL:
-                    case AVCOL_SPC_BT2020_CL:
-                        vidEncParams.extraOpts.push_back({"color_primaries", MediaCore::Value((int)AVCOL_PRI_BT2020)});
-                        break;
-                    default:
-                        vidEncParams.extraOpts.push_back({"color_primaries", MediaCore::Value((int)AVCOL_PRI_UNSPECIFIED)});
+                        const int divisor = g_media_editor_settings.OutputRenditionDivisor[i];
+                        if (divisor <= 1)
+                            continue;
+                        TimeLine::VideoEncoderParams renditionVidParams = vidEncParams;
+                        renditionVidParams.width = (vidEncParams.width / divisor) & ~1;
+                        renditionVidParams.height = (vidEncParams.height / divisor) & ~1;
+                        renditionVidParams.bitRate = g_media_editor_settings.OutputRenditionBitrate[i] > 0 ?
+                                g_media_editor_settings.OutputRenditionBitrate[i] : vidEncParams.bitRate / (divisor * divisor);
+                        std::string renditionPath = timeline->mOutputPath+"/"+timeline->mOutputName+"_"+std::to_string(renditionVidParams.height)+"p"
+                            +"."+OutFormats[g_media_editor_settings.OutputFormatIndex].suffix;
+                        encoderConfigured = timeline->AddEncodeOutput(renditionPath, renditionVidParams, audEncParams, g_encoderConfigErrorMessage);
                     }
-                    vidEncParams.extraOpts.push_back({"colorspace", MediaCore::Value((int)outColorspaceValue)});
-                    vidEncParams.extraOpts.push_back({"color_trc", MediaCore::Value((int)(ColorTransfer[g_media_editor_settings.OutputColorTransferIndex].tag))});
-                    TimeLine::AudioEncoderParams audEncParams;
-                    audEncParams.codecName = g_currAudEncDescList[g_media_editor_settings.OutputAudioCodecTypeIndex].codecName;
-                    audEncParams.channels = g_media_editor_settings.OutputAudioChannels;
-                    audEncParams.sampleRate = g_media_editor_settings.OutputAudioSampleRate;
-                    audEncParams.bitRate = 128000;
-                    if (timeline->ConfigEncoder(fullpath, vidEncParams, audEncParams, g_encoderConfigErrorMessage))
+                    if (encoderConfigured)
                     {
                         timeline->StartEncoding();
                         encode_duration = -1;
@@ -3648,6 +3977,23 @@ static void ShowMediaOutputWindow(ImDrawList *_draw_list)
             {
                 timeline->mEncodingInRange = false;
             }
+            if (encoder_stage != 2)
+            {
+                ImGui::SameLine();
+                ImGui::BeginDisabled(timeline->mIsEncoding);
+                ImGui::Checkbox("Write stage stats", &g_media_editor_settings.OutputWriteStats);
+                ImGui::ShowTooltipOnHover("Save the per-stage timing summary as '<output name>.stats.json' when encoding ends.");
+                ImGui::SameLine();
+                ImGui::Checkbox("Write frame hashes", &g_media_editor_settings.OutputWriteHashes);
+                ImGui::ShowTooltipOnHover("Save the content hash of every composed frame and audio block as '<output name>.hash', compare two of them by 'mec-render --compare-hashes'. Not available with smart render, render cache or resumable export.");
+                ImGui::SameLine();
+                ImGui::PushItemWidth(100);
+                if (ImGui::InputFloat("Preview fps", &g_media_editor_settings.OutputPreviewRate, 0.5f, 1.f, "%.1f"))
+                    g_media_editor_settings.OutputPreviewRate = ImClamp(g_media_editor_settings.OutputPreviewRate, 0.f, 30.f);
+                ImGui::PopItemWidth();
+                ImGui::ShowTooltipOnHover("Refresh rate of the downscaled encoding preview, 0 turns the preview off.");
+                ImGui::EndDisabled();
+            }
             if (!g_encoderConfigErrorMessage.empty())
             {
                 ImGui::TextColored({1., 0.2, 0.2, 1.}, "%s", g_encoderConfigErrorMessage.c_str());
@@ -3682,6 +4028,18 @@ static void ShowMediaOutputWindow(ImDrawList *_draw_list)
         }
         ImGuiFileDialog::Instance()->Close();
     }
+    if (multiviewport)
+        ImGui::SetNextWindowViewport(viewport->ID);
+    if (ImGuiFileDialog::Instance()->Display("##MediaEditQueueProjectDlgKey", ImGuiWindowFlags_NoCollapse, minSize, maxSize))
+    {
+        if (ImGuiFileDialog::Instance()->IsOk() && g_export_queue)
+        {
+            std::string errMsg;
+            if (!AddProjectFileToExportQueue(ImGuiFileDialog::Instance()->GetFilePathName(), errMsg))
+                Logger::Log(Logger::WARN) << errMsg << std::endl;
+        }
+        ImGuiFileDialog::Instance()->Close();
+    }
 }
 
 /****************************************************************************************
@@ -3825,6 +4183,12 @@ static void ShowMediaPreviewWindow(ImDrawList *draw_list, std::string title, flo
     ImGui::SetWindowFontScale(is_small_window ? 1.0 : 1.5);
     ImGui::ShowDigitalTime(draw_list, timeline->mCurrentTime, 3, TimeStampRect.Min, timeline->mIsPreviewPlaying ? IM_COL32(255, 255, 0, 255) : COL_MARK);
     ImGui::SetWindowFontScale(1.0);
+    if (timeline->mIsPreviewPlaying && timeline->mShuttleSpeed > 1)
+    {
+        std::string speed_str = (timeline->mIsPreviewForward ? "" : "-") + std::to_string(timeline->mShuttleSpeed) + "x";
+        ImVec2 speed_size = ImGui::CalcTextSize(speed_str.c_str());
+        draw_list->AddText(ImVec2(TimeStampRect.Max.x - speed_size.x - 4, TimeStampRect.Min.y), IM_COL32(255, 255, 0, 255), speed_str.c_str());
+    }
     draw_list->PopClipRect();
 
     // audio meters
@@ -3949,6 +4313,26 @@ static void ShowMediaPreviewWindow(ImDrawList *draw_list, std::string title, flo
         }
         video_rect.Min = ImVec2(offset_x, offset_y);
         video_rect.Max = ImVec2(tf_x, tf_y);
+        // scrubbing, the nearest clip snapshot is shown till the frame at the play head is decoded
+        ImTextureID scrub_texture = nullptr;
+        ImVec2 scrub_uv0, scrub_uv1;
+        if (video_rect.GetWidth() > 0 && timeline->GetScrubSnapshot(scrub_texture, scrub_uv0, scrub_uv1))
+            draw_list->AddImage(scrub_texture, video_rect.Min, video_rect.Max, scrub_uv0, scrub_uv1);
+        if (timeline->bShowPlaybackStats)
+        {
+            auto stats = timeline->mPlaybackStats.GetLastSecond();
+            char stats_str[4][128];
+            snprintf(stats_str[0], 128, "Presented %lld/s  Late %lld  Dropped %lld", (long long)stats.presented, (long long)stats.late, (long long)stats.dropped);
+            snprintf(stats_str[1], 128, "A/V offset p50 %.1f  p95 %.1f  p99 %.1f ms", stats.avOffsetMs[0], stats.avOffsetMs[1], stats.avOffsetMs[2]);
+            snprintf(stats_str[2], 128, "Compose p50 %.1f  p95 %.1f  p99 %.1f ms", stats.composeMs[0], stats.composeMs[1], stats.composeMs[2]);
+            snprintf(stats_str[3], 128, "Read-ahead %lld/%lld  Scale 1/%d", (long long)timeline->mPrefetchHits.load(), (long long)(timeline->mPrefetchHits.load() + timeline->mPrefetchMisses.load()), 1 << timeline->mPreviewScaler.GetLevel());
+            ImVec2 stats_pos = PreviewPos + ImVec2(8, 8);
+            float stats_width = 0;
+            for (auto& str : stats_str) stats_width = ImMax(stats_width, ImGui::CalcTextSize(str).x);
+            draw_list->AddRectFilled(stats_pos - ImVec2(4, 4), stats_pos + ImVec2(stats_width + 4, ImGui::GetTextLineHeight() * 4 + 4), IM_COL32(0, 0, 0, 160), 4);
+            for (int i = 0; i < 4; i++)
+                draw_list->AddText(stats_pos + ImVec2(0, ImGui::GetTextLineHeight() * i), IM_COL32(255, 255, 255, 255), stats_str[i]);
+        }
     }
     if (monitors)
     {
@@ -10177,6 +10561,7 @@ static void MediaEditor_SetupContext(ImGuiContext* ctx, bool in_splash)
         float val_float = 0;
         char val_path[1024] = {0};
         ImVec4 val_vec4 = {0, 0, 0, 0};
+        int val_rendition[2] = {0, 0};
         if (sscanf(line, "ProjectPath=%[^|\n]", val_path) == 1) { setting->project_path = std::string(val_path); }
         else if (sscanf(line, "UILanguage=%[^|\n]", val_path) == 1) { setting->UILanguage = std::string(val_path); }
         else if (sscanf(line, "BottomViewExpanded=%d", &val_int) == 1) { setting->BottomViewExpanded = val_int == 1; }
@@ -10202,6 +10587,11 @@ static void MediaEditor_SetupContext(ImGuiContext* ctx, bool in_splash)
         else if (sscanf(line, "ColorSpaceIndex=%d", &val_int) == 1) { setting->ColorSpaceIndex = val_int; }
         else if (sscanf(line, "ColorTransferIndex=%d", &val_int) == 1) { setting->ColorTransferIndex = val_int; }
         else if (sscanf(line, "VideoFrameCache=%d", &val_int) == 1) { setting->VideoFrameCacheSize = val_int; }
+        else if (sscanf(line, "VideoPrefetchBudget=%d", &val_int) == 1) { setting->VideoPrefetchBudget = val_int; }
+        else if (sscanf(line, "PreviewAdaptive=%d", &val_int) == 1) { setting->PreviewAdaptive = val_int == 1; }
+        else if (sscanf(line, "ShowPlaybackStats=%d", &val_int) == 1) { setting->ShowPlaybackStats = val_int == 1; }
+        else if (sscanf(line, "ProxyEnabled=%d", &val_int) == 1) { setting->ProxyEnabled = val_int == 1; }
+        else if (sscanf(line, "PreviewRenderBudget=%d", &val_int) == 1) { setting->PreviewRenderBudget = val_int; }
         else if (sscanf(line, "AudioChannels=%d", &val_int) == 1) { setting->AudioChannels = val_int; }
         else if (sscanf(line, "AudioSampleRate=%d", &val_int) == 1) { setting->AudioSampleRate = val_int; }
         else if (sscanf(line, "AudioFormat=%d", &val_int) == 1) { setting->AudioFormat = val_int; }
@@ -10280,6 +10670,23 @@ static void MediaEditor_SetupContext(ImGuiContext* ctx, bool in_splash)
         else if (sscanf(line, "OutputVideoBitrateStrategyindex=%d", &val_int) == 1) { setting->OutputVideoBitrateStrategyindex = val_int; }
         else if (sscanf(line, "OutputVideoBitrate=%d", &val_int) == 1) { setting->OutputVideoBitrate = val_int; }
         else if (sscanf(line, "OutputVideoGOPSize=%d", &val_int) == 1) { setting->OutputVideoGOPSize = val_int; }
+        else if (sscanf(line, "OutputSegmentThreads=%d", &val_int) == 1) { setting->OutputSegmentThreads = val_int; }
+        else if (sscanf(line, "OutputSmartRender=%d", &val_int) == 1) { setting->OutputSmartRender = val_int == 1; }
+        else if (sscanf(line, "OutputRenderCache=%d", &val_int) == 1) { setting->OutputRenderCache = val_int == 1; }
+        else if (sscanf(line, "OutputResumable=%d", &val_int) == 1) { setting->OutputResumable = val_int == 1; }
+        else if (sscanf(line, "OutputAutoTune=%d", &val_int) == 1) { setting->OutputAutoTune = val_int == 1; }
+        else if (sscanf(line, "OutputQueueJobThreads=%d", &val_int) == 1) { setting->OutputQueueJobThreads = val_int; }
+        else if (sscanf(line, "OutputWriteStats=%d", &val_int) == 1) { setting->OutputWriteStats = val_int == 1; }
+        else if (sscanf(line, "OutputWriteHashes=%d", &val_int) == 1) { setting->OutputWriteHashes = val_int == 1; }
+        else if (sscanf(line, "OutputPreviewRate=%f", &val_float) == 1) { setting->OutputPreviewRate = isnan(val_float) ? 2.f : val_float; }
+        else if (sscanf(line, "OutputRendition%d=%d,%d", &val_int, &val_rendition[0], &val_rendition[1]) == 3)
+        {
+            if (val_int >= 0 && val_int < IM_ARRAYSIZE(setting->OutputRenditionDivisor))
+            {
+                setting->OutputRenditionDivisor[val_int] = val_rendition[0];
+                setting->OutputRenditionBitrate[val_int] = val_rendition[1];
+            }
+        }
         else if (sscanf(line, "OutputVideoBFrames=%d", &val_int) == 1) { setting->OutputVideoBFrames = val_int; }
         else if (sscanf(line, "OutputAudioCodecIndex=%d", &val_int) == 1) { setting->OutputAudioCodecIndex = val_int; }
         else if (sscanf(line, "OutputAudioCodecTypeIndex=%d", &val_int) == 1) { setting->OutputAudioCodecTypeIndex = val_int; }
@@ -10320,6 +10727,11 @@ static void MediaEditor_SetupContext(ImGuiContext* ctx, bool in_splash)
         out_buf->appendf("ColorSpaceIndex=%d\n", g_media_editor_settings.ColorSpaceIndex);
         out_buf->appendf("ColorTransferIndex=%d\n", g_media_editor_settings.ColorTransferIndex);
         out_buf->appendf("VideoFrameCache=%d\n", g_media_editor_settings.VideoFrameCacheSize);
+        out_buf->appendf("VideoPrefetchBudget=%d\n", g_media_editor_settings.VideoPrefetchBudget);
+        out_buf->appendf("PreviewAdaptive=%d\n", g_media_editor_settings.PreviewAdaptive ? 1 : 0);
+        out_buf->appendf("ShowPlaybackStats=%d\n", g_media_editor_settings.ShowPlaybackStats ? 1 : 0);
+        out_buf->appendf("ProxyEnabled=%d\n", g_media_editor_settings.ProxyEnabled ? 1 : 0);
+        out_buf->appendf("PreviewRenderBudget=%d\n", g_media_editor_settings.PreviewRenderBudget);
         out_buf->appendf("AudioChannels=%d\n", g_media_editor_settings.AudioChannels);
         out_buf->appendf("AudioSampleRate=%d\n", g_media_editor_settings.AudioSampleRate);
         out_buf->appendf("AudioFormat=%d\n", g_media_editor_settings.AudioFormat);
@@ -10398,6 +10810,17 @@ static void MediaEditor_SetupContext(ImGuiContext* ctx, bool in_splash)
         out_buf->appendf("OutputVideoBitrateStrategyindex=%d\n", g_media_editor_settings.OutputVideoBitrateStrategyindex);
         out_buf->appendf("OutputVideoBitrate=%d\n", g_media_editor_settings.OutputVideoBitrate);
         out_buf->appendf("OutputVideoGOPSize=%d\n", g_media_editor_settings.OutputVideoGOPSize);
+        out_buf->appendf("OutputSegmentThreads=%d\n", g_media_editor_settings.OutputSegmentThreads);
+        out_buf->appendf("OutputSmartRender=%d\n", g_media_editor_settings.OutputSmartRender ? 1 : 0);
+        out_buf->appendf("OutputRenderCache=%d\n", g_media_editor_settings.OutputRenderCache ? 1 : 0);
+        out_buf->appendf("OutputResumable=%d\n", g_media_editor_settings.OutputResumable ? 1 : 0);
+        out_buf->appendf("OutputAutoTune=%d\n", g_media_editor_settings.OutputAutoTune ? 1 : 0);
+        out_buf->appendf("OutputQueueJobThreads=%d\n", g_media_editor_settings.OutputQueueJobThreads);
+        out_buf->appendf("OutputWriteStats=%d\n", g_media_editor_settings.OutputWriteStats ? 1 : 0);
+        out_buf->appendf("OutputWriteHashes=%d\n", g_media_editor_settings.OutputWriteHashes ? 1 : 0);
+        out_buf->appendf("OutputPreviewRate=%f\n", g_media_editor_settings.OutputPreviewRate);
+        for (int i = 0; i < IM_ARRAYSIZE(g_media_editor_settings.OutputRenditionDivisor); i++)
+            out_buf->appendf("OutputRendition%d=%d,%d\n", i, g_media_editor_settings.OutputRenditionDivisor[i], g_media_editor_settings.OutputRenditionBitrate[i]);
         out_buf->appendf("OutputVideoBFrames=%d\n", g_media_editor_settings.OutputVideoBFrames);
         out_buf->appendf("OutputAudioCodecIndex=%d\n", g_media_editor_settings.OutputAudioCodecIndex);
         out_buf->appendf("OutputAudioCodecTypeIndex=%d\n", g_media_editor_settings.OutputAudioCodecTypeIndex);
@@ -10513,6 +10936,7 @@ static void MediaEditor_Initialize(void** handle)
 
 static void MediaEditor_Finalize(void** handle)
 {
+    if (g_export_queue) { delete g_export_queue; g_export_queue = nullptr; }
     if (timeline) { delete timeline; timeline = nullptr; }
 #if IMGUI_VULKAN_SHADER
     if (m_histogram) { delete m_histogram; m_histogram = nullptr; }
@@ -10566,6 +10990,18 @@ static bool MediaEditor_Frame(void * handle, bool app_will_quit)
     auto platform_io = ImGui::GetPlatformIO();
     bool is_splitter_hold = false;
     if (!timeline) return app_will_quit;
+    // queued jobs need the plugins, so the export queue starts after plugin loading
+    if (!g_export_queue && g_plugin_loaded)
+    {
+        ImGuiIO& io = ImGui::GetIO();
+        g_export_queue_dir = io.IniFilename ? ImGuiHelper::path_parent(io.IniFilename) : std::string();
+        g_export_queue = new MEC::ExportJobQueue(g_plugin_path, g_export_queue_dir+"Media_Editor_ExportQueue.json");
+    }
+    if (!g_project_loading)
+    {
+        timeline->UpdateProxyMedia();
+        timeline->UpdatePreviewRender();
+    }
     ImGuiContext& g = *GImGui;
     if (!g_media_editor_settings.UILanguage.empty() && g.LanguageName != g_media_editor_settings.UILanguage)
         g.LanguageName = g_media_editor_settings.UILanguage;
@@ -10682,6 +11118,12 @@ static bool MediaEditor_Frame(void * handle, bool app_will_quit)
                 timeline->mPreviewScale = g_media_editor_settings.PreviewScale;
                 timeline->mFrameRate = g_media_editor_settings.VideoFrameRate;
                 timeline->mMaxCachedVideoFrame = g_media_editor_settings.VideoFrameCacheSize > 0 ? g_media_editor_settings.VideoFrameCacheSize : MAX_VIDEO_CACHE_FRAMES;
+                timeline->mPrefetchBudgetMB = g_media_editor_settings.VideoPrefetchBudget;
+                timeline->mPreviewAdaptive = g_media_editor_settings.PreviewAdaptive;
+                timeline->bShowPlaybackStats = g_media_editor_settings.ShowPlaybackStats;
+                timeline->mPreviewRenderBudgetMB = g_media_editor_settings.PreviewRenderBudget;
+                timeline->InvalidatePrefetch();
+                timeline->SetProxyEnabled(g_media_editor_settings.ProxyEnabled);
                 timeline->mAudioSampleRate = g_media_editor_settings.AudioSampleRate;
                 timeline->mAudioChannels = g_media_editor_settings.AudioChannels;
                 timeline->mAudioFormat = (MediaCore::AudioRender::PcmFormat)g_media_editor_settings.AudioFormat;
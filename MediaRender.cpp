@@ -0,0 +1,566 @@
+/*
+    Copyright (c) 2023 CodeWin
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+// Headless command line render, load a project and export it without window, texture or audio device.
+//   mec-render [options] project.mep
+// Progress is printed to stdout as one json object per line, to stderr if stdout carries the raw stream.
+// Started with '--worker', it renders segments for other mec-render processes, see MEC::RenderWorkerServer.
+//   mec-render --compare-hashes a.hash b.hash
+// compares two frame hash sidecars written by '--hash', exits with 3 if the renderings diverge.
+
+#include <imgui.h>
+#include <imgui_helper.h>
+#include <imgui_json.h>
+#if IMGUI_VULKAN_SHADER
+#include <ImVulkanShader.h>
+#endif
+#include "MediaTimeline.h"
+#include "MediaEncoder.h"
+#include "ExportUtils.h"
+#include "ExportJobQueue.h"
+#include "RenderWorker.h"
+#include "Logger.h"
+#include <iostream>
+#include <sstream>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <getopt.h>
+
+using namespace MediaTimeline;
+
+static volatile std::sig_atomic_t g_interrupted = 0;
+
+static void OnInterrupt(int)
+{
+    g_interrupted = 1;
+}
+
+struct RenditionOptions
+{
+    uint32_t width {0};
+    uint32_t height {0};
+    uint64_t videoBitrate {0};              // scaled from the main output bitrate if 0
+    std::string videoCodec;                 // same as the main output if empty
+};
+
+struct RenderOptions
+{
+    std::string projectPath;
+    std::string outputPath;
+    std::string pluginPath;
+    std::string videoCodec;                 // codec hint, use project setting if empty
+    std::string audioCodec;                 // codec hint, use project setting if empty
+    std::string statsPath;                  // per-stage timing summary, not written if empty
+    std::string hashPath;                   // per-frame content hashes, not written if empty
+    std::string compareHashPath;            // compare this frame hash sidecar with the positional one, no rendering
+    std::string cacheDir;                   // segment render cache, disabled if empty
+    std::string tuneCachePath;              // encoder auto-tuning cache, default is '$HOME/.mec-encoder-tune.json'
+    std::string rawPixelFormat;             // stream raw frames and PCM instead of encoding if not empty
+    std::string rawSampleFormat {"f32le"};
+    int64_t rangeStart {-1};                // millisecond
+    int64_t rangeEnd {-1};                  // millisecond
+    uint32_t width {0};
+    uint32_t height {0};
+    uint64_t videoBitrate {0};
+    uint64_t audioBitrate {128000};
+    int segmentThreads {0};
+    int gopSize {12};
+    bool smartRender {false};
+    bool resumable {false};
+    bool autoTune {false};
+    int progressInterval {500};             // millisecond
+    bool hwAccel {false};
+    std::vector<RenditionOptions> renditions;
+    std::vector<std::string> workers;       // render workers the segments are sent to
+    std::string workerAddress;              // run as render worker listening here if not empty
+    bool allowRemote {false};               // the render worker may listen on a non-loopback address
+    std::string workDir;                    // where a render worker keeps the segment it's rendering
+};
+
+static void PrintUsage(const char* name)
+{
+    std::cerr << "Usage: " << name << " [options] project.mep" << std::endl
+        << "  -o, --out <file>              output media file, default is the output setting of the project" << std::endl
+        << "                                a .png/.tif/.exr file is exported as numbered image sequence" << std::endl
+        << "  -r, --range <in:out>          export range in seconds, e.g. 10.5:30" << std::endl
+        << "  -p, --plugin_dir <dir>        blueprint plugin directory" << std::endl
+        << "      --vcodec <name>           video codec hint, e.g. h264, hevc" << std::endl
+        << "      --acodec <name>           audio codec hint, e.g. aac" << std::endl
+        << "      --size <WxH>              output video size, default is the timeline size" << std::endl
+        << "      --vbitrate <bps>          video bitrate" << std::endl
+        << "      --abitrate <bps>          audio bitrate" << std::endl
+        << "      --segment-threads <n>     encode GOP aligned segments concurrently" << std::endl
+        << "      --gop <n>                 GOP size in frames used by the segmented encoding" << std::endl
+        << "      --smart-render            copy the packets of untouched clips without re-encoding" << std::endl
+        << "      --rendition <WxH[,bps[,vcodec]]>" << std::endl
+        << "                                encode another output from the same composition, saved as" << std::endl
+        << "                                '<out name>.<H>p.<ext>', can be repeated, not with the segmented encoding" << std::endl
+        << "      --cache-dir <dir>         reuse the rendered segments whose inputs are unchanged" << std::endl
+        << "      --resume                  keep the finished segments and '<out>.journal' if the export fails or is" << std::endl
+        << "                                interrupted, running it again resumes from them" << std::endl
+        << "      --auto-tune               measure the encoder thread settings on a slice of the project and use the" << std::endl
+        << "                                fastest one keeping the quality of the defaults, the choice is cached per" << std::endl
+        << "                                encoder, size, bitrate, preset and core count" << std::endl
+        << "      --tune-cache <file>       encoder auto-tuning cache, default is '$HOME/.mec-encoder-tune.json'" << std::endl
+        << "      --stats <file>            write the per-stage timing summary as json" << std::endl
+        << "      --hash <file>             write the content hash of every composed frame and audio block, it can't be" << std::endl
+        << "                                used with --smart-render, --cache-dir, --resume or --workers" << std::endl
+        << "      --compare-hashes <file>   compare with the hash file given as positional argument and report" << std::endl
+        << "                                the first diverging frame, nothing is rendered" << std::endl
+        << "      --raw <pixfmt>            stream raw frames and PCM to the output instead of encoding, '-o -' is stdout" << std::endl
+        << "                                pixfmt is rgba, bgra, rgb24, rgba64le or rgbaf32le" << std::endl
+        << "      --raw-audio <smpfmt>      PCM sample format of the raw stream, f32le(default) or s16le" << std::endl
+        << "      --workers <addr,...>       render the segments by the worker processes at '[host:]port', host is" << std::endl
+        << "                                127.0.0.1 if omitted, and concatenate them here" << std::endl
+        << "      --worker <[host:]port>    run as render worker without project, serve one segment at a time" << std::endl
+        << "      --allow-remote            let the render worker listen on a non-loopback address, anyone reaching" << std::endl
+        << "                                it can have the worker read and write files with its permissions" << std::endl
+        << "      --work-dir <dir>          temporary directory of the render worker" << std::endl
+        << "      --interval <ms>           progress report interval" << std::endl
+        << "      --hwaccel                 enable hardware decoding" << std::endl;
+}
+
+static bool ParseOptions(int argc, char** argv, RenderOptions& options)
+{
+    enum { OPT_VCODEC = 256, OPT_ACODEC, OPT_SIZE, OPT_VBITRATE, OPT_ABITRATE, OPT_SEGMENT_THREADS, OPT_GOP, OPT_INTERVAL, OPT_HWACCEL, OPT_SMART_RENDER, OPT_STATS, OPT_RENDITION, OPT_CACHE_DIR, OPT_RAW, OPT_RAW_AUDIO, OPT_WORKERS, OPT_WORKER, OPT_ALLOW_REMOTE, OPT_WORK_DIR, OPT_RESUME, OPT_HASH, OPT_COMPARE_HASHES, OPT_AUTO_TUNE, OPT_TUNE_CACHE };
+    static struct option long_options[] = {
+        { "out", required_argument, NULL, 'o' },
+        { "range", required_argument, NULL, 'r' },
+        { "plugin_dir", required_argument, NULL, 'p' },
+        { "vcodec", required_argument, NULL, OPT_VCODEC },
+        { "acodec", required_argument, NULL, OPT_ACODEC },
+        { "size", required_argument, NULL, OPT_SIZE },
+        { "vbitrate", required_argument, NULL, OPT_VBITRATE },
+        { "abitrate", required_argument, NULL, OPT_ABITRATE },
+        { "segment-threads", required_argument, NULL, OPT_SEGMENT_THREADS },
+        { "gop", required_argument, NULL, OPT_GOP },
+        { "interval", required_argument, NULL, OPT_INTERVAL },
+        { "hwaccel", no_argument, NULL, OPT_HWACCEL },
+        { "smart-render", no_argument, NULL, OPT_SMART_RENDER },
+        { "stats", required_argument, NULL, OPT_STATS },
+        { "rendition", required_argument, NULL, OPT_RENDITION },
+        { "cache-dir", required_argument, NULL, OPT_CACHE_DIR },
+        { "raw", required_argument, NULL, OPT_RAW },
+        { "raw-audio", required_argument, NULL, OPT_RAW_AUDIO },
+        { "workers", required_argument, NULL, OPT_WORKERS },
+        { "worker", required_argument, NULL, OPT_WORKER },
+        { "allow-remote", no_argument, NULL, OPT_ALLOW_REMOTE },
+        { "work-dir", required_argument, NULL, OPT_WORK_DIR },
+        { "resume", no_argument, NULL, OPT_RESUME },
+        { "hash", required_argument, NULL, OPT_HASH },
+        { "compare-hashes", required_argument, NULL, OPT_COMPARE_HASHES },
+        { "auto-tune", no_argument, NULL, OPT_AUTO_TUNE },
+        { "tune-cache", required_argument, NULL, OPT_TUNE_CACHE },
+        { "help", no_argument, NULL, 'h' },
+        { 0, 0, 0, 0 }
+    };
+    int o = -1;
+    int option_index = 0;
+    while ((o = getopt_long(argc, argv, "o:r:p:h", long_options, &option_index)) != -1)
+    {
+        switch (o)
+        {
+            case 'o': options.outputPath = std::string(optarg); break;
+            case 'r':
+            {
+                double in = 0, out = 0;
+                if (sscanf(optarg, "%lf:%lf", &in, &out) != 2 || in < 0 || out <= in)
+                {
+                    std::cerr << "Invalid range '" << optarg << "'!" << std::endl;
+                    return false;
+                }
+                options.rangeStart = (int64_t)(in * 1000);
+                options.rangeEnd = (int64_t)(out * 1000);
+                break;
+            }
+            case 'p': options.pluginPath = std::string(optarg); break;
+            case OPT_VCODEC: options.videoCodec = std::string(optarg); break;
+            case OPT_ACODEC: options.audioCodec = std::string(optarg); break;
+            case OPT_SIZE:
+                if (sscanf(optarg, "%ux%u", &options.width, &options.height) != 2)
+                {
+                    std::cerr << "Invalid size '" << optarg << "'!" << std::endl;
+                    return false;
+                }
+                break;
+            case OPT_VBITRATE: options.videoBitrate = std::stoull(optarg); break;
+            case OPT_ABITRATE: options.audioBitrate = std::stoull(optarg); break;
+            case OPT_SEGMENT_THREADS: options.segmentThreads = std::stoi(optarg); break;
+            case OPT_GOP: options.gopSize = std::stoi(optarg); break;
+            case OPT_INTERVAL: options.progressInterval = std::stoi(optarg); break;
+            case OPT_HWACCEL: options.hwAccel = true; break;
+            case OPT_SMART_RENDER: options.smartRender = true; break;
+            case OPT_RESUME: options.resumable = true; break;
+            case OPT_AUTO_TUNE: options.autoTune = true; break;
+            case OPT_TUNE_CACHE: options.tuneCachePath = std::string(optarg); break;
+            case OPT_STATS: options.statsPath = std::string(optarg); break;
+            case OPT_HASH: options.hashPath = std::string(optarg); break;
+            case OPT_COMPARE_HASHES: options.compareHashPath = std::string(optarg); break;
+            case OPT_CACHE_DIR: options.cacheDir = std::string(optarg); break;
+            case OPT_RAW:
+                options.rawPixelFormat = std::string(optarg);
+                if (!MEC::RawStreamWriter::IsSupportedPixelFormat(options.rawPixelFormat))
+                {
+                    std::cerr << "Invalid raw pixel format '" << optarg << "'!" << std::endl;
+                    return false;
+                }
+                break;
+            case OPT_RAW_AUDIO: options.rawSampleFormat = std::string(optarg); break;
+            case OPT_WORKERS:
+            {
+                std::istringstream iss(optarg);
+                std::string address;
+                while (std::getline(iss, address, ','))
+                {
+                    if (!address.empty())
+                        options.workers.push_back(address);
+                }
+                break;
+            }
+            case OPT_WORKER: options.workerAddress = std::string(optarg); break;
+            case OPT_ALLOW_REMOTE: options.allowRemote = true; break;
+            case OPT_WORK_DIR: options.workDir = std::string(optarg); break;
+            case OPT_RENDITION:
+            {
+                RenditionOptions rendition;
+                char codec[64] = {0};
+                unsigned long long bitrate = 0;
+                int fields = sscanf(optarg, "%ux%u,%llu,%63s", &rendition.width, &rendition.height, &bitrate, codec);
+                if (fields < 2 || rendition.width == 0 || rendition.height == 0)
+                {
+                    std::cerr << "Invalid rendition '" << optarg << "'!" << std::endl;
+                    return false;
+                }
+                rendition.videoBitrate = bitrate;
+                rendition.videoCodec = std::string(codec);
+                options.renditions.push_back(rendition);
+                break;
+            }
+            default: return false;
+        }
+    }
+    if (optind >= argc && options.workerAddress.empty())
+    {
+        std::cerr << (options.compareHashPath.empty() ? "No project file is specified!" : "No hash file to compare is specified!") << std::endl;
+        return false;
+    }
+    // the segmented encoding only concatenates the main output
+    if (!options.renditions.empty() && (options.segmentThreads > 1 || options.smartRender || !options.cacheDir.empty() || options.resumable || !options.workers.empty()))
+    {
+        std::cerr << "--rendition can't be used with --segment-threads, --smart-render, --cache-dir, --resume or --workers!" << std::endl;
+        return false;
+    }
+    if (optind < argc)
+        options.projectPath = std::string(argv[optind]);
+    if (options.workDir.empty())
+    {
+        const char* tmpDir = std::getenv("TMPDIR");
+        options.workDir = tmpDir && tmpDir[0] ? std::string(tmpDir) : std::string("/tmp");
+    }
+    if (options.tuneCachePath.empty())
+    {
+        const char* homeDir = std::getenv("HOME");
+        if (homeDir && homeDir[0])
+            options.tuneCachePath = std::string(homeDir) + "/.mec-encoder-tune.json";
+    }
+    if (options.pluginPath.empty())
+        options.pluginPath = ImGuiHelper::path_parent(ImGuiHelper::exec_path()) + "plugins";
+    if (options.progressInterval < 10)
+        options.progressInterval = 10;
+    return true;
+}
+
+static void LoadPlugins(const std::string& pluginPath)
+{
+    std::vector<std::string> plugin_paths;
+    plugin_paths.push_back(pluginPath);
+    int index = 0;
+    std::string message;
+    float percentage = 0;
+    int plugins = BluePrint::BluePrintUI::CheckPlugins(plugin_paths);
+    BluePrint::BluePrintUI::LoadPlugins(plugin_paths, index, message, percentage, plugins);
+}
+
+static bool FindEncoderName(const std::string& codecHint, std::string& codecName)
+{
+    std::vector<MediaCore::MediaEncoder::Description> encDescList;
+    if (!MediaCore::MediaEncoder::FindEncoder(codecHint, encDescList) || encDescList.empty())
+    {
+        std::cerr << "CANNOT find encoder for codec '" << codecHint << "'!" << std::endl;
+        return false;
+    }
+    codecName = encDescList[0].codecName;
+    return true;
+}
+
+static void PrintProgress(const std::string& status, TimeLine* timeline, double elapsed, bool withStages = false)
+{
+    const double encoded = timeline->mEncodingProgress * timeline->mEncodingDuration;
+    std::ostringstream oss;
+    oss << std::fixed;
+    oss.precision(4);
+    oss << "{\"status\":\"" << status << "\",\"progress\":" << timeline->mEncodingProgress
+        << ",\"encoded\":" << encoded << ",\"duration\":" << timeline->mEncodingDuration
+        << ",\"elapsed\":" << elapsed << ",\"speed\":" << (elapsed > 0 ? encoded / elapsed : 0);
+    oss << ",\"bottleneck\":\"" << TimeLine::GetEncodeStageName(timeline->GetEncodeBottleneckStage()) << "\"";
+    if (withStages)
+        oss << ",\"stages\":" << timeline->GetEncodeStageSummary()["stages"].dump();
+    if (!timeline->mEncodeProcErrMsg.empty())
+    {
+        auto errMsg = timeline->mEncodeProcErrMsg;
+        std::string escaped;
+        for (auto c : errMsg)
+        {
+            if (c == '"' || c == '\\') escaped.push_back('\\');
+            escaped.push_back(c);
+        }
+        oss << ",\"error\":\"" << escaped << "\"";
+    }
+    oss << "}";
+    std::cout << oss.str() << std::endl;
+}
+
+static int CompareHashes(const std::string& path1, const std::string& path2)
+{
+    MEC::FrameHashDiff diff;
+    std::string errMsg;
+    if (!MEC::CompareFrameHashes(path1, path2, diff, errMsg))
+    {
+        std::cerr << errMsg << std::endl;
+        return 1;
+    }
+    std::cout << "{\"status\":\"" << (diff.Identical() ? "identical" : "diverged") << "\""
+        << ",\"video_frames\":[" << diff.videoFrames[0] << "," << diff.videoFrames[1] << "]"
+        << ",\"audio_blocks\":[" << diff.audioBlocks[0] << "," << diff.audioBlocks[1] << "]"
+        << ",\"first_video_diff\":" << diff.firstVideoDiff << ",\"first_video_pts\":" << diff.firstVideoPts
+        << ",\"first_audio_diff\":" << diff.firstAudioDiff << ",\"first_audio_pts\":" << diff.firstAudioPts << "}" << std::endl;
+    return diff.Identical() ? 0 : 3;
+}
+
+static int RunWorker(const RenderOptions& options)
+{
+    MEC::RenderWorkerServer server(options.pluginPath, options.workDir);
+    std::string errMsg;
+    if (!server.Listen(options.workerAddress, options.allowRemote, errMsg))
+    {
+        std::cerr << errMsg << std::endl;
+        return 1;
+    }
+#if !defined(_WIN32)
+    // a coordinator gone away fails the send instead of killing the worker
+    std::signal(SIGPIPE, SIG_IGN);
+#endif
+    std::signal(SIGINT, OnInterrupt);
+    std::signal(SIGTERM, OnInterrupt);
+    std::cout << "{\"status\":\"listening\",\"address\":\"" << options.workerAddress << "\"}" << std::endl;
+    int64_t servedCount = 0;
+    while (!g_interrupted)
+    {
+        if (!server.ServeOne(options.progressInterval))
+        {
+            std::cerr << "Render worker FAILED to accept connection!" << std::endl;
+            return 1;
+        }
+        if (server.GetServedCount() != servedCount)
+        {
+            servedCount = server.GetServedCount();
+            std::cout << "{\"status\":\"served\",\"segments\":" << servedCount << "}" << std::endl;
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    RenderOptions options;
+    if (!ParseOptions(argc, argv, options))
+    {
+        PrintUsage(argv[0]);
+        return 1;
+    }
+
+    // comparing needs neither GPU nor plugins
+    if (!options.compareHashPath.empty())
+        return CompareHashes(options.compareHashPath, options.projectPath);
+
+    ImGui::CreateContext();
+#if IMGUI_VULKAN_SHADER
+    ImGui::create_gpu_instance();
+#endif
+    LoadPlugins(options.pluginPath);
+
+    if (!options.workerAddress.empty())
+    {
+        int ret = RunWorker(options);
+#if IMGUI_VULKAN_SHADER
+        ImGui::destroy_gpu_instance();
+#endif
+        ImGui::DestroyContext();
+        return ret;
+    }
+
+    int ret = 0;
+    TimeLine* timeline = new TimeLine(options.pluginPath, true);
+    timeline->mHardwareCodec = options.hwAccel;
+    do {
+        std::string errMsg;
+        if (!MEC::LoadProject(timeline, options.projectPath, errMsg))
+        {
+            std::cerr << errMsg << std::endl;
+            ret = 1;
+            break;
+        }
+        if (options.rangeStart >= 0)
+        {
+            timeline->mark_in = options.rangeStart;
+            timeline->mark_out = options.rangeEnd;
+            timeline->mEncodingInRange = true;
+        }
+        if (options.outputPath.empty())
+            options.outputPath = timeline->mOutputPath + "/" + timeline->mOutputName + ".mp4";
+
+        // a raw stream has no encoder
+        const bool rawStream = !options.rawPixelFormat.empty();
+        TimeLine::VideoEncoderParams vidEncParams;
+        if (!rawStream && !FindEncoderName(options.videoCodec.empty() ? timeline->mVideoCodec : options.videoCodec, vidEncParams.codecName))
+        {
+            ret = 1;
+            break;
+        }
+        vidEncParams.width = options.width > 0 ? options.width : timeline->mWidth;
+        vidEncParams.height = options.height > 0 ? options.height : timeline->mHeight;
+        vidEncParams.frameRate = timeline->mFrameRate;
+        vidEncParams.bitRate = options.videoBitrate > 0 ? options.videoBitrate :
+                (int64_t)vidEncParams.width * (int64_t)vidEncParams.height * (int64_t)vidEncParams.frameRate.num / (int64_t)vidEncParams.frameRate.den / 10;
+        TimeLine::AudioEncoderParams audEncParams;
+        if (!rawStream && !FindEncoderName(options.audioCodec.empty() ? timeline->mAudioCodec : options.audioCodec, audEncParams.codecName))
+        {
+            ret = 1;
+            break;
+        }
+        audEncParams.channels = timeline->mAudioChannels;
+        audEncParams.sampleRate = timeline->mAudioSampleRate;
+        audEncParams.bitRate = options.audioBitrate;
+
+        if (timeline->ValidDuration() <= 0)
+        {
+            std::cerr << "Nothing to render in project '" << options.projectPath << "'!" << std::endl;
+            ret = 1;
+            break;
+        }
+        timeline->mEncodingSegmentThreads = options.segmentThreads;
+        timeline->mEncodingGopSize = options.gopSize;
+        timeline->mEncodingSmartRender = options.smartRender;
+        timeline->mEncodingStatsPath = options.statsPath;
+        timeline->mEncodingHashPath = options.hashPath;
+        timeline->mEncodingCacheDir = options.cacheDir;
+        timeline->mEncodingRemoteWorkers = options.workers;
+        timeline->mEncodingResumable = options.resumable;
+        timeline->mEncodingPreviewRate = 0;     // nobody shows the preview
+        // segments are encoded concurrently, so the per-encoder threading isn't what limits the throughput there
+        if (options.autoTune && !rawStream && MEC::GetImageSequenceCodec(options.outputPath).empty() &&
+            options.segmentThreads <= 1 && options.workers.empty() && !options.smartRender)
+        {
+            if (!timeline->TuneVideoEncoder(options.outputPath, vidEncParams, options.tuneCachePath, errMsg))
+            {
+                std::cerr << "Encoder auto-tuning is skipped! " << errMsg << std::endl;
+                errMsg.clear();
+            }
+        }
+        if (rawStream)
+        {
+#if !defined(_WIN32)
+            // a closed reader fails the write instead of killing the process
+            std::signal(SIGPIPE, SIG_IGN);
+#endif
+            if (!timeline->ConfigRawStreamOutput(options.outputPath, options.rawPixelFormat, options.rawSampleFormat, vidEncParams, audEncParams, errMsg))
+            {
+                std::cerr << "FAILED to open raw stream! " << errMsg << std::endl;
+                ret = 1;
+                break;
+            }
+        }
+        else if (!timeline->ConfigEncoder(options.outputPath, vidEncParams, audEncParams, errMsg))
+        {
+            std::cerr << "FAILED to configure encoder! " << errMsg << std::endl;
+            ret = 1;
+            break;
+        }
+        for (auto& rendition : options.renditions)
+        {
+            TimeLine::VideoEncoderParams renditionVidParams = vidEncParams;
+            if (!rendition.videoCodec.empty() && !FindEncoderName(rendition.videoCodec, renditionVidParams.codecName))
+            {
+                ret = 1;
+                break;
+            }
+            renditionVidParams.width = rendition.width;
+            renditionVidParams.height = rendition.height;
+            renditionVidParams.bitRate = rendition.videoBitrate > 0 ? rendition.videoBitrate :
+                    vidEncParams.bitRate * rendition.width * rendition.height / ((uint64_t)vidEncParams.width * vidEncParams.height);
+            const std::string renditionPath = MEC::MakeSegmentPath(options.outputPath, std::to_string(rendition.height)+"p");
+            if (!timeline->AddEncodeOutput(renditionPath, renditionVidParams, audEncParams, errMsg))
+            {
+                std::cerr << "FAILED to configure encoder for '" << renditionPath << "'! " << errMsg << std::endl;
+                ret = 1;
+                break;
+            }
+        }
+        if (ret != 0)
+            break;
+
+        std::signal(SIGINT, OnInterrupt);
+        std::signal(SIGTERM, OnInterrupt);
+        const double encodeStart = ImGui::get_current_time();
+        timeline->StartEncoding();
+        PrintProgress("start", timeline, 0);
+        while (timeline->mIsEncoding)
+        {
+            ImGui::sleep(options.progressInterval);
+            if (g_interrupted)
+            {
+                timeline->StopEncoding();
+                break;
+            }
+            PrintProgress("encoding", timeline, ImGui::get_current_time() - encodeStart);
+        }
+        timeline->StopEncoding();
+        const double elapsed = ImGui::get_current_time() - encodeStart;
+        if (g_interrupted)
+        {
+            PrintProgress("interrupted", timeline, elapsed, true);
+            ret = 2;
+        }
+        else if (!timeline->mEncodeProcErrMsg.empty())
+        {
+            PrintProgress("failed", timeline, elapsed, true);
+            ret = 1;
+        }
+        else
+        {
+            PrintProgress("done", timeline, elapsed, true);
+        }
+    } while (false);
+
+    delete timeline;
+#if IMGUI_VULKAN_SHADER
+    ImGui::destroy_gpu_instance();
+#endif
+    ImGui::DestroyContext();
+    return ret;
+}
@@ -23,7 +23,14 @@
 #include <cmath>
 #include <sstream>
 #include <iomanip>
+#include <map>
+#include <algorithm>
+#include <memory>
+#include <deque>
 #include "EventStackFilter.h"
+#include "ExportUtils.h"
+#include "ExportJobQueue.h"
+#include "RenderWorker.h"
 #include "SysUtils.h"
 #include "TextureManager.h"
 #include "Logger.h"
@@ -208,6 +215,8 @@ void MediaItem::ReleaseItem()
 {
     mMediaOverview = nullptr;
     mMediaThumbnail.clear();
+    mProxyPath.clear();
+    mProxyParser = nullptr;
     mSrcLength = 0;
     mValid = false;
 }
@@ -2067,6 +2076,27 @@ void VideoClip::SetViewWindowStart(int64_t millisec)
     }
 }
 
+bool VideoClip::GetNearestSnapshot(int64_t mediaTime, ImTextureID& texture, ImVec2& uvMin, ImVec2& uvMax)
+{
+    const MediaCore::Snapshot::Image* nearest = nullptr;
+    for (auto& img : mSnapImages)
+    {
+        if (!img.hDispData || !img.hDispData->mTextureReady || !img.hDispData->mhTx)
+            continue;
+        if (!nearest || std::abs(img.ssTimestampMs-mediaTime) < std::abs(nearest->ssTimestampMs-mediaTime))
+            nearest = &img;
+    }
+    if (!nearest)
+        return false;
+    auto hTx = nearest->hDispData->mhTx;
+    texture = hTx->TextureID();
+    auto roiRect = hTx->GetDisplayRoi();
+    RenderUtils::Vec2<float> uvMax2 = roiRect.lt+roiRect.Size();
+    uvMin = roiRect.lt;
+    uvMax = uvMax2;
+    return texture != nullptr;
+}
+
 void VideoClip::DrawContent(ImDrawList* drawList, const ImVec2& leftTop, const ImVec2& rightBottom, const ImRect& clipRect, bool updated)
 {
     if (IS_DUMMY(mType))
@@ -3068,6 +3098,13 @@ ImGui::ImMat BluePrintVideoTransition::MixTwoImages(const ImGui::ImMat& vmat1, c
     std::lock_guard<std::mutex> lk(mBpLock);
     if (mBp && mBp->Blueprint_IsExecutable())
     {
+        TimeLine * timeline = (TimeLine *)mHandle;
+        std::unique_ptr<MEC::ScopedStageTimer> stageTimer;
+        if (timeline && timeline->mIsEncoding)
+        {
+            stageTimer.reset(new MEC::ScopedStageTimer(timeline->mEncodeStageStatus[TimeLine::ENC_STAGE_VIDEO_TRANSITION].busyUs));
+            timeline->mEncodeStageStatus[TimeLine::ENC_STAGE_VIDEO_TRANSITION].processed++;
+        }
         // setup bp input curve
         for (int i = 0; i < mKeyPoints.GetCurveCount(); i++)
         {
@@ -5587,27 +5624,30 @@ int TimeLine::OnBluePrintChange(int type, std::string name, void* handle)
     return ret;
 }
 
-TimeLine::TimeLine(std::string plugin_path)
-    : mStart(0), mEnd(0), mPcmStream(this)
+TimeLine::TimeLine(std::string plugin_path, bool headless)
+    : mHeadless(headless), mStart(0), mEnd(0), mPcmStream(this)
 {
     std::srand(std::time(0)); // init std::rand
 
     mTxMgr = RenderUtils::TextureManager::GetDefaultInstance();
-    RenderUtils::Vec2<int32_t> snapshotGridTextureSize;
-    snapshotGridTextureSize = {64*16/9, 64};
-    if (!mTxMgr->CreateGridTexturePool(VIDEOITEM_OVERVIEW_GRID_TEXTURE_POOL_NAME, snapshotGridTextureSize, IM_DT_INT8, {8, 8}, 1))
-        Logger::Log(Logger::Error) << "FAILED to create grid texture pool '" << VIDEOITEM_OVERVIEW_GRID_TEXTURE_POOL_NAME << "'! Error is '" << mTxMgr->GetError() << "'." << std::endl;
-    snapshotGridTextureSize = {DEFAULT_VIDEO_TRACK_HEIGHT*16/9, DEFAULT_VIDEO_TRACK_HEIGHT};
-    if (!mTxMgr->CreateGridTexturePool(VIDEOCLIP_SNAPSHOT_GRID_TEXTURE_POOL_NAME, snapshotGridTextureSize, IM_DT_INT8, {8, 8}, 1))
-        Logger::Log(Logger::Error) << "FAILED to create grid texture pool '" << VIDEOCLIP_SNAPSHOT_GRID_TEXTURE_POOL_NAME << "'! Error is '" << mTxMgr->GetError() << "'." << std::endl;
-    snapshotGridTextureSize = {50*16/9, 50};
-    if (!mTxMgr->CreateGridTexturePool(EDITING_VIDEOCLIP_SNAPSHOT_GRID_TEXTURE_POOL_NAME, snapshotGridTextureSize, IM_DT_INT8, {8, 8}, 1))
-        Logger::Log(Logger::Error) << "FAILED to create grid texture pool '" << EDITING_VIDEOCLIP_SNAPSHOT_GRID_TEXTURE_POOL_NAME << "'! Error is '" << mTxMgr->GetError() << "'." << std::endl;
-
-    mAudioRender = MediaCore::AudioRender::CreateInstance();
-    if (mAudioRender)
-    {
-        mAudioRender->OpenDevice(mAudioSampleRate, mAudioChannels, mAudioFormat, &mPcmStream);
+    if (!mHeadless)
+    {
+        RenderUtils::Vec2<int32_t> snapshotGridTextureSize;
+        snapshotGridTextureSize = {64*16/9, 64};
+        if (!mTxMgr->CreateGridTexturePool(VIDEOITEM_OVERVIEW_GRID_TEXTURE_POOL_NAME, snapshotGridTextureSize, IM_DT_INT8, {8, 8}, 1))
+            Logger::Log(Logger::Error) << "FAILED to create grid texture pool '" << VIDEOITEM_OVERVIEW_GRID_TEXTURE_POOL_NAME << "'! Error is '" << mTxMgr->GetError() << "'." << std::endl;
+        snapshotGridTextureSize = {DEFAULT_VIDEO_TRACK_HEIGHT*16/9, DEFAULT_VIDEO_TRACK_HEIGHT};
+        if (!mTxMgr->CreateGridTexturePool(VIDEOCLIP_SNAPSHOT_GRID_TEXTURE_POOL_NAME, snapshotGridTextureSize, IM_DT_INT8, {8, 8}, 1))
+            Logger::Log(Logger::Error) << "FAILED to create grid texture pool '" << VIDEOCLIP_SNAPSHOT_GRID_TEXTURE_POOL_NAME << "'! Error is '" << mTxMgr->GetError() << "'." << std::endl;
+        snapshotGridTextureSize = {50*16/9, 50};
+        if (!mTxMgr->CreateGridTexturePool(EDITING_VIDEOCLIP_SNAPSHOT_GRID_TEXTURE_POOL_NAME, snapshotGridTextureSize, IM_DT_INT8, {8, 8}, 1))
+            Logger::Log(Logger::Error) << "FAILED to create grid texture pool '" << EDITING_VIDEOCLIP_SNAPSHOT_GRID_TEXTURE_POOL_NAME << "'! Error is '" << mTxMgr->GetError() << "'." << std::endl;
+
+        mAudioRender = MediaCore::AudioRender::CreateInstance();
+        if (mAudioRender)
+        {
+            mAudioRender->OpenDevice(mAudioSampleRate, mAudioChannels, mAudioFormat, &mPcmStream);
+        }
     }
 
     auto exec_path = ImGuiHelper::exec_path();
@@ -5624,6 +5664,40 @@ TimeLine::TimeLine(std::string plugin_path)
 
 TimeLine::~TimeLine()
 {
+    StopPreviewRender();
+    if (mPrefetchThread.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lk(mPrefetchLock);
+            mQuitPrefetch = true;
+            mPrefetchCv.notify_all();
+        }
+        mPrefetchThread.join();
+    }
+    mPrefetchReader = nullptr;
+    mPrefetchCache.Clear();
+    if (mPreviewThread.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lk(mPreviewLock);
+            mQuitPreview = true;
+            mPreviewCv.notify_all();
+        }
+        mPreviewThread.join();
+    }
+    mPreviewReader = nullptr;
+    mPreviewMailbox.Clear();
+    if (mScrubThread.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lk(mScrubLock);
+            mQuitScrub = true;
+            mScrubCv.notify_all();
+        }
+        mScrubThread.join();
+    }
+    mScrubReader = nullptr;
+    mScrubMailbox.Clear();
     mMtvReader = nullptr;
     mMtaReader = nullptr;
     
@@ -6424,37 +6498,444 @@ void TimeLine::UpdateCurrent()
 void TimeLine::UpdatePreview(bool updateDuration)
 {
     mMtvReader->Refresh(updateDuration);
+    InvalidatePrefetch();
     mIsPreviewNeedUpdate = true;
 }
 
 void TimeLine::RefreshTrackView(const std::unordered_set<int64_t>& trackIds)
 {
     mMtvReader->RefreshTrackView(trackIds);
+    InvalidatePrefetch();
     mIsPreviewNeedUpdate = true;
 }
 
-std::vector<MediaCore::CorrelativeFrame> TimeLine::GetPreviewFrame()
+int64_t TimeLine::TimeToFrameIndex(int64_t time) const
 {
-    int64_t auddataPos, previewPos;
-    if (!bSeeking)
+    return (int64_t)round((double)time * mFrameRate.num / ((double)mFrameRate.den * 1000.0));
+}
+
+int64_t TimeLine::FrameIndexToTime(int64_t frameIndex) const
+{
+    return (int64_t)round((double)frameIndex * 1000 * mFrameRate.den / mFrameRate.num);
+}
+
+void TimeLine::InvalidatePrefetch()
+{
+    // the rendered preview chunks are checked against their hashes lazily
+    mPreviewRenderChunksDirty = true;
+    {
+        std::lock_guard<std::mutex> lk(mScrubLock);
+        mScrubGeneration++;
+        mScrubReader = nullptr;
+    }
+    // the cloned reader is a snapshot of the timeline, so it's dropped with the frames and cloned again on demand
+    std::lock_guard<std::mutex> lk(mPrefetchLock);
+    mPrefetchGeneration++;
+    mPrefetchReader = nullptr;
+    mPrefetchCache.Clear();
+    mPrefetchCv.notify_all();
+}
+
+void TimeLine::_PrefetchProc()
+{
+    // compose the frames ahead of the play head until the cache budget is full, nearest first. Backward, a
+    // long-GOP source would be decoded again from its key frame for every frame, so the frames are composed by
+    // blocks in forward order instead, and the block before it is prefetched next.
+    std::unique_lock<std::mutex> lk(mPrefetchLock);
+    while (!mQuitPrefetch)
     {
-        if (mPcmStream.GetTimestampMs(auddataPos))
+        if (!mPrefetchReader || !mPrefetchActive || mPrefetchCache.GetBudget() == 0)
         {
-            int64_t bufferedDur = mMtaReader->SizeToDuration(mAudioRender->GetBufferedDataSize());
-            previewPos = mIsPreviewForward ? auddataPos-bufferedDur : auddataPos+bufferedDur;
-            if (previewPos < 0) previewPos = 0;
+            mPrefetchCv.wait_for(lk, std::chrono::milliseconds(20));
+            continue;
         }
-        else
+        auto hReader = mPrefetchReader;
+        const int64_t generation = mPrefetchGeneration;
+        const bool forward = mPrefetchForward;
+        const int64_t stride = mPrefetchStride;
+        int64_t frameIndex = mPrefetchPlayhead/stride*stride;
+        while ((mPrefetchCache.Contains(frameIndex) || _IsRenderedPreviewFrame(mPrefetchRenderedChunks, frameIndex)) &&
+            frameIndex >= 0 && frameIndex <= mPrefetchEndIndex)
+            frameIndex += forward ? stride : -stride;
+        if (frameIndex < 0 || frameIndex > mPrefetchEndIndex)
+        {
+            mPrefetchCv.wait_for(lk, std::chrono::milliseconds(20));
+            continue;
+        }
+        // inside a rendered chunk the cores are left to the playback, only the frames after it are composed in time
+        if (_IsRenderedPreviewFrame(mPrefetchRenderedChunks, mPrefetchPlayhead) &&
+            std::abs(frameIndex-mPrefetchPlayhead) > PREVIEW_RENDER_CHUNK_FRAMES)
+        {
+            mPrefetchCv.wait_for(lk, std::chrono::milliseconds(20));
+            continue;
+        }
+        if (!forward && stride == 1)
+        {
+            _PrefetchReverseBlock(lk, hReader, generation, frameIndex);
+            continue;
+        }
+
+        lk.unlock();
+        std::vector<MediaCore::CorrelativeFrame> frames;
+        // shuttling composes every Nth frame without the precise seek, it's sampling by stride rather than a key frame
+        // only scan, so the decoders still go through the frames between the samples
+        bool readOk = hReader->ReadVideoFrameEx(FrameIndexToTime(frameIndex), frames, false, stride == 1) && !frames.empty() && !frames[0].frame.empty();
+        lk.lock();
+        if (!readOk)
+        {
+            mPrefetchCv.wait_for(lk, std::chrono::milliseconds(20));
+            continue;
+        }
+        // an edit during the composition makes the frame stale
+        if (generation != mPrefetchGeneration)
+            continue;
+        if (!mPrefetchCache.Put(frameIndex, frames))
+            mPrefetchCv.wait_for(lk, std::chrono::milliseconds(10));
+    }
+}
+
+void TimeLine::_UpdatePreviewScaler(int64_t frameIndex, bool missed)
+{
+    // a frame is reported once however many times the ui shows it, and the read-ahead needs a moment to fill
+    // after playback starts, those misses aren't counted
+    if (frameIndex == mPreviewScalerFrameIndex)
+        return;
+    mPreviewScalerFrameIndex = frameIndex;
+    if (PlayerClock::now()-mPlayTriggerTp < std::chrono::seconds(1))
+        return;
+    const int prevLevel = mPreviewScaler.GetLevel();
+    if (!mPreviewScaler.OnFrame(missed))
+        return;
+    Logger::Log(Logger::DEBUG) << "Preview scale level " << prevLevel << " => " << mPreviewScaler.GetLevel() << " at frame " << frameIndex << std::endl;
+    // the cached frames are shown at any size, only the reader is cloned again at the new scale
+    std::lock_guard<std::mutex> lk(mPrefetchLock);
+    mPrefetchReader = nullptr;
+}
+
+void TimeLine::_PrefetchReverseBlock(std::unique_lock<std::mutex>& lk, MediaCore::MultiTrackVideoReader::Holder hReader, int64_t generation, int64_t lastFrameIndex)
+{
+    // the block is aligned, so the playback crosses each one once, and is cut down to a half of the budget to keep
+    // the frames of the block being played while the previous block is composed
+    int64_t blockFrames = PREFETCH_REVERSE_BLOCK_FRAMES;
+    const size_t frameCount = mPrefetchCache.GetFrameCount();
+    const size_t frameBytes = frameCount > 0 ? mPrefetchCache.GetUsedBytes()/frameCount : 0;
+    if (frameBytes > 0)
+        blockFrames = std::max<int64_t>(std::min<int64_t>(blockFrames, mPrefetchCache.GetBudget()/2/frameBytes), 1);
+    const int64_t firstFrameIndex = lastFrameIndex/blockFrames*blockFrames;
+    for (int64_t frameIndex = firstFrameIndex; frameIndex <= lastFrameIndex; frameIndex++)
+    {
+        if (mQuitPrefetch || generation != mPrefetchGeneration || mPrefetchForward || !mPrefetchActive)
+            break;
+        if (mPrefetchCache.Contains(frameIndex) || _IsRenderedPreviewFrame(mPrefetchRenderedChunks, frameIndex))
+            continue;
+        lk.unlock();
+        std::vector<MediaCore::CorrelativeFrame> frames;
+        bool readOk = hReader->ReadVideoFrameEx(FrameIndexToTime(frameIndex), frames, false, true) && !frames.empty() && !frames[0].frame.empty();
+        lk.lock();
+        if (!readOk)
+        {
+            mPrefetchCv.wait_for(lk, std::chrono::milliseconds(20));
+            break;
+        }
+        if (generation != mPrefetchGeneration)
+            break;
+        // frames the play head has passed are useless
+        if (frameIndex > mPrefetchPlayhead)
+            continue;
+        mPrefetchCache.Put(frameIndex, frames);
+    }
+    if (mPrefetchCache.Contains(lastFrameIndex) || mQuitPrefetch)
+        return;
+    // the budget is full of nearer frames
+    mPrefetchCv.wait_for(lk, std::chrono::milliseconds(10));
+}
+
+bool TimeLine::StartPreviewRender(bool dirtyOnly)
+{
+    if (mPreviewRenderThread.joinable())
+        return false;
+    _RefreshPreviewRenderChunks();
+    std::vector<int64_t> chunkIndices;
+    const int64_t endFrame = TimeToFrameIndex(mEnd);
+    if (dirtyOnly)
+    {
+        chunkIndices.assign(mPreviewRenderDirtyChunks.begin(), mPreviewRenderDirtyChunks.end());
+    }
+    else
+    {
+        const int64_t startMs = mark_in >= 0 ? mark_in : 0;
+        const int64_t endMs = mark_out > startMs ? mark_out : mEnd;
+        const int64_t firstChunk = TimeToFrameIndex(startMs) / PREVIEW_RENDER_CHUNK_FRAMES;
+        const int64_t lastChunk = (TimeToFrameIndex(endMs)+PREVIEW_RENDER_CHUNK_FRAMES-1) / PREVIEW_RENDER_CHUNK_FRAMES;
+        for (int64_t chunkIdx = firstChunk; chunkIdx < lastChunk; chunkIdx++)
+        {
+            if (mPreviewRenderChunks.find(chunkIdx) == mPreviewRenderChunks.end())
+                chunkIndices.push_back(chunkIdx);
+        }
+    }
+    // the hashes are taken now, an edit during the rendering shows up as dirty chunks afterwards
+    std::vector<std::pair<int64_t, std::string>> chunks;
+    for (auto chunkIdx : chunkIndices)
+    {
+        if (chunkIdx*PREVIEW_RENDER_CHUNK_FRAMES < endFrame)
+            chunks.push_back({chunkIdx, _HashPreviewChunk(chunkIdx)});
+    }
+    if (chunks.empty())
+        return false;
+    mPreviewRenderCache.SetBudget((size_t)std::max(mPreviewRenderBudgetMB, 0) << 20);
+    auto hReader = mMtvReader->CloneAndConfigure(GetPreviewWidth(), GetPreviewHeight(), mFrameRate);
+    if (!hReader)
+        return false;
+    mQuitPreviewRender = false;
+    mPreviewRenderProgress = 0;
+    mIsPreviewRendering = true;
+    mPreviewRenderThread = std::thread(&TimeLine::_PreviewRenderProc, this, hReader, chunks, endFrame);
+    SysUtils::SetThreadName(mPreviewRenderThread, "TL-PrvRender");
+    return true;
+}
+
+void TimeLine::StopPreviewRender()
+{
+    mQuitPreviewRender = true;
+    if (mPreviewRenderThread.joinable())
+        mPreviewRenderThread.join();
+    mIsPreviewRendering = false;
+    UpdatePreviewRender();
+}
+
+void TimeLine::UpdatePreviewRender()
+{
+    {
+        std::lock_guard<std::mutex> lk(mPreviewRenderLock);
+        for (auto& result : mPreviewRenderResults)
+        {
+            mPreviewRenderChunks[result.first] = result.second;
+            mPreviewRenderDirtyChunks.erase(result.first);
+            mPreviewRenderChunksDirty = true;
+        }
+        mPreviewRenderResults.clear();
+    }
+    if (!mIsPreviewRendering && mPreviewRenderThread.joinable())
+        mPreviewRenderThread.join();
+    // hashing is cheap but not free, continuous edits like dragging a slider refresh the chunks a few times per second
+    if (mPreviewRenderChunksDirty && PlayerClock::now()-mPreviewRenderRefreshTp > std::chrono::milliseconds(200))
+        _RefreshPreviewRenderChunks();
+}
+
+bool TimeLine::GetRenderedPreviewFrame(int64_t frameIndex, std::vector<MediaCore::CorrelativeFrame>& frames)
+{
+    if (frameIndex < 0 || mPreviewRenderChunks.empty())
+        return false;
+    // the chunks are refreshed at the same rate as UpdatePreviewRender() does, until then they may be stale and count as misses
+    if (mPreviewRenderChunksDirty)
+    {
+        if (PlayerClock::now()-mPreviewRenderRefreshTp <= std::chrono::milliseconds(200))
+            return false;
+        _RefreshPreviewRenderChunks();
+    }
+    auto iter = mPreviewRenderChunks.find(frameIndex / PREVIEW_RENDER_CHUNK_FRAMES);
+    if (iter == mPreviewRenderChunks.end())
+        return false;
+    MediaCore::CorrelativeFrame frame;
+    if (!mPreviewRenderCache.GetFrame(iter->second, (int)(frameIndex % PREVIEW_RENDER_CHUNK_FRAMES), frame))
+        return false;
+    frames.clear();
+    frames.push_back(frame);
+    return true;
+}
+
+std::string TimeLine::_HashPreviewChunk(int64_t chunkIndex)
+{
+    const int64_t startFrame = chunkIndex*PREVIEW_RENDER_CHUNK_FRAMES;
+    const int64_t endFrame = startFrame+PREVIEW_RENDER_CHUNK_FRAMES;
+    MEC::ContentHasher hasher;
+    hasher.Add(std::string("mec-preview-v1"));
+    hasher.Add(startFrame);
+    hasher.Add((int64_t)GetPreviewWidth());
+    hasher.Add((int64_t)GetPreviewHeight());
+    hasher.Add((int64_t)mFrameRate.num);
+    hasher.Add((int64_t)mFrameRate.den);
+    _HashComposition(hasher, FrameIndexToTime(startFrame), FrameIndexToTime(endFrame), true);
+    return hasher.HexDigest();
+}
+
+void TimeLine::_RefreshPreviewRenderChunks()
+{
+    // an edited chunk turns dirty, unless its new composition was rendered before, e.g. after an undo
+    for (auto iter = mPreviewRenderChunks.begin(); iter != mPreviewRenderChunks.end();)
+    {
+        const std::string key = _HashPreviewChunk(iter->first);
+        if (key != iter->second && !mPreviewRenderCache.Contains(key))
+        {
+            mPreviewRenderDirtyChunks.insert(iter->first);
+            iter = mPreviewRenderChunks.erase(iter);
+            continue;
+        }
+        iter->second = key;
+        // dropped by the cache budget, it's unrendered but not dirty
+        if (!mPreviewRenderCache.Contains(key))
+        {
+            iter = mPreviewRenderChunks.erase(iter);
+            continue;
+        }
+        iter++;
+    }
+    for (auto iter = mPreviewRenderDirtyChunks.begin(); iter != mPreviewRenderDirtyChunks.end();)
+    {
+        const std::string key = _HashPreviewChunk(*iter);
+        if (mPreviewRenderCache.Contains(key))
+        {
+            mPreviewRenderChunks[*iter] = key;
+            iter = mPreviewRenderDirtyChunks.erase(iter);
+            continue;
+        }
+        iter++;
+    }
+    mPreviewRenderChunksDirty = false;
+    mPreviewRenderRefreshTp = PlayerClock::now();
+    mPreviewRenderChunksSnapshot = mPreviewRenderChunks.empty() ? nullptr : std::make_shared<const std::map<int64_t, std::string>>(mPreviewRenderChunks);
+}
+
+bool TimeLine::_IsRenderedPreviewFrame(const std::shared_ptr<const std::map<int64_t, std::string>>& chunks, int64_t frameIndex) const
+{
+    if (!chunks || frameIndex < 0)
+        return false;
+    auto iter = chunks->find(frameIndex / PREVIEW_RENDER_CHUNK_FRAMES);
+    // a chunk dropped by the cache budget is composed again
+    return iter != chunks->end() && mPreviewRenderCache.Contains(iter->second);
+}
+
+void TimeLine::_PreviewRenderProc(MediaCore::MultiTrackVideoReader::Holder hReader, std::vector<std::pair<int64_t, std::string>> chunks, int64_t endFrame)
+{
+    const int64_t totalFrames = (int64_t)chunks.size()*PREVIEW_RENDER_CHUNK_FRAMES;
+    int64_t renderedFrames = 0;
+    for (auto& chunk : chunks)
+    {
+        std::vector<MediaCore::CorrelativeFrame> chunkFrames;
+        const int64_t startFrame = chunk.first*PREVIEW_RENDER_CHUNK_FRAMES;
+        const int64_t chunkEndFrame = std::min(startFrame+PREVIEW_RENDER_CHUNK_FRAMES, endFrame);
+        bool readOk = true;
+        for (int64_t frameIdx = startFrame; frameIdx < chunkEndFrame && !mQuitPreviewRender; frameIdx++)
+        {
+            std::vector<MediaCore::CorrelativeFrame> frames;
+            readOk = hReader->ReadVideoFrameEx(FrameIndexToTime(frameIdx), frames, false, true) && !frames.empty() && !frames[0].frame.empty();
+            if (!readOk)
+                break;
+            // only the mixed output is kept, the per-clip frames are for the clip editing windows
+            chunkFrames.push_back(frames[0]);
+            renderedFrames++;
+            mPreviewRenderProgress = (float)renderedFrames / totalFrames;
+        }
+        if (mQuitPreviewRender)
+            break;
+        if (!readOk)
         {
-            int64_t elapsedTime = (int64_t)(std::chrono::duration_cast<std::chrono::duration<double>>((PlayerClock::now()-mPlayTriggerTp)).count()*1000);
-            previewPos = mIsPreviewPlaying ? (mIsPreviewForward ? mPreviewResumePos+elapsedTime : mPreviewResumePos-elapsedTime) : mPreviewResumePos;
-            if (previewPos < 0) previewPos = 0;
+            Logger::Log(Logger::WARN) << "Preview rendering of chunk #" << chunk.first << " FAILED! " << hReader->GetError() << std::endl;
+            continue;
         }
+        if (!mPreviewRenderCache.Put(chunk.second, chunkFrames))
+            continue;
+        std::lock_guard<std::mutex> lk(mPreviewRenderLock);
+        mPreviewRenderResults.push_back(chunk);
+    }
+    mIsPreviewRendering = false;
+}
+
+int64_t TimeLine::_GetPlayClockPos(int64_t resumePos, PlayerClock::time_point triggerTp, bool playing, bool forward, int speed)
+{
+    // the audio being heard is the master clock, the wall clock is used when there is no audio output or the audio
+    // is skipped by shuttling
+    int64_t auddataPos, previewPos;
+    if (speed == 1 && mPcmStream.GetTimestampMs(auddataPos))
+    {
+        int64_t bufferedDur = mMtaReader->SizeToDuration(mAudioRender->GetBufferedDataSize());
+        previewPos = forward ? auddataPos-bufferedDur : auddataPos+bufferedDur;
     }
     else
     {
-        previewPos = mPreviewResumePos;
+        int64_t elapsedTime = (int64_t)(std::chrono::duration_cast<std::chrono::duration<double>>((PlayerClock::now()-triggerTp)).count()*1000*speed);
+        previewPos = playing ? (forward ? resumePos+elapsedTime : resumePos-elapsedTime) : resumePos;
+    }
+    if (previewPos < 0) previewPos = 0;
+    return previewPos;
+}
+
+void TimeLine::_PreviewProc()
+{
+    int64_t lastFrameIndex = -1;
+    int64_t lastGeneration = -1;
+    std::unique_lock<std::mutex> lk(mPreviewLock);
+    while (!mQuitPreview)
+    {
+        if (!mPreviewThreadActive || !mPreviewReader)
+        {
+            lastFrameIndex = -1;
+            mPreviewCv.wait_for(lk, std::chrono::milliseconds(20));
+            continue;
+        }
+        auto hReader = mPreviewReader;
+        const int64_t resumePos = mPreviewClockResumePos;
+        const auto triggerTp = mPreviewClockTriggerTp;
+        const bool forward = mPreviewClockForward;
+        const int speed = mPreviewClockSpeed;
+        const int64_t endIndex = mPreviewClockEndIndex;
+        const int64_t generation = mPreviewGeneration;
+        auto renderedChunks = mPreviewClockRenderedChunks;
+        lk.unlock();
+
+        const int64_t clockPos = _GetPlayClockPos(resumePos, triggerTp, true, forward, speed);
+        int64_t frameIndex = TimeToFrameIndex(clockPos);
+        if (frameIndex > endIndex) frameIndex = endIndex;
+        // the same frames as the read-ahead composes while shuttling
+        frameIndex = frameIndex/speed*speed;
+        if (frameIndex == lastFrameIndex && generation == lastGeneration)
+        {
+            // sleep till the clock reaches the next frame
+            const int64_t nextPos = FrameIndexToTime(forward ? frameIndex+speed : frameIndex-speed);
+            const int64_t waitMs = std::min<int64_t>(std::max<int64_t>(std::abs(nextPos-clockPos), 1), 40);
+            lk.lock();
+            mPreviewCv.wait_for(lk, std::chrono::milliseconds(waitMs));
+            continue;
+        }
+
+        // the ui shows the rendered chunk, composing the frame would only take the cores from it
+        if (_IsRenderedPreviewFrame(renderedChunks, frameIndex))
+        {
+            lastFrameIndex = frameIndex;
+            lastGeneration = generation;
+            lk.lock();
+            continue;
+        }
+        PreviewFrameSlot slot;
+        slot.frameIndex = frameIndex;
+        slot.generation = generation;
+        if (mPrefetchCache.Get(frameIndex, slot.frames))
+        {
+            mPrefetchHits++;
+        }
+        else
+        {
+            if (mPrefetchCache.GetBudget() > 0)
+            {
+                mPrefetchMisses++;
+                slot.missed = true;
+            }
+            // only the real compositions count, the cache hits would pull the percentiles down to zero
+            const auto composeStartTp = PlayerClock::now();
+            hReader->ReadVideoFrameEx(FrameIndexToTime(frameIndex), slot.frames, false, false);
+            mPlaybackStats.OnComposed(std::chrono::duration_cast<std::chrono::duration<double, std::milli>>(PlayerClock::now()-composeStartTp).count());
+        }
+        if (!slot.frames.empty() && !slot.frames[0].frame.empty())
+            mPreviewMailbox.Post(slot);
+        lastFrameIndex = frameIndex;
+        lastGeneration = generation;
+        lk.lock();
     }
+}
+
+std::vector<MediaCore::CorrelativeFrame> TimeLine::GetPreviewFrame()
+{
+    const int64_t previewPos = !bSeeking ? _GetPlayClockPos(mPreviewResumePos, mPlayTriggerTp, mIsPreviewPlaying, mIsPreviewForward, mShuttleSpeed) : mPreviewResumePos;
 
     if (mIsPreviewPlaying)
     {
@@ -6509,12 +6990,161 @@ std::vector<MediaCore::CorrelativeFrame> TimeLine::GetPreviewFrame()
     }
 
     std::vector<MediaCore::CorrelativeFrame> frames;
-    const bool needPreciseFrame = !(bSeeking || mIsPreviewPlaying);
-    mMtvReader->ReadVideoFrameEx(mCurrentTime, frames, true, needPreciseFrame);
+    const int64_t frameIndex = TimeToFrameIndex(mCurrentTime);
+    // the clip editing windows need the per-clip frames, a rendered chunk only has the mixed output
+    const bool clipEditing = bEditingFilter || bEditingAttribute || bEditingOverlap || bEditingText;
+    // the frames of the rendered chunks are shown instead of composed ones, the preview threads skip them. stale
+    // chunks aren't skipped till they're refreshed.
+    auto renderedChunks = !clipEditing && !mPreviewRenderChunksDirty ? mPreviewRenderChunksSnapshot : nullptr;
+    mPrefetchCache.SetBudget((size_t)std::max(mPrefetchBudgetMB, 0) << 20);
+    mPrefetchCache.SetPlayhead(frameIndex, mIsPreviewForward);
+    const bool prefetchActive = mIsPreviewPlaying && mPrefetchBudgetMB > 0 && !bSeeking;
+    if (prefetchActive || mPrefetchThread.joinable())
+    {
+        std::lock_guard<std::mutex> lk(mPrefetchLock);
+        if (prefetchActive && !mPrefetchReader)
+        {
+            const int level = mPreviewScaler.GetLevel();
+            mPrefetchReader = mMtvReader->CloneAndConfigure((GetPreviewWidth() >> level) & ~1, (GetPreviewHeight() >> level) & ~1, mFrameRate);
+            // the read-ahead always decodes forward, backward playback is served by forward composed blocks
+            if (mPrefetchReader && !mIsPreviewForward)
+                mPrefetchReader->SetDirection(true, mCurrentTime);
+        }
+        mPrefetchActive = prefetchActive;
+        mPrefetchForward = mIsPreviewForward;
+        mPrefetchStride = mShuttleSpeed;
+        mPrefetchPlayhead = frameIndex;
+        mPrefetchEndIndex = TimeToFrameIndex(ValidDuration());
+        mPrefetchRenderedChunks = renderedChunks;
+        mPrefetchCv.notify_all();
+    }
+    if (prefetchActive && !mPrefetchThread.joinable())
+    {
+        mPrefetchThread = std::thread(&TimeLine::_PrefetchProc, this);
+        SysUtils::SetThreadName(mPrefetchThread, "TL-Prefetch");
+    }
+    const bool previewThreadActive = mIsPreviewPlaying && !bSeeking;
+    int64_t previewGeneration;
+    {
+        std::lock_guard<std::mutex> lk(mPreviewLock);
+        if (mPreviewClockResumePos != mPreviewResumePos || mPreviewClockTriggerTp != mPlayTriggerTp || mPreviewClockForward != mIsPreviewForward || mPreviewClockSpeed != mShuttleSpeed)
+            mPreviewGeneration++;
+        mPreviewThreadActive = previewThreadActive;
+        mPreviewReader = previewThreadActive ? mMtvReader : nullptr;
+        mPreviewClockResumePos = mPreviewResumePos;
+        mPreviewClockTriggerTp = mPlayTriggerTp;
+        mPreviewClockForward = mIsPreviewForward;
+        mPreviewClockSpeed = mShuttleSpeed;
+        mPreviewClockEndIndex = TimeToFrameIndex(ValidDuration());
+        mPreviewClockRenderedChunks = renderedChunks;
+        previewGeneration = mPreviewGeneration;
+        mPreviewCv.notify_all();
+    }
+    if (previewThreadActive && !mPreviewThread.joinable())
+    {
+        mPreviewThread = std::thread(&TimeLine::_PreviewProc, this);
+        SysUtils::SetThreadName(mPreviewThread, "TL-Preview");
+    }
+    PreviewFrameSlot slot;
+    const bool slotTaken = previewThreadActive && mPreviewMailbox.Take(slot) && slot.generation == previewGeneration;
+    if (slotTaken)
+        mPreviewShownFrames = std::move(slot.frames);
+    if (previewThreadActive && !mPlaybackStatsActive)
+        mPlaybackStats.Reset();
+    else if (!previewThreadActive && mPlaybackStatsActive)
+        Logger::Log(Logger::INFO) << "Preview playback: " << MEC::PlaybackStats::ToString(mPlaybackStats.GetSession()) << std::endl;
+    mPlaybackStatsActive = previewThreadActive;
+    if (previewThreadActive && previewGeneration != mPlaybackStatsGeneration)
+    {
+        mPlaybackStats.OnDiscontinuity();
+        mPlaybackStatsGeneration = previewGeneration;
+    }
+    if (!clipEditing && GetRenderedPreviewFrame(frameIndex, frames))
+    {
+        mPreviewRenderHits++;
+        if (bSeeking)
+            mScrubShownFrameIndex = frameIndex;
+        // the preview thread skips the chunk, its last frame stays till the thread posts the one after it
+        if (previewThreadActive)
+            mPreviewShownFrames = frames;
+        // shuttling presents every Nth frame on purpose, only the normal speed playback is measured
+        if (previewThreadActive && mShuttleSpeed == 1)
+            mPlaybackStats.OnPresented(frameIndex, FrameIndexToTime(frameIndex)-previewPos, false);
+    }
+    else if (previewThreadActive)
+    {
+        // till the preview thread posts its first frame, the last shown one stays, the reader is busy on that thread
+        frames = mPreviewShownFrames;
+        if (slotTaken && mShuttleSpeed == 1)
+            mPlaybackStats.OnPresented(slot.frameIndex, FrameIndexToTime(slot.frameIndex)-previewPos, std::abs(frameIndex-slot.frameIndex) > 1);
+    }
+    else if (bSeeking)
+    {
+        // scrubbing, the latest frame read by the scrub worker, a snapshot is shown over it till it's the current one
+        PreviewFrameSlot scrubSlot;
+        if (mScrubMailbox.Take(scrubSlot))
+        {
+            mScrubShownFrames = std::move(scrubSlot.frames);
+            mScrubShownFrameIndex = scrubSlot.frameIndex;
+        }
+        frames = mScrubShownFrames;
+    }
+    else
+    {
+        // paused
+        const bool needPreciseFrame = !(bSeeking || mIsPreviewPlaying);
+        mMtvReader->ReadVideoFrameEx(mCurrentTime, frames, true, needPreciseFrame);
+    }
+    if (!previewThreadActive && !frames.empty())
+        mPreviewShownFrames = frames;
+    if (prefetchActive && mPreviewAdaptive)
+    {
+        // a frame composed later than the clock moved on to the next one missed its deadline too
+        if (slotTaken)
+            _UpdatePreviewScaler(slot.frameIndex, slot.missed || std::abs(frameIndex-slot.frameIndex) > 1);
+    }
+    else if (mPreviewScaler.GetLevel() > 0 && (!mIsPreviewPlaying || !mPreviewAdaptive))
+    {
+        // back to the full scale, the paused frame read precisely above replaces the last scaled one
+        mPreviewScaler.Reset();
+        mPreviewScalerFrameIndex = -1;
+        {
+            std::lock_guard<std::mutex> lk(mPrefetchLock);
+            mPrefetchReader = nullptr;
+        }
+        mIsPreviewNeedUpdate = true;
+    }
+    if (previewThreadActive && mPlaybackStats.Update())
+        Logger::Log(Logger::DEBUG) << "Preview playback: " << MEC::PlaybackStats::ToString(mPlaybackStats.GetLastSecond()) << std::endl;
     if (mIsPreviewPlaying) UpdateCurrent();
     return frames;
 }
 
+void TimeLine::Shuttle(int direction)
+{
+    if (direction == 0)
+    {
+        Play(false, mIsPreviewForward);
+        return;
+    }
+    const bool forward = direction > 0;
+    int speed = 1;
+    if (mIsPreviewPlaying && mIsPreviewForward == forward)
+        speed = std::min(mShuttleSpeed*2, MAX_SHUTTLE_SPEED);
+    Play(true, forward);
+    if (speed == 1)
+        return;
+    mShuttleSpeed = speed;
+    mPreviewResumePos = mCurrentTime;
+    mPlayTriggerTp = PlayerClock::now();
+    if (mAudioRender)
+    {
+        mAudioRender->Pause();
+        mAudioRender->Flush();
+    }
+    for (int i = 0; i < mAudioAttribute.channel_data.size(); i++) SetAudioLevel(i, 0);
+}
+
 float TimeLine::GetAudioLevel(int channel)
 {
     if (channel < mAudioAttribute.channel_data.size())
@@ -6541,12 +7171,29 @@ int TimeLine::GetSelectedClipCount()
 void TimeLine::Play(bool play, bool forward)
 {
     bool needSeekAudio = false;
+    bool needResumeAudio = false;
     if (mIsStepMode)
     {
         mIsStepMode = false;
         if (mAudioRender)
             needSeekAudio = true;
     }
+    if (mShuttleSpeed != 1)
+    {
+        // back to 1x, the audio skipped by shuttling restarts from the play head
+        mShuttleSpeed = 1;
+        mPreviewResumePos = mCurrentTime;
+        mPlayTriggerTp = PlayerClock::now();
+        if (mAudioRender)
+        {
+            needSeekAudio = true;
+            needResumeAudio = play && mIsPreviewPlaying && forward == mIsPreviewForward;
+        }
+        // the frames composed without precise seeking must not be played at 1x
+        std::lock_guard<std::mutex> lk(mPrefetchLock);
+        mPrefetchGeneration++;
+        mPrefetchCache.Clear();
+    }
     if (forward != mIsPreviewForward)
     {
         if (mAudioRender)
@@ -6568,6 +7215,8 @@ void TimeLine::Play(bool play, bool forward)
     {
         mAudioRender->Flush();
         mMtaReader->SeekTo(mCurrentTime);
+        if (needResumeAudio)
+            mAudioRender->Resume();
     }
     if (play != mIsPreviewPlaying)
     {
@@ -6611,8 +7260,7 @@ void TimeLine::Seek(int64_t msPos, bool enterSeekingState)
         mPlayTriggerTp = PlayerClock::now();
         if (mMtaReader)
             mMtaReader->SeekTo(msPos, true);
-        if (mMtvReader)
-            mMtvReader->ConsecutiveSeek(msPos);
+        _RequestScrubFrame(msPos);
     }
     else
     {
@@ -6638,8 +7286,11 @@ void TimeLine::StopSeek()
                 mAudioRender->Pause();
             mAudioRender->Flush();
         }
+        // the preview reader isn't moved while scrubbing, only the scrub worker reads the targets
         if (mMtvReader)
-            mMtvReader->StopConsecutiveSeek();
+            mMtvReader->SeekTo(mPreviewResumePos);
+        mScrubShownFrames.clear();
+        mScrubShownFrameIndex = -1;
         mPlayTriggerTp = PlayerClock::now();
     }
     if (!mIsPreviewPlaying)
@@ -6652,6 +7303,69 @@ void TimeLine::StopSeek()
     }
 }
 
+void TimeLine::_RequestScrubFrame(int64_t msPos)
+{
+    std::lock_guard<std::mutex> lk(mScrubLock);
+    if (!mScrubReader && mMtvReader)
+        mScrubReader = mMtvReader->CloneAndConfigure(GetPreviewWidth(), GetPreviewHeight(), mFrameRate);
+    mScrubTarget = msPos;
+    mScrubCv.notify_all();
+    if (!mScrubThread.joinable())
+    {
+        mScrubThread = std::thread(&TimeLine::_ScrubProc, this);
+        SysUtils::SetThreadName(mScrubThread, "TL-Scrub");
+    }
+}
+
+void TimeLine::_ScrubProc()
+{
+    std::unique_lock<std::mutex> lk(mScrubLock);
+    while (!mQuitScrub)
+    {
+        if (mScrubTarget < 0 || !mScrubReader)
+        {
+            mScrubCv.wait_for(lk, std::chrono::milliseconds(20));
+            continue;
+        }
+        // the targets posted while the last one was read are skipped but the latest
+        const int64_t target = mScrubTarget;
+        mScrubTarget = -1;
+        auto hReader = mScrubReader;
+        const int64_t generation = mScrubGeneration;
+        lk.unlock();
+        PreviewFrameSlot slot;
+        slot.frameIndex = TimeToFrameIndex(target);
+        slot.generation = generation;
+        bool readOk = hReader->ReadVideoFrameEx(target, slot.frames, false, true) && !slot.frames.empty() && !slot.frames[0].frame.empty();
+        lk.lock();
+        if (readOk && generation == mScrubGeneration)
+            mScrubMailbox.Post(slot);
+    }
+}
+
+bool TimeLine::GetScrubSnapshot(ImTextureID& texture, ImVec2& uvMin, ImVec2& uvMax)
+{
+    if (!bSeeking || mScrubShownFrameIndex == TimeToFrameIndex(mCurrentTime))
+        return false;
+    // the first viewable video track having a clip at the play head, its snapshots are loaded for the visible
+    // part of the timeline, where the play head is dragged
+    for (auto track : m_Tracks)
+    {
+        if (!IS_VIDEO(track->mType) || !track->mView)
+            continue;
+        for (auto clip : track->m_Clips)
+        {
+            if (!IS_VIDEO(clip->mType) || IS_DUMMY(clip->mType) || IS_IMAGE(clip->mType) || mCurrentTime < clip->Start() || mCurrentTime >= clip->End())
+                continue;
+            auto vidclip = dynamic_cast<VideoClip*>(clip);
+            if (!vidclip)
+                continue;
+            return vidclip->GetNearestSnapshot(vidclip->StartOffset()+mCurrentTime-vidclip->Start(), texture, uvMin, uvMax);
+        }
+    }
+    return false;
+}
+
 void TimeLine::Step(bool forward)
 {
     if (mIsPreviewPlaying)
@@ -7853,7 +8567,7 @@ int TimeLine::Load(const imgui_json::value& value)
                 if (IS_IMAGE(clip->mType))
                     hVidClip = vidTrack->AddImageClip(clip->mID, clip->mMediaParser, clip->Start(), clip->Length());
                 else
-                    hVidClip = vidTrack->AddVideoClip(clip->mID, clip->mMediaParser, clip->Start(), clip->End(), clip->StartOffset(), clip->EndOffset(), mCurrentTime-clip->Start());
+                    hVidClip = vidTrack->AddVideoClip(clip->mID, GetPreviewMediaParser(clip), clip->Start(), clip->End(), clip->StartOffset(), clip->EndOffset(), mCurrentTime-clip->Start());
                 VideoClip* vclip = dynamic_cast<VideoClip*>(clip);
                 vclip->SyncFilterWithDataLayer(hVidClip);
                 vclip->SyncAttributesWithDataLayer(hVidClip);
@@ -8151,7 +8865,7 @@ void TimeLine::PerformVideoAction(imgui_json::value& action)
         int64_t clipId = action["clip_json"]["ID"].get<imgui_json::number>();
         Clip* clip = FindClipByID(clipId);
         MediaCore::VideoClip::Holder hVidClip = MediaCore::VideoClip::CreateVideoInstance(
-            clip->mID, clip->mMediaParser, mMtvReader->GetSharedSettings(),
+            clip->mID, GetPreviewMediaParser(clip), mMtvReader->GetSharedSettings(),
             clip->Start(), clip->End(), clip->StartOffset(), clip->EndOffset(), mCurrentTime-clip->Start(), vidTrack->Direction());
         VideoClip* vclip = dynamic_cast<VideoClip*>(clip);
         vclip->SyncFilterWithDataLayer(hVidClip);
@@ -8668,6 +9382,7 @@ int TimeLine::OnAudioEventStackFilterBpChanged(int type, std::string name, void*
 
 void TimeLine::ConfigureDataLayer()
 {
+    InvalidatePrefetch();
     mMtvReader = MediaCore::MultiTrackVideoReader::CreateInstance();
     mMtvReader->Configure(GetPreviewWidth(), GetPreviewHeight(), mFrameRate);
     mMtvReader->Start();
@@ -8677,14 +9392,12 @@ void TimeLine::ConfigureDataLayer()
     mPcmStream.SetAudioReader(mMtaReader);
 }
 
-void TimeLine::SyncDataLayer(bool forceRefresh)
+bool TimeLine::_SyncVideoOverlaps(MediaCore::MultiTrackVideoReader::Holder hReader, int& syncedOverlapCount)
 {
-    // video overlap
-    int syncedOverlapCount = 0;
-    bool needUpdatePreview = false;
-    bool needRefreshAudio = false;
-    auto vidTrackIter = mMtvReader->TrackListBegin();
-    while (vidTrackIter != mMtvReader->TrackListEnd())
+    // the overlaps created by the reader get the ids and the transitions of the timeline overlaps
+    bool transitionSet = false;
+    auto vidTrackIter = hReader->TrackListBegin();
+    while (vidTrackIter != hReader->TrackListEnd())
     {
         auto& vidTrack = *vidTrackIter++;
         vidTrack->UpdateClipState();
@@ -8709,7 +9422,7 @@ void TimeLine::SyncDataLayer(bool forceRefresh)
                         bpvt->SetKeyPoint(ovlp->mTransitionKeyPoints);
                         MediaCore::VideoTransition::Holder hTrans(bpvt);
                         vidOvlp->SetTransition(hTrans);
-                        needUpdatePreview = true;
+                        transitionSet = true;
                     }
                     found = true;
                     break;
@@ -8722,6 +9435,15 @@ void TimeLine::SyncDataLayer(bool forceRefresh)
                 syncedOverlapCount++;
         }
     }
+    return transitionSet;
+}
+
+void TimeLine::SyncDataLayer(bool forceRefresh)
+{
+    // video overlap
+    int syncedOverlapCount = 0;
+    bool needUpdatePreview = _SyncVideoOverlaps(mMtvReader, syncedOverlapCount);
+    bool needRefreshAudio = false;
     // audio overlap
     auto audTrackIter = mMtaReader->TrackListBegin();
     while (audTrackIter != mMtaReader->TrackListEnd())
@@ -8780,20 +9502,156 @@ void TimeLine::SyncDataLayer(bool forceRefresh)
             << ", while the count of video overlap array is " << OvlpCnt << "." << std::endl;
 }
 
-MediaCore::Snapshot::Generator::Holder TimeLine::GetSnapshotGenerator(int64_t mediaItemId)
+void TimeLine::SetProxyEnabled(bool enable)
 {
-    auto iter = m_VidSsGenTable.find(mediaItemId);
-    if (iter != m_VidSsGenTable.end())
-        return iter->second;
-    MediaItem* mi = FindMediaItemByID(mediaItemId);
-    if (!mi)
-        return nullptr;
-    if (!IS_VIDEO(mi->mMediaType) || IS_IMAGE(mi->mMediaType))
-        return nullptr;
-    MediaCore::Snapshot::Generator::Holder hSsGen = MediaCore::Snapshot::Generator::CreateInstance();
-    hSsGen->SetOverview(mi->mMediaOverview);
-    hSsGen->EnableHwAccel(mHardwareCodec);
-    if (!hSsGen->Open(mi->mMediaOverview->GetMediaParser()))
+    if (mProxyEnabled == enable)
+        return;
+    mProxyEnabled = enable;
+    if (enable)
+    {
+        for (auto item : media_items)
+            RequestProxyMedia(item);
+    }
+    m_VidSsGenTable.clear();
+    for (auto track : m_Tracks)
+    {
+        if (!IS_VIDEO(track->mType))
+            continue;
+        for (auto clip : track->m_Clips)
+            _SwapVideoClipParser(mMtvReader, clip, GetPreviewMediaParser(clip));
+    }
+    int syncedOverlapCount = 0;
+    _SyncVideoOverlaps(mMtvReader, syncedOverlapCount);
+    UpdatePreview();
+}
+
+void TimeLine::RequestProxyMedia(MediaItem* item)
+{
+    if (!mProxyEnabled || mHeadless || !item || !item->mValid || !IS_VIDEO(item->mMediaType) || IS_IMAGE(item->mMediaType) || item->mProxyParser)
+        return;
+    const std::string proxyDir = mProxyDir.empty() ? ImGuiHelper::path_parent(item->mPath)+"Proxy" : mProxyDir;
+    const std::string proxyPath = MEC::GetProxyMediaPath(item->mPath, proxyDir);
+    // a proxy of the unchanged source is reused from the earlier sessions
+    if (ImGuiHelper::file_exists(proxyPath) && _OpenProxyMedia(item, proxyPath))
+        return;
+    if (!MEC::MakeDirectory(proxyDir))
+    {
+        Logger::Log(Logger::WARN) << "FAILED to create proxy folder '" << proxyDir << "'!" << std::endl;
+        return;
+    }
+    mProxyGenerator.EnableHwAccel(mHardwareCodec);
+    mProxyGenerator.AddJob(item->mID, item->mPath, proxyPath);
+}
+
+void TimeLine::UpdateProxyMedia()
+{
+    MEC::ProxyMediaGenerator::Result result;
+    while (mProxyGenerator.TakeResult(result))
+    {
+        MediaItem* item = FindMediaItemByID(result.mediaId);
+        if (!item || !result.succeeded || !_OpenProxyMedia(item, result.proxyPath))
+            continue;
+        m_VidSsGenTable.erase(item->mID);
+        if (!mProxyEnabled)
+            continue;
+        for (auto clip : m_Clips)
+        {
+            if (clip->mMediaID == item->mID)
+                _SwapVideoClipParser(mMtvReader, clip, item->mProxyParser);
+        }
+        int syncedOverlapCount = 0;
+        _SyncVideoOverlaps(mMtvReader, syncedOverlapCount);
+        UpdatePreview();
+    }
+}
+
+MediaCore::MediaParser::Holder TimeLine::GetPreviewMediaParser(Clip* clip)
+{
+    if (!mProxyEnabled || !IS_VIDEO(clip->mType) || IS_IMAGE(clip->mType))
+        return clip->mMediaParser;
+    MediaItem* item = FindMediaItemByID(clip->mMediaID);
+    return item && item->mProxyParser ? item->mProxyParser : clip->mMediaParser;
+}
+
+bool TimeLine::_OpenProxyMedia(MediaItem* item, const std::string& proxyPath)
+{
+    auto hParser = MediaCore::MediaParser::CreateInstance();
+    if (!hParser->Open(proxyPath))
+    {
+        Logger::Log(Logger::WARN) << "FAILED to open proxy '" << proxyPath << "' of '" << item->mPath << "'! " << hParser->GetError() << std::endl;
+        return false;
+    }
+    item->mProxyPath = proxyPath;
+    item->mProxyParser = hParser;
+    return true;
+}
+
+void TimeLine::_SwapVideoClipParser(MediaCore::MultiTrackVideoReader::Holder hReader, Clip* clip, MediaCore::MediaParser::Holder hParser)
+{
+    // the proxy has the same duration and frame timing as the original, so only the clip instance is replaced,
+    // the range, filter and attributes stay as they are. the overlaps of the clip are rebuilt without transitions,
+    // call _SyncVideoOverlaps() after swapping.
+    if (!hParser || IS_DUMMY(clip->mType) || !IS_VIDEO(clip->mType) || IS_IMAGE(clip->mType))
+        return;
+    MediaTrack* track = FindTrackByClipID(clip->mID);
+    auto hTrack = track ? hReader->GetTrackById(track->mID) : nullptr;
+    auto hOldClip = hTrack ? hTrack->GetClipById(clip->mID) : nullptr;
+    if (!hOldClip || hOldClip->GetMediaParser() == hParser)
+        return;
+    MediaCore::VideoClip::Holder hNewClip = MediaCore::VideoClip::CreateVideoInstance(
+        clip->mID, hParser, hReader->GetSharedSettings(),
+        hOldClip->Start(), hOldClip->End(), hOldClip->StartOffset(), hOldClip->EndOffset(), mCurrentTime-hOldClip->Start(), hTrack->Direction());
+    auto hFilter = hOldClip->GetFilter();
+    hTrack->RemoveClipById(clip->mID);
+    if (hFilter)
+        hNewClip->SetFilter(hFilter);
+    auto vclip = dynamic_cast<VideoClip*>(clip);
+    if (vclip)
+        vclip->SyncAttributesWithDataLayer(hNewClip);
+    hTrack->InsertClip(hNewClip);
+}
+
+MediaCore::MultiTrackVideoReader::Holder TimeLine::_CloneEncodeVideoReader(uint32_t width, uint32_t height, const MediaCore::Ratio& frameRate)
+{
+    auto hReader = mMtvReader->CloneAndConfigure(width, height, frameRate);
+    if (!hReader || !mProxyEnabled)
+        return hReader;
+    // the preview reader may compose the proxies, the export always composes the originals
+    bool swapped = false;
+    for (auto clip : m_Clips)
+    {
+        MediaItem* item = FindMediaItemByID(clip->mMediaID);
+        if (!item || !item->mProxyParser)
+            continue;
+        _SwapVideoClipParser(hReader, clip, clip->mMediaParser);
+        swapped = true;
+    }
+    if (swapped)
+    {
+        int syncedOverlapCount = 0;
+        _SyncVideoOverlaps(hReader, syncedOverlapCount);
+        hReader->Refresh(false);
+    }
+    return hReader;
+}
+
+MediaCore::Snapshot::Generator::Holder TimeLine::GetSnapshotGenerator(int64_t mediaItemId)
+{
+    auto iter = m_VidSsGenTable.find(mediaItemId);
+    if (iter != m_VidSsGenTable.end())
+        return iter->second;
+    MediaItem* mi = FindMediaItemByID(mediaItemId);
+    if (!mi)
+        return nullptr;
+    if (!IS_VIDEO(mi->mMediaType) || IS_IMAGE(mi->mMediaType))
+        return nullptr;
+    MediaCore::Snapshot::Generator::Holder hSsGen = MediaCore::Snapshot::Generator::CreateInstance();
+    // the proxy decodes much faster, and snapshots are small anyway
+    const bool useProxy = mProxyEnabled && mi->mProxyParser;
+    if (!useProxy)
+        hSsGen->SetOverview(mi->mMediaOverview);
+    hSsGen->EnableHwAccel(mHardwareCodec);
+    if (!hSsGen->Open(useProxy ? mi->mProxyParser : mi->mMediaOverview->GetMediaParser()))
     {
         Logger::Log(Logger::Error) << hSsGen->GetError() << std::endl;
         return nullptr;
@@ -8987,246 +9845,2194 @@ void TimeLine::CalculateAudioScopeData(ImGui::ImMat& mat_in)
     }
     if (mat.c >= 2)
     {
-        if (mAudioAttribute.m_audio_vector.empty())
+        if (mAudioAttribute.m_audio_vector.empty())
+        {
+            mAudioAttribute.m_audio_vector.create_type(256, 256, 4, IM_DT_INT8);
+            mAudioAttribute.m_audio_vector.fill((int8_t)0);
+            mAudioAttribute.m_audio_vector.elempack = 4;
+        }
+        if (!mAudioAttribute.m_audio_vector.empty())
+        {
+            float zoom = mAudioAttribute.mAudioVectorScale;
+            float hw = mAudioAttribute.m_audio_vector.w / 2;
+            float hh = mAudioAttribute.m_audio_vector.h / 2;
+            int samples = mat.w;
+            mAudioAttribute.m_audio_vector -= 64;
+            for (int n = 0; n < samples; n++)
+            {
+                float s1 = mAudioAttribute.channel_data[0].m_wave.at<float>(n, 0);
+                float s2 = mAudioAttribute.channel_data[1].m_wave.at<float>(n, 0);
+                int x = hw;
+                int y = hh;
+
+                if (mAudioAttribute.mAudioVectorMode == LISSAJOUS)
+                {
+                    x = ((s2 - s1) * zoom / 2 + 1) * hw;
+                    y = (1.0 - (s1 + s2) * zoom / 2) * hh;
+                }
+                else if (mAudioAttribute.mAudioVectorMode == LISSAJOUS_XY)
+                {
+                    x = (s2 * zoom + 1) * hw;
+                    y = (s1 * zoom + 1) * hh;
+                }
+                else
+                {
+                    float sx, sy, cx, cy;
+                    sx = s2 * zoom;
+                    sy = s1 * zoom;
+                    cx = sx * sqrtf(1 - 0.5 * sy * sy);
+                    cy = sy * sqrtf(1 - 0.5 * sx * sx);
+                    x = hw + hw * ImSign(cx + cy) * (cx - cy) * .7;
+                    y = mAudioAttribute.m_audio_vector.h - mAudioAttribute.m_audio_vector.h * fabsf(cx + cy) * .7;
+                }
+                x = ImClamp(x, 0, mAudioAttribute.m_audio_vector.w - 1);
+                y = ImClamp(y, 0, mAudioAttribute.m_audio_vector.h - 1);
+                uint8_t r = ImClamp(mAudioAttribute.m_audio_vector.at<uint8_t>(x, y, 0) + 30, 0, 255);
+                uint8_t g = ImClamp(mAudioAttribute.m_audio_vector.at<uint8_t>(x, y, 1) + 50, 0, 255);
+                uint8_t b = ImClamp(mAudioAttribute.m_audio_vector.at<uint8_t>(x, y, 2) + 30, 0, 255);
+                mAudioAttribute.m_audio_vector.draw_dot(x, y, ImPixel(r / 255.0, g / 255.0, b / 255.0, 1.f));
+            }
+            mAudioAttribute.m_audio_vector.flags |= IM_MAT_FLAGS_CUSTOM_UPDATED;
+        }
+    }
+}
+
+// the suffix of the file name with its dot, empty if there's none
+static std::string GetPathSuffix(const std::string& path)
+{
+    const auto suffixPos = path.find_last_of('.');
+    const auto slashPos = path.find_last_of("/\\");
+    if (suffixPos != std::string::npos && (slashPos == std::string::npos || suffixPos > slashPos))
+        return path.substr(suffixPos);
+    return std::string();
+}
+
+bool TimeLine::ConfigEncoder(const std::string& outputPath, VideoEncoderParams& vidEncParams, AudioEncoderParams& audEncParams, std::string& errMsg)
+{
+    mEncImageSeqWriter = nullptr;
+    mEncRawStreamWriter = nullptr;
+    const std::string imageCodec = MEC::GetImageSequenceCodec(outputPath);
+    if (!imageCodec.empty())
+        return _ConfigImageSequenceEncoder(outputPath, imageCodec, vidEncParams, audEncParams, errMsg);
+    // passthrough, cached, resumed and remote segments are never composed here, so their frames can't be hashed
+    if (!mEncodingHashPath.empty() && bExportVideo && (mEncodingSmartRender || !mEncodingCacheDir.empty() || mEncodingResumable || !mEncodingRemoteWorkers.empty()))
+    {
+        errMsg = "Frame hashes can't be written by smart render, render cache, resumable or remote worker export!";
+        return false;
+    }
+    mEncoder = MediaCore::MediaEncoder::CreateInstance();
+    if (!mEncoder->Open(outputPath))
+    {
+        errMsg = mEncoder->GetError();
+        return false;
+    }
+    // Video, an audio-only export has no video stream and never composes the video
+    mEncMtvReader = nullptr;
+    if (bExportVideo)
+    {
+        if (!mEncoder->ConfigureVideoStream(
+            vidEncParams.codecName, vidEncParams.imageFormat, vidEncParams.width, vidEncParams.height,
+            vidEncParams.frameRate, vidEncParams.bitRate, &vidEncParams.extraOpts))
+        {
+            errMsg = mEncoder->GetError();
+            return false;
+        }
+        mEncMtvReader = _CloneEncodeVideoReader(vidEncParams.width, vidEncParams.height, vidEncParams.frameRate);
+    }
+
+    // Audio
+    std::string audEncSmpFormat;
+    if (!mEncoder->ConfigureAudioStream(
+        audEncParams.codecName, audEncParams.sampleFormat, audEncParams.channels,
+        audEncParams.sampleRate, audEncParams.bitRate))
+    {
+        errMsg = mEncoder->GetError();
+        return false;
+    }
+    mEncMtaReader = mMtaReader->CloneAndConfigure(audEncParams.channels, audEncParams.sampleRate, audEncParams.samplesPerFrame);
+    mEncOutputPath = outputPath;
+    mEncVidParams = vidEncParams;
+    mEncAudParams = audEncParams;
+    mEncExtraOutputs.clear();
+    mEncComposeWidth = vidEncParams.width;
+    mEncComposeHeight = vidEncParams.height;
+    // the segments are planned on this thread, the encoding thread never reads the live timeline
+    mEncSegments.clear();
+    mEncSegmentReaders.clear();
+    mEncRemoteRequest = imgui_json::value();
+    if (bExportVideo && IsSegmentedEncoding())
+    {
+        _PlanEncodeSegments();
+        // every render worker renders from the same project snapshot and encoder settings
+        if (!mEncodingRemoteWorkers.empty())
+        {
+            mEncRemoteRequest["Project"] = MEC::SaveProject(this);
+            mEncRemoteRequest["Video"] = MEC::VideoEncoderParamsToJson(mEncVidParams);
+            mEncRemoteRequest["Suffix"] = GetPathSuffix(mEncOutputPath);
+            mEncRemoteRequest["HardwareCodec"] = imgui_json::boolean(mHardwareCodec);
+        }
+        else
+        {
+            // every local segment worker composes with its own reader, they're cloned here since the clone reads the live timeline
+            int workerCount = mEncodingSegmentThreads > 1 ? mEncodingSegmentThreads : 1;
+            if (workerCount > (int)mEncSegments.size()) workerCount = std::max((int)mEncSegments.size(), 1);
+            mEncSegmentReaders.push_back(mEncMtvReader);
+            while ((int)mEncSegmentReaders.size() < workerCount)
+                mEncSegmentReaders.push_back(_CloneEncodeVideoReader(vidEncParams.width, vidEncParams.height, vidEncParams.frameRate));
+            for (auto& hReader : mEncSegmentReaders)
+            {
+                if (!hReader)
+                {
+                    mEncSegmentReaders.clear();
+                    errMsg = "FAILED to clone the video reader of segment workers!";
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+bool TimeLine::_ConfigImageSequenceEncoder(const std::string& outputPath, const std::string& imageCodec, VideoEncoderParams& vidEncParams, AudioEncoderParams& audEncParams, std::string& errMsg)
+{
+    if (!bExportVideo)
+    {
+        errMsg = "Image sequence export needs the video!";
+        return false;
+    }
+    mEncoder = nullptr;
+    mEncMtaReader = nullptr;
+    std::unique_ptr<MEC::ImageSequenceWriter> writer(new MEC::ImageSequenceWriter());
+    if (!writer->Open(outputPath, imageCodec, vidEncParams.width, vidEncParams.height, mEncodingImageWriterThreads, errMsg))
+        return false;
+    mEncImageSeqWriter = std::move(writer);
+    mEncMtvReader = _CloneEncodeVideoReader(vidEncParams.width, vidEncParams.height, vidEncParams.frameRate);
+    mEncOutputPath = outputPath;
+    mEncVidParams = vidEncParams;
+    mEncAudParams = audEncParams;
+    mEncExtraOutputs.clear();
+    mEncComposeWidth = vidEncParams.width;
+    mEncComposeHeight = vidEncParams.height;
+    return true;
+}
+
+bool TimeLine::ConfigRawStreamOutput(const std::string& outputPath, const std::string& pixelFormat, const std::string& sampleFormat,
+        VideoEncoderParams& vidEncParams, AudioEncoderParams& audEncParams, std::string& errMsg)
+{
+    mEncoder = nullptr;
+    mEncImageSeqWriter = nullptr;
+    mEncRawStreamWriter = nullptr;
+    mEncMtvReader = nullptr;
+    mEncMtaReader = nullptr;
+    if (!bExportVideo && !bExportAudio)
+    {
+        errMsg = "Nothing to stream, both video and audio are disabled!";
+        return false;
+    }
+    MEC::RawStreamFormat format;
+    if (bExportVideo)
+    {
+        format.width = vidEncParams.width;
+        format.height = vidEncParams.height;
+        format.pixelFormat = pixelFormat;
+        format.frameRateNum = vidEncParams.frameRate.num;
+        format.frameRateDen = vidEncParams.frameRate.den;
+    }
+    if (bExportAudio)
+    {
+        format.channels = audEncParams.channels;
+        format.sampleRate = audEncParams.sampleRate;
+        format.sampleFormat = sampleFormat;
+    }
+    std::unique_ptr<MEC::RawStreamWriter> writer(new MEC::RawStreamWriter());
+    if (!writer->Open(outputPath, format, errMsg))
+        return false;
+    mEncRawStreamWriter = std::move(writer);
+    if (bExportVideo)
+        mEncMtvReader = _CloneEncodeVideoReader(vidEncParams.width, vidEncParams.height, vidEncParams.frameRate);
+    if (bExportAudio)
+        mEncMtaReader = mMtaReader->CloneAndConfigure(audEncParams.channels, audEncParams.sampleRate, audEncParams.samplesPerFrame);
+    mEncOutputPath = outputPath;
+    mEncVidParams = vidEncParams;
+    mEncAudParams = audEncParams;
+    mEncExtraOutputs.clear();
+    mEncComposeWidth = vidEncParams.width;
+    mEncComposeHeight = vidEncParams.height;
+    return true;
+}
+
+bool TimeLine::AddEncodeOutput(const std::string& outputPath, VideoEncoderParams& vidEncParams, AudioEncoderParams& audEncParams, std::string& errMsg)
+{
+    if (mEncImageSeqWriter || mEncRawStreamWriter)
+    {
+        errMsg = "Extra outputs are only supported by media file export!";
+        return false;
+    }
+    if (!mEncoder)
+    {
+        errMsg = "The main output is not configured!";
+        return false;
+    }
+    if (!mEncMtvReader)
+    {
+        errMsg = "Extra outputs are only supported by video export!";
+        return false;
+    }
+    // the segments are encoded and concatenated for the main output only
+    if (IsSegmentedEncoding())
+    {
+        errMsg = "Extra outputs can't be encoded by segmented export, disable segment threads, smart render, render cache, resume and render workers!";
+        return false;
+    }
+    if ((int64_t)vidEncParams.frameRate.num * mEncVidParams.frameRate.den != (int64_t)mEncVidParams.frameRate.num * vidEncParams.frameRate.den)
+    {
+        errMsg = "All the outputs must have the same frame rate!";
+        return false;
+    }
+    if (audEncParams.channels != mEncAudParams.channels || audEncParams.sampleRate != mEncAudParams.sampleRate ||
+        audEncParams.samplesPerFrame != mEncAudParams.samplesPerFrame)
+    {
+        errMsg = "All the outputs must have the same audio channels, sample rate and frame size!";
+        return false;
+    }
+    EncodeOutput output;
+    output.path = outputPath;
+    output.vidParams = vidEncParams;
+    output.audParams = audEncParams;
+    output.encoder = MediaCore::MediaEncoder::CreateInstance();
+    if (!output.encoder->Open(outputPath) ||
+        !output.encoder->ConfigureVideoStream(
+            vidEncParams.codecName, vidEncParams.imageFormat, vidEncParams.width, vidEncParams.height,
+            vidEncParams.frameRate, vidEncParams.bitRate, &vidEncParams.extraOpts) ||
+        !output.encoder->ConfigureAudioStream(
+            audEncParams.codecName, audEncParams.sampleFormat, audEncParams.channels,
+            audEncParams.sampleRate, audEncParams.bitRate))
+    {
+        errMsg = output.encoder->GetError();
+        return false;
+    }
+    // compose at the largest output size, the smaller outputs are scaled from it
+    if ((uint64_t)vidEncParams.width * vidEncParams.height > (uint64_t)mEncComposeWidth * mEncComposeHeight)
+    {
+        mEncComposeWidth = vidEncParams.width;
+        mEncComposeHeight = vidEncParams.height;
+        mEncMtvReader = _CloneEncodeVideoReader(mEncComposeWidth, mEncComposeHeight, mEncVidParams.frameRate);
+    }
+    mEncExtraOutputs.push_back(output);
+    return true;
+}
+
+void TimeLine::StartEncoding()
+{
+    if (mEncodingThread.joinable())
+    {
+        mQuitEncoding = true;
+        mEncodingThread.join();
+        //return;
+    }
+    mEncodeProcErrMsg.clear();
+    mEncodingProgress = 0;
+    mEncodingDuration = (double)ValidDuration()/1000.f;
+    _ResetEncodeStageStats();
+    mEncodingPreviewNextUs = 0;
+    mEncodingPreviewMailbox.Clear();
+    mEncHashWriter.Close();
+    if (!mEncodingHashPath.empty() && !mEncHashWriter.Open(mEncodingHashPath, mEncodeProcErrMsg))
+    {
+        mEncodeProcErrMsg = "[hash] '" + mEncodeProcErrMsg + "'.";
+        return;
+    }
+    const MediaCore::Ratio hashFrameRate = mEncVidParams.frameRate;
+    mEncHashStartFrame = hashFrameRate.num > 0 ? (int64_t)std::ceil((double)mEncoding_start * hashFrameRate.num / ((double)hashFrameRate.den * 1000)) : 0;
+    mQuitEncoding = false;
+    mIsEncoding = true;
+    if (mEncRawStreamWriter)
+        mEncodingThread = std::thread(&TimeLine::_EncodeRawStreamProc, this);
+    else if (mEncImageSeqWriter)
+        mEncodingThread = std::thread(&TimeLine::_EncodeImageSequenceProc, this);
+    else if (!mEncMtvReader)
+        mEncodingThread = std::thread(&TimeLine::_EncodeAudioProc, this);
+    else if (IsSegmentedEncoding())
+        mEncodingThread = std::thread(&TimeLine::_EncodeSegmentsProc, this);
+    else
+        mEncodingThread = std::thread(&TimeLine::_EncodeProc, this);
+    SysUtils::SetThreadName(mEncodingThread, "TL-EncProc");
+}
+
+void TimeLine::StopEncoding()
+{
+    mQuitEncoding = true;
+    if (mEncodingThread.joinable())
+    {
+        mEncodingThread.join();
+        mEncodingThread = std::thread();
+    }
+    mIsEncoding = false;
+    mEncMtvReader = nullptr;
+    mEncMtaReader = nullptr;
+    mEncSegments.clear();
+    mEncSegmentReaders.clear();
+    mEncRemoteRequest = imgui_json::value();
+    mEncExtraOutputs.clear();
+    mEncImageSeqWriter = nullptr;
+    mEncRawStreamWriter = nullptr;
+}
+
+bool TimeLine::_TuneEncoders(std::string& errMsg)
+{
+    if (!mEncMtvReader)
+        return true;
+    VideoEncoderParams tunedParams = mEncVidParams;
+    std::string tuneErrMsg;
+    // the encoding reader isn't used yet, the encoding seeks it to the start after the tuning
+    if (!_TuneVideoEncoder(mEncMtvReader, mEncOutputPath, tunedParams, mEncodingTuneCachePath, tuneErrMsg))
+    {
+        if (!mQuitEncoding)
+            Logger::Log(Logger::WARN) << "Encoder auto-tuning is skipped! " << tuneErrMsg << std::endl;
+        return true;
+    }
+    // the encoders are configured but not started yet, they're reopened with the tuned options
+    auto reopen = [] (MediaCore::MediaEncoder::Holder& hEncoder, const std::string& path, const VideoEncoderParams& vidParams, const AudioEncoderParams& audParams, std::string& errMsg) {
+        hEncoder->Close();
+        hEncoder = MediaCore::MediaEncoder::CreateInstance();
+        std::vector<MediaCore::MediaEncoder::Option> extraOpts = vidParams.extraOpts;
+        if (!hEncoder->Open(path) ||
+            !hEncoder->ConfigureVideoStream(
+                vidParams.codecName, vidParams.imageFormat, vidParams.width, vidParams.height,
+                vidParams.frameRate, vidParams.bitRate, &extraOpts) ||
+            !hEncoder->ConfigureAudioStream(
+                audParams.codecName, audParams.sampleFormat, audParams.channels,
+                audParams.sampleRate, audParams.bitRate))
+        {
+            errMsg = hEncoder->GetError();
+            return false;
+        }
+        return true;
+    };
+    auto applyTuning = [&tunedParams] (VideoEncoderParams& params) {
+        for (auto& opt : tunedParams.extraOpts)
+        {
+            auto iter = std::find_if(params.extraOpts.begin(), params.extraOpts.end(), [&opt] (const MediaCore::MediaEncoder::Option& item) { return item.name == opt.name; });
+            if (iter != params.extraOpts.end())
+                *iter = opt;
+            else
+                params.extraOpts.push_back(opt);
+        }
+    };
+    mEncVidParams = tunedParams;
+    if (!reopen(mEncoder, mEncOutputPath, mEncVidParams, mEncAudParams, errMsg))
+        return false;
+    for (auto& output : mEncExtraOutputs)
+    {
+        applyTuning(output.vidParams);
+        if (!reopen(output.encoder, output.path, output.vidParams, output.audParams, errMsg))
+            return false;
+    }
+    return true;
+}
+
+void TimeLine::_EncodeProc()
+{
+    Logger::Log(Logger::DEBUG) << ">>>>>>>>>>> Enter encoding proc >>>>>>>>>>>>" << std::endl;
+    // the calibration takes a few seconds, so it's done here instead of the ui thread
+    std::string tuneErrMsg;
+    if (!mEncodingTuneCachePath.empty() && (!_TuneEncoders(tuneErrMsg) || mQuitEncoding))
+    {
+        if (!tuneErrMsg.empty())
+            mEncodeProcErrMsg = "[video] '" + tuneErrMsg + "'.";
+        mIsEncoding = false;
+        Logger::Log(Logger::DEBUG) << "<<<<<<<<<<<<< Quit encoding proc <<<<<<<<<<<<<<<<" << std::endl;
+        return;
+    }
+    MediaCore::Ratio outFrameRate = mEncoder->GetVideoFrameRate();
+    double dur = (double)ValidDuration() / 1000;
+    double enc_start = (double)mEncoding_start / 1000;
+    double enc_end = (double)mEncoding_end / 1000;
+    if (mEncMtvReader) mEncMtvReader->SeekTo(mEncoding_start);
+    if (mEncMtaReader) mEncMtaReader->SeekTo(mEncoding_start);
+
+    // compose, (scale,) audio mix and the encode/mux of every output run in their own threads, connected
+    // by bounded queues. an empty mat in the queue marks the end of the stream.
+    struct OutputContext
+    {
+        MediaCore::MediaEncoder::Holder encoder;
+        uint32_t width;
+        uint32_t height;
+        std::unique_ptr<MEC::BoundedQueue<ImGui::ImMat>> vidQueue;
+        std::unique_ptr<MEC::BoundedQueue<ImGui::ImMat>> audQueue;
+    };
+    const size_t vidQueueSize = mEncodingVideoQueueSize > 0 ? mEncodingVideoQueueSize : 1;
+    const size_t audQueueSize = mEncodingAudioQueueSize > 0 ? mEncodingAudioQueueSize : 1;
+    std::vector<OutputContext> outputs(1+mEncExtraOutputs.size());
+    bool needScale = false;
+    for (int i = 0; i < outputs.size(); i++)
+    {
+        auto& output = outputs[i];
+        output.encoder = i == 0 ? mEncoder : mEncExtraOutputs[i-1].encoder;
+        output.width = i == 0 ? mEncVidParams.width : mEncExtraOutputs[i-1].vidParams.width;
+        output.height = i == 0 ? mEncVidParams.height : mEncExtraOutputs[i-1].vidParams.height;
+        output.vidQueue.reset(new MEC::BoundedQueue<ImGui::ImMat>(vidQueueSize));
+        output.audQueue.reset(new MEC::BoundedQueue<ImGui::ImMat>(audQueueSize));
+        if (output.width != mEncComposeWidth || output.height != mEncComposeHeight)
+            needScale = true;
+    }
+    auto& mainOutput = outputs[0];
+    MEC::BoundedQueue<ImGui::ImMat> scaleQueue(vidQueueSize);
+    auto& composeQueue = needScale ? scaleQueue : *mainOutput.vidQueue;
+    mEncodeStageStatus[ENC_STAGE_VIDEO_COMPOSE].capacity = composeQueue.Capacity();
+    mEncodeStageStatus[ENC_STAGE_AUDIO_MIX].capacity = mainOutput.audQueue->Capacity();
+    for (auto stage : {ENC_STAGE_VIDEO_COMPOSE, ENC_STAGE_AUDIO_MIX})
+        mEncodeStageStatus[stage].threads = 1;
+    for (auto stage : {ENC_STAGE_VIDEO_ENCODE, ENC_STAGE_AUDIO_ENCODE, ENC_STAGE_MUX})
+        mEncodeStageStatus[stage].threads = outputs.size();
+    if (needScale)
+    {
+        mEncodeStageStatus[ENC_STAGE_VIDEO_SCALE].threads = 1;
+        mEncodeStageStatus[ENC_STAGE_VIDEO_SCALE].capacity = mainOutput.vidQueue->Capacity();
+    }
+    std::atomic<bool> stageFailed {false};
+    std::mutex errMsgLock;
+    auto setError = [&] (const std::string& errMsg) {
+        std::lock_guard<std::mutex> lk(errMsgLock);
+        if (mEncodeProcErrMsg.empty())
+            mEncodeProcErrMsg = errMsg;
+        stageFailed = true;
+    };
+    auto pushWait = [&] (MEC::BoundedQueue<ImGui::ImMat>& queue, const ImGui::ImMat& mat) {
+        while (!queue.TryPush(mat))
+        {
+            if (mQuitEncoding || stageFailed)
+                return false;
+            ImGui::sleep(1);
+        }
+        return true;
+    };
+    for (auto& output : outputs)
+    {
+        if (!output.encoder->Start())
+        {
+            setError("[video] '" + output.encoder->GetError() + "'.");
+            break;
+        }
+    }
+    // composed frames and mixed blocks are hashed before they are scaled or encoded
+    auto hashFrame = [&] (const ImGui::ImMat& mat, bool isVideo, int64_t index) {
+        std::string errMsg;
+        if (!_HashEncodeFrame(mat, isVideo, index, mat.time_stamp, errMsg))
+        {
+            setError(errMsg);
+            return false;
+        }
+        return true;
+    };
+
+    // the composed frame is scaled once for every distinct output size, then shared by the outputs of that size
+    MEC::FrameScaler scaler;
+    auto fanOutVideo = [&] (const ImGui::ImMat& vmat) {
+        std::map<std::pair<uint32_t, uint32_t>, ImGui::ImMat> scaledMats;
+        for (auto& output : outputs)
+        {
+            ImGui::ImMat outMat = vmat;
+            if (!vmat.empty() && (output.width != vmat.w || output.height != vmat.h))
+            {
+                auto scaledIter = scaledMats.find({output.width, output.height});
+                if (scaledIter == scaledMats.end())
+                {
+                    MEC::ScopedStageTimer stageTimer(mEncodeStageStatus[ENC_STAGE_VIDEO_SCALE].busyUs);
+                    if (!scaler.Scale(vmat, outMat, output.width, output.height))
+                    {
+                        std::ostringstream oss;
+                        oss << "[video] 'FAILED to scale frame to " << output.width << "x" << output.height << ".'";
+                        setError(oss.str());
+                        return false;
+                    }
+                    scaledMats[{output.width, output.height}] = outMat;
+                }
+                else
+                    outMat = scaledIter->second;
+            }
+            if (!pushWait(*output.vidQueue, outMat))
+                return false;
+        }
+        return true;
+    };
+
+    std::thread vidComposeThread([&] () {
+        uint32_t vidFrameCount = 0;
+        ImGui::ImMat vmat;
+        while (!mQuitEncoding && !stageFailed)
+        {
+            double vidpos = (double)vidFrameCount * outFrameRate.den / outFrameRate.num + enc_start;
+            if (vidpos >= enc_end)
+                break;
+            bool readOk;
+            {
+                MEC::ScopedStageTimer stageTimer(mEncodeStageStatus[ENC_STAGE_VIDEO_COMPOSE].busyUs);
+                readOk = mEncMtvReader->ReadVideoFrame((int64_t)(vidpos * 1000), vmat);
+            }
+            if (!readOk)
+            {
+                std::ostringstream oss;
+                oss << "[video] '" << mEncMtvReader->GetError() << "'.";
+                setError(oss.str());
+                break;
+            }
+            if (vmat.empty())
+                continue;
+            vidFrameCount++;
+            vmat.time_stamp = vidpos - enc_start;
+            if (mEncHashWriter.IsOpened() && !hashFrame(vmat, true, vidFrameCount-1))
+                break;
+            _PublishEncodingPreview(vmat);
+            if (needScale ? !pushWait(scaleQueue, vmat) : !fanOutVideo(vmat))
+                break;
+            mEncodeStageStatus[ENC_STAGE_VIDEO_COMPOSE].processed++;
+            mEncodeStageStatus[ENC_STAGE_VIDEO_COMPOSE].queued = composeQueue.Size();
+        }
+        if (needScale)
+            pushWait(scaleQueue, ImGui::ImMat());
+        else
+            fanOutVideo(ImGui::ImMat());
+    });
+    SysUtils::SetThreadName(vidComposeThread, "TL-EncVidComp");
+
+    std::thread vidScaleThread;
+    if (needScale)
+    {
+        vidScaleThread = std::thread([&] () {
+            ImGui::ImMat vmat;
+            while (!mQuitEncoding && !stageFailed)
+            {
+                if (!scaleQueue.TryPop(vmat))
+                {
+                    ImGui::sleep(1);
+                    continue;
+                }
+                if (!fanOutVideo(vmat) || vmat.empty())
+                    break;
+                mEncodeStageStatus[ENC_STAGE_VIDEO_SCALE].processed++;
+                mEncodeStageStatus[ENC_STAGE_VIDEO_SCALE].queued = mainOutput.vidQueue->Size();
+            }
+        });
+        SysUtils::SetThreadName(vidScaleThread, "TL-EncVidScale");
+    }
+
+    std::thread audMixThread([&] () {
+        double audpos = 0;
+        int64_t audBlockCount = 0;
+        ImGui::ImMat amat;
+        auto fanOutAudio = [&] (const ImGui::ImMat& mat) {
+            for (auto& output : outputs)
+            {
+                if (!pushWait(*output.audQueue, mat))
+                    return false;
+            }
+            return true;
+        };
+        while (!mQuitEncoding && !stageFailed)
+        {
+            bool eof, readOk;
+            {
+                MEC::ScopedStageTimer stageTimer(mEncodeStageStatus[ENC_STAGE_AUDIO_MIX].busyUs);
+                readOk = mEncMtaReader->ReadAudioSamples(amat, eof);
+            }
+            if (!readOk && !eof)
+            {
+                std::ostringstream oss;
+                oss << "[audio] '" << mEncMtaReader->GetError() << "'.";
+                setError(oss.str());
+                break;
+            }
+            if (audpos > enc_end || eof)
+                break;
+            if (amat.empty())
+                continue;
+            audpos = amat.time_stamp;
+            amat.time_stamp -= enc_start;
+            if (mEncHashWriter.IsOpened() && !hashFrame(amat, false, audBlockCount++))
+                break;
+            if (!fanOutAudio(amat))
+                break;
+            mEncodeStageStatus[ENC_STAGE_AUDIO_MIX].processed++;
+            mEncodeStageStatus[ENC_STAGE_AUDIO_MIX].queued = mainOutput.audQueue->Size();
+        }
+        fanOutAudio(ImGui::ImMat());
+    });
+    SysUtils::SetThreadName(audMixThread, "TL-EncAudMix");
+
+    // encode and mux in timestamp order, the encoder is never blocked by the composition
+    auto encodeOutput = [&] (OutputContext& output, bool isMainOutput) {
+        auto& vidQueue = *output.vidQueue;
+        auto& audQueue = *output.audQueue;
+        double encpos = 0;
+        bool vidInputEof = false;
+        bool audInputEof = false;
+        bool vidReady = false, audReady = false;
+        ImGui::ImMat vmat, amat;
+        while (!mQuitEncoding && !stageFailed && (!vidInputEof || !audInputEof))
+        {
+            if (!vidInputEof && !vidReady)
+                vidReady = vidQueue.TryPop(vmat);
+            if (!audInputEof && !audReady)
+                audReady = audQueue.TryPop(amat);
+            if (isMainOutput)
+            {
+                mEncodeStageStatus[ENC_STAGE_VIDEO_COMPOSE].queued = composeQueue.Size();
+                mEncodeStageStatus[ENC_STAGE_AUDIO_MIX].queued = audQueue.Size();
+            }
+            bool encodeVideo;
+            if (vidReady && (audInputEof || (audReady && (vmat.empty() || (!amat.empty() && vmat.time_stamp <= amat.time_stamp)))))
+                encodeVideo = true;
+            else if (audReady && (vidInputEof || vidReady))
+                encodeVideo = false;
+            else
+            {
+                // wait until both streams have data to keep the output interleaved
+                ImGui::sleep(1);
+                continue;
+            }
+
+            if (encodeVideo)
+            {
+                vidReady = false;
+                bool encodeOk;
+                {
+                    MEC::ScopedStageTimer stageTimer(mEncodeStageStatus[ENC_STAGE_VIDEO_ENCODE].busyUs);
+                    encodeOk = output.encoder->EncodeVideoFrame(vmat);
+                }
+                if (!encodeOk)
+                {
+                    std::ostringstream oss;
+                    oss << "[video] '" << output.encoder->GetError() << "'.";
+                    setError(oss.str());
+                    break;
+                }
+                if (vmat.empty())
+                {
+                    vidInputEof = true;
+                    continue;
+                }
+                if (vmat.time_stamp + enc_start > encpos)
+                    encpos = vmat.time_stamp + enc_start;
+                mEncodeStageStatus[ENC_STAGE_VIDEO_ENCODE].processed++;
+            }
+            else
+            {
+                audReady = false;
+                bool encodeOk;
+                {
+                    MEC::ScopedStageTimer stageTimer(mEncodeStageStatus[ENC_STAGE_AUDIO_ENCODE].busyUs);
+                    encodeOk = output.encoder->EncodeAudioSamples(amat);
+                }
+                if (!encodeOk)
+                {
+                    std::ostringstream oss;
+                    oss << "[audio] '" << output.encoder->GetError() << "'.";
+                    setError(oss.str());
+                    break;
+                }
+                if (amat.empty())
+                {
+                    audInputEof = true;
+                    continue;
+                }
+                if (amat.time_stamp + enc_start > encpos)
+                    encpos = amat.time_stamp + enc_start;
+                mEncodeStageStatus[ENC_STAGE_AUDIO_ENCODE].processed++;
+            }
+            if (isMainOutput)
+                mEncodingProgress = (encpos - enc_start) / dur;
+        }
+        if (!vidInputEof || !audInputEof)
+            stageFailed = true;     // stop the producer stages and the other outputs
+    };
+    std::vector<std::thread> outputThreads;
+    for (int i = 1; i < outputs.size(); i++)
+    {
+        outputThreads.push_back(std::thread(encodeOutput, std::ref(outputs[i]), false));
+        SysUtils::SetThreadName(outputThreads.back(), "TL-EncOut"+std::to_string(i));
+    }
+    encodeOutput(mainOutput, true);
+    for (auto& outputThread : outputThreads)
+        outputThread.join();
+    vidComposeThread.join();
+    if (vidScaleThread.joinable())
+        vidScaleThread.join();
+    audMixThread.join();
+    if (!mQuitEncoding && mEncodeProcErrMsg.empty())
+    {
+        mEncodingProgress = 1;
+    }
+    {
+        MEC::ScopedStageTimer stageTimer(mEncodeStageStatus[ENC_STAGE_MUX].busyUs);
+        for (auto& output : outputs)
+        {
+            output.encoder->FinishEncoding();
+            output.encoder->Close();
+        }
+    }
+    _FinishEncodeStageStats();
+    mIsEncoding = false;
+    Logger::Log(Logger::DEBUG) << "<<<<<<<<<<<<< Quit encoding proc <<<<<<<<<<<<<<<<" << std::endl;
+}
+
+void TimeLine::_EncodeAudioProc()
+{
+    Logger::Log(Logger::DEBUG) << ">>>>>>>>>>> Enter audio encoding proc >>>>>>>>>>>>" << std::endl;
+    const double dur = (double)ValidDuration() / 1000;
+    const double enc_start = (double)mEncoding_start / 1000;
+    const double enc_end = (double)mEncoding_end / 1000;
+    // the bulk of the range is mixed in large blocks, the last part with the encoder sized blocks of
+    // the configured reader, so the output doesn't run over the end by a whole large block
+    const int64_t blockMs = mEncodingAudioBlockMs > 0 ? mEncodingAudioBlockMs : 1000;
+    const uint32_t blockSamples = (uint32_t)((int64_t)mEncAudParams.sampleRate * blockMs / 1000);
+    auto hBulkReader = mMtaReader->CloneAndConfigure(mEncAudParams.channels, mEncAudParams.sampleRate, blockSamples);
+    hBulkReader->SeekTo(mEncoding_start);
+
+    MEC::BoundedQueue<ImGui::ImMat> audQueue(4);
+    mEncodeStageStatus[ENC_STAGE_AUDIO_MIX].capacity = audQueue.Capacity();
+    for (auto stage : {ENC_STAGE_AUDIO_MIX, ENC_STAGE_AUDIO_ENCODE, ENC_STAGE_MUX})
+        mEncodeStageStatus[stage].threads = 1;
+    std::atomic<bool> stageFailed {false};
+    std::mutex errMsgLock;
+    auto setError = [&] (const std::string& errMsg) {
+        std::lock_guard<std::mutex> lk(errMsgLock);
+        if (mEncodeProcErrMsg.empty())
+            mEncodeProcErrMsg = errMsg;
+        stageFailed = true;
+    };
+    if (!mEncoder->Start())
+        setError("[audio] '" + mEncoder->GetError() + "'.");
+
+    std::thread audMixThread([&] () {
+        auto hReader = hBulkReader;
+        bool bulkReading = true;
+        double nextpos = enc_start;
+        int64_t audBlockCount = 0;
+        ImGui::ImMat amat;
+        while (!mQuitEncoding && !stageFailed)
+        {
+            if (bulkReading && nextpos + (double)blockMs / 1000 > enc_end)
+            {
+                bulkReading = false;
+                hReader = mEncMtaReader;
+                hReader->SeekTo((int64_t)std::round(nextpos * 1000));
+            }
+            bool eof, readOk;
+            {
+                MEC::ScopedStageTimer stageTimer(mEncodeStageStatus[ENC_STAGE_AUDIO_MIX].busyUs);
+                readOk = hReader->ReadAudioSamples(amat, eof);
+            }
+            if (!readOk && !eof)
+            {
+                setError("[audio] '" + hReader->GetError() + "'.");
+                break;
+            }
+            if (eof || (!amat.empty() && amat.time_stamp >= enc_end))
+                break;
+            if (amat.empty())
+                continue;
+            if (bulkReading)
+                nextpos = amat.time_stamp + (double)blockMs / 1000;
+            amat.time_stamp -= enc_start;
+            std::string hashErrMsg;
+            if (mEncHashWriter.IsOpened() && !_HashEncodeFrame(amat, false, audBlockCount++, amat.time_stamp, hashErrMsg))
+            {
+                setError(hashErrMsg);
+                break;
+            }
+            while (!audQueue.TryPush(amat) && !mQuitEncoding && !stageFailed)
+                ImGui::sleep(1);
+            mEncodeStageStatus[ENC_STAGE_AUDIO_MIX].processed++;
+            mEncodeStageStatus[ENC_STAGE_AUDIO_MIX].queued = audQueue.Size();
+        }
+        while (!audQueue.TryPush(ImGui::ImMat()) && !mQuitEncoding && !stageFailed)
+            ImGui::sleep(1);
+    });
+    SysUtils::SetThreadName(audMixThread, "TL-EncAudMix");
+
+    ImGui::ImMat amat;
+    while (!mQuitEncoding && !stageFailed)
+    {
+        if (!audQueue.TryPop(amat))
+        {
+            ImGui::sleep(1);
+            continue;
+        }
+        mEncodeStageStatus[ENC_STAGE_AUDIO_MIX].queued = audQueue.Size();
+        bool encodeOk;
+        {
+            MEC::ScopedStageTimer stageTimer(mEncodeStageStatus[ENC_STAGE_AUDIO_ENCODE].busyUs);
+            encodeOk = mEncoder->EncodeAudioSamples(amat);
+        }
+        if (!encodeOk)
+        {
+            setError("[audio] '" + mEncoder->GetError() + "'.");
+            break;
+        }
+        if (amat.empty())
+            break;
+        mEncodeStageStatus[ENC_STAGE_AUDIO_ENCODE].processed++;
+        mEncodingProgress = amat.time_stamp / dur;
+    }
+    stageFailed = stageFailed || mQuitEncoding;
+    audMixThread.join();
+    if (!mQuitEncoding && mEncodeProcErrMsg.empty())
+    {
+        mEncodingProgress = 1;
+    }
+    {
+        MEC::ScopedStageTimer stageTimer(mEncodeStageStatus[ENC_STAGE_MUX].busyUs);
+        mEncoder->FinishEncoding();
+        mEncoder->Close();
+    }
+    _FinishEncodeStageStats();
+    mIsEncoding = false;
+    Logger::Log(Logger::DEBUG) << "<<<<<<<<<<<<< Quit audio encoding proc <<<<<<<<<<<<<<<<" << std::endl;
+}
+
+void TimeLine::_EncodeImageSequenceProc()
+{
+    Logger::Log(Logger::DEBUG) << ">>>>>>>>>>> Enter image sequence encoding proc >>>>>>>>>>>>" << std::endl;
+    const MediaCore::Ratio outFrameRate = mEncVidParams.frameRate;
+    const double dur = (double)ValidDuration() / 1000;
+    const double enc_start = (double)mEncoding_start / 1000;
+    const double enc_end = (double)mEncoding_end / 1000;
+    const double totalFrames = std::max(dur * outFrameRate.num / outFrameRate.den, 1.);
+    mEncMtvReader->SeekTo(mEncoding_start);
+
+    // frames are composed in order on this thread, compressed and written by the writer pool
+    auto& composeStatus = mEncodeStageStatus[ENC_STAGE_VIDEO_COMPOSE];
+    auto& writeStatus = mEncodeStageStatus[ENC_STAGE_VIDEO_ENCODE];
+    composeStatus.threads = 1;
+    composeStatus.capacity = (int32_t)mEncImageSeqWriter->GetQueueCapacity();
+    writeStatus.threads = mEncImageSeqWriter->GetThreadCount();
+    mEncImageSeqWriter->SetStageCounters(&writeStatus.busyUs, &writeStatus.processed);
+    int64_t frameIndex = 0;
+    ImGui::ImMat vmat;
+    while (!mQuitEncoding)
+    {
+        double vidpos = (double)frameIndex * outFrameRate.den / outFrameRate.num + enc_start;
+        if (vidpos >= enc_end)
+            break;
+        bool readOk;
+        {
+            MEC::ScopedStageTimer stageTimer(composeStatus.busyUs);
+            readOk = mEncMtvReader->ReadVideoFrame((int64_t)(vidpos * 1000), vmat);
+        }
+        if (!readOk)
+        {
+            mEncodeProcErrMsg = "[video] '" + mEncMtvReader->GetError() + "'.";
+            break;
+        }
+        if (vmat.empty())
+            continue;
+        vmat.time_stamp = vidpos - enc_start;
+        if (mEncHashWriter.IsOpened() && !_HashEncodeFrame(vmat, true, frameIndex, vmat.time_stamp, mEncodeProcErrMsg))
+            break;
+        _PublishEncodingPreview(vmat);
+        if (!mEncImageSeqWriter->WriteFrame(vmat, frameIndex))
+        {
+            mEncodeProcErrMsg = "[image] '" + mEncImageSeqWriter->GetError() + "'.";
+            break;
+        }
+        frameIndex++;
+        composeStatus.processed++;
+        composeStatus.queued = (int32_t)mEncImageSeqWriter->GetQueuedCount();
+        mEncodingProgress = std::min(writeStatus.processed / totalFrames, 1.);
+    }
+    const bool discardPending = mQuitEncoding || !mEncodeProcErrMsg.empty();
+    if (!mEncImageSeqWriter->Close(discardPending) && mEncodeProcErrMsg.empty())
+        mEncodeProcErrMsg = "[image] '" + mEncImageSeqWriter->GetError() + "'.";
+    if (!mQuitEncoding && mEncodeProcErrMsg.empty())
+    {
+        mEncodingProgress = 1;
+    }
+    _FinishEncodeStageStats();
+    mIsEncoding = false;
+    Logger::Log(Logger::DEBUG) << "<<<<<<<<<<<<< Quit image sequence encoding proc <<<<<<<<<<<<<<<<" << std::endl;
+}
+
+void TimeLine::_EncodeRawStreamProc()
+{
+    Logger::Log(Logger::DEBUG) << ">>>>>>>>>>> Enter raw stream proc >>>>>>>>>>>>" << std::endl;
+    const auto& format = mEncRawStreamWriter->GetFormat();
+    const MediaCore::Ratio outFrameRate = mEncVidParams.frameRate;
+    const double dur = (double)ValidDuration() / 1000;
+    const double enc_start = (double)mEncoding_start / 1000;
+    const double enc_end = (double)mEncoding_end / 1000;
+    const bool hasVideo = format.width > 0;
+    const bool hasAudio = format.channels > 0;
+    if (hasVideo) mEncMtvReader->SeekTo(mEncoding_start);
+    if (hasAudio) mEncMtaReader->SeekTo(mEncoding_start);
+
+    // the video is composed on its own thread, the audio is mixed and both are written in timestamp order on this thread
+    const size_t vidQueueSize = mEncodingVideoQueueSize > 0 ? mEncodingVideoQueueSize : 1;
+    MEC::BoundedQueue<ImGui::ImMat> vidQueue(vidQueueSize);
+    mEncodeStageStatus[ENC_STAGE_VIDEO_COMPOSE].capacity = vidQueue.Capacity();
+    mEncodeStageStatus[ENC_STAGE_VIDEO_COMPOSE].threads = hasVideo ? 1 : 0;
+    mEncodeStageStatus[ENC_STAGE_AUDIO_MIX].threads = hasAudio ? 1 : 0;
+    mEncodeStageStatus[ENC_STAGE_MUX].threads = 1;
+    std::atomic<bool> stageFailed {false};
+    std::mutex errMsgLock;
+    auto setError = [&] (const std::string& errMsg) {
+        std::lock_guard<std::mutex> lk(errMsgLock);
+        if (mEncodeProcErrMsg.empty())
+            mEncodeProcErrMsg = errMsg;
+        stageFailed = true;
+    };
+
+    std::thread vidComposeThread;
+    if (hasVideo)
+    {
+        vidComposeThread = std::thread([&] () {
+            int64_t vidFrameCount = 0;
+            ImGui::ImMat vmat;
+            while (!mQuitEncoding && !stageFailed)
+            {
+                double vidpos = (double)vidFrameCount * outFrameRate.den / outFrameRate.num + enc_start;
+                if (vidpos >= enc_end)
+                    break;
+                bool readOk;
+                {
+                    MEC::ScopedStageTimer stageTimer(mEncodeStageStatus[ENC_STAGE_VIDEO_COMPOSE].busyUs);
+                    readOk = mEncMtvReader->ReadVideoFrame((int64_t)(vidpos * 1000), vmat);
+                }
+                if (!readOk)
+                {
+                    setError("[video] '" + mEncMtvReader->GetError() + "'.");
+                    break;
+                }
+                if (vmat.empty())
+                    continue;
+                vidFrameCount++;
+                vmat.time_stamp = vidpos - enc_start;
+                std::string hashErrMsg;
+                if (mEncHashWriter.IsOpened() && !_HashEncodeFrame(vmat, true, vidFrameCount-1, vmat.time_stamp, hashErrMsg))
+                {
+                    setError(hashErrMsg);
+                    break;
+                }
+                _PublishEncodingPreview(vmat);
+                while (!vidQueue.TryPush(vmat) && !mQuitEncoding && !stageFailed)
+                    ImGui::sleep(1);
+                mEncodeStageStatus[ENC_STAGE_VIDEO_COMPOSE].processed++;
+                mEncodeStageStatus[ENC_STAGE_VIDEO_COMPOSE].queued = vidQueue.Size();
+            }
+            while (!vidQueue.TryPush(ImGui::ImMat()) && !mQuitEncoding && !stageFailed)
+                ImGui::sleep(1);
+        });
+        SysUtils::SetThreadName(vidComposeThread, "TL-EncVidComp");
+    }
+
+    ImGui::ImMat vmat, amat;
+    bool vidEof = !hasVideo, audEof = !hasAudio, vidPending = false;
+    double audpos = 0;
+    int64_t audBlockCount = 0;
+    while (!mQuitEncoding && !stageFailed && (!vidEof || !audEof))
+    {
+        if (!vidEof && !vidPending)
+        {
+            if (!vidQueue.TryPop(vmat))
+            {
+                ImGui::sleep(1);
+                continue;
+            }
+            mEncodeStageStatus[ENC_STAGE_VIDEO_COMPOSE].queued = vidQueue.Size();
+            if (vmat.empty())
+                vidEof = true;
+            else
+                vidPending = true;
+            continue;
+        }
+        // the audio goes first until it reaches the pending video frame
+        if (!audEof && (!vidPending || audpos <= vmat.time_stamp))
+        {
+            bool eof, readOk;
+            {
+                MEC::ScopedStageTimer stageTimer(mEncodeStageStatus[ENC_STAGE_AUDIO_MIX].busyUs);
+                readOk = mEncMtaReader->ReadAudioSamples(amat, eof);
+            }
+            if (!readOk && !eof)
+            {
+                setError("[audio] '" + mEncMtaReader->GetError() + "'.");
+                break;
+            }
+            if (eof || (!amat.empty() && amat.time_stamp >= enc_end))
+            {
+                audEof = true;
+                continue;
+            }
+            if (amat.empty())
+                continue;
+            const double audts = amat.time_stamp - enc_start;
+            audpos = audts + (double)amat.w / format.sampleRate;
+            std::string hashErrMsg;
+            if (mEncHashWriter.IsOpened() && !_HashEncodeFrame(amat, false, audBlockCount++, audts, hashErrMsg))
+            {
+                setError(hashErrMsg);
+                break;
+            }
+            bool writeOk;
+            {
+                MEC::ScopedStageTimer stageTimer(mEncodeStageStatus[ENC_STAGE_MUX].busyUs);
+                writeOk = mEncRawStreamWriter->WriteAudioSamples(amat, (int64_t)std::round(audts * 1000000));
+            }
+            if (!writeOk)
+            {
+                setError("[raw] '" + mEncRawStreamWriter->GetError() + "'.");
+                break;
+            }
+            mEncodeStageStatus[ENC_STAGE_AUDIO_MIX].processed++;
+            if (!hasVideo)
+                mEncodingProgress = std::min(audpos / dur, 1.);
+            continue;
+        }
+        if (vidPending)
+        {
+            bool writeOk;
+            {
+                MEC::ScopedStageTimer stageTimer(mEncodeStageStatus[ENC_STAGE_MUX].busyUs);
+                writeOk = mEncRawStreamWriter->WriteVideoFrame(vmat, (int64_t)std::round(vmat.time_stamp * 1000000));
+            }
+            if (!writeOk)
+            {
+                setError("[raw] '" + mEncRawStreamWriter->GetError() + "'.");
+                break;
+            }
+            vidPending = false;
+            mEncodeStageStatus[ENC_STAGE_MUX].processed++;
+            mEncodingProgress = std::min(vmat.time_stamp / dur, 1.);
+        }
+    }
+    stageFailed = stageFailed || mQuitEncoding;
+    if (vidComposeThread.joinable())
+        vidComposeThread.join();
+    mEncRawStreamWriter->Close();
+    if (!mQuitEncoding && mEncodeProcErrMsg.empty())
+    {
+        mEncodingProgress = 1;
+    }
+    _FinishEncodeStageStats();
+    mIsEncoding = false;
+    Logger::Log(Logger::DEBUG) << "<<<<<<<<<<<<< Quit raw stream proc <<<<<<<<<<<<<<<<" << std::endl;
+}
+
+bool TimeLine::_EncodeAudioOnly(const std::string& outputPath, std::string& errMsg)
+{
+    auto hEncoder = MediaCore::MediaEncoder::CreateInstance();
+    if (!hEncoder->Open(outputPath) ||
+        !hEncoder->ConfigureAudioStream(mEncAudParams.codecName, mEncAudParams.sampleFormat, mEncAudParams.channels, mEncAudParams.sampleRate, mEncAudParams.bitRate) ||
+        !hEncoder->Start())
+    {
+        errMsg = "[audio] '" + hEncoder->GetError() + "'.";
+        return false;
+    }
+    const double enc_start = (double)mEncoding_start / 1000;
+    const double enc_end = (double)mEncoding_end / 1000;
+    mEncMtaReader->SeekTo(mEncoding_start);
+    ImGui::ImMat amat;
+    bool eof = false;
+    int64_t audBlockCount = 0;
+    auto& mixStatus = mEncodeStageStatus[ENC_STAGE_AUDIO_MIX];
+    auto& encodeStatus = mEncodeStageStatus[ENC_STAGE_AUDIO_ENCODE];
+    mixStatus.threads = 1;
+    encodeStatus.threads = 1;
+    while (!mQuitEncoding && !eof)
+    {
+        bool readOk;
+        {
+            MEC::ScopedStageTimer stageTimer(mixStatus.busyUs);
+            readOk = mEncMtaReader->ReadAudioSamples(amat, eof);
+        }
+        if (!readOk && !eof)
+        {
+            errMsg = "[audio] '" + mEncMtaReader->GetError() + "'.";
+            break;
+        }
+        if (!amat.empty() && amat.time_stamp > enc_end) eof = true;
+        if (eof || amat.empty())
+            amat.release();
+        else
+        {
+            amat.time_stamp -= enc_start;
+            mixStatus.processed++;
+            if (mEncHashWriter.IsOpened() && !_HashEncodeFrame(amat, false, audBlockCount++, amat.time_stamp, errMsg))
+                break;
+        }
+        MEC::ScopedStageTimer stageTimer(encodeStatus.busyUs);
+        if (!hEncoder->EncodeAudioSamples(amat))
+        {
+            errMsg = "[audio] '" + hEncoder->GetError() + "'.";
+            break;
+        }
+        if (!amat.empty())
+            encodeStatus.processed++;
+    }
+    {
+        MEC::ScopedStageTimer stageTimer(mEncodeStageStatus[ENC_STAGE_MUX].busyUs);
+        hEncoder->FinishEncoding();
+        hEncoder->Close();
+    }
+    return errMsg.empty() && !mQuitEncoding;
+}
+
+void TimeLine::_EncodeSegmentsProc()
+{
+    Logger::Log(Logger::DEBUG) << ">>>>>>>>>>> Enter segmented encoding proc >>>>>>>>>>>>" << std::endl;
+    const MediaCore::Ratio frameRate = mEncVidParams.frameRate;
+    const int64_t startFrame = (int64_t)std::ceil((double)mEncoding_start * frameRate.num / ((double)frameRate.den * 1000));
+    const int64_t endFrame = (int64_t)std::ceil((double)mEncoding_end * frameRate.num / ((double)frameRate.den * 1000));
+    // segments are sent to the render workers if there are any, otherwise they are encoded by local threads
+    const bool remote = !mEncodingRemoteWorkers.empty();
+    int workerCount = remote ? (int)mEncodingRemoteWorkers.size() : mEncodingSegmentThreads > 1 ? mEncodingSegmentThreads : 1;
+    bool useCache = false;
+    // the journal lists the finished segments of a resumable export, it's removed with them once the export succeeds
+    struct JournalEntry
+    {
+        std::string key;
+        std::string identity;
+    };
+    std::map<std::string, JournalEntry> journal;
+    std::mutex journalLock;
+    const std::string journalPath = mEncodingResumable ? mEncOutputPath+".journal" : std::string();
+    if (mEncodingResumable)
+    {
+        auto loadResult = imgui_json::value::load(journalPath);
+        if (loadResult.second && loadResult.first["Segments"].is_array())
+        {
+            for (auto& item : loadResult.first["Segments"].get<imgui_json::array>())
+            {
+                if (item["Path"].is_string() && item["Key"].is_string() && item["Identity"].is_string())
+                    journal[item["Path"].get<imgui_json::string>()] = {item["Key"].get<imgui_json::string>(), item["Identity"].get<imgui_json::string>()};
+            }
+        }
+    }
+    auto saveJournal = [&] () {
+        // replace the journal at once, a crash never leaves half of it
+        imgui_json::value value;
+        value["Version"] = imgui_json::number(1);
+        value["Output"] = mEncOutputPath;
+        imgui_json::value items;
+        for (auto& entry : journal)
+        {
+            imgui_json::value item;
+            item["Path"] = entry.first;
+            item["Key"] = entry.second.key;
+            item["Identity"] = entry.second.identity;
+            items.push_back(item);
+        }
+        value["Segments"] = items;
+        const std::string tmpPath = journalPath+".part";
+        value.save(tmpPath);
+        std::rename(tmpPath.c_str(), journalPath.c_str());
+    };
+    // the segments and their keys are planned by ConfigEncoder, the timeline may be edited while encoding
+    std::vector<EncodeSegment> segments = mEncSegments;
+    int passthroughCount = 0;
+    if (!segments.empty())
+    {
+        int cachedCount = 0;
+        int resumedCount = 0;
+        for (auto& segment : segments)
+        {
+            if (segment.srcStart >= 0)
+                passthroughCount++;
+            if (!segment.cacheKey.empty())
+            {
+                useCache = true;
+                segment.cached = ImGuiHelper::file_exists(segment.path);
+                if (segment.cached)
+                {
+                    MEC::TouchFile(segment.path);
+                    cachedCount++;
+                }
+            }
+            else if (!segment.checkpointKey.empty())
+            {
+                // a checkpoint is reused if its inputs are unchanged and the file is the one journaled
+                auto iter = journal.find(segment.path);
+                segment.cached = iter != journal.end() && iter->second.key == segment.checkpointKey &&
+                        iter->second.identity == MEC::GetFileIdentity(segment.path);
+                if (segment.cached) resumedCount++;
+            }
+        }
+        if (useCache)
+            Logger::Log(Logger::DEBUG) << "Render cache: " << cachedCount << " of " << segments.size() << " segments are reused." << std::endl;
+        if (mEncodingResumable)
+            Logger::Log(Logger::DEBUG) << "Resume export: " << resumedCount << " of " << segments.size() << " segments are checkpointed." << std::endl;
+    }
+    if (workerCount > segments.size()) workerCount = segments.size();
+    if (!remote && workerCount > mEncSegmentReaders.size()) workerCount = mEncSegmentReaders.size();
+    if (passthroughCount > 0)
+        Logger::Log(Logger::DEBUG) << "Smart render: " << passthroughCount << " segments are copied without re-encoding." << std::endl;
+    Logger::Log(Logger::DEBUG) << "Encode " << (endFrame-startFrame) << " frames in " << segments.size() << " segments with " << workerCount
+            << (remote ? " render workers." : " workers.") << std::endl;
+
+    mEncodeStageStatus[ENC_STAGE_VIDEO_COMPOSE].threads = workerCount;
+    mEncodeStageStatus[ENC_STAGE_VIDEO_ENCODE].threads = workerCount;
+    mEncodeStageStatus[ENC_STAGE_MUX].threads = 1;
+    // the segments are taken from a queue, a segment failed by a render worker goes back to it for the other workers
+    std::deque<int> pendingSegments;
+    for (int i = 0; i < segments.size(); i++)
+        pendingSegments.push_back(i);
+    std::mutex pendingLock;
+    int inFlightSegments = 0;
+    int liveWorkers = workerCount;
+    std::atomic<int64_t> encodedFrames {0};
+    std::atomic<bool> workerFailed {false};
+    std::mutex errMsgLock;
+    const int64_t totalFrames = endFrame-startFrame;
+    auto setError = [&] (const std::string& errMsg) {
+        std::lock_guard<std::mutex> lk(errMsgLock);
+        if (mEncodeProcErrMsg.empty())
+            mEncodeProcErrMsg = errMsg;
+        workerFailed = true;
+    };
+    std::vector<imgui_json::value> segmentStats;
+    if (remote)
+        segmentStats.resize(segments.size());
+    auto releaseSegment = [&] (int& segIdx) {
+        if (segIdx < 0)
+            return;
+        std::lock_guard<std::mutex> lk(pendingLock);
+        inFlightSegments--;
+        segIdx = -1;
+    };
+    auto takeSegment = [&] (int& segIdx) {
+        releaseSegment(segIdx);
+        while (!mQuitEncoding && !workerFailed)
+        {
+            {
+                std::lock_guard<std::mutex> lk(pendingLock);
+                if (!pendingSegments.empty())
+                {
+                    segIdx = pendingSegments.front();
+                    pendingSegments.pop_front();
+                    inFlightSegments++;
+                    return true;
+                }
+                if (inFlightSegments == 0)
+                    return false;
+            }
+            // a segment in flight may still come back
+            ImGui::sleep(10);
+        }
+        return false;
+    };
+    auto segmentWorker = [&] (int workerIdx) {
+        // every local worker owns a reader cloned by ConfigEncoder, so the composition runs concurrently
+        MediaCore::MultiTrackVideoReader::Holder hReader;
+        if (!remote)
+            hReader = mEncSegmentReaders[workerIdx];
+        int segIdx = -1;
+        while (takeSegment(segIdx))
+        {
+            auto& segment = segments[segIdx];
+            if (segment.cached)
+            {
+                encodedFrames += segment.endFrame-segment.startFrame;
+                mEncodingProgress = (float)encodedFrames / (totalFrames + 1);
+                continue;
+            }
+            if (segment.srcStart >= 0)
+            {
+                std::string errMsg;
+                bool remuxOk;
+                int64_t remuxedFrames = 0;
+                {
+                    MEC::ScopedStageTimer stageTimer(mEncodeStageStatus[ENC_STAGE_MUX].busyUs);
+                    remuxOk = MEC::RemuxVideoRange(segment.srcPath, segment.srcStart, segment.srcEnd, segment.path, remuxedFrames, errMsg);
+                }
+                const int64_t plannedFrames = segment.endFrame-segment.startFrame;
+                if (remuxOk && remuxedFrames == plannedFrames)
+                {
+                    encodedFrames += plannedFrames;
+                    mEncodingProgress = (float)encodedFrames / (totalFrames + 1);
+                    continue;
+                }
+                // open GOPs or leading B-frames make the copy differ from the plan, the video would drift from the audio
+                if (remuxOk)
+                    errMsg = std::to_string(remuxedFrames) + " of " + std::to_string(plannedFrames) + " frames are copied.";
+                Logger::Log(Logger::WARN) << "Smart render: segment [" << segment.startFrame << ", " << segment.endFrame << ") is re-encoded. " << errMsg << std::endl;
+                std::remove(segment.path.c_str());
+            }
+            // a cached or checkpointed segment is written to a partial file first, an interrupted rendering is never reused
+            const bool keepSegment = !segment.cacheKey.empty() || !segment.checkpointKey.empty();
+            const std::string encodePath = keepSegment ? MEC::MakeSegmentPath(segment.path, "part") : segment.path;
+            int64_t segmentFrames = 0;
+            auto onFrames = [&] (int64_t frames) {
+                segmentFrames += frames;
+                encodedFrames += frames;
+                mEncodingProgress = (float)encodedFrames / (totalFrames + 1);
+                return !mQuitEncoding && !workerFailed;
+            };
+            std::string errMsg;
+            bool encodeOk;
+            if (remote)
+            {
+                auto& address = mEncodingRemoteWorkers[workerIdx];
+                auto request = mEncRemoteRequest;
+                request["StartFrame"] = imgui_json::number(segment.startFrame);
+                request["EndFrame"] = imgui_json::number(segment.endFrame);
+                encodeOk = MEC::RenderSegmentOnWorker(address, request, encodePath, onFrames, segmentStats[segIdx], errMsg);
+                if (!encodeOk && !errMsg.empty())
+                    errMsg = "[worker] '" + address + ": " + errMsg + "'.";
+            }
+            else
+            {
+                encodeOk = _EncodeVideoSegment(hReader, mEncVidParams, segment.startFrame, segment.endFrame, encodePath, onFrames, errMsg);
+            }
+            if (!encodeOk)
+            {
+                if (remote && !errMsg.empty() && !mQuitEncoding && !workerFailed)
+                {
+                    // this worker is dropped, the segment is rendered again by the others if any is left
+                    encodedFrames -= segmentFrames;
+                    bool requeued = false;
+                    {
+                        std::lock_guard<std::mutex> lk(pendingLock);
+                        if (--liveWorkers > 0)
+                        {
+                            pendingSegments.push_front(segIdx);
+                            inFlightSegments--;
+                            segIdx = -1;
+                            requeued = true;
+                        }
+                    }
+                    if (requeued)
+                    {
+                        Logger::Log(Logger::WARN) << errMsg << " Segment [" << segment.startFrame << ", " << segment.endFrame << ") is requeued." << std::endl;
+                        break;
+                    }
+                }
+                if (!errMsg.empty())
+                    setError(errMsg);
+                break;
+            }
+            if (keepSegment && std::rename(encodePath.c_str(), segment.path.c_str()) != 0)
+            {
+                setError("[cache] 'FAILED to save segment " + segment.path + "'.");
+                break;
+            }
+            if (!segment.checkpointKey.empty())
+            {
+                std::lock_guard<std::mutex> lk(journalLock);
+                journal[segment.path] = {segment.checkpointKey, MEC::GetFileIdentity(segment.path)};
+                saveJournal();
+            }
+        }
+        releaseSegment(segIdx);
+    };
+
+    std::vector<std::thread> workers;
+    for (int i = 0; i < workerCount; i++)
+    {
+        workers.push_back(std::thread(segmentWorker, i));
+        SysUtils::SetThreadName(workers.back(), (remote ? "TL-EncRemote" : "TL-EncSeg")+std::to_string(i));
+    }
+    std::string audioPath;
+    if (bExportAudio && mEncMtaReader)
+    {
+        // audio is encoded as one continuous stream, avoid codec priming gaps at the segment joints
+        audioPath = MEC::MakeSegmentPath(mEncOutputPath, "audio");
+        std::string errMsg;
+        if (!_EncodeAudioOnly(audioPath, errMsg) && !errMsg.empty())
+            setError(errMsg);
+    }
+    for (auto& worker : workers)
+        worker.join();
+    // the stages run by the workers are accounted as if they were local
+    for (auto& stats : segmentStats)
+    {
+        if (!stats.contains("stages"))
+            continue;
+        for (auto stage : {ENC_STAGE_VIDEO_COMPOSE, ENC_STAGE_VIDEO_FILTER, ENC_STAGE_VIDEO_TRANSITION, ENC_STAGE_VIDEO_ENCODE})
+        {
+            auto& stageStats = stats["stages"][GetEncodeStageName(stage)];
+            if (!stageStats.is_object() || !stageStats["processed"].is_number() || !stageStats["busy"].is_number())
+                continue;
+            mEncodeStageStatus[stage].processed += (int64_t)stageStats["processed"].get<imgui_json::number>();
+            mEncodeStageStatus[stage].busyUs += (int64_t)(stageStats["busy"].get<imgui_json::number>() * 1000000);
+        }
+    }
+
+    // the encoder configured on the final output path is only used to validate the settings
+    mEncoder->Close();
+    if (!mQuitEncoding && !workerFailed)
+    {
+        std::vector<std::string> segmentPaths;
+        for (auto& segment : segments)
+            segmentPaths.push_back(segment.path);
+        std::string errMsg;
+        bool concatOk;
+        {
+            MEC::ScopedStageTimer stageTimer(mEncodeStageStatus[ENC_STAGE_MUX].busyUs);
+            concatOk = MEC::ConcatMediaSegments(segmentPaths, audioPath, mEncOutputPath, errMsg);
+        }
+        if (!concatOk)
+            setError("[concat] '" + errMsg + "'.");
+        else
+            mEncodingProgress = 1;
+    }
+    // the checkpoints of an export which isn't finished are kept for the next run
+    const bool finished = !mQuitEncoding && !workerFailed;
+    for (auto& segment : segments)
+    {
+        if (!segment.cacheKey.empty() || (!segment.checkpointKey.empty() && !finished))
+        {
+            if (!segment.cached)
+                std::remove(MEC::MakeSegmentPath(segment.path, "part").c_str());
+        }
+        else
+            std::remove(segment.path.c_str());
+    }
+    if (finished && !journalPath.empty())
+        std::remove(journalPath.c_str());
+    if (!audioPath.empty())
+        std::remove(audioPath.c_str());
+    if (useCache)
+    {
+        std::vector<std::string> keepPaths;
+        for (auto& segment : segments)
+            if (!segment.cacheKey.empty()) keepPaths.push_back(segment.path);
+        const int pruned = MEC::PruneDirectory(mEncodingCacheDir, (uint64_t)std::max(mEncodingCacheMaxMB, 0) << 20, keepPaths);
+        if (pruned > 0)
+            Logger::Log(Logger::DEBUG) << pruned << " file(s) are pruned from render cache '" << mEncodingCacheDir << "'." << std::endl;
+    }
+    _FinishEncodeStageStats();
+    mIsEncoding = false;
+    Logger::Log(Logger::DEBUG) << "<<<<<<<<<<<<< Quit segmented encoding proc <<<<<<<<<<<<<<<<" << std::endl;
+}
+
+bool TimeLine::TuneVideoEncoder(const std::string& outputPath, VideoEncoderParams& vidEncParams, const std::string& cachePath, std::string& errMsg)
+{
+    ValidDuration();
+    auto hReader = _CloneEncodeVideoReader(vidEncParams.width, vidEncParams.height, vidEncParams.frameRate);
+    if (!hReader)
+    {
+        errMsg = "FAILED to clone the video reader of the encoder auto-tuning!";
+        return false;
+    }
+    return _TuneVideoEncoder(hReader, outputPath, vidEncParams, cachePath, errMsg);
+}
+
+bool TimeLine::_TuneVideoEncoder(MediaCore::MultiTrackVideoReader::Holder hReader, const std::string& outputPath, VideoEncoderParams& vidEncParams,
+        const std::string& cachePath, std::string& errMsg)
+{
+    errMsg.clear();
+    // the best setting depends on the machine, the encoder and its rate control settings, so it's measured once and cached
+    const int cores = std::max((int)std::thread::hardware_concurrency(), 1);
+    auto presetIter = std::find_if(vidEncParams.extraOpts.begin(), vidEncParams.extraOpts.end(), [] (const MediaCore::MediaEncoder::Option& opt) { return opt.name == "preset"; });
+    std::ostringstream keyOss;
+    keyOss << vidEncParams.codecName << "/" << vidEncParams.width << "x" << vidEncParams.height << "/" << vidEncParams.bitRate << "bps/preset";
+    if (presetIter != vidEncParams.extraOpts.end())
+        keyOss << presetIter->value.numval.i64;
+    else
+        keyOss << "default";
+    keyOss << "/" << cores << "cores/lookahead" << mEncodingTuneMinLookahead << "/psnr" << mEncodingTuneMinPsnr;
+    const std::string key = keyOss.str();
+    auto setOption = [] (VideoEncoderParams& params, const std::string& name, int value) {
+        auto iter = std::find_if(params.extraOpts.begin(), params.extraOpts.end(), [&name] (const MediaCore::MediaEncoder::Option& opt) { return opt.name == name; });
+        if (iter != params.extraOpts.end())
+            params.extraOpts.erase(iter);
+        params.extraOpts.push_back({name, MediaCore::Value(value)});
+    };
+    imgui_json::value cache;
+    if (!cachePath.empty())
+    {
+        auto loadResult = imgui_json::value::load(cachePath);
+        if (loadResult.second && loadResult.first.is_object())
+            cache = loadResult.first;
+    }
+    if (cache.contains(key) && cache[key]["Options"].is_object())
+    {
+        for (auto& item : cache[key]["Options"].get<imgui_json::object>())
+        {
+            if (item.second.is_number())
+                setOption(vidEncParams, item.first, (int)item.second.get<imgui_json::number>());
+        }
+        Logger::Log(Logger::DEBUG) << "Encoder tuning of '" << key << "' is loaded from cache." << std::endl;
+        return true;
+    }
+
+    // candidates: the encoder defaults, frame or slice threading with all or half of the cores, and a shorter lookahead
+    // if the encoder has one. the defaults come first, they're the quality reference of the others.
+    typedef std::vector<std::pair<std::string, int>> TuneOptions;
+    std::vector<TuneOptions> candidates;
+    candidates.push_back(TuneOptions());
+    bool hasLookahead = false;
+    std::vector<MediaCore::MediaEncoder::Description> encDescList;
+    if (MediaCore::MediaEncoder::FindEncoder(vidEncParams.codecName, encDescList))
+    {
+        for (auto& desc : encDescList)
+        {
+            if (desc.codecName != vidEncParams.codecName)
+                continue;
+            for (auto& opt : desc.optDescList)
+                if (opt.name == "rc-lookahead") hasLookahead = true;
+        }
+    }
+    std::vector<int> threadCounts {cores};
+    if (cores >= 4)
+        threadCounts.push_back(cores/2);
+    for (auto threads : threadCounts)
+    {
+        for (auto threadType : {1 /* frame */, 2 /* slice */})
+        {
+            candidates.push_back({{"threads", threads}, {"thread_type", threadType}});
+            if (hasLookahead && mEncodingTuneMinLookahead > 0)
+                candidates.push_back({{"threads", threads}, {"thread_type", threadType}, {"rc-lookahead", mEncodingTuneMinLookahead}});
+        }
+    }
+
+    // a slice from the middle of the export range, composed once and encoded by every candidate
+    const MediaCore::Ratio frameRate = vidEncParams.frameRate;
+    const int64_t startFrame = (int64_t)std::ceil((double)mEncoding_start * frameRate.num / ((double)frameRate.den * 1000));
+    const int64_t endFrame = (int64_t)std::ceil((double)mEncoding_end * frameRate.num / ((double)frameRate.den * 1000));
+    int64_t sliceFrames = std::min((int64_t)mEncodingTuneFrames, endFrame-startFrame);
+    if (sliceFrames <= 0)
+    {
+        errMsg = "Nothing to calibrate the encoder with!";
+        return false;
+    }
+    const int64_t sliceStart = startFrame + (endFrame-startFrame-sliceFrames) / 2;
+    const double sliceStartPos = (double)sliceStart * frameRate.den / frameRate.num;
+    hReader->SeekTo((int64_t)(sliceStartPos * 1000));
+    // the slice is held in memory, it's shortened if the frames are too large
+    const uint64_t maxBytes = (uint64_t)std::max(mEncodingTuneMaxMB, 1) << 20;
+    std::vector<ImGui::ImMat> frames;
+    int64_t frameIdx = sliceStart;
+    while (frameIdx < sliceStart+sliceFrames)
+    {
+        if (mQuitEncoding)
+        {
+            errMsg = "Encoder auto-tuning is cancelled!";
+            return false;
+        }
+        const double vidpos = (double)frameIdx * frameRate.den / frameRate.num;
+        ImGui::ImMat vmat;
+        if (!hReader->ReadVideoFrame((int64_t)(vidpos * 1000), vmat))
+        {
+            errMsg = hReader->GetError();
+            return false;
+        }
+        // not composed yet, read the same frame again
+        if (vmat.empty())
+            continue;
+        vmat.time_stamp = vidpos - sliceStartPos;
+        frames.push_back(vmat);
+        frameIdx++;
+        if (frames.size() == 1)
+        {
+            const uint64_t frameBytes = std::max((uint64_t)(vmat.total()*vmat.elemsize), (uint64_t)1);
+            sliceFrames = std::min(sliceFrames, std::max((int64_t)(maxBytes/frameBytes), (int64_t)1));
+        }
+    }
+    if (frames.empty())
+    {
+        errMsg = "Nothing to calibrate the encoder with!";
+        return false;
+    }
+
+    const std::string tunePath = MEC::MakeSegmentPath(outputPath, "tune");
+    const std::string refPath = MEC::MakeSegmentPath(outputPath, "tuneref");
+    int bestIdx = -1;
+    double bestFps = 0;
+    for (int i = 0; i < candidates.size() && !mQuitEncoding; i++)
+    {
+        auto params = vidEncParams;
+        std::ostringstream nameOss;
+        for (auto& opt : candidates[i])
+        {
+            setOption(params, opt.first, opt.second);
+            nameOss << opt.first << "=" << opt.second << " ";
+        }
+        auto hEncoder = MediaCore::MediaEncoder::CreateInstance();
+        bool encodeOk = hEncoder->Open(i == 0 ? refPath : tunePath) &&
+            hEncoder->ConfigureVideoStream(params.codecName, params.imageFormat, params.width, params.height, frameRate, params.bitRate, &params.extraOpts) &&
+            hEncoder->Start();
+        // only the encoding is timed, including the flush of the frames held by frame threads or lookahead
+        const auto startTp = std::chrono::steady_clock::now();
+        for (auto& vmat : frames)
+        {
+            if (!encodeOk) break;
+            encodeOk = hEncoder->EncodeVideoFrame(vmat);
+        }
+        ImGui::ImMat eofMat;
+        encodeOk = encodeOk && hEncoder->EncodeVideoFrame(eofMat);
+        hEncoder->FinishEncoding();
+        const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now()-startTp).count();
+        hEncoder->Close();
+        if (!encodeOk)
+        {
+            if (i == 0)
+            {
+                errMsg = "The default setting of '" + vidEncParams.codecName + "' fails, " + hEncoder->GetError();
+                break;
+            }
+            Logger::Log(Logger::WARN) << "Encoder setting '" << nameOss.str() << "' is skipped, " << hEncoder->GetError() << std::endl;
+            continue;
+        }
+        const double fps = elapsed > 0 ? frames.size() / elapsed : 0;
+        // a faster setting mustn't lose quality, its output is compared with the one of the defaults
+        double psnr = 100;
+        if (i > 0)
+        {
+            std::string psnrErrMsg;
+            if (!MEC::CompareVideoPsnr(tunePath, refPath, psnr, psnrErrMsg))
+            {
+                Logger::Log(Logger::WARN) << "Encoder setting '" << nameOss.str() << "' is skipped, " << psnrErrMsg << std::endl;
+                continue;
+            }
+        }
+        Logger::Log(Logger::DEBUG) << "Encoder setting '" << (candidates[i].empty() ? std::string("default") : nameOss.str()) << "': " << fps << " fps, "
+                << psnr << " dB." << std::endl;
+        if (psnr < mEncodingTuneMinPsnr)
+            continue;
+        if (fps > bestFps)
+        {
+            bestFps = fps;
+            bestIdx = i;
+        }
+    }
+    std::remove(tunePath.c_str());
+    std::remove(refPath.c_str());
+    if (mQuitEncoding)
+    {
+        errMsg = "Encoder auto-tuning is cancelled!";
+        return false;
+    }
+    if (!errMsg.empty())
+        return false;
+    if (bestIdx < 0)
+    {
+        errMsg = "No encoder setting works for '" + vidEncParams.codecName + "'!";
+        return false;
+    }
+
+    imgui_json::value options(imgui_json::type_t::object);
+    for (auto& opt : candidates[bestIdx])
+    {
+        setOption(vidEncParams, opt.first, opt.second);
+        options[opt.first] = imgui_json::number(opt.second);
+    }
+    Logger::Log(Logger::DEBUG) << "Encoder tuning of '" << key << "' picks setting #" << bestIdx << ", " << bestFps << " fps." << std::endl;
+    if (!cachePath.empty())
+    {
+        imgui_json::value entry;
+        entry["Options"] = options;
+        entry["Fps"] = imgui_json::number(bestFps);
+        cache[key] = entry;
+        cache.save(cachePath);
+    }
+    return true;
+}
+
+bool TimeLine::_EncodeVideoSegment(MediaCore::MultiTrackVideoReader::Holder hReader, const VideoEncoderParams& vidEncParams, int64_t startFrame, int64_t endFrame,
+        const std::string& outputPath, const std::function<bool(int64_t)>& onFrames, std::string& errMsg)
+{
+    errMsg.clear();
+    const MediaCore::Ratio frameRate = vidEncParams.frameRate;
+    auto hEncoder = MediaCore::MediaEncoder::CreateInstance();
+    auto extraOpts = vidEncParams.extraOpts;
+    if (!hEncoder->Open(outputPath) ||
+        !hEncoder->ConfigureVideoStream(vidEncParams.codecName, vidEncParams.imageFormat, vidEncParams.width, vidEncParams.height,
+            frameRate, vidEncParams.bitRate, &extraOpts) ||
+        !hEncoder->Start())
+    {
+        errMsg = "[video] '" + hEncoder->GetError() + "'.";
+        return false;
+    }
+    const double segStartPos = (double)startFrame * frameRate.den / frameRate.num;
+    hReader->SeekTo((int64_t)(segStartPos * 1000));
+    ImGui::ImMat vmat;
+    bool aborted = false;
+    int64_t frameIdx = startFrame;
+    while (frameIdx < endFrame && errMsg.empty())
+    {
+        if (mQuitEncoding)
         {
-            mAudioAttribute.m_audio_vector.create_type(256, 256, 4, IM_DT_INT8);
-            mAudioAttribute.m_audio_vector.fill((int8_t)0);
-            mAudioAttribute.m_audio_vector.elempack = 4;
+            aborted = true;
+            break;
         }
-        if (!mAudioAttribute.m_audio_vector.empty())
+        const double vidpos = (double)frameIdx * frameRate.den / frameRate.num;
+        bool readOk;
         {
-            float zoom = mAudioAttribute.mAudioVectorScale;
-            float hw = mAudioAttribute.m_audio_vector.w / 2;
-            float hh = mAudioAttribute.m_audio_vector.h / 2;
-            int samples = mat.w;
-            mAudioAttribute.m_audio_vector -= 64;
-            for (int n = 0; n < samples; n++)
-            {
-                float s1 = mAudioAttribute.channel_data[0].m_wave.at<float>(n, 0);
-                float s2 = mAudioAttribute.channel_data[1].m_wave.at<float>(n, 0);
-                int x = hw;
-                int y = hh;
-
-                if (mAudioAttribute.mAudioVectorMode == LISSAJOUS)
-                {
-                    x = ((s2 - s1) * zoom / 2 + 1) * hw;
-                    y = (1.0 - (s1 + s2) * zoom / 2) * hh;
-                }
-                else if (mAudioAttribute.mAudioVectorMode == LISSAJOUS_XY)
-                {
-                    x = (s2 * zoom + 1) * hw;
-                    y = (s1 * zoom + 1) * hh;
-                }
-                else
-                {
-                    float sx, sy, cx, cy;
-                    sx = s2 * zoom;
-                    sy = s1 * zoom;
-                    cx = sx * sqrtf(1 - 0.5 * sy * sy);
-                    cy = sy * sqrtf(1 - 0.5 * sx * sx);
-                    x = hw + hw * ImSign(cx + cy) * (cx - cy) * .7;
-                    y = mAudioAttribute.m_audio_vector.h - mAudioAttribute.m_audio_vector.h * fabsf(cx + cy) * .7;
-                }
-                x = ImClamp(x, 0, mAudioAttribute.m_audio_vector.w - 1);
-                y = ImClamp(y, 0, mAudioAttribute.m_audio_vector.h - 1);
-                uint8_t r = ImClamp(mAudioAttribute.m_audio_vector.at<uint8_t>(x, y, 0) + 30, 0, 255);
-                uint8_t g = ImClamp(mAudioAttribute.m_audio_vector.at<uint8_t>(x, y, 1) + 50, 0, 255);
-                uint8_t b = ImClamp(mAudioAttribute.m_audio_vector.at<uint8_t>(x, y, 2) + 30, 0, 255);
-                mAudioAttribute.m_audio_vector.draw_dot(x, y, ImPixel(r / 255.0, g / 255.0, b / 255.0, 1.f));
-            }
-            mAudioAttribute.m_audio_vector.flags |= IM_MAT_FLAGS_CUSTOM_UPDATED;
+            MEC::ScopedStageTimer stageTimer(mEncodeStageStatus[ENC_STAGE_VIDEO_COMPOSE].busyUs);
+            readOk = hReader->ReadVideoFrame((int64_t)(vidpos * 1000), vmat);
+        }
+        if (!readOk)
+        {
+            errMsg = "[video] '" + hReader->GetError() + "'.";
+            break;
+        }
+        // the frame isn't ready yet, read the same position again like _EncodeProc does
+        if (vmat.empty())
+            continue;
+        frameIdx++;
+        mEncodeStageStatus[ENC_STAGE_VIDEO_COMPOSE].processed++;
+        // the segments are composed out of order, the sidecar lines are keyed by the frame index
+        if (mEncHashWriter.IsOpened() && !_HashEncodeFrame(vmat, true, frameIdx-1-mEncHashStartFrame, vidpos-(double)mEncoding_start/1000, errMsg))
+            break;
+        _PublishEncodingPreview(vmat);
+        vmat.time_stamp = vidpos - segStartPos;
+        bool encodeOk;
+        {
+            MEC::ScopedStageTimer stageTimer(mEncodeStageStatus[ENC_STAGE_VIDEO_ENCODE].busyUs);
+            encodeOk = hEncoder->EncodeVideoFrame(vmat);
+        }
+        if (!encodeOk)
+        {
+            errMsg = "[video] '" + hEncoder->GetError() + "'.";
+            break;
+        }
+        mEncodeStageStatus[ENC_STAGE_VIDEO_ENCODE].processed++;
+        if (!onFrames(1))
+        {
+            aborted = true;
+            break;
         }
     }
+    vmat.release();
+    MEC::ScopedStageTimer stageTimer(mEncodeStageStatus[ENC_STAGE_VIDEO_ENCODE].busyUs);
+    if (!aborted && errMsg.empty() && !hEncoder->EncodeVideoFrame(vmat))
+        errMsg = "[video] '" + hEncoder->GetError() + "'.";
+    hEncoder->FinishEncoding();
+    hEncoder->Close();
+    return !aborted && errMsg.empty();
 }
 
-bool TimeLine::ConfigEncoder(const std::string& outputPath, VideoEncoderParams& vidEncParams, AudioEncoderParams& audEncParams, std::string& errMsg)
+bool TimeLine::EncodeVideoSegment(int64_t startFrame, int64_t endFrame, VideoEncoderParams& vidEncParams, const std::string& outputPath, std::string& errMsg)
 {
-    mEncoder = MediaCore::MediaEncoder::CreateInstance();
-    if (!mEncoder->Open(outputPath))
+    if (mIsEncoding)
     {
-        errMsg = mEncoder->GetError();
+        errMsg = "Another encoding is running!";
         return false;
     }
-    // Video
-    std::string vidEncImgFormat;
-    if (!mEncoder->ConfigureVideoStream(
-        vidEncParams.codecName, vidEncParams.imageFormat, vidEncParams.width, vidEncParams.height,
-        vidEncParams.frameRate, vidEncParams.bitRate, &vidEncParams.extraOpts))
+    const MediaCore::Ratio frameRate = vidEncParams.frameRate;
+    if (startFrame < 0 || endFrame <= startFrame || frameRate.num <= 0 || frameRate.den <= 0)
     {
-        errMsg = mEncoder->GetError();
+        errMsg = "Invalid segment range!";
         return false;
     }
-    mEncMtvReader = mMtvReader->CloneAndConfigure(vidEncParams.width, vidEncParams.height, vidEncParams.frameRate);
+    mEncodeProcErrMsg.clear();
+    mEncOutputPath = outputPath;
+    mEncVidParams = vidEncParams;
+    mEncodingProgress = 0;
+    mEncodingDuration = (float)((double)(endFrame-startFrame) * frameRate.den / frameRate.num);
+    _ResetEncodeStageStats();
+    mEncodeStageStatus[ENC_STAGE_VIDEO_COMPOSE].threads = 1;
+    mEncodeStageStatus[ENC_STAGE_VIDEO_ENCODE].threads = 1;
+    mQuitEncoding = false;
+    mIsEncoding = true;
+    auto hReader = _CloneEncodeVideoReader(vidEncParams.width, vidEncParams.height, frameRate);
+    int64_t encodedFrames = 0;
+    const bool encodeOk = _EncodeVideoSegment(hReader, vidEncParams, startFrame, endFrame, outputPath, [&] (int64_t frames) {
+        encodedFrames += frames;
+        mEncodingProgress = (float)encodedFrames / (endFrame-startFrame);
+        return !mQuitEncoding;
+    }, mEncodeProcErrMsg);
+    if (!encodeOk && mEncodeProcErrMsg.empty())
+        mEncodeProcErrMsg = "Encoding is canceled.";
+    errMsg = mEncodeProcErrMsg;
+    _FinishEncodeStageStats();
+    mIsEncoding = false;
+    return encodeOk;
+}
 
-    // Audio
-    std::string audEncSmpFormat;
-    if (!mEncoder->ConfigureAudioStream(
-        audEncParams.codecName, audEncParams.sampleFormat, audEncParams.channels,
-        audEncParams.sampleRate, audEncParams.bitRate))
+void TimeLine::_PublishEncodingPreview(const ImGui::ImMat& vmat)
+{
+    // rate limited, and only one encoding thread downscales a preview frame at a time
+    if (mEncodingPreviewRate <= 0)
+        return;
+    const int64_t nowUs = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now()-mEncodingStartTp).count();
+    int64_t dueUs = mEncodingPreviewNextUs;
+    if (nowUs < dueUs || !mEncodingPreviewNextUs.compare_exchange_strong(dueUs, nowUs+(int64_t)(1000000/mEncodingPreviewRate)))
+        return;
+    if (mEncodingPreviewBusy.exchange(true))
+        return;
+    ImGui::ImMat previewMat = vmat;
+    if (mEncodingPreviewWidth > 0 && vmat.w > mEncodingPreviewWidth)
     {
-        errMsg = mEncoder->GetError();
-        return false;
+        // keep the full size frame if it can't be scaled here
+        const uint32_t previewHeight = std::max((int64_t)vmat.h * mEncodingPreviewWidth / vmat.w, (int64_t)1);
+        if (!mEncodingPreviewScaler.Scale(vmat, previewMat, mEncodingPreviewWidth, previewHeight))
+            previewMat = vmat;
     }
-    mEncMtaReader = mMtaReader->CloneAndConfigure(audEncParams.channels, audEncParams.sampleRate, audEncParams.samplesPerFrame);
-    return true;
+    mEncodingPreviewMailbox.Post(previewMat);
+    mEncodingPreviewBusy = false;
 }
 
-void TimeLine::StartEncoding()
+const char* TimeLine::GetEncodeStageName(int stage)
 {
-    if (mEncodingThread.joinable())
+    static const char* stageNames[ENC_STAGE_COUNT] = {
+        "video_compose", "video_filter", "video_transition", "video_scale", "audio_mix", "video_encode", "audio_encode", "mux" };
+    if (stage < 0 || stage >= ENC_STAGE_COUNT)
+        return "unknown";
+    return stageNames[stage];
+}
+
+double TimeLine::GetEncodingElapsedTime() const
+{
+    if (mEncodingElapsedUs > 0 || !mIsEncoding)
+        return (double)mEncodingElapsedUs / 1000000;
+    return std::chrono::duration<double>(std::chrono::steady_clock::now()-mEncodingStartTp).count();
+}
+
+int TimeLine::GetEncodeBottleneckStage() const
+{
+    // filter and transition run inside the compose stage, they aren't pipeline stages by themselves.
+    // busy time is divided by the thread count, so a stage running on several workers is compared fairly.
+    int bottleneck = -1;
+    double maxBusy = 0;
+    for (auto stage : {ENC_STAGE_VIDEO_COMPOSE, ENC_STAGE_VIDEO_SCALE, ENC_STAGE_AUDIO_MIX, ENC_STAGE_VIDEO_ENCODE, ENC_STAGE_AUDIO_ENCODE, ENC_STAGE_MUX})
     {
-        mQuitEncoding = true;
-        mEncodingThread.join();
-        //return;
+        auto& status = mEncodeStageStatus[stage];
+        const double busy = (double)status.busyUs / (status.threads > 0 ? status.threads : 1);
+        if (busy > maxBusy)
+        {
+            maxBusy = busy;
+            bottleneck = stage;
+        }
     }
-    mEncodeProcErrMsg.clear();
-    mEncodingProgress = 0;
-    mEncodingDuration = (double)ValidDuration()/1000.f;
-    mQuitEncoding = false;
-    mIsEncoding = true;
-    mEncodingThread = std::thread(&TimeLine::_EncodeProc, this);
-    SysUtils::SetThreadName(mEncodingThread, "TL-EncProc");
+    return bottleneck;
 }
 
-void TimeLine::StopEncoding()
+imgui_json::value TimeLine::GetEncodeStageSummary() const
+{
+    const double elapsed = GetEncodingElapsedTime();
+    const double encoded = mEncodingDuration * mEncodingProgress;
+    imgui_json::value summary;
+    summary["output"] = mEncOutputPath;
+    summary["duration"] = imgui_json::number(mEncodingDuration);
+    summary["encoded"] = imgui_json::number(encoded);
+    summary["elapsed"] = imgui_json::number(elapsed);
+    summary["realtime"] = imgui_json::number(elapsed > 0 ? encoded / elapsed : 0);
+    summary["bottleneck"] = imgui_json::string(GetEncodeStageName(GetEncodeBottleneckStage()));
+    summary["error"] = mEncodeProcErrMsg;
+    imgui_json::value stages;
+    for (int i = 0; i < ENC_STAGE_COUNT; i++)
+    {
+        auto& status = mEncodeStageStatus[i];
+        const double busy = (double)status.busyUs / 1000000;
+        const int threads = status.threads > 0 ? status.threads.load() : 1;
+        imgui_json::value stage;
+        stage["processed"] = imgui_json::number(status.processed);
+        stage["busy"] = imgui_json::number(busy);
+        stage["threads"] = imgui_json::number(threads);
+        // throughput of this stage alone, and the share of the wall time it kept its threads busy
+        stage["fps"] = imgui_json::number(busy > 0 ? status.processed * threads / busy : 0);
+        stage["realtime"] = imgui_json::number(busy > 0 ? encoded * threads / busy : 0);
+        stage["utilization"] = imgui_json::number(elapsed > 0 ? busy / (elapsed * threads) : 0);
+        stages[GetEncodeStageName(i)] = stage;
+    }
+    summary["stages"] = stages;
+    return summary;
+}
+
+void TimeLine::_ResetEncodeStageStats()
 {
-    mQuitEncoding = true;
-    if (mEncodingThread.joinable())
+    for (auto& status : mEncodeStageStatus)
     {
-        mEncodingThread.join();
-        mEncodingThread = std::thread();
+        status.processed = 0;
+        status.busyUs = 0;
+        status.queued = 0;
+        status.capacity = 0;
+        status.threads = 0;
     }
-    mIsEncoding = false;
-    mEncMtvReader = nullptr;
-    mEncMtaReader = nullptr;
+    mEncodingStartTp = std::chrono::steady_clock::now();
+    mEncodingElapsedUs = 0;
 }
 
-void TimeLine::_EncodeProc()
+bool TimeLine::_HashEncodeFrame(const ImGui::ImMat& mat, bool isVideo, int64_t index, double pts, std::string& errMsg)
 {
-    Logger::Log(Logger::DEBUG) << ">>>>>>>>>>> Enter encoding proc >>>>>>>>>>>>" << std::endl;
-    mEncoder->Start();
-    bool vidInputEof = false;
-    bool audInputEof = false;
-    double audpos = 0, vidpos = 0;
-    double maxEncodeDuration = 0;
-    uint32_t vidFrameCount = 0;
-    MediaCore::Ratio outFrameRate = mEncoder->GetVideoFrameRate();
-    ImGui::ImMat vmat, amat;
-    uint32_t pcmbufSize = 8192;
-    uint8_t* pcmbuf = new uint8_t[pcmbufSize];
-    double viddur = (double)mEncMtvReader->Duration() / 1000;
-    double dur = (double)ValidDuration() / 1000;
-    double encpos = 0;
-    double enc_start = (double)mEncoding_start / 1000;
-    double enc_end = (double)mEncoding_end / 1000;
-    if (mEncMtvReader) mEncMtvReader->SeekTo(mEncoding_start);
-    if (mEncMtaReader) mEncMtaReader->SeekTo(mEncoding_start);
-    while (!mQuitEncoding && (!vidInputEof || !audInputEof))
+    uint64_t hash;
+    if (!MEC::HashMediaFrame(mat, hash))
+    {
+        errMsg = isVideo ? "[hash] 'FAILED to hash video frame.'" : "[hash] 'FAILED to hash audio block.'";
+        return false;
+    }
+    if (isVideo)
+        mEncHashWriter.AddVideoFrame(index, pts, hash);
+    else
+        mEncHashWriter.AddAudioBlock(index, pts, hash);
+    return true;
+}
+
+void TimeLine::_FinishEncodeStageStats()
+{
+    mEncHashWriter.Close();
+    mEncodingElapsedUs = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now()-mEncodingStartTp).count();
+    auto summary = GetEncodeStageSummary();
+    Logger::Log(Logger::DEBUG) << "Encoding stage summary: " << summary.dump() << std::endl;
+    if (!mEncodingStatsPath.empty())
+        summary.save(mEncodingStatsPath);
+}
+
+std::string TimeLine::_HashEncodeSegment(int64_t startFrame, int64_t endFrame)
+{
+    // every input of the video composition inside the segment: encoder settings, visible video and text clips
+    // with their filters, attributes and key points, transitions, and the identity of the source media files
+    const MediaCore::Ratio frameRate = mEncVidParams.frameRate;
+    const int64_t startMs = (int64_t)std::floor((double)startFrame * frameRate.den * 1000 / frameRate.num);
+    const int64_t endMs = (int64_t)std::ceil((double)endFrame * frameRate.den * 1000 / frameRate.num);
+    MEC::ContentHasher hasher;
+    hasher.Add(std::string("mec-segment-v1"));
+    hasher.Add(startFrame);
+    hasher.Add(endFrame);
+    hasher.Add(mEncVidParams.codecName);
+    hasher.Add(mEncVidParams.imageFormat);
+    hasher.Add((int64_t)mEncVidParams.width);
+    hasher.Add((int64_t)mEncVidParams.height);
+    hasher.Add((int64_t)frameRate.num);
+    hasher.Add((int64_t)frameRate.den);
+    hasher.Add((int64_t)mEncVidParams.bitRate);
+    for (auto& opt : mEncVidParams.extraOpts)
+    {
+        hasher.Add(opt.name);
+        hasher.Add(opt.value.numval.i64);
+        hasher.Add(opt.value.strval);
+    }
+    _HashComposition(hasher, startMs, endMs, false);
+    return hasher.HexDigest();
+}
+
+void TimeLine::_HashComposition(MEC::ContentHasher& hasher, int64_t startMs, int64_t endMs, bool preview)
+{
+    int64_t trackIndex = 0;
+    for (auto track : m_Tracks)
     {
-        bool idleLoop = true;
-        if ((!vidInputEof && vidpos <= audpos) || audInputEof)
+        trackIndex++;
+        if (!track->mView || (!IS_VIDEO(track->mType) && !IS_TEXT(track->mType)))
+            continue;
+        // the track order decides the composition order
+        hasher.Add(trackIndex);
+        hasher.Add((int64_t)track->mType);
+        // the text style and its key points are kept by the track
+        if (IS_TEXT(track->mType))
         {
-            vidpos = (double)vidFrameCount * outFrameRate.den / outFrameRate.num + enc_start;
-            bool eof = vidpos >= enc_end; //viddur;
-            if (!eof)
-            {
-                if (!mEncMtvReader->ReadVideoFrame((int64_t)(vidpos * 1000), vmat))
-                {
-                    std::ostringstream oss;
-                    oss << "[video] '" << mEncMtvReader->GetError() << "'.";
-                    mEncodeProcErrMsg = oss.str();
-                    break;
-                }
-                if (!vmat.empty())
-                {
-                    vidFrameCount++;
-                    vmat.time_stamp = vidpos - enc_start;
-                    {
-                        std::lock_guard<std::mutex> lk(mEncodingMutex);
-                        mEncodingVFrame = vmat;
-                    }
-                    if (!mEncoder->EncodeVideoFrame(vmat))
-                    {
-                        std::ostringstream oss;
-                        oss << "[video] '" << mEncoder->GetError() << "'.";
-                        mEncodeProcErrMsg = oss.str();
-                        break;
-                    }
-                    if (vidpos > encpos)
-                    {
-                        encpos = vidpos;
-                        mEncodingProgress = (encpos - enc_start) / dur;
-                    }
-                }
-            }
-            else
+            imgui_json::value trackJson;
+            track->Save(trackJson);
+            if (trackJson.contains("SubTrack"))
+                hasher.Add(trackJson["SubTrack"].dump());
+        }
+        for (auto clip : track->m_Clips)
+        {
+            if (clip->End() <= startMs || clip->Start() >= endMs)
+                continue;
+            imgui_json::value clipJson;
+            clip->Save(clipJson);
+            // selection states don't change the rendering
+            clipJson["Selected"] = imgui_json::boolean(false);
+            clipJson["Editing"] = imgui_json::boolean(false);
+            auto pEsf = dynamic_cast<MEC::VideoEventStackFilter*>(clip->mEventStack);
+            if (pEsf)
+                clipJson["FilterJson"] = pEsf->SaveAsJson();
+            hasher.Add(clipJson.dump());
+            if (!clip->mPath.empty())
+                hasher.Add(MEC::GetFileIdentity(clip->mPath));
+            // the preview composes the proxy instead of the source if there is one
+            if (preview && GetPreviewMediaParser(clip) != clip->mMediaParser)
             {
-                vmat.release();
-                if (!mEncoder->EncodeVideoFrame(vmat))
-                {
-                    std::ostringstream oss;
-                    oss << "[video] '" << mEncoder->GetError() << "'.";
-                    mEncodeProcErrMsg = oss.str();
-                    break;
-                }
-                vidInputEof = true;
+                MediaItem* item = FindMediaItemByID(clip->mMediaID);
+                hasher.Add(item ? item->mProxyPath : std::string());
             }
         }
-        else
+    }
+    for (auto overlap : m_Overlaps)
+    {
+        if (overlap->mEnd <= startMs || overlap->mStart >= endMs)
+            continue;
+        auto clip = FindClipByID(overlap->m_Clip.first);
+        if (!clip || !IS_VIDEO(clip->mType))
+            continue;
+        imgui_json::value overlapJson;
+        overlap->Save(overlapJson);
+        overlapJson["Current"] = imgui_json::number(0);
+        overlapJson["Editing"] = imgui_json::boolean(false);
+        hasher.Add(overlapJson.dump());
+    }
+}
+
+static void SubtractTimeRange(std::vector<std::pair<int64_t, int64_t>>& ranges, int64_t start, int64_t end)
+{
+    std::vector<std::pair<int64_t, int64_t>> result;
+    for (auto& range : ranges)
+    {
+        if (end <= range.first || start >= range.second)
         {
-            bool eof;
-            uint32_t readSize = pcmbufSize;
-            if (!mEncMtaReader->ReadAudioSamples(amat, eof) && !eof)
+            result.push_back(range);
+            continue;
+        }
+        if (start > range.first)
+            result.push_back({range.first, start});
+        if (end < range.second)
+            result.push_back({end, range.second});
+    }
+    ranges = result;
+}
+
+void TimeLine::_PlanEncodeSegments()
+{
+    // split the encoding range into GOP aligned segments, more segments than workers to balance the load
+    mEncSegments.clear();
+    ValidDuration();
+    const MediaCore::Ratio frameRate = mEncVidParams.frameRate;
+    if (frameRate.num <= 0 || frameRate.den <= 0)
+        return;
+    const int64_t startFrame = (int64_t)std::ceil((double)mEncoding_start * frameRate.num / ((double)frameRate.den * 1000));
+    const int64_t endFrame = (int64_t)std::ceil((double)mEncoding_end * frameRate.num / ((double)frameRate.den * 1000));
+    const int64_t gopSize = mEncodingGopSize > 0 ? mEncodingGopSize : 1;
+    const int64_t gopCount = (endFrame-startFrame+gopSize-1) / gopSize;
+    const int workerCount = !mEncodingRemoteWorkers.empty() ? (int)mEncodingRemoteWorkers.size() : mEncodingSegmentThreads > 1 ? mEncodingSegmentThreads : 1;
+    int64_t segmentCount = (int64_t)workerCount * 4;
+    if (segmentCount > gopCount) segmentCount = gopCount;
+    if (segmentCount <= 0)
+        return;
+    std::vector<EncodeSegment> passthroughSegments;
+    if (mEncodingSmartRender)
+        _PlanPassthroughSegments(startFrame, endFrame, gopSize, passthroughSegments);
+    int64_t framesPerSegment = (gopCount+segmentCount-1) / segmentCount * gopSize;
+    const bool fixedGrid = !mEncodingCacheDir.empty() || mEncodingResumable;
+    if (fixedGrid)
+    {
+        // cached and resumable segments are laid on a fixed frame grid, so an unchanged segment gets the same key in the next export
+        const int64_t cacheGops = (int64_t)std::ceil((double)mEncodingCacheSegmentSeconds * frameRate.num / frameRate.den / gopSize);
+        framesPerSegment = std::max(cacheGops, (int64_t)1) * gopSize;
+    }
+    auto addEncodeSegments = [&] (int64_t rangeStart, int64_t rangeEnd) {
+        for (int64_t segStart = rangeStart; segStart < rangeEnd;)
+        {
+            int64_t segEnd = fixedGrid ? (segStart/framesPerSegment+1)*framesPerSegment : segStart+framesPerSegment;
+            if (segEnd > rangeEnd) segEnd = rangeEnd;
+            mEncSegments.push_back({segStart, segEnd});
+            segStart = segEnd;
+        }
+    };
+    // re-encode the gaps between passthrough segments
+    int64_t encodeStart = startFrame;
+    for (auto& passthrough : passthroughSegments)
+    {
+        addEncodeSegments(encodeStart, passthrough.startFrame);
+        mEncSegments.push_back(passthrough);
+        encodeStart = passthrough.endFrame;
+    }
+    addEncodeSegments(encodeStart, endFrame);
+
+    // the keys hash the timeline content, the encoding thread only checks the files they name
+    const bool useCache = !mEncodingCacheDir.empty() && MEC::MakeDirectory(mEncodingCacheDir);
+    if (!mEncodingCacheDir.empty() && !useCache)
+        Logger::Log(Logger::WARN) << "CANNOT create render cache directory '" << mEncodingCacheDir << "', cache is disabled." << std::endl;
+    const std::string outputSuffix = GetPathSuffix(mEncOutputPath);
+    for (int i = 0; i < mEncSegments.size(); i++)
+    {
+        auto& segment = mEncSegments[i];
+        if (useCache && segment.srcStart < 0)
+        {
+            segment.cacheKey = _HashEncodeSegment(segment.startFrame, segment.endFrame);
+            segment.path = mEncodingCacheDir+"/"+segment.cacheKey+outputSuffix;
+            continue;
+        }
+        std::ostringstream oss; oss << "seg" << std::setw(4) << std::setfill('0') << i;
+        segment.path = MEC::MakeSegmentPath(mEncOutputPath, oss.str());
+        if (mEncodingResumable && segment.srcStart < 0)
+            segment.checkpointKey = _HashEncodeSegment(segment.startFrame, segment.endFrame);
+    }
+}
+
+void TimeLine::_PlanPassthroughSegments(int64_t startFrame, int64_t endFrame, int64_t minFrames, std::vector<EncodeSegment>& segments)
+{
+    segments.clear();
+    const MediaCore::Ratio frameRate = mEncVidParams.frameRate;
+    MEC::VideoStreamInfo encInfo;
+    std::vector<std::pair<std::string, int64_t>> encOptions;
+    for (auto& opt : mEncVidParams.extraOpts)
+        encOptions.push_back({opt.name, opt.value.numval.i64});
+    if (!MEC::GetVideoEncoderInfo(mEncVidParams.codecName, mEncVidParams.imageFormat, mEncVidParams.width, mEncVidParams.height, frameRate.num, frameRate.den, encOptions, encInfo))
+        return;
+    auto msToFrame = [&] (int64_t ms) { return (int64_t)std::round((double)ms * frameRate.num / ((double)frameRate.den * 1000)); };
+    auto frameToMs = [&] (int64_t frame) { return (int64_t)std::round((double)frame * frameRate.den * 1000 / frameRate.num); };
+    const int64_t rangeStart = frameToMs(startFrame);
+    const int64_t rangeEnd = frameToMs(endFrame);
+
+    std::map<std::string, bool> sourceCompatible;
+    for (auto track : m_Tracks)
+    {
+        if (!IS_VIDEO(track->mType) || !track->mView)
+            continue;
+        for (auto clip : track->m_Clips)
+        {
+            // untouched clip: no filter event, no animated or non-default attribute, same codec and format as the output
+            if (IS_DUMMY(clip->mType) || IS_IMAGE(clip->mType) || clip->mPath.empty())
+                continue;
+            auto vclip = dynamic_cast<VideoClip*>(clip);
+            if (!vclip)
+                continue;
+            if (vclip->mEventStack ? !vclip->mEventStack->GetEventList().empty() : !vclip->mFilterJson.is_null())
+                continue;
+            if (vclip->mAttributeKeyPoints.GetCurveCount() > 0 ||
+                vclip->mScaleH != 1.f || vclip->mScaleV != 1.f || vclip->mRotationAngle != 0.f ||
+                vclip->mPositionOffsetH != 0.f || vclip->mPositionOffsetV != 0.f ||
+                vclip->mCropMarginL != 0.f || vclip->mCropMarginT != 0.f || vclip->mCropMarginR != 0.f || vclip->mCropMarginB != 0.f)
+                continue;
+            auto compatibleIter = sourceCompatible.find(clip->mPath);
+            if (compatibleIter == sourceCompatible.end())
             {
-                std::ostringstream oss;
-                oss << "[audio] '" << mEncMtaReader->GetError() << "'.";
-                mEncodeProcErrMsg = oss.str();
-                break;
+                MEC::VideoStreamInfo srcInfo;
+                std::string errMsg;
+                bool compatible = MEC::ProbeVideoStream(clip->mPath, srcInfo, errMsg) && MEC::CanPassthrough(srcInfo, encInfo);
+                compatibleIter = sourceCompatible.insert({clip->mPath, compatible}).first;
             }
-            if (audpos > enc_end) eof = true;
-            if (!eof && !amat.empty())
+            if (!compatibleIter->second)
+                continue;
+
+            // exclude the ranges composed with transitions, other video tracks or subtitles
+            std::vector<std::pair<int64_t, int64_t>> ranges;
+            ranges.push_back({std::max(clip->Start(), rangeStart), std::min(clip->End(), rangeEnd)});
+            for (auto overlap : m_Overlaps)
             {
-                audpos = amat.time_stamp;
-                amat.time_stamp -= enc_start;
-                if (!mEncoder->EncodeAudioSamples(amat))
-                {
-                    std::ostringstream oss;
-                    oss << "[audio] '" << mEncoder->GetError() << "'.";
-                    mEncodeProcErrMsg = oss.str();
-                    break;
-                }
-                if (audpos > encpos)
-                {
-                    encpos = audpos;
-                    mEncodingProgress = (encpos - enc_start) / dur;
-                }
+                if (overlap->m_Clip.first == clip->mID || overlap->m_Clip.second == clip->mID)
+                    SubtractTimeRange(ranges, overlap->mStart, overlap->mEnd);
             }
-            else
+            for (auto other_track : m_Tracks)
             {
-                amat.release();
-                // {
-                //     std::lock_guard<std::mutex> lk(mEncodingMutex);
-                //     mEncodingAFrame = amat;
-                // }
-                if (!mEncoder->EncodeAudioSamples(amat))
-                {
-                    std::ostringstream oss;
-                    oss << "[audio] '" << mEncoder->GetError() << "'.";
-                    mEncodeProcErrMsg = oss.str();
-                    break;
-                }
-                audInputEof = true;
+                if (other_track == track || !other_track->mView || (!IS_VIDEO(other_track->mType) && !IS_TEXT(other_track->mType)))
+                    continue;
+                for (auto other_clip : other_track->m_Clips)
+                    SubtractTimeRange(ranges, other_clip->Start(), other_clip->End());
+            }
+
+            // only whole GOPs are copied, the frames before the first and after the last key frame are re-encoded
+            for (auto& range : ranges)
+            {
+                if (msToFrame(range.second)-msToFrame(range.first) < minFrames)
+                    continue;
+                const int64_t srcStart = range.first-clip->Start()+clip->StartOffset();
+                const int64_t srcEnd = range.second-clip->Start()+clip->StartOffset();
+                std::vector<int64_t> keyFrames;
+                std::string errMsg;
+                if (!MEC::ScanVideoKeyFrames(clip->mPath, srcStart, srcEnd, keyFrames, errMsg) || keyFrames.size() < 2)
+                    continue;
+                const int64_t copyStart = keyFrames.front();
+                const int64_t copyEnd = keyFrames.back();
+                const int64_t segStart = msToFrame(range.first+copyStart-srcStart);
+                const int64_t segEnd = msToFrame(range.first+copyEnd-srcStart);
+                if (segEnd-segStart < minFrames)
+                    continue;
+                EncodeSegment segment;
+                segment.startFrame = segStart;
+                segment.endFrame = segEnd;
+                segment.srcPath = clip->mPath;
+                segment.srcStart = copyStart;
+                segment.srcEnd = copyEnd;
+                segments.push_back(segment);
             }
         }
     }
-    if (!mQuitEncoding && mEncodeProcErrMsg.empty())
-    {
-        mEncodingProgress = 1;
-    }
-    mEncoder->FinishEncoding();
-    mEncoder->Close();
-    mIsEncoding = false;
-    Logger::Log(Logger::DEBUG) << "<<<<<<<<<<<<< Quit encoding proc <<<<<<<<<<<<<<<<" << std::endl;
+    std::sort(segments.begin(), segments.end(), [] (const EncodeSegment& a, const EncodeSegment& b) {
+        return a.startFrame < b.startFrame;
+    });
 }
 
 void TimeLine::AddNewRecord(imgui_json::value& record)
@@ -10147,6 +12953,21 @@ bool DrawTimeLine(TimeLine *timeline, bool *expanded, bool editable)
         ImGui::ShowTooltipOnHover("Delete mark point");
         ImGui::EndDisabled();
 
+        ImGui::SameLine();
+        if (timeline->mIsPreviewRendering)
+        {
+            const std::string progress_text = std::to_string((int)(timeline->mPreviewRenderProgress * 100)) + "%##main_timeline_render_preview";
+            if (ImGui::Button(progress_text.c_str()))
+                timeline->StopPreviewRender();
+            ImGui::ShowTooltipOnHover("Stop rendering preview");
+        }
+        else
+        {
+            if (ImGui::Button(ICON_MAKE_VIDEO "##main_timeline_render_preview"))
+                timeline->StartPreviewRender(io.KeyShift);
+            ImGui::ShowTooltipOnHover("Render preview of mark range, or whole timeline without mark\nShift+Click renders the edited regions again");
+        }
+
         ImGui::SameLine();
         ImGui::SeparatorEx(ImGuiSeparatorFlags_Vertical);
 
@@ -11446,6 +14267,24 @@ bool DrawTimeLine(TimeLine *timeline, bool *expanded, bool editable)
                 markMovingShift = mouseTime - timeline->mark_in;
             }
         }
+
+        // draw rendered and edited preview chunks under the mark bar
+        auto draw_render_chunk = [&](int64_t chunk_index, ImU32 color)
+        {
+            int64_t chunk_start = timeline->FrameIndexToTime(chunk_index * TimeLine::PREVIEW_RENDER_CHUNK_FRAMES);
+            int64_t chunk_end = timeline->FrameIndexToTime((chunk_index + 1) * TimeLine::PREVIEW_RENDER_CHUNK_FRAMES);
+            if (chunk_end <= timeline->firstTime || chunk_start >= timeline->lastTime)
+                return;
+            chunk_start = ImMax(chunk_start, timeline->firstTime);
+            chunk_end = ImMin(chunk_end, timeline->lastTime);
+            float start_offset = (chunk_start - timeline->firstTime) * timeline->msPixelWidthTarget;
+            float end_offset = (chunk_end - timeline->firstTime) * timeline->msPixelWidthTarget;
+            draw_list->AddRectFilled(HeaderAreaRect.Min + ImVec2(start_offset, 8), HeaderAreaRect.Min + ImVec2(end_offset, 11), color, 0);
+        };
+        for (auto& chunk : timeline->mPreviewRenderChunks)
+            draw_render_chunk(chunk.first, COL_RENDERED_BAR);
+        for (auto chunk_index : timeline->mPreviewRenderDirtyChunks)
+            draw_render_chunk(chunk_index, COL_DIRTY_BAR);
         ImGui::PopClipRect();
 
         // check current time moving
@@ -12007,6 +14846,13 @@ bool DrawTimeLine(TimeLine *timeline, bool *expanded, bool editable)
     //}
     // for debug end
 
+    if (!io.WantTextInput && io.KeyMods == ImGuiModFlags_None)
+    {
+        if (ImGui::IsKeyPressed(ImGuiKey_J, false)) timeline->Shuttle(-1);
+        else if (ImGui::IsKeyPressed(ImGuiKey_K, false)) timeline->Shuttle(0);
+        else if (ImGui::IsKeyPressed(ImGuiKey_L, false)) timeline->Shuttle(1);
+    }
+
     if (ImGui::IsKeyPressed(ImGuiKey_Z, false))
     {
 #ifdef __APPLE__
@@ -31,12 +31,21 @@
 #include "UI.h"
 #include "Event.h"
 #include "EventStackFilter.h"
+#include "ExportUtils.h"
+#include "PlaybackUtils.h"
 #include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
 #include <string>
 #include <vector>
 #include <list>
 #include <unordered_set>
+#include <set>
+#include <map>
 #include <chrono>
+#include <memory>
+#include <functional>
 
 #define PLOT_IMPLOT   0
 #define PLOT_TEXTURE  1
@@ -258,6 +267,8 @@
 #define COL_GRAY_GRATICULE  IM_COL32( 96,  96,  96, 128)
 #define COL_GRAY_TEXT       IM_COL32(128, 128, 128, 128)
 #define COL_MARK_BAR        IM_COL32(128, 128, 128, 170)
+#define COL_RENDERED_BAR    IM_COL32( 64, 192,  64, 200)
+#define COL_DIRTY_BAR       IM_COL32(208,  64,  64, 200)
 #define COL_MARK_DOT        IM_COL32(170, 170, 170, 224)
 #define COL_MARK_DOT_LIGHT  IM_COL32(255, 255, 255, 224)
 #define COL_ERROR_MEDIA     IM_COL32(160,   0,   0, 224)
@@ -339,6 +350,8 @@ struct MediaItem
     RenderUtils::TextureManager::Holder mTxMgr;
     std::vector<RenderUtils::ManagedTexture::Holder> mMediaThumbnail;
     std::vector<ImTextureID> mWaveformTextures;
+    std::string mProxyPath;                 // low resolution intra-only copy for preview, empty if not generated yet
+    MediaCore::MediaParser::Holder mProxyParser;
     MediaItem(const std::string& name, const std::string& path, uint32_t type, void* handle);
     ~MediaItem();
     void UpdateItem(const std::string& name, const std::string& path, void* handle);
@@ -534,6 +547,8 @@ struct VideoClip : Clip
     void SetTrackHeight(int trackHeight) override;
     void SetViewWindowStart(int64_t millisec) override;
     void DrawContent(ImDrawList* drawList, const ImVec2& leftTop, const ImVec2& rightBottom, const ImRect& clipRect, bool updated = false) override;
+    // The loaded snapshot nearest to 'mediaTime', only the snapshots of the visible part of the clip are loaded
+    bool GetNearestSnapshot(int64_t mediaTime, ImTextureID& texture, ImVec2& uvMin, ImVec2& uvMax);
 
     static Clip * Load(const imgui_json::value& value, void * handle);
     void Save(imgui_json::value& value) override;
@@ -990,8 +1005,9 @@ typedef struct TimeLineCallbackFunctions
 struct TimeLine
 {
 #define MAX_VIDEO_CACHE_FRAMES  3
-    TimeLine(std::string plugin_path = {});
+    TimeLine(std::string plugin_path = {}, bool headless = false);
     ~TimeLine();
+    bool mHeadless {false};                 // no texture and no audio device, used by command line render
     IDGenerator m_IDGenerator;              // Timeline ID generator
     std::vector<MediaItem *> media_items;   // Media Bank, project saved
     std::vector<MediaTrack *> m_Tracks;     // timeline tracks, project saved
@@ -1055,11 +1071,80 @@ struct TimeLine
 
     MediaCore::MultiTrackVideoReader::Holder mEncMtvReader;
     MediaCore::MultiTrackAudioReader::Holder mEncMtaReader;
-
+    std::vector<MediaCore::MultiTrackVideoReader::Holder> mEncSegmentReaders;  // one per local segment worker, the first is mEncMtvReader
+    std::string mEncOutputPath;                 // output file path of current encoding
+    VideoEncoderParams mEncVidParams;           // video encoder params of current encoding
+    AudioEncoderParams mEncAudParams;           // audio encoder params of current encoding
+    struct EncodeOutput
+    {
+        std::string path;
+        VideoEncoderParams vidParams;
+        AudioEncoderParams audParams;
+        MediaCore::MediaEncoder::Holder encoder;
+    };
+    std::vector<EncodeOutput> mEncExtraOutputs;     // renditions encoded from the same composition as the main output
+    uint32_t mEncComposeWidth {0};              // composition size of current encoding, the largest output size
+    uint32_t mEncComposeHeight {0};
+    std::unique_ptr<MEC::ImageSequenceWriter> mEncImageSeqWriter;  // set if the output is an image sequence, no audio
+    int mEncodingImageWriterThreads {0};        // image sequence writers, 0 means one per CPU core
+    std::unique_ptr<MEC::RawStreamWriter> mEncRawStreamWriter;  // set if the output is a raw stream, no encoder
+
+    // An output path with image suffix(png/tif/tiff/exr) is exported as image sequence, e.g. '/out/name.png'
+    // => '/out/name.000000.png', '/out/name.000001.png' ...
     bool ConfigEncoder(const std::string& outputPath, VideoEncoderParams& vidEncParams, AudioEncoderParams& audEncParams, std::string& errMsg);
+    // Add another output after ConfigEncoder. It shares the frame rate, audio channels and sample rate of the main output,
+    // while codec, bitrate and video size can be different. The timeline is composed once for all outputs.
+    bool AddEncodeOutput(const std::string& outputPath, VideoEncoderParams& vidEncParams, AudioEncoderParams& audEncParams, std::string& errMsg);
+    // Configure raw composed video and PCM streaming to a pipe, a named pipe or stdout('-') instead of ConfigEncoder,
+    // the codec names of the encoder params are not used. See MEC::RawStreamWriter for the stream layout.
+    bool ConfigRawStreamOutput(const std::string& outputPath, const std::string& pixelFormat, const std::string& sampleFormat,
+            VideoEncoderParams& vidEncParams, AudioEncoderParams& audEncParams, std::string& errMsg);
+    // Auto-tune the threading of the video encoder: a slice from the middle of the export range is
+    // encoded with a few thread count, thread type and lookahead settings, and the fastest one within the quality floor
+    // is added to the extra options. The choice is cached in 'cachePath' per encoder, frame size, bitrate, preset and
+    // core count, so the calibration runs once on every machine. Set mEncodingTuneCachePath instead to run it on the
+    // encoding thread when encoding starts.
+    bool TuneVideoEncoder(const std::string& outputPath, VideoEncoderParams& vidEncParams, const std::string& cachePath, std::string& errMsg);
     void StartEncoding();
     void StopEncoding();
+    // Encode the frames [startFrame, endFrame) into a video only file in the calling thread, used by the render worker.
+    // Progress and stage status are updated like StartEncoding, set mQuitEncoding from another thread to cancel it.
+    bool EncodeVideoSegment(int64_t startFrame, int64_t endFrame, VideoEncoderParams& vidEncParams, const std::string& outputPath, std::string& errMsg);
+    struct EncodeSegment
+    {
+        int64_t startFrame;
+        int64_t endFrame;
+        std::string path;
+        std::string srcPath;                    // source media of packet passthrough segment
+        int64_t srcStart {-1};                  // passthrough range in source media(millisecond), -1 means re-encoding segment
+        int64_t srcEnd {-1};
+        std::string cacheKey;                   // content hash of the segment inputs if it's in the render cache
+        std::string checkpointKey;              // content hash of the segment inputs if it's journaled by a resumable export
+        bool cached {false};                    // the cached or checkpointed segment file is reused, no rendering is needed
+    };
+    std::vector<EncodeSegment> mEncSegments;    // planned by ConfigEncoder for the segmented encoding
+    imgui_json::value mEncRemoteRequest;        // project snapshot and encoder settings sent to the render workers, made by ConfigEncoder
     void _EncodeProc();
+    bool _TuneEncoders(std::string& errMsg);
+    bool _TuneVideoEncoder(MediaCore::MultiTrackVideoReader::Holder hReader, const std::string& outputPath, VideoEncoderParams& vidEncParams,
+            const std::string& cachePath, std::string& errMsg);
+    void _EncodeSegmentsProc();
+    void _EncodeAudioProc();
+    void _EncodeImageSequenceProc();
+    void _EncodeRawStreamProc();
+    bool _ConfigImageSequenceEncoder(const std::string& outputPath, const std::string& imageCodec, VideoEncoderParams& vidEncParams, AudioEncoderParams& audEncParams, std::string& errMsg);
+    bool _EncodeAudioOnly(const std::string& outputPath, std::string& errMsg);
+    void _PlanEncodeSegments();
+    void _PlanPassthroughSegments(int64_t startFrame, int64_t endFrame, int64_t minFrames, std::vector<EncodeSegment>& segments);
+    std::string _HashEncodeSegment(int64_t startFrame, int64_t endFrame);
+    void _HashComposition(MEC::ContentHasher& hasher, int64_t startMs, int64_t endMs, bool preview);
+    bool _EncodeVideoSegment(MediaCore::MultiTrackVideoReader::Holder hReader, const VideoEncoderParams& vidEncParams, int64_t startFrame, int64_t endFrame,
+            const std::string& outputPath, const std::function<bool(int64_t)>& onFrames, std::string& errMsg);
+    void _ResetEncodeStageStats();
+    void _FinishEncodeStageStats();
+    void _PublishEncodingPreview(const ImGui::ImMat& vmat);
+    bool _HashEncodeFrame(const ImGui::ImMat& mat, bool isVideo, int64_t index, double pts, std::string& errMsg);
+    bool IsSegmentedEncoding() const { return (mEncodingSegmentThreads > 1 || mEncodingSmartRender || !mEncodingCacheDir.empty() || !mEncodingRemoteWorkers.empty() || mEncodingResumable) && bExportVideo; }
     // encoding 
     std::thread mEncodingThread;
     bool mIsEncoding {false};
@@ -1070,9 +1155,62 @@ struct TimeLine
     std::string mEncodeProcErrMsg;
     float mEncodingProgress {0};
     float mEncodingDuration {0};
-    std::mutex mEncodingMutex;
-    ImGui::ImMat mEncodingVFrame;
+    int mEncodingSegmentThreads {0};            // concurrent segment encoders, less than 2 means single encoding proc, configured
+    int mEncodingGopSize {12};                  // segment boundaries are aligned to GOP size in frames, configured
+    bool mEncodingSmartRender {false};          // copy the packets of untouched clip ranges instead of re-encoding, configured
+    std::string mEncodingCacheDir;              // rendered segments are kept here and reused if their inputs are unchanged, empty disables, configured
+    int mEncodingCacheSegmentSeconds {4};       // segment length of cached or resumable rendering, rounded up to whole GOPs
+    int mEncodingCacheMaxMB {4096};             // the least recently used files of the render cache are deleted beyond it
+    int mEncodingTuneFrames {48};               // frames encoded by every auto-tuning candidate
+    int mEncodingTuneMaxMB {512};               // memory bound of the composed frames held by the auto-tuning, fewer frames are encoded above it
+    int mEncodingTuneMinLookahead {20};         // the shortest lookahead tried by the auto-tuning
+    double mEncodingTuneMinPsnr {40};           // quality floor of the auto-tuning, luma PSNR(dB) of a candidate against the encoder defaults
+    std::string mEncodingTuneCachePath;         // tune the video encoder of single proc encoding before it starts, empty disables, configured
+    bool mEncodingResumable {false};            // keep finished segments and a journal('<output>.journal') until the export succeeds,
+                                                // a restarted export reuses the unchanged ones, configured
+    std::vector<std::string> mEncodingRemoteWorkers;    // '[host:]port' of render workers, the segments are rendered by them instead of local threads, configured
+    enum EncodeStage
+    {
+        ENC_STAGE_VIDEO_COMPOSE = 0,            // video read and composition, includes filter and transition
+        ENC_STAGE_VIDEO_FILTER,
+        ENC_STAGE_VIDEO_TRANSITION,
+        ENC_STAGE_VIDEO_SCALE,                  // scale the composition to the output sizes
+        ENC_STAGE_AUDIO_MIX,
+        ENC_STAGE_VIDEO_ENCODE,
+        ENC_STAGE_AUDIO_ENCODE,
+        ENC_STAGE_MUX,                          // packet copy, concatenation and trailer writing
+        ENC_STAGE_COUNT
+    };
+    struct EncodeStageStatus
+    {
+        std::atomic<int64_t> processed {0};     // frames or audio blocks finished by this stage
+        std::atomic<int64_t> busyUs {0};        // time spent inside this stage in microseconds, summed over all its threads
+        std::atomic<int32_t> threads {0};       // threads running this stage concurrently
+        std::atomic<int32_t> queued {0};        // items waiting in the output queue of this stage
+        std::atomic<int32_t> capacity {0};      // output queue capacity of this stage
+    };
+    EncodeStageStatus mEncodeStageStatus[ENC_STAGE_COUNT];
+    std::chrono::steady_clock::time_point mEncodingStartTp;
+    std::atomic<int64_t> mEncodingElapsedUs {0};    // wall time of the finished encoding, 0 while encoding
+    std::string mEncodingStatsPath;             // write the stage summary json here when encoding ends, configured
+    std::string mEncodingHashPath;              // write the content hash of every composed frame and audio block here, see MEC::FrameHashWriter,
+                                                // every frame must be composed, so smart render, cache, resume and workers are refused, configured
+    MEC::FrameHashWriter mEncHashWriter;        // opened by StartEncoding if mEncodingHashPath is set, closed when encoding ends
+    int64_t mEncHashStartFrame {0};             // frame index of the export start, the sidecar indices are relative to it
+    static const char* GetEncodeStageName(int stage);
+    double GetEncodingElapsedTime() const;      // in seconds, keep running while encoding
+    int GetEncodeBottleneckStage() const;       // the top level stage with the most busy time, -1 if nothing is measured
+    imgui_json::value GetEncodeStageSummary() const;
+    int mEncodingVideoQueueSize {8};            // frames buffered between video compose and encode stage
+    int mEncodingAudioQueueSize {32};           // audio blocks buffered between audio mix and encode stage
+    int mEncodingAudioBlockMs {1000};           // audio block length mixed at once by audio-only export
     ImGui::ImMat mEncodingAFrame;
+    MEC::SingleSlotMailbox<ImGui::ImMat> mEncodingPreviewMailbox;  // downscaled frames for the encoding preview
+    float mEncodingPreviewRate {2.f};           // encoding preview frames per second, 0 disables the preview, configured
+    int mEncodingPreviewWidth {640};            // encoding preview frames are downscaled to this width at most
+    std::atomic<int64_t> mEncodingPreviewNextUs {0};    // time from encoding start when the next preview frame is due
+    std::atomic<bool> mEncodingPreviewBusy {false};
+    MEC::FrameScaler mEncodingPreviewScaler;
     ImTextureID mEncodingPreviewTexture {nullptr};  // encoding preview texture
 
     void CalculateAudioScopeData(ImGui::ImMat& mat);
@@ -1125,6 +1263,130 @@ struct TimeLine
     PlayerClock::time_point mPlayTriggerTp;
     std::unordered_set<int64_t> mNeedUpdateTrackIds;
 
+    // playback read-ahead, frames in the play direction are composed by a cloned reader into a memory budgeted cache
+    int mPrefetchBudgetMB {256};            // read-ahead cache budget, 0=disable, configured
+    MEC::PreviewFrameCache mPrefetchCache;
+    MediaCore::MultiTrackVideoReader::Holder mPrefetchReader;  // cloned from mMtvReader when playback starts, dropped by edits
+    std::mutex mPrefetchLock;
+    std::condition_variable mPrefetchCv;
+    std::thread mPrefetchThread;
+    bool mQuitPrefetch {false};
+    bool mPrefetchActive {false};           // playing, set by the preview on ui thread with the fields below
+    bool mPrefetchForward {true};
+    int64_t mPrefetchStride {1};            // only every Nth frame is composed while shuttling
+    int64_t mPrefetchPlayhead {0};          // frame index
+    int64_t mPrefetchEndIndex {0};
+    int64_t mPrefetchGeneration {0};        // bumped by every edit, frames composed before it are discarded
+    std::shared_ptr<const std::map<int64_t, std::string>> mPrefetchRenderedChunks;   // shown instead of composed frames, null if none
+    std::atomic<int64_t> mPrefetchHits {0};
+    std::atomic<int64_t> mPrefetchMisses {0};
+    int64_t TimeToFrameIndex(int64_t time) const;
+    int64_t FrameIndexToTime(int64_t frameIndex) const;
+    static constexpr int64_t PREFETCH_REVERSE_BLOCK_FRAMES = 32;  // composed forward at a time for backward playback
+    void InvalidatePrefetch();
+    void _PrefetchProc();
+    void _PrefetchReverseBlock(std::unique_lock<std::mutex>& lk, MediaCore::MultiTrackVideoReader::Holder hReader, int64_t generation, int64_t lastFrameIndex);
+
+    // adaptive preview resolution, the read-ahead reader composes at a lower scale while playback misses frame deadlines
+    bool mPreviewAdaptive {true};           // configured
+    MEC::AdaptivePreviewScaler mPreviewScaler;
+    int64_t mPreviewScalerFrameIndex {-1};  // last played frame reported to the scaler
+    void _UpdatePreviewScaler(int64_t frameIndex, bool missed);
+
+    // playback preview thread, composes the frame at the audio clock and hands it to the ui by a triple buffer,
+    // so a slow composition only lowers the preview frame rate but never stalls the ui
+    struct PreviewFrameSlot
+    {
+        std::vector<MediaCore::CorrelativeFrame> frames;
+        int64_t frameIndex {-1};
+        int64_t generation {0};
+        bool missed {false};                // not found in the read-ahead cache
+    };
+    MEC::SingleSlotMailbox<PreviewFrameSlot> mPreviewMailbox;
+    std::vector<MediaCore::CorrelativeFrame> mPreviewShownFrames;  // latest frames taken from the mailbox or shown while paused, ui thread only
+    std::mutex mPreviewLock;
+    std::condition_variable mPreviewCv;
+    std::thread mPreviewThread;
+    bool mQuitPreview {false};
+    bool mPreviewThreadActive {false};      // playing, set by the preview on ui thread with the clock fields below
+    MediaCore::MultiTrackVideoReader::Holder mPreviewReader;
+    int64_t mPreviewClockResumePos {0};
+    PlayerClock::time_point mPreviewClockTriggerTp;
+    bool mPreviewClockForward {true};
+    int mPreviewClockSpeed {1};
+    int64_t mPreviewClockEndIndex {0};
+    std::shared_ptr<const std::map<int64_t, std::string>> mPreviewClockRenderedChunks;   // shown instead of composed frames, null if none
+    int64_t mPreviewGeneration {0};         // bumped by seeks and direction changes, older slots are dropped
+    int64_t _GetPlayClockPos(int64_t resumePos, PlayerClock::time_point triggerTp, bool playing, bool forward, int speed);
+
+    // scrubbing, the seek targets are coalesced and only the latest one is read precisely by a worker on a cloned
+    // reader, a clip snapshot near the target is shown until its frame is ready
+    MEC::SingleSlotMailbox<PreviewFrameSlot> mScrubMailbox;
+    std::vector<MediaCore::CorrelativeFrame> mScrubShownFrames;    // latest scrub frames, ui thread only
+    int64_t mScrubShownFrameIndex {-1};
+    std::mutex mScrubLock;
+    std::condition_variable mScrubCv;
+    std::thread mScrubThread;
+    bool mQuitScrub {false};
+    MediaCore::MultiTrackVideoReader::Holder mScrubReader;      // cloned by the first scrub, dropped by edits
+    int64_t mScrubTarget {-1};              // pending seek target, replaced by every newer one
+    int64_t mScrubGeneration {0};           // bumped by edits, frames read before it are discarded
+    void _RequestScrubFrame(int64_t msPos);
+    void _ScrubProc();
+    bool GetScrubSnapshot(ImTextureID& texture, ImVec2& uvMin, ImVec2& uvMax); // nearest clip snapshot while the scrub frame isn't ready
+
+    // shuttle playback, above 1x the audio is skipped and only every Nth frame is composed without precise seeking
+    static constexpr int MAX_SHUTTLE_SPEED = 16;
+    int mShuttleSpeed {1};
+    void _PreviewProc();
+
+    // playback statistics, every second is logged at debug level and the whole playback when it stops
+    bool bShowPlaybackStats {false};        // show them over the preview, configured
+    MEC::PlaybackStats mPlaybackStats;
+    bool mPlaybackStatsActive {false};
+    int64_t mPlaybackStatsGeneration {-1};
+
+    // proxy media, preview and snapshots use the proxy of a video media once it's generated, encoding always uses the original
+    bool mProxyEnabled {false};             // configured
+    std::string mProxyDir;                  // proxy folder, 'Proxy' next to the source media if empty, configured
+    MEC::ProxyMediaGenerator mProxyGenerator;
+    void SetProxyEnabled(bool enable);
+    void RequestProxyMedia(MediaItem* item);
+    void UpdateProxyMedia();                // apply the generated proxies, call it on ui thread
+    MediaCore::MediaParser::Holder GetPreviewMediaParser(Clip* clip);
+    bool _OpenProxyMedia(MediaItem* item, const std::string& proxyPath);
+    void _SwapVideoClipParser(MediaCore::MultiTrackVideoReader::Holder hReader, Clip* clip, MediaCore::MediaParser::Holder hParser);
+    bool _SyncVideoOverlaps(MediaCore::MultiTrackVideoReader::Holder hReader, int& syncedOverlapCount);
+    MediaCore::MultiTrackVideoReader::Holder _CloneEncodeVideoReader(uint32_t width, uint32_t height, const MediaCore::Ratio& frameRate);
+
+    // render-in-place preview, chunks of the composed preview are rendered ahead into memory and keyed by the hash of
+    // everything composing them, so heavy regions play in real time until they are edited
+    static constexpr int PREVIEW_RENDER_CHUNK_FRAMES = 25;
+    int mPreviewRenderBudgetMB {2048};      // rendered preview cache budget, configured
+    MEC::RenderedPreviewCache mPreviewRenderCache;
+    std::map<int64_t, std::string> mPreviewRenderChunks;    // chunk index => composition hash of the rendered chunk
+    std::shared_ptr<const std::map<int64_t, std::string>> mPreviewRenderChunksSnapshot;  // copy for the preview threads, taken by every refresh
+    std::set<int64_t> mPreviewRenderDirtyChunks;            // rendered chunks which are edited afterwards
+    bool mPreviewRenderChunksDirty {false};
+    PlayerClock::time_point mPreviewRenderRefreshTp;
+    std::thread mPreviewRenderThread;
+    std::atomic<bool> mQuitPreviewRender {false};
+    std::atomic<bool> mIsPreviewRendering {false};
+    std::atomic<float> mPreviewRenderProgress {0};
+    std::mutex mPreviewRenderLock;
+    std::list<std::pair<int64_t, std::string>> mPreviewRenderResults;
+    int64_t mPreviewRenderHits {0};
+    // Render the chunks inside the mark range, or the whole timeline without marks. 'dirtyOnly' renders again the
+    // rendered chunks which are edited since.
+    bool StartPreviewRender(bool dirtyOnly);
+    void StopPreviewRender();
+    void UpdatePreviewRender();             // collect the rendered chunks, call it on ui thread
+    bool GetRenderedPreviewFrame(int64_t frameIndex, std::vector<MediaCore::CorrelativeFrame>& frames);
+    bool _IsRenderedPreviewFrame(const std::shared_ptr<const std::map<int64_t, std::string>>& chunks, int64_t frameIndex) const;
+    std::string _HashPreviewChunk(int64_t chunkIndex);
+    void _RefreshPreviewRenderChunks();
+    void _PreviewRenderProc(MediaCore::MultiTrackVideoReader::Holder hReader, std::vector<std::pair<int64_t, std::string>> chunks, int64_t endFrame);
+
     bool mIsCutting {false};
     std::list<imgui_json::value> mOngoingActions;
     std::list<imgui_json::value> mUiActions;
@@ -1224,6 +1486,7 @@ struct TimeLine
     void SetAudioLevel(int channel, float level);
 
     void Play(bool play, bool forward = true);
+    void Shuttle(int direction);            // J/K/L, -1 plays backward, 1 forward, and again doubles the speed, 0 stops
     void Seek(int64_t msPos, bool enterSeekingState = false);
     void StopSeek();
     void Step(bool forward = true);
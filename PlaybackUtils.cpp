@@ -0,0 +1,568 @@
+/*
+    Copyright (c) 2023 CodeWin
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <limits>
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <algorithm>
+#include "PlaybackUtils.h"
+#include "ExportUtils.h"
+#include "MediaParser.h"
+#include "MediaReader.h"
+#include "MediaEncoder.h"
+#include "SysUtils.h"
+#include "Logger.h"
+
+using namespace std;
+using namespace Logger;
+
+namespace MEC
+{
+void PreviewFrameCache::SetBudget(size_t bytes)
+{
+    lock_guard<mutex> lk(mLock);
+    mBudget = bytes;
+    while (mUsedBytes > mBudget && !mFrames.empty())
+    {
+        auto first = mFrames.begin();
+        auto last = prev(mFrames.end());
+        _Erase(_EvictRank(first->first) >= _EvictRank(last->first) ? first : last);
+    }
+}
+
+void PreviewFrameCache::SetPlayhead(int64_t frameIndex, bool forward)
+{
+    lock_guard<mutex> lk(mLock);
+    mPlayhead = frameIndex;
+    mForward = forward;
+}
+
+bool PreviewFrameCache::Get(int64_t frameIndex, Frames& frames) const
+{
+    lock_guard<mutex> lk(mLock);
+    auto iter = mFrames.find(frameIndex);
+    if (iter == mFrames.end())
+        return false;
+    frames = iter->second.first;
+    return true;
+}
+
+bool PreviewFrameCache::Contains(int64_t frameIndex) const
+{
+    lock_guard<mutex> lk(mLock);
+    return mFrames.find(frameIndex) != mFrames.end();
+}
+
+bool PreviewFrameCache::Put(int64_t frameIndex, const Frames& frames)
+{
+    const size_t bytes = GetFramesBytes(frames);
+    lock_guard<mutex> lk(mLock);
+    if (bytes > mBudget)
+        return false;
+    auto iter = mFrames.find(frameIndex);
+    if (iter != mFrames.end())
+        _Erase(iter);
+    const int64_t rank = _EvictRank(frameIndex);
+    while (mUsedBytes+bytes > mBudget)
+    {
+        // the rank grows away from the play head on both sides, so the victim is at one end of the ordered map
+        auto first = mFrames.begin();
+        auto last = prev(mFrames.end());
+        auto victim = _EvictRank(first->first) >= _EvictRank(last->first) ? first : last;
+        if (_EvictRank(victim->first) <= rank)
+            return false;
+        _Erase(victim);
+    }
+    mFrames[frameIndex] = {frames, bytes};
+    mUsedBytes += bytes;
+    return true;
+}
+
+void PreviewFrameCache::Clear()
+{
+    lock_guard<mutex> lk(mLock);
+    mFrames.clear();
+    mUsedBytes = 0;
+}
+
+size_t PreviewFrameCache::GetUsedBytes() const
+{
+    lock_guard<mutex> lk(mLock);
+    return mUsedBytes;
+}
+
+size_t PreviewFrameCache::GetFrameCount() const
+{
+    lock_guard<mutex> lk(mLock);
+    return mFrames.size();
+}
+
+size_t PreviewFrameCache::GetFramesBytes(const Frames& frames)
+{
+    size_t bytes = 0;
+    for (auto& frame : frames)
+        bytes += frame.frame.total() * frame.frame.elemsize;
+    return bytes;
+}
+
+int64_t PreviewFrameCache::_EvictRank(int64_t frameIndex) const
+{
+    // frames ahead of the play head rank by distance, every frame behind it ranks after all of them
+    const int64_t ahead = mForward ? frameIndex-mPlayhead : mPlayhead-frameIndex;
+    return ahead >= 0 ? ahead : numeric_limits<int64_t>::max()/2-ahead;
+}
+
+void PreviewFrameCache::_Erase(map<int64_t, pair<Frames, size_t>>::iterator iter)
+{
+    mUsedBytes -= iter->second.second;
+    mFrames.erase(iter);
+}
+
+void AdaptivePreviewScaler::Reset()
+{
+    mLevel = 0;
+    mWindowFrames = mWindowMisses = mFramesOnTime = 0;
+}
+
+bool AdaptivePreviewScaler::OnFrame(bool missed)
+{
+    mWindowFrames++;
+    if (missed)
+    {
+        mWindowMisses++;
+        mFramesOnTime = 0;
+    }
+    else
+    {
+        mFramesOnTime++;
+    }
+    if (mWindowMisses >= MISSES_TO_DOWNGRADE && mLevel < MAX_LEVEL)
+    {
+        mLevel++;
+        mWindowFrames = mWindowMisses = mFramesOnTime = 0;
+        return true;
+    }
+    if (mFramesOnTime >= FRAMES_TO_UPGRADE && mLevel > 0)
+    {
+        mLevel--;
+        mWindowFrames = mWindowMisses = mFramesOnTime = 0;
+        return true;
+    }
+    if (mWindowFrames >= WINDOW_FRAMES)
+        mWindowFrames = mWindowMisses = 0;
+    return false;
+}
+
+void PlaybackStats::Reset()
+{
+    lock_guard<mutex> lk(mLock);
+    mSessionStartTp = mSecondStartTp = chrono::steady_clock::now();
+    mLastFrameIndex = -1;
+    mSecond = mLastSecond = mSession = Summary();
+    mSecondAvOffsets.clear();
+    mSecondComposeTimes.clear();
+    mSessionAvOffsets.clear();
+    mSessionComposeTimes.clear();
+    mSessionAvOffsetIdx = mSessionComposeIdx = 0;
+}
+
+void PlaybackStats::OnDiscontinuity()
+{
+    lock_guard<mutex> lk(mLock);
+    mLastFrameIndex = -1;
+}
+
+void PlaybackStats::OnPresented(int64_t frameIndex, int64_t avOffsetMs, bool late)
+{
+    lock_guard<mutex> lk(mLock);
+    if (frameIndex == mLastFrameIndex)
+        return;
+    int64_t dropped = 0;
+    if (mLastFrameIndex >= 0)
+        dropped = std::max<int64_t>(std::abs(frameIndex-mLastFrameIndex)-1, 0);
+    mLastFrameIndex = frameIndex;
+    mSecond.presented++; mSession.presented++;
+    if (late) { mSecond.late++; mSession.late++; }
+    mSecond.dropped += dropped; mSession.dropped += dropped;
+    const float offset = (float)std::abs(avOffsetMs);
+    mSecondAvOffsets.push_back(offset);
+    AddSample(mSessionAvOffsets, mSessionAvOffsetIdx, offset);
+}
+
+void PlaybackStats::OnComposed(double ms)
+{
+    lock_guard<mutex> lk(mLock);
+    mSecondComposeTimes.push_back((float)ms);
+    AddSample(mSessionComposeTimes, mSessionComposeIdx, (float)ms);
+}
+
+bool PlaybackStats::Update()
+{
+    lock_guard<mutex> lk(mLock);
+    const auto now = chrono::steady_clock::now();
+    const double elapsed = chrono::duration_cast<chrono::duration<double>>(now-mSecondStartTp).count();
+    if (elapsed < 1.0)
+        return false;
+    mSecond.seconds = elapsed;
+    Percentiles(mSecondAvOffsets, mSecond.avOffsetMs);
+    Percentiles(mSecondComposeTimes, mSecond.composeMs);
+    mLastSecond = mSecond;
+    mSecond = Summary();
+    mSecondAvOffsets.clear();
+    mSecondComposeTimes.clear();
+    mSecondStartTp = now;
+    return true;
+}
+
+PlaybackStats::Summary PlaybackStats::GetLastSecond() const
+{
+    lock_guard<mutex> lk(mLock);
+    return mLastSecond;
+}
+
+PlaybackStats::Summary PlaybackStats::GetSession() const
+{
+    lock_guard<mutex> lk(mLock);
+    Summary summary = mSession;
+    summary.seconds = chrono::duration_cast<chrono::duration<double>>(chrono::steady_clock::now()-mSessionStartTp).count();
+    Percentiles(mSessionAvOffsets, summary.avOffsetMs);
+    Percentiles(mSessionComposeTimes, summary.composeMs);
+    return summary;
+}
+
+string PlaybackStats::ToString(const Summary& summary)
+{
+    char buf[256];
+    snprintf(buf, sizeof(buf), "%.1fs presented %lld, late %lld, dropped %lld, A/V offset p50/p95/p99 %.1f/%.1f/%.1fms, compose p50/p95/p99 %.1f/%.1f/%.1fms",
+            summary.seconds, (long long)summary.presented, (long long)summary.late, (long long)summary.dropped,
+            summary.avOffsetMs[0], summary.avOffsetMs[1], summary.avOffsetMs[2], summary.composeMs[0], summary.composeMs[1], summary.composeMs[2]);
+    return string(buf);
+}
+
+void PlaybackStats::AddSample(vector<float>& samples, size_t& ringIdx, float value)
+{
+    // a long session keeps the latest samples
+    if (samples.size() < MAX_SESSION_SAMPLES)
+    {
+        samples.push_back(value);
+        return;
+    }
+    samples[ringIdx] = value;
+    ringIdx = (ringIdx+1)%MAX_SESSION_SAMPLES;
+}
+
+void PlaybackStats::Percentiles(vector<float> samples, float out[3])
+{
+    if (samples.empty())
+    {
+        out[0] = out[1] = out[2] = 0;
+        return;
+    }
+    std::sort(samples.begin(), samples.end());
+    const float ranks[3] = {0.5f, 0.95f, 0.99f};
+    for (int i = 0; i < 3; i++)
+        out[i] = samples[std::min((size_t)(ranks[i]*samples.size()), samples.size()-1)];
+}
+
+void RenderedPreviewCache::SetBudget(size_t bytes)
+{
+    lock_guard<mutex> lk(mLock);
+    mBudget = bytes;
+    _Evict(0);
+}
+
+bool RenderedPreviewCache::Put(const string& key, const vector<MediaCore::CorrelativeFrame>& frames)
+{
+    const size_t bytes = PreviewFrameCache::GetFramesBytes(frames);
+    lock_guard<mutex> lk(mLock);
+    if (bytes > mBudget)
+        return false;
+    auto iter = mChunks.find(key);
+    if (iter != mChunks.end())
+    {
+        mUsedBytes -= iter->second.bytes;
+        mChunks.erase(iter);
+    }
+    _Evict(bytes);
+    auto& chunk = mChunks[key];
+    chunk.frames = frames;
+    chunk.bytes = bytes;
+    chunk.lastUse = ++mUseCounter;
+    mUsedBytes += bytes;
+    return true;
+}
+
+bool RenderedPreviewCache::GetFrame(const string& key, int index, MediaCore::CorrelativeFrame& frame)
+{
+    lock_guard<mutex> lk(mLock);
+    auto iter = mChunks.find(key);
+    if (iter == mChunks.end() || index < 0 || index >= iter->second.frames.size())
+        return false;
+    iter->second.lastUse = ++mUseCounter;
+    frame = iter->second.frames[index];
+    return true;
+}
+
+bool RenderedPreviewCache::Contains(const string& key) const
+{
+    lock_guard<mutex> lk(mLock);
+    return mChunks.find(key) != mChunks.end();
+}
+
+void RenderedPreviewCache::Clear()
+{
+    lock_guard<mutex> lk(mLock);
+    mChunks.clear();
+    mUsedBytes = 0;
+}
+
+size_t RenderedPreviewCache::GetUsedBytes() const
+{
+    lock_guard<mutex> lk(mLock);
+    return mUsedBytes;
+}
+
+void RenderedPreviewCache::_Evict(size_t bytes)
+{
+    // a handful of chunks per minute of timeline, a linear search for the least recently used one is cheap enough
+    while (mUsedBytes+bytes > mBudget && !mChunks.empty())
+    {
+        auto victim = min_element(mChunks.begin(), mChunks.end(), [] (const pair<const string, Chunk>& a, const pair<const string, Chunk>& b) {
+            return a.second.lastUse < b.second.lastUse;
+        });
+        mUsedBytes -= victim->second.bytes;
+        mChunks.erase(victim);
+    }
+}
+
+string GetProxyMediaPath(const string& srcPath, const string& proxyDir)
+{
+    ContentHasher hasher;
+    hasher.Add(srcPath);
+    hasher.Add(GetFileIdentity(srcPath));
+    string dir = proxyDir;
+    if (!dir.empty() && dir.back() != '/' && dir.back() != '\\')
+        dir += "/";
+    return dir+hasher.HexDigest()+".proxy.mp4";
+}
+
+bool MakeProxyMedia(const string& srcPath, const string& proxyPath, int divisor, bool hwAccel,
+        const atomic<bool>& cancel, atomic<float>& progress, string& errMsg)
+{
+    auto hParser = MediaCore::MediaParser::CreateInstance();
+    if (!hParser->Open(srcPath))
+    {
+        errMsg = "FAILED to open '"+srcPath+"'! "+hParser->GetError();
+        return false;
+    }
+    const MediaCore::VideoStream* vidStream = hParser->GetBestVideoStream();
+    if (!vidStream || vidStream->width <= 0 || vidStream->height <= 0)
+    {
+        errMsg = "'"+srcPath+"' has no video stream!";
+        return false;
+    }
+    // even size for the 4:2:0 proxy
+    const uint32_t width = max((uint32_t)(vidStream->width/max(divisor, 1)) & ~1U, 2U);
+    const uint32_t height = max((uint32_t)(vidStream->height/max(divisor, 1)) & ~1U, 2U);
+    MediaCore::Ratio frameRate = vidStream->avgFrameRate;
+    if (frameRate.num <= 0 || frameRate.den <= 0)
+        frameRate = {25, 1};
+    // the proxy is written at a constant rate, the frames of a variable frame rate source would be moved in time
+    const MediaCore::Ratio realFrameRate = vidStream->realFrameRate;
+    if (realFrameRate.num > 0 && realFrameRate.den > 0)
+    {
+        const double avgFps = (double)frameRate.num / frameRate.den;
+        const double realFps = (double)realFrameRate.num / realFrameRate.den;
+        if (fabs(avgFps-realFps) > realFps*0.01)
+        {
+            errMsg = "'"+srcPath+"' has variable frame rate, proxy is not supported!";
+            return false;
+        }
+    }
+    const int64_t frameCount = (int64_t)(vidStream->duration * frameRate.num / frameRate.den);
+
+    auto hReader = MediaCore::MediaReader::CreateVideoInstance();
+    hReader->EnableHwAccel(hwAccel);
+    if (!hReader->Open(hParser) || !hReader->ConfigVideoReader(width, height) || !hReader->Start())
+    {
+        errMsg = "FAILED to read '"+srcPath+"'! "+hReader->GetError();
+        return false;
+    }
+    string codecName;
+    vector<MediaCore::MediaEncoder::Description> encDescList;
+    if (!MediaCore::MediaEncoder::FindEncoder("h264", encDescList) || encDescList.empty())
+    {
+        errMsg = "CANNOT find encoder for proxy media!";
+        return false;
+    }
+    codecName = encDescList[0].codecName;
+    // all-intra, and a bitrate high enough for intra frames to look like the source at preview size
+    vector<MediaCore::MediaEncoder::Option> extraOpts {
+        {"g", MediaCore::Value((int)1)},
+        {"bf", MediaCore::Value((int)0)},
+    };
+    const uint64_t bitRate = (uint64_t)width * height * frameRate.num / frameRate.den / 2;
+    const string partPath = MakeSegmentPath(proxyPath, "part");
+    auto hEncoder = MediaCore::MediaEncoder::CreateInstance();
+    if (!hEncoder->Open(partPath) ||
+        !hEncoder->ConfigureVideoStream(codecName, string(), width, height, frameRate, bitRate, &extraOpts) ||
+        !hEncoder->Start())
+    {
+        errMsg = "FAILED to create proxy '"+proxyPath+"'! "+hEncoder->GetError();
+        hEncoder->Close();
+        remove(partPath.c_str());
+        return false;
+    }
+    bool succeeded = true;
+    int64_t frameIdx = 0;
+    while (!cancel)
+    {
+        const int64_t pos = (int64_t)((double)frameIdx * frameRate.den * 1000 / frameRate.num);
+        ImGui::ImMat vmat;
+        bool eof = false;
+        if (!hReader->ReadVideoFrame(pos, vmat, eof))
+        {
+            if (!eof)
+            {
+                errMsg = "FAILED to read '"+srcPath+"'! "+hReader->GetError();
+                succeeded = false;
+            }
+            break;
+        }
+        if (eof)
+            break;
+        // the frame isn't decoded yet, read the same position again
+        if (vmat.empty())
+            continue;
+        vmat.time_stamp = (double)pos / 1000;
+        if (!hEncoder->EncodeVideoFrame(vmat))
+        {
+            errMsg = "FAILED to encode proxy '"+proxyPath+"'! "+hEncoder->GetError();
+            succeeded = false;
+            break;
+        }
+        frameIdx++;
+        if (frameCount > 0)
+            progress = min((float)frameIdx / frameCount, 1.f);
+    }
+    hReader->Close();
+    if (succeeded && !cancel)
+    {
+        ImGui::ImMat eofMat;
+        succeeded = hEncoder->EncodeVideoFrame(eofMat) && hEncoder->FinishEncoding();
+        if (!succeeded)
+            errMsg = "FAILED to finish proxy '"+proxyPath+"'! "+hEncoder->GetError();
+    }
+    hEncoder->Close();
+    // the proxy path only appears when the proxy is complete
+    if (!succeeded || cancel || rename(partPath.c_str(), proxyPath.c_str()) != 0)
+    {
+        if (succeeded && !cancel)
+            errMsg = "FAILED to rename '"+partPath+"' to '"+proxyPath+"'!";
+        remove(partPath.c_str());
+        return false;
+    }
+    progress = 1.f;
+    return true;
+}
+
+ProxyMediaGenerator::~ProxyMediaGenerator()
+{
+    {
+        lock_guard<mutex> lk(mLock);
+        mQuit = true;
+        mCancelRunning = true;
+        mCv.notify_all();
+    }
+    if (mWorker.joinable())
+        mWorker.join();
+}
+
+void ProxyMediaGenerator::AddJob(int64_t mediaId, const string& srcPath, const string& proxyPath)
+{
+    lock_guard<mutex> lk(mLock);
+    if (mRunningId == mediaId || find_if(mJobs.begin(), mJobs.end(), [mediaId] (const Job& job) { return job.mediaId == mediaId; }) != mJobs.end())
+        return;
+    mJobs.push_back({mediaId, srcPath, proxyPath});
+    if (!mWorker.joinable())
+    {
+        mWorker = thread(&ProxyMediaGenerator::_WorkerProc, this);
+        SysUtils::SetThreadName(mWorker, "ProxyGen");
+    }
+    mCv.notify_all();
+}
+
+void ProxyMediaGenerator::CancelJob(int64_t mediaId)
+{
+    lock_guard<mutex> lk(mLock);
+    mJobs.erase(remove_if(mJobs.begin(), mJobs.end(), [mediaId] (const Job& job) { return job.mediaId == mediaId; }), mJobs.end());
+    if (mRunningId == mediaId)
+        mCancelRunning = true;
+}
+
+bool ProxyMediaGenerator::TakeResult(Result& result)
+{
+    lock_guard<mutex> lk(mLock);
+    if (mResults.empty())
+        return false;
+    result = mResults.front();
+    mResults.pop_front();
+    return true;
+}
+
+float ProxyMediaGenerator::GetProgress(int64_t mediaId) const
+{
+    lock_guard<mutex> lk(mLock);
+    if (mRunningId == mediaId)
+        return mProgress;
+    if (find_if(mJobs.begin(), mJobs.end(), [mediaId] (const Job& job) { return job.mediaId == mediaId; }) != mJobs.end())
+        return 0.f;
+    return -1.f;
+}
+
+void ProxyMediaGenerator::_WorkerProc()
+{
+    unique_lock<mutex> lk(mLock);
+    while (!mQuit)
+    {
+        if (mJobs.empty())
+        {
+            mCv.wait(lk);
+            continue;
+        }
+        Job job = mJobs.front();
+        mJobs.pop_front();
+        mRunningId = job.mediaId;
+        mCancelRunning = false;
+        mProgress = 0;
+        lk.unlock();
+
+        Result result;
+        result.mediaId = job.mediaId;
+        result.proxyPath = job.proxyPath;
+        result.succeeded = MakeProxyMedia(job.srcPath, job.proxyPath, mDivisor, mHwAccel, mCancelRunning, mProgress, result.errMsg);
+        if (!result.succeeded && !mCancelRunning)
+            Log(WARN) << "Proxy of '" << job.srcPath << "' is NOT generated! " << result.errMsg << endl;
+
+        lk.lock();
+        mRunningId = -1;
+        if (!mCancelRunning)
+            mResults.push_back(result);
+    }
+}
+}
@@ -0,0 +1,233 @@
+/*
+    Copyright (c) 2023 CodeWin
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <map>
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <condition_variable>
+#include <chrono>
+#include "MultiTrackVideoReader.h"
+
+namespace MEC
+{
+    // Composed preview frames keyed by frame index, bounded by a memory budget instead of a frame count. The frames
+    // behind the play head in the play direction are dropped first, then the ones farthest ahead, so the cache works
+    // as a read-ahead ring following the play head.
+    class PreviewFrameCache
+    {
+    public:
+        using Frames = std::vector<MediaCore::CorrelativeFrame>;
+
+        PreviewFrameCache() = default;
+        PreviewFrameCache(const PreviewFrameCache&) = delete;
+        PreviewFrameCache& operator=(const PreviewFrameCache&) = delete;
+
+        void SetBudget(size_t bytes);
+        size_t GetBudget() const { return mBudget; }
+        void SetPlayhead(int64_t frameIndex, bool forward);
+        bool Get(int64_t frameIndex, Frames& frames) const;
+        bool Contains(int64_t frameIndex) const;
+        // Add the frames of 'frameIndex', false if the budget is taken by frames nearer to the play head
+        bool Put(int64_t frameIndex, const Frames& frames);
+        void Clear();
+        size_t GetUsedBytes() const;
+        size_t GetFrameCount() const;
+
+        static size_t GetFramesBytes(const Frames& frames);
+
+    private:
+        int64_t _EvictRank(int64_t frameIndex) const;
+        void _Erase(std::map<int64_t, std::pair<Frames, size_t>>::iterator iter);
+
+    private:
+        mutable std::mutex mLock;
+        std::map<int64_t, std::pair<Frames, size_t>> mFrames;    // frame index => {frames, bytes}
+        size_t mBudget {0};
+        size_t mUsedBytes {0};
+        int64_t mPlayhead {0};
+        bool mForward {true};
+    };
+
+    // Preview scale level driven by frame deadline misses during playback, level n composes at 1/2^n of the
+    // preview size. Misses in a short window step the level down at once, a long run of frames on time steps it
+    // back up, so the level doesn't oscillate around the limit of the machine.
+    class AdaptivePreviewScaler
+    {
+    public:
+        static constexpr int MAX_LEVEL = 3;             // 1/8 of the preview size
+
+        void Reset();
+        // Report one played frame, true if the level is changed
+        bool OnFrame(bool missed);
+        int GetLevel() const { return mLevel; }
+        float GetScale() const { return 1.f/(1 << mLevel); }
+
+    private:
+        static constexpr int WINDOW_FRAMES = 25;
+        static constexpr int MISSES_TO_DOWNGRADE = 3;
+        static constexpr int FRAMES_TO_UPGRADE = 100;
+
+        int mLevel {0};
+        int mWindowFrames {0};
+        int mWindowMisses {0};
+        int mFramesOnTime {0};
+    };
+
+    // Preview playback statistics. The presented, late(shown after the clock moved on to a later frame) and dropped
+    // (never shown) frames are counted, the A/V offset of the shown frames and the composition times are sampled for
+    // percentiles. Every second of playback is summarized when it ends, and so is the whole session since Reset().
+    class PlaybackStats
+    {
+    public:
+        struct Summary
+        {
+            double seconds {0};
+            int64_t presented {0};
+            int64_t late {0};
+            int64_t dropped {0};
+            float avOffsetMs[3] {0, 0, 0};  // p50, p95 and p99 of |shown frame time - clock time|
+            float composeMs[3] {0, 0, 0};   // p50, p95 and p99 of the composition time, the prefetch cache hits excluded
+        };
+
+        void Reset();
+        // A jump of the play head, the skipped frames are not counted as dropped
+        void OnDiscontinuity();
+        // Report the shown frame on every preview update, a frame is counted once
+        void OnPresented(int64_t frameIndex, int64_t avOffsetMs, bool late);
+        void OnComposed(double ms);
+        // Close the current second if it's over, true if a new second summary is made
+        bool Update();
+        Summary GetLastSecond() const;
+        Summary GetSession() const;
+        static std::string ToString(const Summary& summary);
+
+    private:
+        static constexpr size_t MAX_SESSION_SAMPLES = 36000;
+        static void AddSample(std::vector<float>& samples, size_t& ringIdx, float value);
+        static void Percentiles(std::vector<float> samples, float out[3]);
+
+    private:
+        mutable std::mutex mLock;
+        std::chrono::steady_clock::time_point mSessionStartTp;
+        std::chrono::steady_clock::time_point mSecondStartTp;
+        int64_t mLastFrameIndex {-1};
+        Summary mSecond;
+        Summary mLastSecond;
+        Summary mSession;
+        std::vector<float> mSecondAvOffsets;
+        std::vector<float> mSecondComposeTimes;
+        std::vector<float> mSessionAvOffsets;
+        std::vector<float> mSessionComposeTimes;
+        size_t mSessionAvOffsetIdx {0};
+        size_t mSessionComposeIdx {0};
+    };
+
+    // Rendered preview chunks keyed by the composition hash of their frames, bounded by a memory budget and dropped in
+    // least recently used order. A chunk is found again by its hash if an undo restores the composition.
+    class RenderedPreviewCache
+    {
+    public:
+        RenderedPreviewCache() = default;
+        RenderedPreviewCache(const RenderedPreviewCache&) = delete;
+        RenderedPreviewCache& operator=(const RenderedPreviewCache&) = delete;
+
+        void SetBudget(size_t bytes);
+        bool Put(const std::string& key, const std::vector<MediaCore::CorrelativeFrame>& frames);
+        bool GetFrame(const std::string& key, int index, MediaCore::CorrelativeFrame& frame);
+        bool Contains(const std::string& key) const;
+        void Clear();
+        size_t GetUsedBytes() const;
+
+    private:
+        void _Evict(size_t bytes);
+
+    private:
+        struct Chunk
+        {
+            std::vector<MediaCore::CorrelativeFrame> frames;
+            size_t bytes {0};
+            uint64_t lastUse {0};
+        };
+        mutable std::mutex mLock;
+        std::map<std::string, Chunk> mChunks;
+        size_t mBudget {0};
+        size_t mUsedBytes {0};
+        uint64_t mUseCounter {0};
+    };
+
+    // Proxy of a video media, named by the source path and identity in 'proxyDir', so a changed source gets a new proxy
+    std::string GetProxyMediaPath(const std::string& srcPath, const std::string& proxyDir);
+    // Transcode the video of 'srcPath' into a low resolution intra-only media, every frame is a key frame so seeking
+    // and reverse playback never decode a GOP. The frame size is divided by 'divisor', the frame rate is kept.
+    // A variable frame rate source is refused, the proxy has a constant frame rate.
+    bool MakeProxyMedia(const std::string& srcPath, const std::string& proxyPath, int divisor, bool hwAccel,
+            const std::atomic<bool>& cancel, std::atomic<float>& progress, std::string& errMsg);
+
+    // Generate proxies one at a time on a background thread, results are taken by the owner on ui thread
+    class ProxyMediaGenerator
+    {
+    public:
+        struct Result
+        {
+            int64_t mediaId {-1};
+            std::string proxyPath;
+            bool succeeded {false};
+            std::string errMsg;
+        };
+
+        ProxyMediaGenerator() = default;
+        ProxyMediaGenerator(const ProxyMediaGenerator&) = delete;
+        ProxyMediaGenerator& operator=(const ProxyMediaGenerator&) = delete;
+        ~ProxyMediaGenerator();
+
+        void SetDivisor(int divisor) { mDivisor = divisor; }
+        void EnableHwAccel(bool enable) { mHwAccel = enable; }
+        void AddJob(int64_t mediaId, const std::string& srcPath, const std::string& proxyPath);
+        void CancelJob(int64_t mediaId);
+        bool TakeResult(Result& result);
+        // Progress of a queued or running job in [0, 1], -1 if the media has no job
+        float GetProgress(int64_t mediaId) const;
+
+    private:
+        void _WorkerProc();
+
+    private:
+        struct Job
+        {
+            int64_t mediaId;
+            std::string srcPath;
+            std::string proxyPath;
+        };
+        mutable std::mutex mLock;
+        std::condition_variable mCv;
+        std::deque<Job> mJobs;
+        std::deque<Result> mResults;
+        std::thread mWorker;
+        bool mQuit {false};
+        int64_t mRunningId {-1};
+        std::atomic<bool> mCancelRunning {false};
+        std::atomic<float> mProgress {0};
+        std::atomic<int> mDivisor {4};
+        std::atomic<bool> mHwAccel {true};
+    };
+}
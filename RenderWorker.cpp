@@ -0,0 +1,568 @@
+/*
+    Copyright (c) 2023 CodeWin
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <cmath>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <algorithm>
+#include <sys/stat.h>
+#if !defined(_WIN32)
+#include <unistd.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/time.h>
+#endif
+#include <imgui_helper.h>
+#include "RenderWorker.h"
+#include "ExportJobQueue.h"
+#include "MediaTimeline.h"
+#include "Logger.h"
+
+using namespace std;
+using namespace Logger;
+using namespace MediaTimeline;
+
+#if defined(MSG_NOSIGNAL)
+#define SEND_FLAGS MSG_NOSIGNAL
+#else
+#define SEND_FLAGS 0
+#endif
+
+namespace MEC
+{
+static const size_t FRAME_HEADER_SIZE = 12;
+static const size_t FILE_CHUNK_SIZE = 1024*1024;
+static const uint64_t MAX_JSON_SIZE = 64*1024*1024;    // a project file is far smaller, anything larger is garbage
+static const int HEARTBEAT_INTERVAL_MS = 250;
+static const int RECV_TIMEOUT_MS = 10000;              // a peer silent for many heartbeats is considered gone
+
+static bool ParseAddress(const string& address, string& host, string& port)
+{
+    const auto pos = address.find_last_of(':');
+    host = pos == string::npos ? string("127.0.0.1") : address.substr(0, pos);
+    port = pos == string::npos ? address : address.substr(pos+1);
+    return !host.empty() && !port.empty() && all_of(port.begin(), port.end(), [] (char c) { return c >= '0' && c <= '9'; });
+}
+
+#if !defined(_WIN32)
+// the requests aren't authenticated, a worker only listens on loopback unless it's allowed explicitly
+static bool IsLoopbackAddress(const struct sockaddr* addr)
+{
+    if (addr->sa_family == AF_INET)
+        return (ntohl(((const struct sockaddr_in*)addr)->sin_addr.s_addr) >> 24) == 127;
+    if (addr->sa_family == AF_INET6)
+    {
+        const struct in6_addr& addr6 = ((const struct sockaddr_in6*)addr)->sin6_addr;
+        return IN6_IS_ADDR_LOOPBACK(&addr6) || (IN6_IS_ADDR_V4MAPPED(&addr6) && addr6.s6_addr[12] == 127);
+    }
+    return false;
+}
+
+static void SetNoSigPipe(int fd)
+{
+#if defined(SO_NOSIGPIPE)
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+    // progress messages are small, don't hold them back
+    int nodelay = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+    // a blocked receive gives up when the peer hangs without closing the connection
+    struct timeval tv;
+    tv.tv_sec = RECV_TIMEOUT_MS / 1000;
+    tv.tv_usec = (RECV_TIMEOUT_MS % 1000) * 1000;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+}
+#endif
+
+bool RenderWorkerConnection::Connect(const string& address)
+{
+    Close();
+#if defined(_WIN32)
+    mErrMsg = "Render worker is not supported on this platform!";
+    return false;
+#else
+    string host, port;
+    if (!ParseAddress(address, host, port))
+    {
+        mErrMsg = "Invalid render worker address '" + address + "'!";
+        return false;
+    }
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo* addrList = nullptr;
+    int err = getaddrinfo(host.c_str(), port.c_str(), &hints, &addrList);
+    if (err != 0)
+    {
+        mErrMsg = "CANNOT resolve '" + host + "', " + string(gai_strerror(err)) + ".";
+        return false;
+    }
+    for (auto addr = addrList; addr && mFd < 0; addr = addr->ai_next)
+    {
+        int fd = socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol);
+        if (fd < 0)
+            continue;
+        if (connect(fd, addr->ai_addr, addr->ai_addrlen) == 0)
+            mFd = fd;
+        else
+            close(fd);
+    }
+    freeaddrinfo(addrList);
+    if (mFd < 0)
+    {
+        mErrMsg = "CANNOT connect to render worker '" + address + "', " + string(strerror(errno)) + ".";
+        return false;
+    }
+    SetNoSigPipe(mFd);
+    return true;
+#endif
+}
+
+void RenderWorkerConnection::Close()
+{
+#if !defined(_WIN32)
+    if (mFd >= 0)
+        close(mFd);
+#endif
+    mFd = -1;
+}
+
+bool RenderWorkerConnection::_SendAll(const void* data, size_t size)
+{
+#if defined(_WIN32)
+    mErrMsg = "Render worker is not supported on this platform!";
+    return false;
+#else
+    const uint8_t* ptr = (const uint8_t*)data;
+    while (size > 0)
+    {
+        ssize_t sent = send(mFd, ptr, size, SEND_FLAGS);
+        if (sent < 0 && errno == EINTR)
+            continue;
+        if (sent <= 0)
+        {
+            mErrMsg = "Connection is lost, " + string(strerror(errno)) + ".";
+            return false;
+        }
+        ptr += sent;
+        size -= sent;
+    }
+    return true;
+#endif
+}
+
+bool RenderWorkerConnection::_RecvAll(void* data, size_t size)
+{
+#if defined(_WIN32)
+    mErrMsg = "Render worker is not supported on this platform!";
+    return false;
+#else
+    uint8_t* ptr = (uint8_t*)data;
+    while (size > 0)
+    {
+        ssize_t received = recv(mFd, ptr, size, 0);
+        if (received < 0 && errno == EINTR)
+            continue;
+        if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            mErrMsg = "No message from peer in " + to_string(RECV_TIMEOUT_MS/1000) + " seconds, connection is considered lost.";
+            return false;
+        }
+        if (received <= 0)
+        {
+            mErrMsg = received == 0 ? string("Connection is closed by peer.") : "Connection is lost, " + string(strerror(errno)) + ".";
+            return false;
+        }
+        ptr += received;
+        size -= received;
+    }
+    return true;
+#endif
+}
+
+bool RenderWorkerConnection::_SendFrame(const char* tag, const void* data, uint64_t size)
+{
+    uint8_t header[FRAME_HEADER_SIZE];
+    memcpy(header, tag, 4);
+    for (int i = 0; i < 8; i++)
+        header[4+i] = (uint8_t)(size >> (i*8));
+    return _SendAll(header, sizeof(header)) && _SendAll(data, size);
+}
+
+bool RenderWorkerConnection::_RecvFrameHeader(const char* tag, uint64_t& size)
+{
+    uint8_t header[FRAME_HEADER_SIZE];
+    if (!_RecvAll(header, sizeof(header)))
+        return false;
+    if (memcmp(header, tag, 4) != 0)
+    {
+        mErrMsg = "Unexpected message, '" + string(tag, 4) + "' is expected.";
+        return false;
+    }
+    size = 0;
+    for (int i = 0; i < 8; i++)
+        size |= (uint64_t)header[4+i] << (i*8);
+    return true;
+}
+
+bool RenderWorkerConnection::SendJson(const imgui_json::value& message)
+{
+    const string text = message.dump();
+    return _SendFrame("JSON", text.data(), text.size());
+}
+
+bool RenderWorkerConnection::RecvJson(imgui_json::value& message)
+{
+    uint64_t size;
+    if (!_RecvFrameHeader("JSON", size))
+        return false;
+    if (size > MAX_JSON_SIZE)
+    {
+        mErrMsg = "Json message of " + to_string(size) + " bytes is too large.";
+        return false;
+    }
+    string text(size, '\0');
+    if (!_RecvAll(&text[0], size))
+        return false;
+    message = imgui_json::value::parse(text);
+    if (!message.is_object())
+    {
+        mErrMsg = "Invalid json message.";
+        return false;
+    }
+    return true;
+}
+
+bool RenderWorkerConnection::SendFile(const string& path)
+{
+    struct stat st;
+    FILE* fp = stat(path.c_str(), &st) == 0 ? fopen(path.c_str(), "rb") : nullptr;
+    if (!fp)
+    {
+        mErrMsg = "CANNOT open file '" + path + "'!";
+        return false;
+    }
+    uint8_t header[FRAME_HEADER_SIZE];
+    const uint64_t size = st.st_size;
+    memcpy(header, "DATA", 4);
+    for (int i = 0; i < 8; i++)
+        header[4+i] = (uint8_t)(size >> (i*8));
+    bool sendOk = _SendAll(header, sizeof(header));
+    vector<uint8_t> buffer(FILE_CHUNK_SIZE);
+    uint64_t remaining = size;
+    while (sendOk && remaining > 0)
+    {
+        const size_t readSize = fread(buffer.data(), 1, (size_t)min<uint64_t>(remaining, buffer.size()), fp);
+        if (readSize == 0)
+        {
+            mErrMsg = "FAILED to read file '" + path + "'!";
+            sendOk = false;
+            break;
+        }
+        sendOk = _SendAll(buffer.data(), readSize);
+        remaining -= readSize;
+    }
+    fclose(fp);
+    return sendOk;
+}
+
+bool RenderWorkerConnection::RecvFile(const string& path)
+{
+    uint64_t size;
+    if (!_RecvFrameHeader("DATA", size))
+        return false;
+    FILE* fp = fopen(path.c_str(), "wb");
+    if (!fp)
+    {
+        mErrMsg = "CANNOT create file '" + path + "'!";
+        return false;
+    }
+    vector<uint8_t> buffer(FILE_CHUNK_SIZE);
+    bool recvOk = true;
+    while (size > 0)
+    {
+        const size_t chunkSize = (size_t)min<uint64_t>(size, buffer.size());
+        if (!_RecvAll(buffer.data(), chunkSize))
+        {
+            recvOk = false;
+            break;
+        }
+        if (fwrite(buffer.data(), 1, chunkSize, fp) != chunkSize)
+        {
+            mErrMsg = "FAILED to write file '" + path + "'!";
+            recvOk = false;
+            break;
+        }
+        size -= chunkSize;
+    }
+    fclose(fp);
+    if (!recvOk)
+        remove(path.c_str());
+    return recvOk;
+}
+
+bool RenderSegmentOnWorker(const string& address, const imgui_json::value& request, const string& outputPath,
+        const function<bool(int64_t)>& onFrames, imgui_json::value& stats, string& errMsg)
+{
+    RenderWorkerConnection conn;
+    imgui_json::value message = request;
+    message["Version"] = imgui_json::number(RenderWorkerConnection::VERSION);
+    if (!conn.Connect(address) || !conn.SendJson(message))
+    {
+        errMsg = conn.GetError();
+        return false;
+    }
+    while (true)
+    {
+        imgui_json::value reply;
+        if (!conn.RecvJson(reply))
+        {
+            errMsg = conn.GetError();
+            return false;
+        }
+        const string status = reply["Status"].is_string() ? reply["Status"].get<imgui_json::string>() : string();
+        const int64_t frames = reply["Frames"].is_number() ? (int64_t)reply["Frames"].get<imgui_json::number>() : 0;
+        if (status == "progress")
+        {
+            // closing the connection makes the worker stop at its next progress message
+            if (!onFrames(frames))
+                return false;
+        }
+        else if (status == "done")
+        {
+            stats = reply["Stats"];
+            if (!conn.RecvFile(outputPath))
+            {
+                errMsg = conn.GetError();
+                return false;
+            }
+            onFrames(frames);
+            return true;
+        }
+        else if (status == "failed")
+        {
+            errMsg = reply["Error"].is_string() ? reply["Error"].get<imgui_json::string>() : string("Unknown error.");
+            return false;
+        }
+        else
+        {
+            errMsg = "Unexpected worker status '" + status + "'.";
+            return false;
+        }
+    }
+}
+
+RenderWorkerServer::RenderWorkerServer(const string& pluginPath, const string& workDir)
+    : mPluginPath(pluginPath), mWorkDir(workDir)
+{
+}
+
+RenderWorkerServer::~RenderWorkerServer()
+{
+#if !defined(_WIN32)
+    if (mListenFd >= 0)
+        close(mListenFd);
+#endif
+}
+
+bool RenderWorkerServer::Listen(const string& address, bool allowRemote, string& errMsg)
+{
+#if defined(_WIN32)
+    errMsg = "Render worker is not supported on this platform!";
+    return false;
+#else
+    string host, port;
+    if (!ParseAddress(address, host, port))
+    {
+        errMsg = "Invalid render worker address '" + address + "'!";
+        return false;
+    }
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    struct addrinfo* addrList = nullptr;
+    int err = getaddrinfo(host.c_str(), port.c_str(), &hints, &addrList);
+    if (err != 0)
+    {
+        errMsg = "CANNOT resolve '" + host + "', " + string(gai_strerror(err)) + ".";
+        return false;
+    }
+    bool refused = false;
+    for (auto addr = addrList; addr && mListenFd < 0; addr = addr->ai_next)
+    {
+        if (!allowRemote && !IsLoopbackAddress(addr->ai_addr))
+        {
+            refused = true;
+            continue;
+        }
+        int fd = socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol);
+        if (fd < 0)
+            continue;
+        int reuse = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+        if (::bind(fd, addr->ai_addr, addr->ai_addrlen) == 0 && listen(fd, 4) == 0)
+            mListenFd = fd;
+        else
+            close(fd);
+    }
+    freeaddrinfo(addrList);
+    if (mListenFd < 0 && refused)
+    {
+        errMsg = "Render worker address '" + address + "' is not a loopback address, it's only allowed with '--allow-remote'!";
+        return false;
+    }
+    if (mListenFd < 0)
+    {
+        errMsg = "CANNOT listen on '" + address + "', " + string(strerror(errno)) + ".";
+        return false;
+    }
+    mListenPort = port;
+    Log(DEBUG) << "Render worker is listening on '" << host << ":" << port << "'." << endl;
+    return true;
+#endif
+}
+
+bool RenderWorkerServer::ServeOne(int timeoutMs)
+{
+#if defined(_WIN32)
+    return false;
+#else
+    if (mListenFd < 0)
+        return false;
+    struct pollfd pfd = { mListenFd, POLLIN, 0 };
+    int ready = poll(&pfd, 1, timeoutMs);
+    if (ready == 0 || (ready < 0 && errno == EINTR))
+        return true;
+    if (ready < 0)
+        return false;
+    int fd = accept(mListenFd, nullptr, nullptr);
+    if (fd < 0)
+        return errno == EINTR || errno == ECONNABORTED;
+    SetNoSigPipe(fd);
+    RenderWorkerConnection conn(fd);
+    _Serve(conn);
+    mServedCount++;
+    return true;
+#endif
+}
+
+void RenderWorkerServer::_Serve(RenderWorkerConnection& conn)
+{
+    imgui_json::value request;
+    if (!conn.RecvJson(request))
+    {
+        Log(WARN) << "Render worker FAILED to receive the request! " << conn.GetError() << endl;
+        return;
+    }
+    auto replyFailure = [&conn] (const string& errMsg) {
+        Log(Error) << "Render worker FAILED to render the segment! " << errMsg << endl;
+        imgui_json::value reply;
+        reply["Status"] = "failed";
+        reply["Error"] = errMsg;
+        conn.SendJson(reply);
+    };
+    if (!request["Version"].is_number() || (int)request["Version"].get<imgui_json::number>() != RenderWorkerConnection::VERSION)
+    {
+        replyFailure("Unsupported protocol version.");
+        return;
+    }
+    if (!request["Project"].is_object() || !request["Video"].is_object() || !request["StartFrame"].is_number() || !request["EndFrame"].is_number())
+    {
+        replyFailure("Incomplete segment request.");
+        return;
+    }
+    const int64_t startFrame = request["StartFrame"].get<imgui_json::number>();
+    const int64_t endFrame = request["EndFrame"].get<imgui_json::number>();
+    const string suffix = request["Suffix"].is_string() ? request["Suffix"].get<imgui_json::string>() : string(".mp4");
+    TimeLine::VideoEncoderParams vidParams;
+    VideoEncoderParamsFromJson(request["Video"], vidParams);
+    Log(DEBUG) << "Render worker renders frames [" << startFrame << ", " << endFrame << ")." << endl;
+
+    unique_ptr<TimeLine> timeline(new TimeLine(mPluginPath, true));
+    if (request["HardwareCodec"].is_boolean())
+        timeline->mHardwareCodec = request["HardwareCodec"].get<imgui_json::boolean>();
+    timeline->mEncodingPreviewRate = 0;
+    string errMsg;
+    // the listening port tells the workers on this host apart
+    const string segmentPath = mWorkDir + "/mec-worker-" + mListenPort + "-" + to_string(mServedCount) + suffix;
+    atomic<bool> finished {false};
+    atomic<bool> canceled {false};
+    bool encodeOk = false;
+    // the project is loaded on the encoding thread too, so the heartbeat runs while a large project loads
+    thread encodeThread([&] () {
+        encodeOk = LoadProject(timeline.get(), request["Project"], errMsg) && !canceled &&
+            timeline->EncodeVideoSegment(startFrame, endFrame, vidParams, segmentPath, errMsg);
+        finished = true;
+    });
+    // progress messages double as heartbeat, a failed send means the coordinator is gone
+    bool connected = true;
+    int64_t reportedFrames = 0;
+    auto renderedFrames = [&] () { return (int64_t)llround((double)timeline->mEncodingProgress * (endFrame-startFrame)); };
+    while (!finished)
+    {
+        ImGui::sleep(HEARTBEAT_INTERVAL_MS);
+        if (!connected)
+        {
+            // repeated, the segment encoding clears it when it starts
+            timeline->mQuitEncoding = true;
+            continue;
+        }
+        const int64_t frames = renderedFrames();
+        imgui_json::value progress;
+        progress["Status"] = "progress";
+        progress["Frames"] = imgui_json::number(frames-reportedFrames);
+        reportedFrames = frames;
+        if (!conn.SendJson(progress))
+        {
+            Log(WARN) << "Coordinator is gone, cancel the segment. " << conn.GetError() << endl;
+            canceled = true;
+            timeline->mQuitEncoding = true;
+            connected = false;
+        }
+    }
+    encodeThread.join();
+    if (connected)
+    {
+        if (encodeOk)
+        {
+            imgui_json::value reply;
+            reply["Status"] = "done";
+            reply["Frames"] = imgui_json::number((endFrame-startFrame)-reportedFrames);
+            reply["Stats"] = timeline->GetEncodeStageSummary();
+            if (!conn.SendJson(reply) || !conn.SendFile(segmentPath))
+                Log(WARN) << "Render worker FAILED to return the segment! " << conn.GetError() << endl;
+        }
+        else
+        {
+            replyFailure(errMsg);
+        }
+    }
+    remove(segmentPath.c_str());
+}
+}
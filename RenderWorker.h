@@ -0,0 +1,100 @@
+/*
+    Copyright (c) 2023 CodeWin
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include <cstdint>
+#include <string>
+#include <functional>
+#include <imgui_json.h>
+
+namespace MEC
+{
+    // Render worker protocol over a TCP connection, loopback by default. Every message is a frame of
+    // {char tag[4], uint64 payload size} little-endian followed by the payload, tag 'JSON' carries a json text
+    // and 'DATA' carries a file. One connection renders one segment:
+    //   coordinator => worker   JSON {"Version", "Project", "Video", "StartFrame", "EndFrame", "Suffix", "HardwareCodec"}
+    //                           'Project' is a project file content, 'Video' the video encoder params of the segment
+    //   worker => coordinator   JSON {"Status":"progress", "Frames"} repeatedly while rendering, then either
+    //                           JSON {"Status":"done", "Stats"} followed by DATA of the encoded video only segment,
+    //                           or JSON {"Status":"failed", "Error"}
+    // The coordinator cancels a segment by closing the connection. A read waiting longer than 10 seconds fails, the
+    // worker sends a progress message at least every 250ms while loading and rendering, and a json is 64MB at most.
+    class RenderWorkerConnection
+    {
+    public:
+        static constexpr int VERSION = 1;
+
+        RenderWorkerConnection() = default;
+        explicit RenderWorkerConnection(int fd) : mFd(fd) {}
+        RenderWorkerConnection(const RenderWorkerConnection&) = delete;
+        RenderWorkerConnection& operator=(const RenderWorkerConnection&) = delete;
+        ~RenderWorkerConnection() { Close(); }
+
+        // address is '[host:]port', host is 127.0.0.1 if omitted
+        bool Connect(const std::string& address);
+        bool SendJson(const imgui_json::value& message);
+        bool RecvJson(imgui_json::value& message);
+        bool SendFile(const std::string& path);
+        bool RecvFile(const std::string& path);
+        void Close();
+        std::string GetError() const { return mErrMsg; }
+
+    private:
+        bool _SendFrame(const char* tag, const void* data, uint64_t size);
+        bool _RecvFrameHeader(const char* tag, uint64_t& size);
+        bool _SendAll(const void* data, size_t size);
+        bool _RecvAll(void* data, size_t size);
+
+    private:
+        int mFd {-1};
+        std::string mErrMsg;
+    };
+
+    // Render one segment on a worker and save the returned segment as 'outputPath'. 'onFrames' receives the count
+    // of newly rendered frames from every progress message, the segment is canceled if it returns false, and then
+    // false is returned with an empty 'errMsg'. 'stats' is the stage summary of the worker.
+    bool RenderSegmentOnWorker(const std::string& address, const imgui_json::value& request, const std::string& outputPath,
+            const std::function<bool(int64_t)>& onFrames, imgui_json::value& stats, std::string& errMsg);
+
+    // Serve segment requests one at a time, each by a new headless timeline. Run more worker processes to render
+    // segments in parallel, on this or other machines.
+    class RenderWorkerServer
+    {
+    public:
+        RenderWorkerServer(const std::string& pluginPath, const std::string& workDir);
+        RenderWorkerServer(const RenderWorkerServer&) = delete;
+        RenderWorkerServer& operator=(const RenderWorkerServer&) = delete;
+        ~RenderWorkerServer();
+
+        // address is '[host:]port', host is 127.0.0.1 if omitted so only local coordinators can connect.
+        // A non-loopback host is refused unless 'allowRemote' is set, the requests aren't authenticated.
+        bool Listen(const std::string& address, bool allowRemote, std::string& errMsg);
+        // Wait at most 'timeoutMs' for a coordinator and render its segment, false if the listening socket fails
+        bool ServeOne(int timeoutMs);
+        int64_t GetServedCount() const { return mServedCount; }
+
+    private:
+        void _Serve(RenderWorkerConnection& conn);
+
+    private:
+        std::string mPluginPath;
+        std::string mWorkDir;
+        int mListenFd {-1};
+        std::string mListenPort;
+        int64_t mServedCount {0};
+    };
+}
@@ -0,0 +1,168 @@
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include "ExportUtils.h"
+
+static int g_failures = 0;
+
+#define EXPECT(cond) do { if (!(cond)) { fprintf(stderr, "%s:%d: EXPECT(%s) failed\n", __FILE__, __LINE__, #cond); g_failures++; } } while (0)
+
+static void TestBoundedQueue()
+{
+    MEC::BoundedQueue<int> queue(3);
+    int item = 0;
+    EXPECT(queue.Capacity() == 3);
+    EXPECT(queue.Size() == 0);
+    EXPECT(!queue.TryPop(item));
+    EXPECT(queue.TryPush(1) && queue.TryPush(2) && queue.TryPush(3));
+    EXPECT(queue.Size() == 3);
+    EXPECT(!queue.TryPush(4));
+    EXPECT(queue.TryPop(item) && item == 1);
+    EXPECT(queue.TryPush(4));
+    EXPECT(!queue.TryPush(5));
+    // the indices wrap around the slots many times, the order is kept
+    int next = 2;
+    for (int i = 5; i < 100; i++)
+    {
+        EXPECT(queue.TryPop(item) && item == next);
+        next++;
+        EXPECT(queue.TryPush(i));
+        EXPECT(queue.Size() == 3);
+    }
+    while (queue.TryPop(item))
+        EXPECT(item == next++);
+    EXPECT(next == 100);
+    EXPECT(queue.Size() == 0);
+}
+
+static void TestSingleSlotMailbox()
+{
+    MEC::SingleSlotMailbox<int> mailbox;
+    int item = 0;
+    EXPECT(!mailbox.Take(item));
+    mailbox.Post(1);
+    mailbox.Post(2);
+    EXPECT(mailbox.Take(item) && item == 2);
+    EXPECT(!mailbox.Take(item));
+    mailbox.Post(3);
+    mailbox.Clear();
+    EXPECT(!mailbox.Take(item));
+
+    // the consumer only ever sees newer items, and always gets the last one
+    const int count = 100000;
+    std::thread producer([&] () {
+        for (int i = 1; i <= count; i++)
+            mailbox.Post(i);
+    });
+    int last = 0;
+    while (last < count)
+    {
+        if (mailbox.Take(item))
+        {
+            EXPECT(item > last);
+            last = item;
+        }
+    }
+    producer.join();
+    EXPECT(last == count);
+}
+
+static void TestHashBytes64()
+{
+    // published XXH64 test vectors
+    EXPECT(MEC::HashBytes64("", 0) == 0xef46db3751d8e999ULL);
+    EXPECT(MEC::HashBytes64("a", 1) == 0xd24ec4f1a98c6e5bULL);
+    EXPECT(MEC::HashBytes64("abc", 3) == 0x44bc2cf5ad770999ULL);
+    const char* text = "Nobody inspects the spammish repetition";
+    EXPECT(MEC::HashBytes64(text, strlen(text)) == 0xfbcea83c8a378bf1ULL);
+    EXPECT(MEC::HashBytes64("xxhash", 6) == 0x32dd38952c4bc720ULL);
+    EXPECT(MEC::HashBytes64("xxhash", 6, 20141025) == 0xb559b98d844e0635ULL);
+}
+
+static void TestContentHasher()
+{
+    auto digest = [] (const std::string& a, const std::string& b) {
+        MEC::ContentHasher hasher;
+        hasher.Add(a);
+        hasher.Add(b);
+        return hasher.HexDigest();
+    };
+    EXPECT(digest("ab", "c").size() == 32);
+    EXPECT(digest("ab", "c") == digest("ab", "c"));
+    // the string lengths are hashed, the concatenation is unambiguous
+    EXPECT(digest("ab", "c") != digest("a", "bc"));
+    EXPECT(digest("ab", "c") != digest("ab", "d"));
+    // the two halves are independent hashes
+    const std::string hex = digest("ab", "c");
+    EXPECT(hex.substr(0, 16) != hex.substr(16));
+    MEC::ContentHasher hasher;
+    hasher.Add((int64_t)1);
+    MEC::ContentHasher hasher2;
+    hasher2.Add((int64_t)2);
+    EXPECT(hasher.HexDigest() != hasher2.HexDigest());
+}
+
+static bool WriteHashes(const std::string& path, int64_t videoFrames, int64_t changedFrame)
+{
+    MEC::FrameHashWriter writer;
+    std::string errMsg;
+    if (!writer.Open(path, errMsg))
+        return false;
+    for (int64_t i = 0; i < videoFrames; i++)
+        writer.AddVideoFrame(i, i*0.04, i == changedFrame ? 0xdeadbeefULL : (uint64_t)i*7919);
+    writer.AddAudioBlock(0, 0, 1);
+    writer.Close();
+    return true;
+}
+
+static void TestCompareFrameHashes()
+{
+    const std::string path1 = "export_utils_test_1.hash";
+    const std::string path2 = "export_utils_test_2.hash";
+    MEC::FrameHashDiff diff;
+    std::string errMsg;
+
+    EXPECT(WriteHashes(path1, 10, -1) && WriteHashes(path2, 10, -1));
+    EXPECT(MEC::CompareFrameHashes(path1, path2, diff, errMsg));
+    EXPECT(diff.Identical());
+    EXPECT(diff.videoFrames[0] == 10 && diff.videoFrames[1] == 10);
+    EXPECT(diff.audioBlocks[0] == 1 && diff.audioBlocks[1] == 1);
+
+    EXPECT(WriteHashes(path2, 10, 4));
+    EXPECT(MEC::CompareFrameHashes(path1, path2, diff, errMsg));
+    EXPECT(!diff.Identical());
+    EXPECT(diff.firstVideoDiff == 4 && diff.firstVideoPts == 160);
+    EXPECT(diff.firstAudioDiff == -1);
+
+    // a shorter sidecar diverges where it ends
+    EXPECT(WriteHashes(path2, 7, -1));
+    EXPECT(MEC::CompareFrameHashes(path1, path2, diff, errMsg));
+    EXPECT(diff.firstVideoDiff == 7 && diff.firstVideoPts == 280);
+
+    EXPECT(!MEC::CompareFrameHashes(path1, "export_utils_test_missing.hash", diff, errMsg) && !errMsg.empty());
+    remove(path1.c_str());
+    remove(path2.c_str());
+}
+
+static void TestMakeSegmentPath()
+{
+    EXPECT(MEC::MakeSegmentPath("/out/name.mp4", "seg0003") == "/out/name.seg0003.mp4");
+    EXPECT(MEC::MakeSegmentPath("/out/name.tar.mkv", "audio") == "/out/name.tar.audio.mkv");
+    EXPECT(MEC::MakeSegmentPath("/out.dir/name", "seg0000") == "/out.dir/name.seg0000");
+    EXPECT(MEC::MakeSegmentPath("C:\\out.dir\\name", "tune") == "C:\\out.dir\\name.tune");
+    EXPECT(MEC::MakeSegmentPath("name", "tune") == "name.tune");
+}
+
+int main(int argc, char** argv)
+{
+    TestBoundedQueue();
+    TestSingleSlotMailbox();
+    TestHashBytes64();
+    TestContentHasher();
+    TestCompareFrameHashes();
+    TestMakeSegmentPath();
+    if (g_failures > 0)
+        fprintf(stderr, "%d check(s) failed\n", g_failures);
+    return g_failures > 0 ? 1 : 0;
+}
@@ -0,0 +1,112 @@
+#include <cstdio>
+#include <string>
+#include "PlaybackUtils.h"
+
+static int g_failures = 0;
+
+#define EXPECT(cond) do { if (!(cond)) { fprintf(stderr, "%s:%d: EXPECT(%s) failed\n", __FILE__, __LINE__, #cond); g_failures++; } } while (0)
+
+static MEC::PreviewFrameCache::Frames MakeFrames(int64_t frameIndex)
+{
+    MediaCore::CorrelativeFrame frame;
+    frame.frame.create(16, 16, 4, 1u);
+    frame.frame.time_stamp = (double)frameIndex/25;
+    return {frame};
+}
+
+static void TestPreviewFrameCacheForward()
+{
+    MEC::PreviewFrameCache cache;
+    const size_t frameBytes = MEC::PreviewFrameCache::GetFramesBytes(MakeFrames(0));
+    EXPECT(frameBytes > 0);
+    cache.SetBudget(frameBytes*3);
+    cache.SetPlayhead(10, true);
+    EXPECT(cache.Put(10, MakeFrames(10)) && cache.Put(11, MakeFrames(11)) && cache.Put(12, MakeFrames(12)));
+    EXPECT(cache.GetFrameCount() == 3 && cache.GetUsedBytes() == frameBytes*3);
+    // farther ahead than every cached frame
+    EXPECT(!cache.Put(13, MakeFrames(13)));
+    EXPECT(!cache.Contains(13));
+
+    // the frames behind the play head go first, the farthest behind first
+    cache.SetPlayhead(12, true);
+    EXPECT(cache.Put(13, MakeFrames(13)));
+    EXPECT(!cache.Contains(10) && cache.Contains(11) && cache.Contains(12) && cache.Contains(13));
+    EXPECT(cache.Put(14, MakeFrames(14)));
+    EXPECT(!cache.Contains(11) && cache.Contains(14));
+
+    // then the farthest ahead, when a nearer frame comes
+    cache.SetPlayhead(9, true);
+    EXPECT(cache.Put(10, MakeFrames(10)));
+    EXPECT(cache.Contains(10) && cache.Contains(12) && cache.Contains(13) && !cache.Contains(14));
+
+    MEC::PreviewFrameCache::Frames frames;
+    EXPECT(cache.Get(12, frames) && frames.size() == 1 && frames[0].frame.time_stamp == 12.0/25);
+    EXPECT(!cache.Get(14, frames));
+
+    // a smaller budget drops the frames by the same order
+    cache.SetBudget(frameBytes);
+    EXPECT(cache.GetFrameCount() == 1 && cache.Contains(10));
+    cache.Clear();
+    EXPECT(cache.GetFrameCount() == 0 && cache.GetUsedBytes() == 0);
+}
+
+static void TestPreviewFrameCacheBackward()
+{
+    MEC::PreviewFrameCache cache;
+    const size_t frameBytes = MEC::PreviewFrameCache::GetFramesBytes(MakeFrames(0));
+    cache.SetBudget(frameBytes*2);
+    cache.SetPlayhead(20, false);
+    EXPECT(cache.Put(20, MakeFrames(20)) && cache.Put(19, MakeFrames(19)));
+    EXPECT(!cache.Put(18, MakeFrames(18)));
+    // playing backward, the higher frames are behind
+    cache.SetPlayhead(19, false);
+    EXPECT(cache.Put(18, MakeFrames(18)));
+    EXPECT(!cache.Contains(20) && cache.Contains(19) && cache.Contains(18));
+    // no budget, nothing is kept
+    cache.SetBudget(0);
+    EXPECT(cache.GetFrameCount() == 0);
+    EXPECT(!cache.Put(19, MakeFrames(19)));
+}
+
+static void TestPlaybackStats()
+{
+    MEC::PlaybackStats stats;
+    stats.Reset();
+    for (int i = 100; i >= 1; i--)
+        stats.OnComposed(i);
+    auto summary = stats.GetSession();
+    EXPECT(summary.composeMs[0] == 51 && summary.composeMs[1] == 96 && summary.composeMs[2] == 100);
+
+    // a frame is counted once, skipped frames are dropped unless the play head jumped
+    stats.OnPresented(0, 0, false);
+    stats.OnPresented(0, 0, false);
+    stats.OnPresented(3, -20, true);
+    stats.OnDiscontinuity();
+    stats.OnPresented(50, 10, false);
+    stats.OnPresented(49, 40, false);
+    summary = stats.GetSession();
+    EXPECT(summary.presented == 4);
+    EXPECT(summary.late == 1);
+    EXPECT(summary.dropped == 2);
+    // |offsets| 0, 10, 20, 40
+    EXPECT(summary.avOffsetMs[0] == 20 && summary.avOffsetMs[1] == 40 && summary.avOffsetMs[2] == 40);
+
+    // the current second isn't summarized yet
+    EXPECT(!stats.Update());
+    EXPECT(stats.GetLastSecond().presented == 0);
+
+    stats.Reset();
+    summary = stats.GetSession();
+    EXPECT(summary.presented == 0 && summary.dropped == 0 && summary.composeMs[2] == 0 && summary.avOffsetMs[2] == 0);
+    EXPECT(!MEC::PlaybackStats::ToString(summary).empty());
+}
+
+int main(int argc, char** argv)
+{
+    TestPreviewFrameCacheForward();
+    TestPreviewFrameCacheBackward();
+    TestPlaybackStats();
+    if (g_failures > 0)
+        fprintf(stderr, "%d check(s) failed\n", g_failures);
+    return g_failures > 0 ? 1 : 0;
+}
@@ -0,0 +1,113 @@
+// Render a small project by local 'mec-render --worker' processes, run as
+//   render_worker_test <mec-render> <test dir> <work dir>
+// one of the worker addresses has nobody listening, its segments must be rendered by the live workers.
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+static int g_failures = 0;
+
+#define EXPECT(cond) do { if (!(cond)) { fprintf(stderr, "%s:%d: EXPECT(%s) failed\n", __FILE__, __LINE__, #cond); g_failures++; } } while (0)
+
+static pid_t Spawn(const std::vector<std::string>& args)
+{
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        std::vector<char*> argv;
+        for (auto& arg : args)
+            argv.push_back(const_cast<char*>(arg.c_str()));
+        argv.push_back(nullptr);
+        execv(argv[0], argv.data());
+        _exit(127);
+    }
+    return pid;
+}
+
+static bool WaitForPort(int port, int timeoutMs)
+{
+    for (int waited = 0; waited < timeoutMs; waited += 100)
+    {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+        const bool connected = connect(fd, (sockaddr*)&addr, sizeof(addr)) == 0;
+        close(fd);
+        if (connected)
+            return true;
+        usleep(100*1000);
+    }
+    return false;
+}
+
+// one picture clip of 2 seconds, 50 frames in 5 segments by '--gop 10'
+static bool WriteProject(const std::string& path, const std::string& picturePath)
+{
+    std::ofstream ofs(path);
+    ofs << "{\"MediaBank\":[{\"id\":1,\"name\":\"A.png\",\"path\":\"" << picturePath << "\",\"type\":272}],"
+        << "\"TimeLine\":{\"Start\":0,\"End\":2000,\"VideoWidth\":320,\"VideoHeight\":240,\"FrameRateNum\":25,\"FrameRateDen\":1,"
+        << "\"AudioChannels\":2,\"AudioSampleRate\":44100,\"OutputAudio\":false,"
+        << "\"MediaClip\":[{\"ID\":2,\"MediaID\":1,\"Type\":272,\"Name\":\"A.png\",\"Path\":\"" << picturePath << "\",\"Start\":0,\"End\":2000,\"StartOffset\":0,\"EndOffset\":0}],"
+        << "\"MediaTrack\":[{\"ID\":3,\"Type\":256,\"Name\":\"V1\",\"ClipIDS\":[2]}]}}" << std::endl;
+    return ofs.good();
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 4)
+    {
+        fprintf(stderr, "Usage: %s <mec-render> <test dir> <work dir>\n", argv[0]);
+        return 1;
+    }
+    const std::string renderPath = argv[1];
+    const std::string workDir = argv[3];
+    const std::string projectPath = workDir + "/render_worker_test.mep";
+    const std::string outputPath = workDir + "/render_worker_test.mp4";
+    mkdir(workDir.c_str(), 0755);
+    remove(outputPath.c_str());
+    EXPECT(WriteProject(projectPath, std::string(argv[2]) + "/A.png"));
+
+    const int basePort = 20000 + getpid() % 20000;
+    std::vector<pid_t> workers;
+    for (int i = 0; i < 2; i++)
+    {
+        const std::string port = std::to_string(basePort + i);
+        workers.push_back(Spawn({renderPath, "--worker", "127.0.0.1:" + port, "--work-dir", workDir}));
+        EXPECT(workers.back() > 0);
+    }
+    for (int i = 0; i < 2; i++)
+        EXPECT(WaitForPort(basePort + i, 10000));
+
+    const std::string workerList = "127.0.0.1:" + std::to_string(basePort) + ",127.0.0.1:" + std::to_string(basePort + 1)
+            + ",127.0.0.1:" + std::to_string(basePort + 2);
+    pid_t coordinator = Spawn({renderPath, "--workers", workerList, "--gop", "10", "--vcodec", "mpeg4", "-o", outputPath, projectPath});
+    int status = -1;
+    EXPECT(coordinator > 0 && waitpid(coordinator, &status, 0) == coordinator);
+    EXPECT(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    struct stat st;
+    EXPECT(stat(outputPath.c_str(), &st) == 0 && st.st_size > 0);
+
+    for (auto pid : workers)
+    {
+        if (pid <= 0)
+            continue;
+        kill(pid, SIGTERM);
+        waitpid(pid, &status, 0);
+    }
+    remove(projectPath.c_str());
+    remove(outputPath.c_str());
+    if (g_failures > 0)
+        fprintf(stderr, "%d check(s) failed\n", g_failures);
+    return g_failures > 0 ? 1 : 0;
+}